@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+#
+# Compares two results files of run-bench.sh: prints, for each run found in
+# both, every measure of the new one as a percentage of the old one.
+# Usage: compare.sh old.tsv new.tsv
+
+if [ $# -ne 2 ]; then
+    echo "usage: compare.sh old.tsv new.tsv" >&2
+    exit 2
+fi
+
+awk -F '\t' -v OFS='\t' '
+    function key() { return $1 OFS $2 OFS $3 OFS $4 OFS $5 }
+    FNR == 1 { if (NR == 1) header = $0; next }
+    NR == FNR { old[key()] = $0; next }
+    key() in old {
+        split(old[key()], o, FS)
+        if (!printed++)
+            print header
+        line = key()
+        for (i = 6; i <= NF; i++)
+            line = line OFS (o[i] > 0 ? sprintf("%.0f%%", $i * 100 / o[i]) : "-")
+        print line
+    }' "$1" "$2"
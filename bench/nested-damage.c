@@ -0,0 +1,197 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Draws the damage of a typical desktop workload on a window covering the
+ * screen, one frame after the other, for a given time:
+ *   fill    the whole window in alternating colors
+ *   scroll  the window scrolled up a few lines, the new lines filled in
+ *   text    a line of text written below the one before, as in a terminal
+ *   video   a 640x360 image put at the center, changing on every frame
+ * Each frame is waited for with XSync(), so the frame rate reported on the
+ * single output line is the rate the nested server takes frames at:
+ *   <mode> <frames> <seconds>
+ * Usage: nested-damage [-t seconds] fill|scroll|text|video */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#define SCROLL_LINES 16
+#define VIDEO_WIDTH  640
+#define VIDEO_HEIGHT 360
+
+typedef struct {
+    Display *dpy;
+    Window win;
+    GC gc;
+    XImage *img;
+    unsigned int width;
+    unsigned int height;
+    unsigned long frame;
+    int textY;
+} Damage;
+
+typedef void (*DamageFrameProc)(Damage *d);
+
+static double
+DamageNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Colors are given as pixel values, which is good enough for damage */
+static unsigned long
+DamageColor(unsigned long n) {
+    return n * 0x9e3779b1ul;
+}
+
+static void
+DamageFill(Damage *d) {
+    XSetForeground(d->dpy, d->gc, DamageColor(d->frame));
+    XFillRectangle(d->dpy, d->win, d->gc, 0, 0, d->width, d->height);
+}
+
+static void
+DamageScroll(Damage *d) {
+    XCopyArea(d->dpy, d->win, d->win, d->gc, 0, SCROLL_LINES, d->width,
+              d->height - SCROLL_LINES, 0, 0);
+    XSetForeground(d->dpy, d->gc, DamageColor(d->frame));
+    XFillRectangle(d->dpy, d->win, d->gc, 0, d->height - SCROLL_LINES,
+                   d->width, SCROLL_LINES);
+}
+
+static void
+DamageText(Damage *d) {
+    static const char line[] =
+        "The quick brown fox jumps over the lazy dog 0123456789 "
+        "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG !@#$%^&*()";
+
+    if (d->textY + SCROLL_LINES > d->height) {
+        XSetForeground(d->dpy, d->gc, DamageColor(0));
+        XFillRectangle(d->dpy, d->win, d->gc, 0, 0, d->width, d->height);
+        d->textY = 0;
+    }
+
+    d->textY += SCROLL_LINES;
+    XSetForeground(d->dpy, d->gc, DamageColor(d->frame));
+    XDrawString(d->dpy, d->win, d->gc, 4, d->textY, line, strlen(line));
+}
+
+static void
+DamageVideo(Damage *d) {
+    unsigned int x, y;
+
+    for (y = 0; y < d->img->height; y++)
+        for (x = 0; x < d->img->width; x++)
+            XPutPixel(d->img, x, y, DamageColor((x ^ y) + d->frame));
+
+    XPutImage(d->dpy, d->win, d->gc, d->img, 0, 0,
+              ((int)d->width - d->img->width) / 2,
+              ((int)d->height - d->img->height) / 2,
+              d->img->width, d->img->height);
+}
+
+static void
+DamageUsage(void) {
+    fprintf(stderr, "usage: nested-damage [-t seconds] "
+                    "fill|scroll|text|video\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[]) {
+    Damage d = { 0 };
+    XSetWindowAttributes attrs;
+    DamageFrameProc frame = NULL;
+    const char *mode = NULL;
+    double seconds = 5, start, elapsed;
+    int screen, i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!mode)
+            mode = argv[i];
+        else
+            DamageUsage();
+    }
+
+    if (!mode)
+        DamageUsage();
+    else if (!strcmp(mode, "fill"))
+        frame = DamageFill;
+    else if (!strcmp(mode, "scroll"))
+        frame = DamageScroll;
+    else if (!strcmp(mode, "text"))
+        frame = DamageText;
+    else if (!strcmp(mode, "video"))
+        frame = DamageVideo;
+    else
+        DamageUsage();
+
+    d.dpy = XOpenDisplay(NULL);
+    if (!d.dpy) {
+        fprintf(stderr, "nested-damage: can't open display %s\n",
+                XDisplayName(NULL));
+        return 1;
+    }
+
+    screen = DefaultScreen(d.dpy);
+    d.width = DisplayWidth(d.dpy, screen);
+    d.height = DisplayHeight(d.dpy, screen);
+
+    /* Nothing else is on the screen, so the window needs no manager */
+    attrs.override_redirect = True;
+    attrs.background_pixel = BlackPixel(d.dpy, screen);
+    d.win = XCreateWindow(d.dpy, RootWindow(d.dpy, screen), 0, 0, d.width,
+                          d.height, 0, CopyFromParent, InputOutput,
+                          CopyFromParent, CWOverrideRedirect | CWBackPixel,
+                          &attrs);
+    d.gc = XCreateGC(d.dpy, d.win, 0, NULL);
+    XMapRaised(d.dpy, d.win);
+
+    d.img = XCreateImage(d.dpy, DefaultVisual(d.dpy, screen),
+                         DefaultDepth(d.dpy, screen), ZPixmap, 0, NULL,
+                         VIDEO_WIDTH, VIDEO_HEIGHT, 32, 0);
+    d.img->data = malloc(d.img->bytes_per_line * d.img->height);
+    XSync(d.dpy, False);
+
+    start = DamageNow();
+    do {
+        frame(&d);
+        XSync(d.dpy, False);
+        d.frame++;
+        elapsed = DamageNow() - start;
+    } while (elapsed < seconds);
+
+    printf("%s %lu %.3f\n", mode, d.frame, elapsed);
+
+    XDestroyImage(d.img);
+    XFreeGC(d.dpy, d.gc);
+    XCloseDisplay(d.dpy);
+    return 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Measures how long host input takes to reach a client of the nested server.
+ * Key, button and motion events are injected into the host with XTEST at
+ * the given rates, and a window covering the nested screen receives them,
+ * both from this process so that both ends are timed with the same clock:
+ *   nested-input-latency -H host -N nested [-t seconds] [-k keys/s]
+ *                        [-b buttons/s] [-m motions/s] [-l]
+ * The nested screen has to be shown unscaled at the top left corner of a
+ * host screen of its size with nothing over it, as bench/run-bench.sh does.
+ * With -l, another client fills the whole nested screen as fast as it can
+ * meanwhile. One line is printed per kind of event:
+ *   <kind> <sent> <received> <merged> <dropped> <p50_us> <p99_us> <max_us>
+ * Motion events carry their number in their position, so motion left out
+ * by the nested server is told apart from motion that never arrived:
+ * merged motion was followed by later motion that did. Key and button
+ * events are matched in the order they were sent, per key and button. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#define NUM_KEYS     26 /* keys a to z */
+#define NUM_BUTTONS  3
+#define QUEUE_SIZE   64 /* events of one key or button not received yet */
+#define GRACE_USEC   500000 /* waited for the last events */
+
+enum { KIND_KEY, KIND_BUTTON, KIND_MOTION, NUM_KINDS };
+
+static const char *kindNames[NUM_KINDS] = { "key", "button", "motion" };
+
+typedef struct {
+    uint64_t sent[QUEUE_SIZE];
+    unsigned int head;
+    unsigned int count;
+} SendQueue;
+
+typedef struct {
+    double rate;
+    uint64_t period;   /* in microseconds */
+    uint64_t next;     /* time of the next event */
+    uint64_t numSent;
+    uint64_t received;
+    uint64_t merged;
+    uint64_t dropped;
+    uint32_t *latency; /* of each received event */
+    uint64_t maxLatency;
+} Kind;
+
+typedef struct {
+    Display *host;
+    Display *nested;
+    Window win;
+    unsigned int width;
+    unsigned int height;
+    KeyCode keys[NUM_KEYS];
+    Kind kinds[NUM_KINDS];
+    /* one queue per key or button, pressed and released */
+    SendQueue keyQueues[NUM_KEYS][2];
+    SendQueue buttonQueues[NUM_BUTTONS][2];
+    uint64_t *motionSent;  /* send time of each motion event */
+    uint64_t lastMotion;   /* number of the last motion received, plus 1 */
+} Probe;
+
+static uint64_t
+ProbeNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+ProbeQueuePush(SendQueue *q, uint64_t now) {
+    if (q->count == QUEUE_SIZE)
+        return;
+
+    q->sent[(q->head + q->count++) % QUEUE_SIZE] = now;
+}
+
+static Bool
+ProbeQueuePop(SendQueue *q, uint64_t *sent) {
+    if (!q->count)
+        return False;
+
+    *sent = q->sent[q->head];
+    q->head = (q->head + 1) % QUEUE_SIZE;
+    q->count--;
+    return True;
+}
+
+static void
+ProbeRecord(Kind *kind, uint64_t latency) {
+    kind->latency[kind->received++] = latency;
+    if (latency > kind->maxLatency)
+        kind->maxLatency = latency;
+}
+
+/* Motion event n goes to the nth position of the screen, line after line */
+static void
+ProbeMotionPosition(Probe *p, uint64_t n, int *x, int *y) {
+    uint64_t pos = n % ((uint64_t)p->width * p->height);
+
+    *x = pos % p->width;
+    *y = pos / p->width;
+}
+
+static void
+ProbeSend(Probe *p, int kind, uint64_t now) {
+    Kind *k = &p->kinds[kind];
+    uint64_t n = k->numSent;
+    int x, y;
+
+    switch (kind) {
+    case KIND_KEY: {
+        int key = (n / 2) % NUM_KEYS, release = n % 2;
+
+        XTestFakeKeyEvent(p->host, p->keys[key], !release, CurrentTime);
+        ProbeQueuePush(&p->keyQueues[key][release], now);
+        break;
+    }
+    case KIND_BUTTON: {
+        int button = (n / 2) % NUM_BUTTONS, release = n % 2;
+
+        XTestFakeButtonEvent(p->host, button + 1, !release, CurrentTime);
+        ProbeQueuePush(&p->buttonQueues[button][release], now);
+        break;
+    }
+    case KIND_MOTION:
+        ProbeMotionPosition(p, n, &x, &y);
+        XTestFakeMotionEvent(p->host, DefaultScreen(p->host), x, y,
+                             CurrentTime);
+        p->motionSent[n] = now;
+        break;
+    }
+
+    XFlush(p->host);
+    k->numSent++;
+}
+
+static void
+ProbeReceive(Probe *p, XEvent *ev, uint64_t now) {
+    Kind *k;
+    uint64_t sent, n, pos, screen;
+    int i, release;
+
+    switch (ev->type) {
+    case KeyPress:
+    case KeyRelease:
+        k = &p->kinds[KIND_KEY];
+        release = ev->type == KeyRelease;
+        for (i = 0; i < NUM_KEYS; i++)
+            if (p->keys[i] == ev->xkey.keycode &&
+                ProbeQueuePop(&p->keyQueues[i][release], &sent))
+                ProbeRecord(k, now - sent);
+        break;
+    case ButtonPress:
+    case ButtonRelease:
+        k = &p->kinds[KIND_BUTTON];
+        release = ev->type == ButtonRelease;
+        i = ev->xbutton.button - 1;
+        if (i >= 0 && i < NUM_BUTTONS &&
+            ProbeQueuePop(&p->buttonQueues[i][release], &sent))
+            ProbeRecord(k, now - sent);
+        break;
+    case MotionNotify:
+        k = &p->kinds[KIND_MOTION];
+        screen = (uint64_t)p->width * p->height;
+        pos = (uint64_t)ev->xmotion.y_root * p->width + ev->xmotion.x_root;
+
+        /* The first event at this position since the last one received */
+        n = p->lastMotion + (pos + screen - p->lastMotion % screen) % screen;
+        if (n >= k->numSent)
+            break;
+
+        k->merged += n - p->lastMotion;
+        p->lastMotion = n + 1;
+        ProbeRecord(k, now - p->motionSent[n]);
+        break;
+    }
+}
+
+/* Keeps the nested server drawing until killed */
+static void
+ProbeLoad(const char *nestedName, Window win, unsigned int width,
+          unsigned int height) {
+    Display *dpy = XOpenDisplay(nestedName);
+    unsigned long color = 0;
+    GC gc;
+
+    if (!dpy)
+        _exit(1);
+
+    gc = XCreateGC(dpy, win, 0, NULL);
+    for (;;) {
+        XSetForeground(dpy, gc, color += 0x9e3779b1ul);
+        XFillRectangle(dpy, win, gc, 0, 0, width, height);
+        XSync(dpy, False);
+    }
+}
+
+static int
+ProbeCompare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t
+ProbePercentile(Kind *k, unsigned int percent) {
+    uint64_t i;
+
+    if (!k->received)
+        return 0;
+
+    i = (k->received * percent + 99) / 100;
+    return k->latency[i ? i - 1 : 0];
+}
+
+static void
+ProbeUsage(void) {
+    fprintf(stderr, "usage: nested-input-latency -H host -N nested "
+                    "[-t seconds] [-k keys/s] [-b buttons/s] [-m motions/s] "
+                    "[-l]\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[]) {
+    Probe p = { 0 };
+    const char *hostName = NULL, *nestedName = NULL;
+    double seconds = 5;
+    Bool load = False;
+    XSetWindowAttributes attrs;
+    XEvent ev;
+    pid_t loader = -1;
+    uint64_t start, end, now, next;
+    int screen, ignore, i, j;
+
+    p.kinds[KIND_KEY].rate = 100;
+    p.kinds[KIND_BUTTON].rate = 50;
+    p.kinds[KIND_MOTION].rate = 500;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-H") && i + 1 < argc)
+            hostName = argv[++i];
+        else if (!strcmp(argv[i], "-N") && i + 1 < argc)
+            nestedName = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+            p.kinds[KIND_KEY].rate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            p.kinds[KIND_BUTTON].rate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            p.kinds[KIND_MOTION].rate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-l"))
+            load = True;
+        else
+            ProbeUsage();
+    }
+
+    if (!hostName || !nestedName || seconds <= 0)
+        ProbeUsage();
+
+    p.host = XOpenDisplay(hostName);
+    p.nested = XOpenDisplay(nestedName);
+    if (!p.host || !p.nested) {
+        fprintf(stderr, "nested-input-latency: can't open display %s\n",
+                p.host ? nestedName : hostName);
+        return 1;
+    }
+
+    if (!XTestQueryExtension(p.host, &ignore, &ignore, &ignore, &ignore)) {
+        fprintf(stderr, "nested-input-latency: no XTEST on %s\n", hostName);
+        return 1;
+    }
+
+    screen = DefaultScreen(p.nested);
+    p.width = DisplayWidth(p.nested, screen);
+    p.height = DisplayHeight(p.nested, screen);
+
+    for (i = 0; i < NUM_KEYS; i++)
+        p.keys[i] = XKeysymToKeycode(p.host, XK_a + i);
+
+    for (i = 0; i < NUM_KINDS; i++) {
+        Kind *k = &p.kinds[i];
+        uint64_t max = k->rate * seconds + 1;
+
+        k->period = k->rate > 0 ? 1000000 / k->rate : 0;
+        k->latency = calloc(max, sizeof(uint32_t));
+        if (!k->latency)
+            return 1;
+    }
+
+    p.motionSent = calloc(p.kinds[KIND_MOTION].rate * seconds + 1,
+                          sizeof(uint64_t));
+    if (!p.motionSent)
+        return 1;
+
+    /* Nothing else is on the nested screen, so the window needs no manager */
+    attrs.override_redirect = True;
+    attrs.background_pixel = BlackPixel(p.nested, screen);
+    attrs.event_mask = KeyPressMask | KeyReleaseMask | ButtonPressMask |
+                       ButtonReleaseMask | PointerMotionMask |
+                       StructureNotifyMask;
+    p.win = XCreateWindow(p.nested, RootWindow(p.nested, screen), 0, 0,
+                          p.width, p.height, 0, CopyFromParent, InputOutput,
+                          CopyFromParent,
+                          CWOverrideRedirect | CWBackPixel | CWEventMask,
+                          &attrs);
+    XMapRaised(p.nested, p.win);
+    do
+        XNextEvent(p.nested, &ev);
+    while (ev.type != MapNotify);
+    XSetInputFocus(p.nested, p.win, RevertToParent, CurrentTime);
+    XSync(p.nested, False);
+
+    /* Keys go to the host window under the pointer */
+    XSetInputFocus(p.host, PointerRoot, RevertToPointerRoot, CurrentTime);
+    XTestFakeMotionEvent(p.host, DefaultScreen(p.host), p.width / 2,
+                         p.height / 2, CurrentTime);
+    XSync(p.host, False);
+
+    if (load) {
+        loader = fork();
+        if (loader == 0)
+            ProbeLoad(nestedName, p.win, p.width, p.height);
+        /* Give it time to get going */
+        sleep(1);
+    }
+
+    /* The pointer was moved before the start */
+    usleep(100000);
+    while (XPending(p.nested))
+        XNextEvent(p.nested, &ev);
+
+    start = ProbeNow();
+    end = start + seconds * 1000000;
+    for (i = 0; i < NUM_KINDS; i++)
+        p.kinds[i].next = start;
+
+    for (;;) {
+        struct timeval tv;
+        fd_set fds;
+
+        now = ProbeNow();
+        if (now >= end + GRACE_USEC)
+            break;
+
+        next = end + GRACE_USEC;
+        for (i = 0; i < NUM_KINDS; i++) {
+            Kind *k = &p.kinds[i];
+
+            if (!k->period || k->next >= end)
+                continue;
+
+            if (now >= k->next) {
+                ProbeSend(&p, i, now);
+                k->next += k->period;
+            }
+            if (k->next < next)
+                next = k->next;
+        }
+
+        now = ProbeNow();
+        if (!XPending(p.nested) && next > now) {
+            FD_ZERO(&fds);
+            FD_SET(ConnectionNumber(p.nested), &fds);
+            tv.tv_sec = (next - now) / 1000000;
+            tv.tv_usec = (next - now) % 1000000;
+            select(ConnectionNumber(p.nested) + 1, &fds, NULL, NULL, &tv);
+        }
+
+        now = ProbeNow();
+        while (XPending(p.nested)) {
+            XNextEvent(p.nested, &ev);
+            ProbeReceive(&p, &ev, now);
+        }
+    }
+
+    if (loader > 0) {
+        kill(loader, SIGTERM);
+        waitpid(loader, NULL, 0);
+    }
+
+    /* Motion is merged when later motion arrived, the rest was dropped */
+    p.kinds[KIND_MOTION].dropped = p.kinds[KIND_MOTION].numSent -
+                                   p.lastMotion;
+    for (i = 0; i < NUM_KEYS; i++)
+        for (j = 0; j < 2; j++)
+            p.kinds[KIND_KEY].dropped += p.keyQueues[i][j].count;
+    for (i = 0; i < NUM_BUTTONS; i++)
+        for (j = 0; j < 2; j++)
+            p.kinds[KIND_BUTTON].dropped += p.buttonQueues[i][j].count;
+
+    for (i = 0; i < NUM_KINDS; i++) {
+        Kind *k = &p.kinds[i];
+
+        qsort(k->latency, k->received, sizeof(uint32_t), ProbeCompare);
+        printf("%s %llu %llu %llu %llu %u %u %llu\n", kindNames[i],
+               (unsigned long long)k->numSent,
+               (unsigned long long)k->received,
+               (unsigned long long)k->merged,
+               (unsigned long long)k->dropped, ProbePercentile(k, 50),
+               ProbePercentile(k, 99), (unsigned long long)k->maxLatency);
+    }
+
+    XCloseDisplay(p.nested);
+    XCloseDisplay(p.host);
+    return 0;
+}
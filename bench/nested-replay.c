@@ -0,0 +1,525 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replays a damage trace recorded with the "DamageTrace" option through the
+ * driver's own client backends, without a nested server, to a host such as
+ * Xvfb or to the null backend:
+ *   nested-replay [-b backend] [-d display] [-r] [-s strategy] trace
+ * Frames are replayed as fast as possible, or at the recorded speed with -r.
+ * The strategy picks what is uploaded of each frame:
+ *   rects    every damaged rectangle, as the driver does (the default)
+ *   extents  the bounding box of the damage
+ *   hash     the 64x64 tiles touched by the damage whose contents changed
+ *            since they were last uploaded
+ *   cache    as hash, also leaving out tiles with contents uploaded anywhere
+ *            before, as a tile cache on the host would
+ * Without pixels in the trace, damage is filled with a new value on every
+ * frame, so hashing finds nothing to leave out. A summary line goes to the
+ * standard output:
+ *   <strategy> <frames> <uploads> <bytes> <unchanged> <cached> <seconds>
+ * and the backend's upload counters and messages to the standard error. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+#include "nested_input.h"
+#include "nested_trace_format.h"
+
+#define TILE_SIZE  64
+#define CACHE_SIZE (1 << 16) /* tile hashes, direct mapped */
+
+typedef enum {
+    STRATEGY_RECTS,
+    STRATEGY_EXTENTS,
+    STRATEGY_HASH,
+    STRATEGY_CACHE
+} ReplayStrategy;
+
+static const char *replayStrategyNames[] = {
+    [STRATEGY_RECTS] = "rects",
+    [STRATEGY_EXTENTS] = "extents",
+    [STRATEGY_HASH] = "hash",
+    [STRATEGY_CACHE] = "cache",
+};
+
+typedef struct {
+    FILE *file;
+    NestedTraceHeader header;
+    ReplayStrategy strategy;
+    NestedClientPrivatePtr client;
+    unsigned int width;
+    unsigned int height;
+    size_t stride;
+    int cpp;
+    NestedTraceRect *rects;
+    unsigned int numRects;  /* of the current frame */
+    unsigned int rectsSize;
+    unsigned int tilesX;
+    unsigned int tilesY;
+    uint64_t *tileHashes;  /* of the contents last uploaded, per tile */
+    unsigned char *touched; /* per tile, in the current frame */
+    uint64_t *cache;
+    uint64_t frames;
+    uint64_t uploads;
+    uint64_t bytes;
+    uint64_t unchanged;
+    uint64_t cached;
+} Replay;
+
+/* The server functions and driver callbacks the backends use */
+
+Bool enableNestedInput = FALSE;
+char *display = "replay";
+
+void
+xf86DrvMsg(int scrnIndex, MessageType type, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void
+xf86VDrvMsgVerb(int scrnIndex, MessageType type, int verb,
+                const char *format, va_list args) {
+    vfprintf(stderr, format, args);
+}
+
+void
+xf86Msg(MessageType type, const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+/* Names are compared as the server does, without case, spaces and '_' */
+int
+xf86NameCmp(const char *s1, const char *s2) {
+    while (*s1 || *s2) {
+        if (*s1 == ' ' || *s1 == '_') {
+            s1++;
+        } else if (*s2 == ' ' || *s2 == '_') {
+            s2++;
+        } else if (tolower((unsigned char)*s1) != tolower((unsigned char)*s2)) {
+            return tolower((unsigned char)*s1) - tolower((unsigned char)*s2);
+        } else {
+            s1++;
+            s2++;
+        }
+    }
+
+    return 0;
+}
+
+Bool
+NestedHostDetached(int scrnIndex) {
+    return FALSE;
+}
+
+void
+NestedHostResized(int scrnIndex, unsigned int width, unsigned int height) {
+}
+
+void
+NestedHostToScreen(int scrnIndex, int *x, int *y) {
+}
+
+void
+NestedRootlessHostExpose(int scrnIndex, CARD32 window, int x, int y,
+                         unsigned int width, unsigned int height) {
+}
+
+void
+NestedRootlessHostConfigure(int scrnIndex, CARD32 window, int x, int y,
+                            unsigned int width, unsigned int height) {
+}
+
+void
+NestedRootlessHostRaise(int scrnIndex, CARD32 window) {
+}
+
+void
+NestedRootlessHostClose(int scrnIndex, CARD32 window) {
+}
+
+void
+NestedInputSetFileDescriptor(DeviceIntPtr dev, int fd) {
+}
+
+void
+NestedInputPostMouseMotionEvent(DeviceIntPtr dev, int x, int y) {
+}
+
+void
+NestedInputPostButtonEvent(DeviceIntPtr dev, int button, int isDown) {
+}
+
+void
+NestedInputPostKeyboardEvent(DeviceIntPtr dev, unsigned int keycode,
+                             int isDown) {
+}
+
+static uint64_t
+ReplayNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+ReplaySleepUntil(uint64_t usec) {
+    uint64_t now = ReplayNow();
+    struct timespec ts;
+
+    if (usec <= now)
+        return;
+
+    ts.tv_sec = (usec - now) / 1000000;
+    ts.tv_nsec = (usec - now) % 1000000 * 1000;
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+static Bool
+ReplayRead(Replay *r, void *data, size_t size) {
+    return fread(data, 1, size, r->file) == size;
+}
+
+/* FNV-1a over the lines of a box of the frame buffer */
+static uint64_t
+ReplayHashBox(Replay *r, const char *fb, BoxPtr box) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t len = (size_t)(box->x2 - box->x1) * r->cpp;
+    int x, y;
+
+    for (y = box->y1; y < box->y2; y++) {
+        const unsigned char *p = (const unsigned char *)fb +
+                                 (size_t)y * r->stride + box->x1 * r->cpp;
+
+        for (x = 0; x < len; x++)
+            hash = (hash ^ p[x]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static void
+ReplayUpload(Replay *r, BoxPtr box) {
+    NestedClientUpdateScreen(r->client, box->x1, box->y1, box->x2, box->y2);
+    r->uploads++;
+    r->bytes += (uint64_t)(box->x2 - box->x1) * (box->y2 - box->y1) * r->cpp;
+}
+
+static void
+ReplayUploadTiles(Replay *r, const char *fb) {
+    unsigned int i, tx, ty;
+
+    memset(r->touched, 0, r->tilesX * r->tilesY);
+
+    for (i = 0; i < r->numRects; i++) {
+        NestedTraceRect *rect = &r->rects[i];
+
+        for (ty = rect->y1 / TILE_SIZE; ty * TILE_SIZE < rect->y2; ty++)
+            for (tx = rect->x1 / TILE_SIZE; tx * TILE_SIZE < rect->x2; tx++)
+                r->touched[ty * r->tilesX + tx] = 1;
+    }
+
+    for (ty = 0; ty < r->tilesY; ty++) {
+        for (tx = 0; tx < r->tilesX; tx++) {
+            unsigned int tile = ty * r->tilesX + tx;
+            BoxRec box;
+            uint64_t hash;
+
+            if (!r->touched[tile])
+                continue;
+
+            box.x1 = tx * TILE_SIZE;
+            box.y1 = ty * TILE_SIZE;
+            box.x2 = min(box.x1 + TILE_SIZE, r->width);
+            box.y2 = min(box.y1 + TILE_SIZE, r->height);
+            hash = ReplayHashBox(r, fb, &box);
+
+            if (hash == r->tileHashes[tile]) {
+                r->unchanged++;
+                continue;
+            }
+
+            r->tileHashes[tile] = hash;
+
+            if (r->strategy == STRATEGY_CACHE) {
+                uint64_t *slot = &r->cache[hash % CACHE_SIZE];
+
+                if (*slot == hash) {
+                    r->cached++;
+                    continue;
+                }
+                *slot = hash;
+            }
+
+            ReplayUpload(r, &box);
+        }
+    }
+}
+
+static Bool
+ReplayResize(Replay *r, const char *backendName, const char *displayName,
+             unsigned int width, unsigned int height) {
+    Pixel redMask, greenMask, blueMask;
+
+    r->width = width;
+    r->height = height;
+    r->cpp = r->header.bitsPerPixel / 8;
+    /* Lines are padded to 32 bits, as in the driver's frame buffer */
+    r->stride = ((width * r->header.bitsPerPixel + 31) / 32) * 4;
+
+    r->tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    r->tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    free(r->tileHashes);
+    free(r->touched);
+    r->tileHashes = calloc(r->tilesX * r->tilesY, sizeof(uint64_t));
+    r->touched = malloc(r->tilesX * r->tilesY);
+    if (!r->tileHashes || !r->touched)
+        return FALSE;
+
+    if (r->client)
+        return NestedClientResizeFrameBuffer(r->client, width, height) &&
+               NestedClientResizeWindow(r->client, width, height);
+
+    {
+        NestedClientBackendPtr backend;
+        unsigned int hostWidth, hostHeight;
+        int x, y;
+
+        backend = NestedClientFindBackend(0, backendName, displayName, NULL);
+        if (!backend ||
+            !NestedClientCheckDisplay(backend, 0, displayName, NULL, NULL,
+                                      FALSE, NULL, 0, &hostWidth, &hostHeight,
+                                      &x, &y))
+            return FALSE;
+
+        if (!NestedClientValidDepth(backend, r->header.depth)) {
+            fprintf(stderr, "nested-replay: depth %u isn't supported\n",
+                    r->header.depth);
+            return FALSE;
+        }
+
+        r->client = NestedClientCreateScreen(backend, 0, displayName, NULL,
+                                             FALSE, FALSE, FALSE, width,
+                                             height,
+                                             width, height, 0, 0, 1.0,
+                                             r->header.depth,
+                                             r->header.bitsPerPixel,
+                                             &redMask, &greenMask, &blueMask);
+        if (!r->client)
+            return FALSE;
+
+        if (redMask != r->header.redMask || greenMask != r->header.greenMask ||
+            blueMask != r->header.blueMask)
+            fprintf(stderr, "nested-replay: the host visual differs from the "
+                            "recorded one, colors will be off\n");
+    }
+
+    return TRUE;
+}
+
+/* Reads a frame into the frame buffer and uploads it */
+static Bool
+ReplayFrame(Replay *r, NestedTraceFrame *frame) {
+    char *fb = NestedClientGetFrameBuffer(r->client);
+    unsigned int i;
+    BoxRec extents = { SHRT_MAX, SHRT_MAX, SHRT_MIN, SHRT_MIN };
+    int y;
+
+    if (frame->numRects > r->rectsSize) {
+        free(r->rects);
+        r->rects = malloc(frame->numRects * sizeof(NestedTraceRect));
+        if (!r->rects)
+            return FALSE;
+        r->rectsSize = frame->numRects;
+    }
+    r->numRects = frame->numRects;
+
+    if (!ReplayRead(r, r->rects, frame->numRects * sizeof(NestedTraceRect)))
+        return FALSE;
+
+    for (i = 0; i < frame->numRects; i++) {
+        NestedTraceRect *rect = &r->rects[i];
+        size_t offset = (size_t)rect->y1 * r->stride + rect->x1 * r->cpp;
+        size_t len = (size_t)(rect->x2 - rect->x1) * r->cpp;
+
+        if (rect->x1 < 0 || rect->y1 < 0 || rect->x2 > r->width ||
+            rect->y2 > r->height || rect->x1 > rect->x2 ||
+            rect->y1 > rect->y2)
+            return FALSE;
+
+        for (y = rect->y1; y < rect->y2; y++, offset += r->stride) {
+            if (!(r->header.flags & NESTED_TRACE_PIXELS))
+                memset(fb + offset, (int)r->frames, len);
+            else if (!ReplayRead(r, fb + offset, len))
+                return FALSE;
+        }
+
+        extents.x1 = min(extents.x1, rect->x1);
+        extents.y1 = min(extents.y1, rect->y1);
+        extents.x2 = max(extents.x2, rect->x2);
+        extents.y2 = max(extents.y2, rect->y2);
+    }
+
+    switch (r->strategy) {
+    case STRATEGY_RECTS:
+        for (i = 0; i < frame->numRects; i++) {
+            BoxRec box = {
+                r->rects[i].x1, r->rects[i].y1, r->rects[i].x2, r->rects[i].y2
+            };
+
+            ReplayUpload(r, &box);
+        }
+        break;
+    case STRATEGY_EXTENTS:
+        if (frame->numRects)
+            ReplayUpload(r, &extents);
+        break;
+    case STRATEGY_HASH:
+    case STRATEGY_CACHE:
+        ReplayUploadTiles(r, fb);
+        break;
+    }
+
+    NestedClientBeginSync(r->client);
+    NestedClientFinishSync(r->client);
+    NestedClientCheckEvents(r->client);
+
+    r->frames++;
+    return TRUE;
+}
+
+static void
+ReplayUsage(void) {
+    fprintf(stderr, "usage: nested-replay [-b backend] [-d display] [-r] "
+                    "[-s rects|extents|hash|cache] trace\n");
+    exit(2);
+}
+
+int
+main(int argc, char *argv[]) {
+    Replay r = { 0 };
+    NestedTraceFrame frame;
+    const char *backendName = "auto", *displayName = NULL, *path = NULL;
+    Bool realTime = FALSE;
+    uint64_t start, firstUsec = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            backendName = argv[++i];
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            displayName = argv[++i];
+        } else if (!strcmp(argv[i], "-r")) {
+            realTime = TRUE;
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            i++;
+            for (r.strategy = 0; r.strategy <= STRATEGY_CACHE; r.strategy++)
+                if (!strcmp(argv[i], replayStrategyNames[r.strategy]))
+                    break;
+            if (r.strategy > STRATEGY_CACHE)
+                ReplayUsage();
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            ReplayUsage();
+        }
+    }
+
+    if (!path)
+        ReplayUsage();
+
+    r.file = fopen(path, "rb");
+    if (!r.file) {
+        fprintf(stderr, "nested-replay: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    if (!ReplayRead(&r, &r.header, sizeof(r.header)) ||
+        r.header.magic != NESTED_TRACE_MAGIC ||
+        r.header.version != NESTED_TRACE_VERSION ||
+        r.header.bitsPerPixel % 8) {
+        fprintf(stderr, "nested-replay: %s isn't a damage trace of this "
+                        "version and byte order\n", path);
+        return 1;
+    }
+
+    r.cache = calloc(CACHE_SIZE, sizeof(uint64_t));
+    if (!r.cache)
+        return 1;
+
+    start = ReplayNow();
+    while (ReplayRead(&r, &frame, sizeof(frame))) {
+        if (!r.client || frame.width != r.width || frame.height != r.height) {
+            if (!ReplayResize(&r, backendName, displayName, frame.width,
+                              frame.height)) {
+                fprintf(stderr, "nested-replay: can't show a %ux%u screen\n",
+                        frame.width, frame.height);
+                return 1;
+            }
+        }
+
+        if (!r.frames)
+            firstUsec = frame.usec;
+        if (realTime)
+            ReplaySleepUntil(start + frame.usec - firstUsec);
+
+        if (!ReplayFrame(&r, &frame)) {
+            fprintf(stderr, "nested-replay: %s is cut short or damaged at "
+                            "frame %llu\n", path,
+                    (unsigned long long)r.frames);
+            break;
+        }
+    }
+
+    printf("%s %llu %llu %llu %llu %llu %.3f\n",
+           replayStrategyNames[r.strategy], (unsigned long long)r.frames,
+           (unsigned long long)r.uploads, (unsigned long long)r.bytes,
+           (unsigned long long)r.unchanged, (unsigned long long)r.cached,
+           (ReplayNow() - start) / 1e6);
+
+    if (r.client)
+        NestedClientCloseScreen(r.client);
+    fclose(r.file);
+    return 0;
+}
@@ -0,0 +1,293 @@
+#!/bin/sh
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+#
+# Runs the workloads below on a nested Xorg using the freshly built driver,
+# shown on an Xvfb host, for each backend and upload method, and prints one
+# tab separated line of results per run on the standard output:
+#   backend upload size depth workload client_rate host_fps updates bytes
+#   cpu_ms p50_us p99_us
+# client_rate is the rate the workload reports (x11perf operations or
+# nested-damage frames per second), host_fps the frames uploaded per second,
+# cpu_ms the time the server's main thread was on a CPU. Lines are sorted
+# the same way on every run, so results of two versions can be diffed or
+# compared with compare.sh.
+#
+# With INPUT_LATENCY and INPUT_RESULTS set, the latency of host input to a
+# nested client is measured as well, with and without rendering going on,
+# and written to INPUT_RESULTS one tab separated line per kind of event:
+#   backend load kind sent received merged dropped p50_us p99_us max_us
+#
+# Set in the environment (make bench passes the first three and the input
+# ones when XTEST is there to build nested-input-latency):
+#   DRIVER_DIR     directory holding nested_drv.so
+#   DAMAGE         the nested-damage program
+#   BACKENDS       comma separated backends built into the driver
+#   INPUT_LATENCY  the nested-input-latency program
+#   INPUT_RESULTS  the file to write its results to
+#   BENCH_TIME     seconds per workload, default 5
+#   BENCH_SIZES    sizes for the fill workload, default
+#                  "1024x768 1920x1080 3840x2160"; the other workloads run at
+#                  the first size
+#   BENCH_DEPTHS   depths for the fill workload, default "24 16"
+#   BENCH_X11PERF  x11perf tests, default "-rect500 -scroll500 -aa24text
+#                  -putimage500 -copywinwin500"
+#   BENCH_INPUT    nested-input-latency rates, default "-k 100 -b 50 -m 500"
+#   XORG, XVFB, X11PERF, XORG_MODULE_DIR  programs and server modules
+
+: ${DRIVER_DIR:?DRIVER_DIR must name the directory of nested_drv.so}
+: ${DAMAGE:?DAMAGE must name the nested-damage program}
+: ${BACKENDS:=xcb,xlib,null}
+: ${BENCH_TIME:=5}
+: ${BENCH_SIZES:="1024x768 1920x1080 3840x2160"}
+: ${BENCH_DEPTHS:="24 16"}
+: ${BENCH_X11PERF:="-rect500 -scroll500 -aa24text -putimage500 -copywinwin500"}
+: ${BENCH_INPUT:="-k 100 -b 50 -m 500"}
+: ${XORG:=Xorg}
+: ${XVFB:=Xvfb}
+: ${X11PERF:=x11perf}
+: ${XORG_MODULE_DIR:=`pkg-config --variable=moduledir xorg-server 2>/dev/null`}
+: ${XORG_MODULE_DIR:=/usr/lib/xorg/modules}
+
+HOST_DISPLAY=:71
+NESTED_DISPLAY=:72
+CLK_TCK=`getconf CLK_TCK`
+WORKDIR=`mktemp -d "${TMPDIR:-/tmp}/nested-bench.XXXXXX"` || exit 1
+HOST_PID=
+NESTED_PID=
+
+cleanup() {
+    [ -n "$NESTED_PID" ] && kill $NESTED_PID 2>/dev/null
+    [ -n "$HOST_PID" ] && kill $HOST_PID 2>/dev/null
+    wait
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+log() {
+    echo "bench: $*" >&2
+}
+
+now_ms() {
+    echo $((`date +%s%N` / 1000000))
+}
+
+# A server is up once it has created its socket; one that died on the way
+# is reported by the caller through its log
+wait_for_display() {
+    socket=/tmp/.X11-unix/X${1#:}
+    tries=100
+    while [ ! -S "$socket" ] && kill -0 $2 2>/dev/null; do
+        tries=$((tries - 1))
+        [ $tries -gt 0 ] || return 1
+        sleep 0.1
+    done
+    kill -0 $2 2>/dev/null
+}
+
+# utime + stime of the main thread, which has the process id, in ms
+main_thread_cpu_ms() {
+    sed 's/.*) //' /proc/$1/task/$1/stat |
+        awk -v tck=$CLK_TCK '{ print int(($12 + $13) * 1000 / tck) }'
+}
+
+start_host() { # size depth upload
+    args=
+    [ "$3" = put-image ] && args="-extension MIT-SHM"
+    $XVFB $HOST_DISPLAY -screen 0 ${1}x$2 -nolisten tcp -noreset $args \
+        >"$WORKDIR/Xvfb.log" 2>&1 &
+    HOST_PID=$!
+    if ! wait_for_display $HOST_DISPLAY $HOST_PID; then
+        log "Xvfb didn't start, see below"
+        cat "$WORKDIR/Xvfb.log" >&2
+        exit 1
+    fi
+}
+
+stop_host() {
+    [ -n "$HOST_PID" ] && kill $HOST_PID 2>/dev/null && wait $HOST_PID
+    HOST_PID=
+}
+
+# Xorg only reads a relative configuration file when not run as root, so it
+# is written to the directory the server is started from
+write_config() { # backend size depth
+    cat >"$WORKDIR/xorg.conf" <<EOF
+Section "ServerFlags"
+    Option "AutoEnableDevices" "false"
+    Option "AutoAddDevices" "false"
+    Option "AllowEmptyInput" "true"
+EndSection
+
+Section "Device"
+    Identifier "device1"
+    Driver "nested"
+    Option "Backend" "$1"
+    Option "Display" "$HOST_DISPLAY"
+EndSection
+
+Section "Screen"
+    Identifier "screen1"
+    Device "device1"
+    DefaultDepth $3
+    SubSection "Display"
+        Depth $3
+        Modes "$2"
+    EndSubSection
+EndSection
+
+Section "ServerLayout"
+    Identifier "layout1"
+    Screen "screen1"
+EndSection
+EOF
+}
+
+start_nested() { # upload
+    max=
+    case "$1" in
+        put-image|shm|shm-fd) max=$1 ;;
+    esac
+    rm -f "$WORKDIR/Xorg.log"
+    (cd "$WORKDIR" && NESTED_XCB_MAX_UPLOAD=$max exec $XORG $NESTED_DISPLAY \
+        -config xorg.conf -modulepath "$DRIVER_DIR,$XORG_MODULE_DIR" \
+        -logfile "$WORKDIR/Xorg.log" -nolisten tcp -noreset \
+        >/dev/null 2>&1) &
+    NESTED_PID=$!
+    if ! wait_for_display $NESTED_DISPLAY $NESTED_PID; then
+        log "the nested server didn't start, see below"
+        cat "$WORKDIR/Xorg.log" >&2
+        exit 1
+    fi
+}
+
+# The upload counters are logged when the screen is closed
+stop_nested() {
+    kill $NESTED_PID 2>/dev/null && wait $NESTED_PID
+    NESTED_PID=
+}
+
+# Prints the workload's rate in operations per second
+run_workload() { # workload
+    case "$1" in
+        x11perf*)
+            DISPLAY=$NESTED_DISPLAY $X11PERF -time $BENCH_TIME -repeat 1 \
+                -${1#x11perf-} 2>/dev/null |
+                sed -n 's/.*( *\([0-9.]*\)\/sec).*/\1/p' | tail -n 1
+            ;;
+        *)
+            DISPLAY=$NESTED_DISPLAY "$DAMAGE" -t $BENCH_TIME $1 |
+                awk '$3 > 0 { printf "%.1f\n", $2 / $3 }'
+            ;;
+    esac
+}
+
+run() { # backend upload size depth workload
+    prefix=`printf '%s\t%s\t%s\t%s\t%s' "$@"`
+    start_nested $2
+    cpu=`main_thread_cpu_ms $NESTED_PID`
+    start=`now_ms`
+    rate=`run_workload $5`
+    elapsed=$((`now_ms` - start))
+    cpu=$((`main_thread_cpu_ms $NESTED_PID` - cpu))
+    stop_nested
+
+    sed -n 's/.*Uploads ([a-z]*): \([0-9]*\) frames, \([0-9]*\) updates, \([0-9]*\) bytes, latency p50 \([0-9]*\) us, p99 \([0-9]*\) us.*/\1 \2 \3 \4 \5/p' \
+        "$WORKDIR/Xorg.log" | head -n 1 |
+        awk -v OFS='\t' -v prefix="$prefix" \
+            -v rate="${rate:-0}" -v elapsed=$elapsed -v cpu=$cpu '
+            { found = 1
+              print prefix, rate, sprintf("%.1f", $1 * 1000 / elapsed),
+                    $2, $3, cpu, $4, $5 }
+            END { if (!found)
+                      print prefix, rate, 0, 0, 0, cpu, 0, 0 }'
+}
+
+# The backends this suite can drive, with the upload methods to compare;
+# the others need a viewer or a compositor
+uploads_of() {
+    case "$1" in
+        xcb)  echo "put-image shm shm-fd" ;;
+        xlib) echo "put-image shm" ;;
+        null) echo "none" ;;
+    esac
+}
+
+workloads=
+for t in $BENCH_X11PERF; do
+    workloads="$workloads x11perf${t}"
+done
+workloads="$workloads scroll text video"
+first_size=${BENCH_SIZES%% *}
+
+printf 'backend\tupload\tsize\tdepth\tworkload\tclient_rate\thost_fps\tupdates\tbytes\tcpu_ms\tp50_us\tp99_us\n'
+
+for backend in `echo "$BACKENDS" | tr ',' ' '`; do
+    for upload in `uploads_of $backend`; do
+        for size in $BENCH_SIZES; do
+            for depth in $BENCH_DEPTHS; do
+                log "$backend, $upload, ${size}x$depth"
+                [ $backend = null ] || start_host $size $depth $upload
+                write_config $backend $size $depth
+
+                run $backend $upload $size $depth fill
+                if [ $size = $first_size ] && [ $depth = 24 ]; then
+                    for w in $workloads; do
+                        run $backend $upload $size $depth $w
+                    done
+                fi
+
+                stop_host
+            done
+        done
+    done
+done
+
+[ -n "$INPUT_LATENCY" ] && [ -n "$INPUT_RESULTS" ] || exit 0
+
+# Input is forwarded by the backends with a host window, with the fastest
+# upload method the host has
+printf 'backend\tload\tkind\tsent\treceived\tmerged\tdropped\tp50_us\tp99_us\tmax_us\n' \
+    >"$INPUT_RESULTS"
+
+for backend in `echo "$BACKENDS" | tr ',' ' '`; do
+    case $backend in
+        xcb|xlib) ;;
+        *) continue ;;
+    esac
+
+    log "$backend, input"
+    start_host $first_size 24 default
+    write_config $backend $first_size 24
+    start_nested default
+
+    for load in idle render; do
+        flag=
+        [ $load = render ] && flag=-l
+        "$INPUT_LATENCY" -H $HOST_DISPLAY -N $NESTED_DISPLAY -t $BENCH_TIME \
+            $BENCH_INPUT $flag |
+            awk -v OFS='\t' -v backend=$backend -v load=$load \
+                '{ $1 = $1; print backend, load, $0 }' >>"$INPUT_RESULTS"
+    done
+
+    stop_nested
+    stop_host
+done
@@ -0,0 +1,680 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* The driver side of the client interface: every NestedClient function is
+ * passed on to the backend the screen was created with.
+ *
+ * Frame uploads are counted here, whatever the backend, and logged on one
+ * line when a screen is closed or the server resets, for the benchmarks in
+ * bench/ to pick up. The latency of a frame runs from its first update to
+ * the end of the sync that finished it. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+
+/* Latencies are kept in microseconds, in buckets of 32 per power of two so
+ * that percentiles are off by 3% at most, up to about a minute */
+#define NESTED_LATENCY_SUB_BITS 5
+#define NESTED_LATENCY_MAX_SHIFT 21
+#define NESTED_LATENCY_BUCKETS \
+    ((NESTED_LATENCY_MAX_SHIFT + 2) << NESTED_LATENCY_SUB_BITS)
+
+typedef struct {
+    uint64_t frames;  /* syncs that finished updates */
+    uint64_t updates; /* update requests */
+    uint64_t bytes;   /* uploaded, counting whole pixels */
+    uint32_t latency[NESTED_LATENCY_BUCKETS];
+} NestedClientCounters;
+
+struct NestedClientPrivate {
+    NestedClientBackendPtr backend;
+    NestedBackendScreenPtr priv;
+    int scrnIndex; /* stored only for xf86DrvMsg usage */
+    unsigned int bitsPerPixel;
+    uint64_t frameStartNs; /* 0 when nothing was updated since the sync */
+    NestedClientCounters counters;
+};
+
+typedef struct NestedClientMessage {
+    struct NestedClientMessage *next;
+    int scrnIndex;
+    MessageType type;
+    char text[];
+} NestedClientMessageRec, *NestedClientMessagePtr;
+
+static pthread_mutex_t nestedClientMessagesMutex = PTHREAD_MUTEX_INITIALIZER;
+static NestedClientMessagePtr nestedClientMessages;
+static NestedClientMessagePtr *nestedClientMessagesTail = &nestedClientMessages;
+static __thread Bool nestedClientDeferring;
+
+/* In the order "auto" prefers them when hosts are equally fast. The replay
+ * tool in bench/ has no server to link the RFB and Wayland backends with. */
+static NestedClientBackendPtr nestedBackends[] = {
+#ifdef NESTED_BACKEND_XCB
+    &nestedXcbBackend,
+#endif
+#if defined(NESTED_BACKEND_WAYLAND) && !defined(NESTED_REPLAY)
+    &nestedWaylandBackend,
+#endif
+#ifdef NESTED_BACKEND_XLIB
+    &nestedXlibBackend,
+#endif
+#if defined(NESTED_BACKEND_RFB) && !defined(NESTED_REPLAY)
+    &nestedRfbBackend,
+#endif
+#ifdef NESTED_BACKEND_NULL
+    &nestedNullBackend,
+#endif
+};
+
+#define NUM_BACKENDS (sizeof(nestedBackends) / sizeof(nestedBackends[0]))
+
+static const char *nestedUploadNames[] = {
+    [NESTED_UPLOAD_NONE] = "no host",
+    [NESTED_UPLOAD_PUT_IMAGE] = "image uploads",
+    [NESTED_UPLOAD_SHM] = "shared memory",
+    [NESTED_UPLOAD_SHM_FD] = "shared memory file descriptors",
+};
+
+static uint64_t
+NestedClientNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+NestedClientLatencyBucket(uint64_t us) {
+    int shift = 0;
+
+    while (us >= 2 << NESTED_LATENCY_SUB_BITS &&
+           shift < NESTED_LATENCY_MAX_SHIFT) {
+        us >>= 1;
+        shift++;
+    }
+
+    us = min(us, (2 << NESTED_LATENCY_SUB_BITS) - 1);
+    return shift ? (shift << NESTED_LATENCY_SUB_BITS) + us : us;
+}
+
+/* The lowest latency of the bucket the given share of frames fell below */
+static unsigned long
+NestedClientLatencyPercentile(NestedClientCounters *c, unsigned int percent) {
+    uint64_t wanted = (c->frames * percent + 99) / 100, seen = 0;
+    int i, shift;
+
+    for (i = 0; i < NESTED_LATENCY_BUCKETS - 1; i++) {
+        seen += c->latency[i];
+        if (seen >= wanted)
+            break;
+    }
+
+    if (i < 2 << NESTED_LATENCY_SUB_BITS)
+        return i;
+
+    shift = (i >> NESTED_LATENCY_SUB_BITS) - 1;
+    return (unsigned long)((i & ((1 << NESTED_LATENCY_SUB_BITS) - 1)) +
+                           (1 << NESTED_LATENCY_SUB_BITS)) << shift;
+}
+
+void
+NestedClientMsg(int scrnIndex, MessageType type, const char *format, ...) {
+    NestedClientMessagePtr msg;
+    va_list args;
+    int len;
+
+    va_start(args, format);
+
+    if (!nestedClientDeferring) {
+        xf86VDrvMsgVerb(scrnIndex, type, 1, format, args);
+        va_end(args);
+        return;
+    }
+
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    msg = malloc(sizeof(NestedClientMessageRec) + len + 1);
+    if (!msg)
+        return;
+
+    va_start(args, format);
+    vsnprintf(msg->text, len + 1, format, args);
+    va_end(args);
+
+    msg->next = NULL;
+    msg->scrnIndex = scrnIndex;
+    msg->type = type;
+
+    pthread_mutex_lock(&nestedClientMessagesMutex);
+    *nestedClientMessagesTail = msg;
+    nestedClientMessagesTail = &msg->next;
+    pthread_mutex_unlock(&nestedClientMessagesMutex);
+}
+
+void
+NestedClientDeferMessages(Bool defer) {
+    nestedClientDeferring = defer;
+}
+
+void
+NestedClientFlushMessages(void) {
+    NestedClientMessagePtr msg, next;
+
+    pthread_mutex_lock(&nestedClientMessagesMutex);
+    msg = nestedClientMessages;
+    nestedClientMessages = NULL;
+    nestedClientMessagesTail = &nestedClientMessages;
+    pthread_mutex_unlock(&nestedClientMessagesMutex);
+
+    for (; msg; msg = next) {
+        next = msg->next;
+        xf86DrvMsg(msg->scrnIndex, msg->type, "%s", msg->text);
+        free(msg);
+    }
+}
+
+static void
+NestedClientLogCounters(NestedClientPrivatePtr pPriv) {
+    NestedClientCounters *c = &pPriv->counters;
+
+    if (c->frames)
+        xf86DrvMsg(pPriv->scrnIndex, X_INFO,
+                   "Uploads (%s): %llu frames, %llu updates, %llu bytes, "
+                   "latency p50 %lu us, p99 %lu us\n",
+                   pPriv->backend->name, (unsigned long long)c->frames,
+                   (unsigned long long)c->updates,
+                   (unsigned long long)c->bytes,
+                   NestedClientLatencyPercentile(c, 50),
+                   NestedClientLatencyPercentile(c, 99));
+
+    memset(c, 0, sizeof(*c));
+    pPriv->frameStartNs = 0;
+}
+
+NestedClientBackendPtr
+NestedClientFindBackend(int scrnIndex, const char *name,
+                        const char *displayName, const char *xauthority) {
+    NestedClientBackendPtr best = NULL, first = NULL;
+    NestedUploadMethod bestMethod = NESTED_UPLOAD_NONE;
+    char names[64] = "";
+    int i;
+
+    if (name && xf86NameCmp(name, "auto")) {
+        for (i = 0; i < NUM_BACKENDS; i++) {
+            if (!xf86NameCmp(name, nestedBackends[i]->name))
+                return nestedBackends[i];
+
+            if (i)
+                strncat(names, ", ", sizeof(names) - strlen(names) - 1);
+            strncat(names, nestedBackends[i]->name,
+                    sizeof(names) - strlen(names) - 1);
+        }
+
+        xf86DrvMsg(scrnIndex, X_ERROR,
+                   "Backend \"%s\" is not built in, available: %s\n",
+                   name, names);
+        return NULL;
+    }
+
+    if (NUM_BACKENDS == 1)
+        return nestedBackends[0];
+
+    /* Backends that serve no host are only used when asked for by name, a
+     * mistyped or unreachable display mustn't bring up a headless or
+     * listening server. A host reachable in more than one way is driven by
+     * the backend that gets frames to it fastest. */
+    for (i = 0; i < NUM_BACKENDS; i++) {
+        NestedUploadMethod method;
+
+        if (!nestedBackends[i]->Probe)
+            continue;
+
+        if (!first)
+            first = nestedBackends[i];
+
+        method = nestedBackends[i]->Probe(scrnIndex, displayName, xauthority);
+
+        xf86DrvMsg(scrnIndex, X_PROBED, "Backend %s: %s\n",
+                   nestedBackends[i]->name, nestedUploadNames[method]);
+
+        if (method > bestMethod) {
+            best = nestedBackends[i];
+            bestMethod = method;
+        }
+    }
+
+    /* The host is reached again by the backend that is picked only */
+    for (i = 0; i < NUM_BACKENDS; i++)
+        if (nestedBackends[i] != best && nestedBackends[i]->DropProbe)
+            nestedBackends[i]->DropProbe(scrnIndex);
+
+    if (best)
+        return best;
+
+    if (!first)
+        xf86DrvMsg(scrnIndex, X_ERROR,
+                   "No backend for a host display is built in, "
+                   "the \"Backend\" option must name one\n");
+
+    /* Nothing reached the host, let the first backend report why */
+    return first;
+}
+
+Bool
+NestedClientCheckDisplay(NestedClientBackendPtr backend, int scrnIndex,
+                         const char *displayName, const char *xauthority,
+                         const char *output, Bool enable,
+                         const char *parentOutput, char relation,
+                         unsigned int *width, unsigned int *height,
+                         int *x, int *y) {
+    return backend->CheckDisplay(scrnIndex, displayName, xauthority, output,
+                                 enable, parentOutput, relation, width, height,
+                                 x, y);
+}
+
+Bool
+NestedClientValidDepth(NestedClientBackendPtr backend, int depth) {
+    return backend->ValidDepth(depth);
+}
+
+NestedClientPrivatePtr
+NestedClientCreateScreen(NestedClientBackendPtr backend, int scrnIndex,
+                         const char *displayName, const char *xauthority,
+                         Bool wantFullscreenHint, Bool rootless,
+                         Bool withInput, unsigned int fbWidth,
+                         unsigned int fbHeight, unsigned int width,
+                         unsigned int height, int originX, int originY,
+                         double scale, unsigned int depth,
+                         unsigned int bitsPerPixel, Pixel *retRedMask,
+                         Pixel *retGreenMask, Pixel *retBlueMask) {
+    NestedClientPrivatePtr pPriv;
+
+    pPriv = calloc(1, sizeof(struct NestedClientPrivate));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->backend = backend;
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->bitsPerPixel = bitsPerPixel;
+    pPriv->priv = backend->CreateScreen(scrnIndex, displayName, xauthority,
+                                        wantFullscreenHint, rootless,
+                                        withInput, fbWidth, fbHeight, width, height,
+                                        originX, originY, scale, depth,
+                                        bitsPerPixel, retRedMask,
+                                        retGreenMask, retBlueMask);
+    if (!pPriv->priv) {
+        free(pPriv);
+        return NULL;
+    }
+
+    return pPriv;
+}
+
+void
+NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
+    NestedClientLogCounters(pPriv);
+    pPriv->backend->CloseScreen(pPriv->priv);
+    free(pPriv);
+}
+
+char *
+NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->GetFrameBuffer(pPriv->priv);
+}
+
+Bool
+NestedClientResizeFrameBuffer(NestedClientPrivatePtr pPriv, unsigned int width,
+                              unsigned int height) {
+    return pPriv->backend->ResizeFrameBuffer(pPriv->priv, width, height);
+}
+
+Bool
+NestedClientResizeWindow(NestedClientPrivatePtr pPriv, unsigned int width,
+                         unsigned int height) {
+    return pPriv->backend->ResizeWindow(pPriv->priv, width, height);
+}
+
+void
+NestedClientSetViewport(NestedClientPrivatePtr pPriv, int x, int y) {
+    pPriv->backend->SetViewport(pPriv->priv, x, y);
+}
+
+void
+NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1, int16_t y1,
+                         int16_t x2, int16_t y2) {
+    if (!pPriv->frameStartNs)
+        pPriv->frameStartNs = NestedClientNow();
+
+    pPriv->counters.updates++;
+    pPriv->counters.bytes += (uint64_t)(x2 - x1) * (y2 - y1) *
+                             pPriv->bitsPerPixel / 8;
+
+    pPriv->backend->UpdateScreen(pPriv->priv, x1, y1, x2, y2);
+}
+
+void
+NestedClientBeginSync(NestedClientPrivatePtr pPriv) {
+    pPriv->backend->BeginSync(pPriv->priv);
+}
+
+void
+NestedClientFinishSync(NestedClientPrivatePtr pPriv) {
+    pPriv->backend->FinishSync(pPriv->priv);
+
+    if (pPriv->frameStartNs) {
+        uint64_t us = (NestedClientNow() - pPriv->frameStartNs) / 1000;
+
+        pPriv->counters.frames++;
+        pPriv->counters.latency[NestedClientLatencyBucket(us)]++;
+        pPriv->frameStartNs = 0;
+    }
+}
+
+void
+NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+    pPriv->backend->HideCursor(pPriv->priv);
+}
+
+void
+NestedClientSetBlanked(NestedClientPrivatePtr pPriv, Bool blanked) {
+    pPriv->backend->SetBlanked(pPriv->priv, blanked);
+}
+
+void
+NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+    pPriv->backend->CheckEvents(pPriv->priv);
+}
+
+Bool
+NestedClientReattach(NestedClientPrivatePtr pPriv, const char *displayName,
+                     const char *xauthority) {
+    return pPriv->backend->Reattach(pPriv->priv, displayName, xauthority);
+}
+
+void
+NestedClientResetScreen(NestedClientPrivatePtr pPriv) {
+    NestedClientLogCounters(pPriv);
+    pPriv->backend->ResetScreen(pPriv->priv);
+}
+
+Bool
+NestedClientReuseScreen(NestedClientPrivatePtr pPriv, unsigned int fbWidth,
+                        unsigned int fbHeight, unsigned int width,
+                        unsigned int height, Pixel *retRedMask,
+                        Pixel *retGreenMask, Pixel *retBlueMask) {
+    return pPriv->backend->ReuseScreen(pPriv->priv, fbWidth, fbHeight, width,
+                                       height, retRedMask, retGreenMask,
+                                       retBlueMask);
+}
+
+void
+NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+    pPriv->backend->SetDevicePtr(pPriv->priv, dev);
+}
+
+int
+NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->GetFileDescriptor(pPriv->priv);
+}
+
+Bool
+NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
+                                KeySymsPtr keySyms, CARD8 *modmap,
+                                XkbControlsPtr ctrls) {
+    /* The Xlib backend only has one with NESTED_INPUT */
+    if (!pPriv->backend->GetKeyboardMappings)
+        return FALSE;
+
+    return pPriv->backend->GetKeyboardMappings(pPriv->priv, keySyms, modmap,
+                                               ctrls);
+}
+
+Bool
+NestedClientXvInit(NestedClientPrivatePtr pPriv, XF86ImagePtr *retImages,
+                   int *retNumImages, unsigned short *retMaxWidth,
+                   unsigned short *retMaxHeight) {
+    return pPriv->backend->XvInit(pPriv->priv, retImages, retNumImages,
+                                  retMaxWidth, retMaxHeight);
+}
+
+int
+NestedClientXvQueryImageAttributes(NestedClientPrivatePtr pPriv, int id,
+                                   unsigned short *width,
+                                   unsigned short *height, int *pitches,
+                                   int *offsets) {
+    return pPriv->backend->XvQueryImageAttributes(pPriv->priv, id, width,
+                                                  height, pitches, offsets);
+}
+
+Bool
+NestedClientXvSetColorKey(NestedClientPrivatePtr pPriv, CARD32 colorKey) {
+    return pPriv->backend->XvSetColorKey(pPriv->priv, colorKey);
+}
+
+void
+NestedClientXvPutImage(NestedClientPrivatePtr pPriv, int id,
+                       unsigned char *buf, short width, short height,
+                       short srcX, short srcY, short srcWidth, short srcHeight,
+                       short dstX, short dstY, short dstWidth, short dstHeight,
+                       BoxPtr clipBoxes, int numClipBoxes) {
+    pPriv->backend->XvPutImage(pPriv->priv, id, buf, width, height, srcX, srcY,
+                               srcWidth, srcHeight, dstX, dstY, dstWidth,
+                               dstHeight, clipBoxes, numClipBoxes);
+}
+
+void
+NestedClientXvStopVideo(NestedClientPrivatePtr pPriv) {
+    pPriv->backend->XvStopVideo(pPriv->priv);
+}
+
+Bool
+NestedClientRenderInit(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->RenderInit(pPriv->priv);
+}
+
+Bool
+NestedClientRenderReady(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->RenderReady(pPriv->priv);
+}
+
+CARD32
+NestedClientRenderCreateSolid(NestedClientPrivatePtr pPriv,
+                              xRenderColor *color) {
+    return pPriv->backend->RenderCreateSolid(pPriv->priv, color);
+}
+
+CARD32
+NestedClientRenderCreateLinearGradient(NestedClientPrivatePtr pPriv,
+                                       xPointFixed *p1, xPointFixed *p2,
+                                       int numStops, xFixed *stops,
+                                       xRenderColor *colors, int repeat) {
+    return pPriv->backend->RenderCreateLinearGradient(pPriv->priv, p1, p2,
+                                                      numStops, stops, colors,
+                                                      repeat);
+}
+
+CARD32
+NestedClientRenderCreateRadialGradient(NestedClientPrivatePtr pPriv,
+                                       xPointFixed *inner, xPointFixed *outer,
+                                       xFixed innerRadius, xFixed outerRadius,
+                                       int numStops, xFixed *stops,
+                                       xRenderColor *colors, int repeat) {
+    return pPriv->backend->RenderCreateRadialGradient(pPriv->priv, inner,
+                                                      outer, innerRadius,
+                                                      outerRadius, numStops,
+                                                      stops, colors, repeat);
+}
+
+void
+NestedClientRenderFreePicture(NestedClientPrivatePtr pPriv, CARD32 picture) {
+    pPriv->backend->RenderFreePicture(pPriv->priv, picture);
+}
+
+void
+NestedClientRenderSetClip(NestedClientPrivatePtr pPriv, BoxPtr boxes,
+                          int numBoxes) {
+    pPriv->backend->RenderSetClip(pPriv->priv, boxes, numBoxes);
+}
+
+void
+NestedClientRenderComposite(NestedClientPrivatePtr pPriv, CARD8 op, CARD32 src,
+                            CARD32 mask, INT16 xSrc, INT16 ySrc, INT16 xMask,
+                            INT16 yMask, INT16 xDst, INT16 yDst, CARD16 width,
+                            CARD16 height) {
+    pPriv->backend->RenderComposite(pPriv->priv, op, src, mask, xSrc, ySrc,
+                                    xMask, yMask, xDst, yDst, width, height);
+}
+
+Bool
+NestedClientRenderTrapezoids(NestedClientPrivatePtr pPriv, CARD8 op,
+                             CARD32 src, int maskFormat, INT16 xSrc,
+                             INT16 ySrc, int xOrigin, int yOrigin,
+                             int numTraps, xTrapezoid *traps) {
+    return pPriv->backend->RenderTrapezoids(pPriv->priv, op, src, maskFormat,
+                                            xSrc, ySrc, xOrigin, yOrigin,
+                                            numTraps, traps);
+}
+
+void
+NestedClientRenderResetGlyphs(NestedClientPrivatePtr pPriv, int format) {
+    pPriv->backend->RenderResetGlyphs(pPriv->priv, format);
+}
+
+void
+NestedClientRenderAddGlyph(NestedClientPrivatePtr pPriv, int format, CARD32 id,
+                           xGlyphInfo *info, const char *data, int size) {
+    pPriv->backend->RenderAddGlyph(pPriv->priv, format, id, info, data, size);
+}
+
+Bool
+NestedClientRenderCompositeGlyphs(NestedClientPrivatePtr pPriv, CARD8 op,
+                                  CARD32 src, int maskFormat, int format,
+                                  INT16 xSrc, INT16 ySrc, int xOrigin,
+                                  int yOrigin, int numLists,
+                                  NestedGlyphListPtr lists, CARD32 *glyphs) {
+    return pPriv->backend->RenderCompositeGlyphs(pPriv->priv, op, src,
+                                                 maskFormat, format, xSrc,
+                                                 ySrc, xOrigin, yOrigin,
+                                                 numLists, lists, glyphs);
+}
+
+Bool
+NestedClientCoreInit(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->CoreInit(pPriv->priv);
+}
+
+Bool
+NestedClientCoreReady(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->CoreReady(pPriv->priv);
+}
+
+void
+NestedClientCoreSetGC(NestedClientPrivatePtr pPriv, int alu, CARD32 planeMask,
+                      CARD32 foreground, int capStyle, BoxPtr clipBoxes,
+                      int numClipBoxes) {
+    pPriv->backend->CoreSetGC(pPriv->priv, alu, planeMask, foreground,
+                              capStyle, clipBoxes, numClipBoxes);
+}
+
+void
+NestedClientCorePolyFillRect(NestedClientPrivatePtr pPriv, int xOrigin,
+                             int yOrigin, int numRects, xRectangle *rects) {
+    pPriv->backend->CorePolyFillRect(pPriv->priv, xOrigin, yOrigin, numRects,
+                                     rects);
+}
+
+void
+NestedClientCorePolySegment(NestedClientPrivatePtr pPriv, int xOrigin,
+                            int yOrigin, int numSegments, xSegment *segments) {
+    pPriv->backend->CorePolySegment(pPriv->priv, xOrigin, yOrigin, numSegments,
+                                    segments);
+}
+
+Bool
+NestedClientCoreCopyArea(NestedClientPrivatePtr pPriv, int srcX, int srcY,
+                         int width, int height, int dstX, int dstY) {
+    return pPriv->backend->CoreCopyArea(pPriv->priv, srcX, srcY, width, height,
+                                        dstX, dstY);
+}
+
+Bool
+NestedClientCorePutImage(NestedClientPrivatePtr pPriv, int depth, int x, int y,
+                         int width, int height, int stride, char *data) {
+    return pPriv->backend->CorePutImage(pPriv->priv, depth, x, y, width,
+                                        height, stride, data);
+}
+
+Bool
+NestedClientRootlessReady(NestedClientPrivatePtr pPriv) {
+    return pPriv->backend->RootlessReady(pPriv->priv);
+}
+
+CARD32
+NestedClientRootlessCreateWindow(NestedClientPrivatePtr pPriv, int x, int y,
+                                 unsigned int width, unsigned int height,
+                                 Bool overrideRedirect, const char *name,
+                                 int nameLength) {
+    return pPriv->backend->RootlessCreateWindow(pPriv->priv, x, y, width,
+                                                height, overrideRedirect, name,
+                                                nameLength);
+}
+
+void
+NestedClientRootlessConfigureWindow(NestedClientPrivatePtr pPriv,
+                                    CARD32 window, int x, int y,
+                                    unsigned int width, unsigned int height) {
+    pPriv->backend->RootlessConfigureWindow(pPriv->priv, window, x, y, width,
+                                            height);
+}
+
+void
+NestedClientRootlessRaiseWindow(NestedClientPrivatePtr pPriv, CARD32 window) {
+    pPriv->backend->RootlessRaiseWindow(pPriv->priv, window);
+}
+
+void
+NestedClientRootlessDestroyWindow(NestedClientPrivatePtr pPriv,
+                                  CARD32 window) {
+    pPriv->backend->RootlessDestroyWindow(pPriv->priv, window);
+}
+
+void
+NestedClientRootlessUpdateWindow(NestedClientPrivatePtr pPriv, CARD32 window,
+                                 int x, int y, BoxPtr boxes, int numBoxes) {
+    pPriv->backend->RootlessUpdateWindow(pPriv->priv, window, x, y, boxes,
+                                         numBoxes);
+}
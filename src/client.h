@@ -33,52 +33,525 @@
 #include <colormap.h>
 #include <misc.h>
 #include "xf86Cursor.h"
+#include "xf86xv.h"
 
 #include <X11/extensions/XKBstr.h>
+#include <X11/extensions/renderproto.h>
 
 struct NestedClientPrivate;
 typedef struct NestedClientPrivate *NestedClientPrivatePtr;
 
-Bool NestedClientCheckDisplay(int           scrnIndex,
-                              const char   *output,
-                              Bool          enable,
-                              const char   *parentOutput,
-                              char          relation,
-                              unsigned int *width,
-                              unsigned int *height,
-                              int          *x,
-                              int          *y);
-
-Bool NestedClientValidDepth(int depth);
-
-NestedClientPrivatePtr NestedClientCreateScreen(int          scrnIndex,
-                                                Bool         wantFullscreenHint,
-                                                unsigned int width,
-                                                unsigned int height,
-                                                int          originX,
-                                                int          originY,
-                                                unsigned int depth,
-                                                unsigned int bitsPerPixel,
-                                                Pixel       *retRedMask,
-                                                Pixel       *retGreenMask,
-                                                Pixel       *retBlueMask);
+/* A backend connects nested screens to one kind of host. The driver only
+ * sees NestedClientPrivatePtr, each backend has screen privates of its own. */
+struct NestedBackendScreen;
+typedef struct NestedBackendScreen *NestedBackendScreenPtr;
+
+typedef struct NestedClientBackend NestedClientBackendRec;
+typedef const NestedClientBackendRec *NestedClientBackendPtr;
+
+/* How frames reach a host, from slowest to fastest */
+typedef enum {
+    NESTED_UPLOAD_NONE,      /* no host reachable */
+    NESTED_UPLOAD_PUT_IMAGE, /* copied through the connection */
+    NESTED_UPLOAD_SHM,       /* System V shared memory */
+    NESTED_UPLOAD_SHM_FD     /* shared memory passed as a file descriptor */
+} NestedUploadMethod;
+
+/* xf86DrvMsg() may only be called from the server thread. The backends log
+ * with NestedClientMsg() instead, which queues the messages of threads that
+ * called NestedClientDeferMessages(TRUE) until the server thread logs them
+ * with NestedClientFlushMessages(). */
+void NestedClientMsg(int scrnIndex, MessageType type, const char *format, ...)
+    _X_ATTRIBUTE_PRINTF(3, 4);
+
+void NestedClientDeferMessages(Bool defer);
+
+void NestedClientFlushMessages(void);
+
+/* Picks the backend called name, or the best one for the host at
+ * displayName if name is NULL or "auto"; backends without a host are never
+ * picked that way. Returns NULL, with an error logged, if no backend of that
+ * name is built in. */
+NestedClientBackendPtr NestedClientFindBackend(int         scrnIndex,
+                                               const char *name,
+                                               const char *displayName,
+                                               const char *xauthority);
+
+/* displayName is NULL for $DISPLAY, xauthority for $XAUTHORITY */
+Bool NestedClientCheckDisplay(NestedClientBackendPtr backend,
+                              int                    scrnIndex,
+                              const char            *displayName,
+                              const char            *xauthority,
+                              const char            *output,
+                              Bool                   enable,
+                              const char            *parentOutput,
+                              char                   relation,
+                              unsigned int          *width,
+                              unsigned int          *height,
+                              int                   *x,
+                              int                   *y);
+
+Bool NestedClientValidDepth(NestedClientBackendPtr backend, int depth);
+
+/* Does all of the host setup of a screen. Without withInput the host window
+ * asks for no input events, as for mirrors. The driver calls it from a
+ * thread of its own, concurrently for all screens: backends keep to the new
+ * private, log with NestedClientMsg() and leave the environment alone. */
+NestedClientPrivatePtr NestedClientCreateScreen(NestedClientBackendPtr backend,
+                                                int                    scrnIndex,
+                                                const char            *displayName,
+                                                const char            *xauthority,
+                                                Bool                   wantFullscreenHint,
+                                                Bool                   rootless,
+                                                Bool                   withInput,
+                                                unsigned int           fbWidth,
+                                                unsigned int           fbHeight,
+                                                unsigned int           width,
+                                                unsigned int           height,
+                                                int                    originX,
+                                                int                    originY,
+                                                double                 scale,
+                                                unsigned int           depth,
+                                                unsigned int           bitsPerPixel,
+                                                Pixel                 *retRedMask,
+                                                Pixel                 *retGreenMask,
+                                                Pixel                 *retBlueMask);
 
 char *NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv);
 
+Bool NestedClientResizeFrameBuffer(NestedClientPrivatePtr pPriv,
+                                   unsigned int           width,
+                                   unsigned int           height);
+
+Bool NestedClientResizeWindow(NestedClientPrivatePtr pPriv,
+                              unsigned int           width,
+                              unsigned int           height);
+
+void NestedClientSetViewport(NestedClientPrivatePtr pPriv, int x, int y);
+
+/* Uploads are only queued. The frame buffer must not change before the host
+ * is done with them: NestedClientBeginSync() sends a round trip request on
+ * every connection with pending uploads, NestedClientFinishSync() waits for
+ * its reply, so all screens wait for their hosts at the same time. */
 void NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
                               int16_t x1,
                               int16_t y1,
                               int16_t x2,
                               int16_t y2);
 
+void NestedClientBeginSync(NestedClientPrivatePtr pPriv);
+
+void NestedClientFinishSync(NestedClientPrivatePtr pPriv);
+
 void NestedClientHideCursor(NestedClientPrivatePtr pPriv);
 
+void NestedClientSetBlanked(NestedClientPrivatePtr pPriv, Bool blanked);
+
 void NestedClientCheckEvents(NestedClientPrivatePtr pPriv);
 
 void NestedClientCloseScreen(NestedClientPrivatePtr pPriv);
 
+/* Connects a detached screen to a host server again, see NestedHostDetached().
+ * The frame buffer may have moved. It must not block: a backend may connect
+ * on a thread and return FALSE until that is done, it is called again. */
+Bool NestedClientReattach(NestedClientPrivatePtr pPriv,
+                          const char            *displayName,
+                          const char            *xauthority);
+
+/* Called instead of NestedClientCloseScreen() when the server resets. The
+ * connection, the window and the frame buffer are kept for the next server
+ * generation, everything set up on top of them is released. */
+void NestedClientResetScreen(NestedClientPrivatePtr pPriv);
+
+/* Takes over a screen kept by NestedClientResetScreen(). Returns FALSE if it
+ * doesn't have the given sizes, it then has to be closed and created again */
+Bool NestedClientReuseScreen(NestedClientPrivatePtr pPriv,
+                             unsigned int           fbWidth,
+                             unsigned int           fbHeight,
+                             unsigned int           width,
+                             unsigned int           height,
+                             Pixel                 *retRedMask,
+                             Pixel                 *retGreenMask,
+                             Pixel                 *retBlueMask);
+
 void NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev);
 
 int NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv);
 
 Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls);
+
+/* XVideo forwarding: images are shown by a host Xv port in the window. The
+ * formats and their layout are the ones of the host port. */
+Bool NestedClientXvInit(NestedClientPrivatePtr pPriv,
+                        XF86ImagePtr          *retImages,
+                        int                   *retNumImages,
+                        unsigned short        *retMaxWidth,
+                        unsigned short        *retMaxHeight);
+
+int NestedClientXvQueryImageAttributes(NestedClientPrivatePtr pPriv,
+                                       int                    id,
+                                       unsigned short        *width,
+                                       unsigned short        *height,
+                                       int                   *pitches,
+                                       int                   *offsets);
+
+/* Returns FALSE if the host port doesn't use a color key: it then draws the
+ * video over whatever the window shows, and there is no key to paint */
+Bool NestedClientXvSetColorKey(NestedClientPrivatePtr pPriv, CARD32 colorKey);
+
+void NestedClientXvPutImage(NestedClientPrivatePtr pPriv,
+                            int            id,
+                            unsigned char *buf,
+                            short          width,
+                            short          height,
+                            short          srcX,
+                            short          srcY,
+                            short          srcWidth,
+                            short          srcHeight,
+                            short          dstX,
+                            short          dstY,
+                            short          dstWidth,
+                            short          dstHeight,
+                            BoxPtr         clipBoxes,
+                            int            numClipBoxes);
+
+void NestedClientXvStopVideo(NestedClientPrivatePtr pPriv);
+
+/* RENDER forwarding: operations are replayed on the host window. Coordinates
+ * are nested screen coordinates and pictures are host picture ids. */
+#define NESTED_FORMAT_NONE   0
+#define NESTED_FORMAT_A8     1
+#define NESTED_FORMAT_ARGB32 2
+#define NESTED_NUM_FORMATS   3
+
+typedef struct {
+    INT16 xOff; /* the first list is relative to the drawable origin */
+    INT16 yOff;
+    int   len;
+} NestedGlyphListRec, *NestedGlyphListPtr;
+
+Bool NestedClientRenderInit(NestedClientPrivatePtr pPriv);
+
+Bool NestedClientRenderReady(NestedClientPrivatePtr pPriv);
+
+CARD32 NestedClientRenderCreateSolid(NestedClientPrivatePtr pPriv,
+                                     xRenderColor          *color);
+
+CARD32 NestedClientRenderCreateLinearGradient(NestedClientPrivatePtr pPriv,
+                                              xPointFixed           *p1,
+                                              xPointFixed           *p2,
+                                              int                    numStops,
+                                              xFixed                *stops,
+                                              xRenderColor          *colors,
+                                              int                    repeat);
+
+CARD32 NestedClientRenderCreateRadialGradient(NestedClientPrivatePtr pPriv,
+                                              xPointFixed           *inner,
+                                              xPointFixed           *outer,
+                                              xFixed                 innerRadius,
+                                              xFixed                 outerRadius,
+                                              int                    numStops,
+                                              xFixed                *stops,
+                                              xRenderColor          *colors,
+                                              int                    repeat);
+
+void NestedClientRenderFreePicture(NestedClientPrivatePtr pPriv, CARD32 picture);
+
+void NestedClientRenderSetClip(NestedClientPrivatePtr pPriv,
+                               BoxPtr                 boxes,
+                               int                    numBoxes);
+
+void NestedClientRenderComposite(NestedClientPrivatePtr pPriv,
+                                 CARD8                  op,
+                                 CARD32                 src,
+                                 CARD32                 mask,
+                                 INT16                  xSrc,
+                                 INT16                  ySrc,
+                                 INT16                  xMask,
+                                 INT16                  yMask,
+                                 INT16                  xDst,
+                                 INT16                  yDst,
+                                 CARD16                 width,
+                                 CARD16                 height);
+
+Bool NestedClientRenderTrapezoids(NestedClientPrivatePtr pPriv,
+                                  CARD8                  op,
+                                  CARD32                 src,
+                                  int                    maskFormat,
+                                  INT16                  xSrc,
+                                  INT16                  ySrc,
+                                  int                    xOrigin,
+                                  int                    yOrigin,
+                                  int                    numTraps,
+                                  xTrapezoid            *traps);
+
+void NestedClientRenderResetGlyphs(NestedClientPrivatePtr pPriv, int format);
+
+void NestedClientRenderAddGlyph(NestedClientPrivatePtr pPriv,
+                                int                    format,
+                                CARD32                 id,
+                                xGlyphInfo            *info,
+                                const char            *data,
+                                int                    size);
+
+Bool NestedClientRenderCompositeGlyphs(NestedClientPrivatePtr pPriv,
+                                       CARD8                  op,
+                                       CARD32                 src,
+                                       int                    maskFormat,
+                                       int                    format,
+                                       INT16                  xSrc,
+                                       INT16                  ySrc,
+                                       int                    xOrigin,
+                                       int                    yOrigin,
+                                       int                    numLists,
+                                       NestedGlyphListPtr     lists,
+                                       CARD32                *glyphs);
+
+/* Core drawing forwarding: requests are replayed on the host window with a
+ * single host GC. Coordinates are relative to the given origin, in nested
+ * screen coordinates. */
+Bool NestedClientCoreInit(NestedClientPrivatePtr pPriv);
+
+Bool NestedClientCoreReady(NestedClientPrivatePtr pPriv);
+
+void NestedClientCoreSetGC(NestedClientPrivatePtr pPriv,
+                           int                    alu,
+                           CARD32                 planeMask,
+                           CARD32                 foreground,
+                           int                    capStyle,
+                           BoxPtr                 clipBoxes,
+                           int                    numClipBoxes);
+
+void NestedClientCorePolyFillRect(NestedClientPrivatePtr pPriv,
+                                  int                    xOrigin,
+                                  int                    yOrigin,
+                                  int                    numRects,
+                                  xRectangle            *rects);
+
+void NestedClientCorePolySegment(NestedClientPrivatePtr pPriv,
+                                 int                    xOrigin,
+                                 int                    yOrigin,
+                                 int                    numSegments,
+                                 xSegment              *segments);
+
+Bool NestedClientCoreCopyArea(NestedClientPrivatePtr pPriv,
+                              int                    srcX,
+                              int                    srcY,
+                              int                    width,
+                              int                    height,
+                              int                    dstX,
+                              int                    dstY);
+
+Bool NestedClientCorePutImage(NestedClientPrivatePtr pPriv,
+                              int                    depth,
+                              int                    x,
+                              int                    y,
+                              int                    width,
+                              int                    height,
+                              int                    stride,
+                              char                  *data);
+
+/* Rootless mode, asked for when creating the screen: the screen window is
+ * never shown, each top-level nested window gets a host window of its own
+ * instead. Coordinates are nested screen coordinates, which are also host
+ * root window coordinates. */
+Bool NestedClientRootlessReady(NestedClientPrivatePtr pPriv);
+
+CARD32 NestedClientRootlessCreateWindow(NestedClientPrivatePtr pPriv,
+                                        int                    x,
+                                        int                    y,
+                                        unsigned int           width,
+                                        unsigned int           height,
+                                        Bool                   overrideRedirect,
+                                        const char            *name,
+                                        int                    nameLength);
+
+void NestedClientRootlessConfigureWindow(NestedClientPrivatePtr pPriv,
+                                         CARD32                 window,
+                                         int                    x,
+                                         int                    y,
+                                         unsigned int           width,
+                                         unsigned int           height);
+
+void NestedClientRootlessRaiseWindow(NestedClientPrivatePtr pPriv,
+                                     CARD32                 window);
+
+void NestedClientRootlessDestroyWindow(NestedClientPrivatePtr pPriv,
+                                       CARD32                 window);
+
+/* Uploads frame buffer boxes to the window at x, y, without waiting */
+void NestedClientRootlessUpdateWindow(NestedClientPrivatePtr pPriv,
+                                      CARD32                 window,
+                                      int                    x,
+                                      int                    y,
+                                      BoxPtr                 boxes,
+                                      int                    numBoxes);
+
+struct NestedClientBackend {
+    const char *name;
+
+    /* Connects to the host at displayName and back, quietly. NULL for
+     * backends that don't connect to a host. The connection may be kept
+     * for the CheckDisplay() of the same screen, DropProbe() closes it if
+     * another backend is picked; NULL if nothing is kept. */
+    NestedUploadMethod (*Probe)(int scrnIndex, const char *displayName,
+                                const char *xauthority);
+    void (*DropProbe)(int scrnIndex);
+
+    /* The NestedClient functions above, on the backend screen privates */
+    Bool (*CheckDisplay)(int scrnIndex, const char *displayName,
+                         const char *xauthority, const char *output,
+                         Bool enable, const char *parentOutput, char relation,
+                         unsigned int *width, unsigned int *height, int *x,
+                         int *y);
+    Bool (*ValidDepth)(int depth);
+    NestedBackendScreenPtr (*CreateScreen)(int scrnIndex,
+                                           const char *displayName,
+                                           const char *xauthority,
+                                           Bool wantFullscreenHint,
+                                           Bool rootless, Bool withInput,
+                                           unsigned int fbWidth,
+                                           unsigned int fbHeight,
+                                           unsigned int width,
+                                           unsigned int height, int originX,
+                                           int originY, double scale,
+                                           unsigned int depth,
+                                           unsigned int bitsPerPixel,
+                                           Pixel *retRedMask,
+                                           Pixel *retGreenMask,
+                                           Pixel *retBlueMask);
+    char *(*GetFrameBuffer)(NestedBackendScreenPtr pPriv);
+    Bool (*ResizeFrameBuffer)(NestedBackendScreenPtr pPriv, unsigned int width,
+                              unsigned int height);
+    Bool (*ResizeWindow)(NestedBackendScreenPtr pPriv, unsigned int width,
+                         unsigned int height);
+    void (*SetViewport)(NestedBackendScreenPtr pPriv, int x, int y);
+    void (*UpdateScreen)(NestedBackendScreenPtr pPriv, int16_t x1, int16_t y1,
+                         int16_t x2, int16_t y2);
+    void (*BeginSync)(NestedBackendScreenPtr pPriv);
+    void (*FinishSync)(NestedBackendScreenPtr pPriv);
+    void (*HideCursor)(NestedBackendScreenPtr pPriv);
+    void (*SetBlanked)(NestedBackendScreenPtr pPriv, Bool blanked);
+    void (*CheckEvents)(NestedBackendScreenPtr pPriv);
+    void (*CloseScreen)(NestedBackendScreenPtr pPriv);
+    Bool (*Reattach)(NestedBackendScreenPtr pPriv, const char *displayName,
+                     const char *xauthority);
+    void (*ResetScreen)(NestedBackendScreenPtr pPriv);
+    Bool (*ReuseScreen)(NestedBackendScreenPtr pPriv, unsigned int fbWidth,
+                        unsigned int fbHeight, unsigned int width,
+                        unsigned int height, Pixel *retRedMask,
+                        Pixel *retGreenMask, Pixel *retBlueMask);
+    void (*SetDevicePtr)(NestedBackendScreenPtr pPriv, DeviceIntPtr dev);
+    int (*GetFileDescriptor)(NestedBackendScreenPtr pPriv);
+    Bool (*GetKeyboardMappings)(NestedBackendScreenPtr pPriv,
+                                KeySymsPtr keySyms, CARD8 *modmap,
+                                XkbControlsPtr ctrls);
+
+    Bool (*XvInit)(NestedBackendScreenPtr pPriv, XF86ImagePtr *retImages,
+                   int *retNumImages, unsigned short *retMaxWidth,
+                   unsigned short *retMaxHeight);
+    int (*XvQueryImageAttributes)(NestedBackendScreenPtr pPriv, int id,
+                                  unsigned short *width,
+                                  unsigned short *height, int *pitches,
+                                  int *offsets);
+    Bool (*XvSetColorKey)(NestedBackendScreenPtr pPriv, CARD32 colorKey);
+    void (*XvPutImage)(NestedBackendScreenPtr pPriv, int id,
+                       unsigned char *buf, short width, short height,
+                       short srcX, short srcY, short srcWidth, short srcHeight,
+                       short dstX, short dstY, short dstWidth, short dstHeight,
+                       BoxPtr clipBoxes, int numClipBoxes);
+    void (*XvStopVideo)(NestedBackendScreenPtr pPriv);
+
+    Bool (*RenderInit)(NestedBackendScreenPtr pPriv);
+    Bool (*RenderReady)(NestedBackendScreenPtr pPriv);
+    CARD32 (*RenderCreateSolid)(NestedBackendScreenPtr pPriv,
+                                xRenderColor *color);
+    CARD32 (*RenderCreateLinearGradient)(NestedBackendScreenPtr pPriv,
+                                         xPointFixed *p1, xPointFixed *p2,
+                                         int numStops, xFixed *stops,
+                                         xRenderColor *colors, int repeat);
+    CARD32 (*RenderCreateRadialGradient)(NestedBackendScreenPtr pPriv,
+                                         xPointFixed *inner,
+                                         xPointFixed *outer,
+                                         xFixed innerRadius,
+                                         xFixed outerRadius, int numStops,
+                                         xFixed *stops, xRenderColor *colors,
+                                         int repeat);
+    void (*RenderFreePicture)(NestedBackendScreenPtr pPriv, CARD32 picture);
+    void (*RenderSetClip)(NestedBackendScreenPtr pPriv, BoxPtr boxes,
+                          int numBoxes);
+    void (*RenderComposite)(NestedBackendScreenPtr pPriv, CARD8 op, CARD32 src,
+                            CARD32 mask, INT16 xSrc, INT16 ySrc, INT16 xMask,
+                            INT16 yMask, INT16 xDst, INT16 yDst, CARD16 width,
+                            CARD16 height);
+    Bool (*RenderTrapezoids)(NestedBackendScreenPtr pPriv, CARD8 op,
+                             CARD32 src, int maskFormat, INT16 xSrc,
+                             INT16 ySrc, int xOrigin, int yOrigin,
+                             int numTraps, xTrapezoid *traps);
+    void (*RenderResetGlyphs)(NestedBackendScreenPtr pPriv, int format);
+    void (*RenderAddGlyph)(NestedBackendScreenPtr pPriv, int format, CARD32 id,
+                           xGlyphInfo *info, const char *data, int size);
+    Bool (*RenderCompositeGlyphs)(NestedBackendScreenPtr pPriv, CARD8 op,
+                                  CARD32 src, int maskFormat, int format,
+                                  INT16 xSrc, INT16 ySrc, int xOrigin,
+                                  int yOrigin, int numLists,
+                                  NestedGlyphListPtr lists, CARD32 *glyphs);
+
+    Bool (*CoreInit)(NestedBackendScreenPtr pPriv);
+    Bool (*CoreReady)(NestedBackendScreenPtr pPriv);
+    void (*CoreSetGC)(NestedBackendScreenPtr pPriv, int alu, CARD32 planeMask,
+                      CARD32 foreground, int capStyle, BoxPtr clipBoxes,
+                      int numClipBoxes);
+    void (*CorePolyFillRect)(NestedBackendScreenPtr pPriv, int xOrigin,
+                             int yOrigin, int numRects, xRectangle *rects);
+    void (*CorePolySegment)(NestedBackendScreenPtr pPriv, int xOrigin,
+                            int yOrigin, int numSegments, xSegment *segments);
+    Bool (*CoreCopyArea)(NestedBackendScreenPtr pPriv, int srcX, int srcY,
+                         int width, int height, int dstX, int dstY);
+    Bool (*CorePutImage)(NestedBackendScreenPtr pPriv, int depth, int x, int y,
+                         int width, int height, int stride, char *data);
+
+    Bool (*RootlessReady)(NestedBackendScreenPtr pPriv);
+    CARD32 (*RootlessCreateWindow)(NestedBackendScreenPtr pPriv, int x, int y,
+                                   unsigned int width, unsigned int height,
+                                   Bool overrideRedirect, const char *name,
+                                   int nameLength);
+    void (*RootlessConfigureWindow)(NestedBackendScreenPtr pPriv,
+                                    CARD32 window, int x, int y,
+                                    unsigned int width, unsigned int height);
+    void (*RootlessRaiseWindow)(NestedBackendScreenPtr pPriv, CARD32 window);
+    void (*RootlessDestroyWindow)(NestedBackendScreenPtr pPriv, CARD32 window);
+    void (*RootlessUpdateWindow)(NestedBackendScreenPtr pPriv, CARD32 window,
+                                 int x, int y, BoxPtr boxes, int numBoxes);
+};
+
+extern const NestedClientBackendRec nestedXcbBackend;
+extern const NestedClientBackendRec nestedXlibBackend;
+extern const NestedClientBackendRec nestedNullBackend;
+extern const NestedClientBackendRec nestedRfbBackend;
+extern const NestedClientBackendRec nestedWaylandBackend;
+
+/* Implemented by the driver, called by the client when the host connection
+ * is lost or the window is closed. Returns FALSE if the server should exit,
+ * otherwise the screen goes on without a host until NestedClientReattach() */
+Bool NestedHostDetached(int scrnIndex);
+
+/* Implemented by the driver, called by the client when the host window is
+ * resized from the outside */
+void NestedHostResized(int scrnIndex, unsigned int width, unsigned int height);
+
+/* Implemented by the driver, maps a position in the host window to the
+ * nested screen, following the CRTC position and rotation */
+void NestedHostToScreen(int scrnIndex, int *x, int *y);
+
+/* Implemented by the driver, called by the client when a rootless window is
+ * exposed, or moved, raised or closed by the host window manager */
+void NestedRootlessHostExpose(int scrnIndex, CARD32 window, int x, int y,
+                              unsigned int width, unsigned int height);
+
+void NestedRootlessHostConfigure(int scrnIndex, CARD32 window, int x, int y,
+                                 unsigned int width, unsigned int height);
+
+void NestedRootlessHostRaise(int scrnIndex, CARD32 window);
+
+void NestedRootlessHostClose(int scrnIndex, CARD32 window);
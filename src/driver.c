@@ -30,8 +30,11 @@
  * Laércio de Sousa <laerciosousa@sme-mogidascruzes.sp.gov.br>
  */
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -40,17 +43,40 @@
 #include <xorg-server.h>
 #include <fb.h>
 #include <micmap.h>
+#include <dixstruct.h>
 #include <mipointer.h>
+#include <property.h>
+#include <propertyst.h>
 #include <shadow.h>
 #include <xf86.h>
 #include <xf86Module.h>
 #include <xf86str.h>
 #include "xf86Xinput.h"
+#include "xf86Crtc.h"
+#include "xf86RandR12.h"
+
+#include <X11/Xatom.h>
+
+#ifdef HAVE_XEXTPROTO_71
+#include <X11/extensions/dpmsconst.h>
+#else
+#define DPMS_SERVER
+#include <X11/extensions/dpms.h>
+#endif
 
 #include "compat-api.h"
 
 #include "client.h"
 #include "nested_input.h"
+#include "nested_rotate.h"
+#include "nested_xv.h"
+#include "nested_render.h"
+#include "nested_core.h"
+#include "nested_parallel.h"
+#include "nested_rootless.h"
+#include "nested_capture.h"
+#include "nested_mirror.h"
+#include "nested_trace.h"
 
 #define NESTED_VERSION 0
 #define NESTED_NAME "NESTED"
@@ -62,6 +88,16 @@
 
 #define TIMER_CALLBACK_INTERVAL 20
 
+#define NESTED_MAX_WIDTH  8192
+#define NESTED_MAX_HEIGHT 8192
+#define NESTED_REFRESH_RATE 60
+
+/* Root window property naming the display to reattach to */
+#define NESTED_DISPLAY_PROPERTY "_NESTED_DISPLAY"
+
+/* Damage with more rectangles is uploaded a band at a time */
+#define NESTED_MAX_UPDATE_RECTS 16
+
 static MODULESETUPPROTO(NestedSetup);
 static void NestedIdentify(int flags);
 static const OptionInfoRec *NestedAvailableOptions(int chipid, int busid);
@@ -81,6 +117,7 @@ static ModeStatus NestedValidMode(SCRN_ARG_TYPE arg, DisplayModePtr mode,
                                   Bool verbose, int flags);
 
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode);
+static void NestedUpdateBlanking(ScrnInfoPtr pScrn);
 static Bool NestedCreateScreenResources(ScreenPtr pScreen);
 
 static void NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf);
@@ -89,8 +126,14 @@ static Bool NestedCloseScreen(CLOSE_SCREEN_ARGS_DECL);
 static void NestedBlockHandler(pointer data, OSTimePtr wt, pointer LastSelectMask);
 static void NestedWakeupHandler(pointer data, int i, pointer LastSelectMask);
 
+static Bool NestedCrtcResize(ScrnInfoPtr pScrn, int width, int height);
+static void NestedCrtcGetFrameBufferSize(xf86CrtcPtr crtc, int *width, int *height);
+static void NestedUpdateRotated(ScrnInfoPtr pScrn, BoxPtr pBox, int nBox);
+static Bool NestedCrtcCreate(ScrnInfoPtr pScrn);
+
 int NestedValidateModes(ScrnInfoPtr pScrn);
-Bool NestedAddMode(ScrnInfoPtr pScrn, int width, int height);
+Bool NestedAddMode(DisplayModePtr *modeList, int width, int height);
+void NestedFreeModes(DisplayModePtr *modeList);
 void NestedPrintPscreen(ScrnInfoPtr p);
 void NestedPrintMode(ScrnInfoPtr p, DisplayModePtr m);
 
@@ -107,7 +150,21 @@ typedef enum {
     OPTION_LEFT_OF,
     OPTION_RIGHT_OF,
     OPTION_ABOVE,
-    OPTION_BELOW
+    OPTION_BELOW,
+    OPTION_SCALE,
+    OPTION_PROXY_RENDER,
+    OPTION_PROXY_CORE,
+    OPTION_THREADS,
+    OPTION_PARALLEL_THRESHOLD,
+    OPTION_ROOTLESS,
+    OPTION_DETACH,
+    OPTION_REATTACH_INTERVAL,
+    OPTION_CAPTURE_SOCKET,
+    OPTION_CAPTURE_FRAMES,
+    OPTION_BACKEND,
+    OPTION_MIRROR_DISPLAYS,
+    OPTION_DAMAGE_TRACE,
+    OPTION_DAMAGE_TRACE_PIXELS
 } NestedOpts;
 
 typedef enum {
@@ -123,17 +180,31 @@ static SymTabRec NestedChipsets[] = {
  * port NestedClient to something that's not Xlib/Xcb we might need to add some
  * custom options */
 static OptionInfoRec NestedOptions[] = {
-    { OPTION_DISPLAY,    "Display",    OPTV_STRING,  {0}, FALSE },
-    { OPTION_XAUTHORITY, "Xauthority", OPTV_STRING,  {0}, FALSE },
-    { OPTION_ORIGIN,     "Origin",     OPTV_STRING,  {0}, FALSE },
-    { OPTION_FULLSCREEN, "Fullscreen", OPTV_BOOLEAN, {0}, FALSE },
-    { OPTION_OUTPUT,     "Output",     OPTV_STRING,  {0}, FALSE },
-    { OPTION_ENABLE,     "Enable",     OPTV_BOOLEAN, {0}, FALSE },
-    { OPTION_LEFT_OF,    "LeftOf",     OPTV_STRING,  {0}, FALSE },
-    { OPTION_RIGHT_OF,   "RightOf",    OPTV_STRING,  {0}, FALSE },
-    { OPTION_ABOVE,      "Above",      OPTV_STRING,  {0}, FALSE },
-    { OPTION_BELOW,      "Below",      OPTV_STRING,  {0}, FALSE },
-    { -1,                NULL,         OPTV_NONE,    {0}, FALSE }
+    { OPTION_DISPLAY,             "Display",           OPTV_STRING,  {0}, FALSE },
+    { OPTION_XAUTHORITY,          "Xauthority",        OPTV_STRING,  {0}, FALSE },
+    { OPTION_ORIGIN,              "Origin",            OPTV_STRING,  {0}, FALSE },
+    { OPTION_FULLSCREEN,          "Fullscreen",        OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_OUTPUT,              "Output",            OPTV_STRING,  {0}, FALSE },
+    { OPTION_ENABLE,              "Enable",            OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_LEFT_OF,             "LeftOf",            OPTV_STRING,  {0}, FALSE },
+    { OPTION_RIGHT_OF,            "RightOf",           OPTV_STRING,  {0}, FALSE },
+    { OPTION_ABOVE,               "Above",             OPTV_STRING,  {0}, FALSE },
+    { OPTION_BELOW,               "Below",             OPTV_STRING,  {0}, FALSE },
+    { OPTION_SCALE,               "Scale",             OPTV_STRING,  {0}, FALSE },
+    { OPTION_PROXY_RENDER,        "ProxyRender",       OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_PROXY_CORE,          "ProxyCore",         OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_THREADS,             "Threads",           OPTV_INTEGER, {0}, FALSE },
+    { OPTION_PARALLEL_THRESHOLD,  "ParallelThreshold", OPTV_INTEGER, {0}, FALSE },
+    { OPTION_ROOTLESS,            "Rootless",          OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_DETACH,              "Detach",            OPTV_BOOLEAN, {0}, FALSE },
+    { OPTION_REATTACH_INTERVAL,   "ReattachInterval",  OPTV_INTEGER, {0}, FALSE },
+    { OPTION_CAPTURE_SOCKET,      "CaptureSocket",     OPTV_STRING,  {0}, FALSE },
+    { OPTION_CAPTURE_FRAMES,      "CaptureFrames",     OPTV_INTEGER, {0}, FALSE },
+    { OPTION_BACKEND,             "Backend",           OPTV_STRING,  {0}, FALSE },
+    { OPTION_MIRROR_DISPLAYS,     "MirrorDisplays",    OPTV_STRING,  {0}, FALSE },
+    { OPTION_DAMAGE_TRACE,        "DamageTrace",       OPTV_STRING,  {0}, FALSE },
+    { OPTION_DAMAGE_TRACE_PIXELS, "DamageTracePixels", OPTV_BOOLEAN, {0}, FALSE },
+    { -1,                         NULL,                OPTV_NONE,    {0}, FALSE }
 };
 
 _X_EXPORT DriverRec NESTED = {
@@ -180,6 +251,18 @@ _X_EXPORT XF86ModuleData nestedModuleData = {
     NULL, /* teardown */
 };
 
+/* The host setup of a screen. It is started at the end of NestedPreInit(),
+ * so the host round trips of all screens overlap, and joined by
+ * NestedScreenInit() */
+typedef struct {
+    pthread_t              thread;
+    ScrnInfoPtr            pScrn;
+    NestedClientPrivatePtr clientData;
+    Pixel                  redMask;
+    Pixel                  greenMask;
+    Pixel                  blueMask;
+} NestedSetupRec, *NestedSetupPtr;
+
 /* These stuff should be valid to all server generations */
 typedef struct NestedPrivate {
     int                          originX;
@@ -187,11 +270,41 @@ typedef struct NestedPrivate {
     unsigned int                 fullWidth;
     unsigned int                 fullHeight;
     Bool                         fullscreen;
+    double                       scale;
+    Bool                         proxyRender;
+    Bool                         proxyCore;
+    int                          threads;
+    int                          parallelThreshold;
+    Bool                         rootless;
+    char                        *displayName; /* NULL for $DISPLAY */
+    char                        *xauthority;
     const char                  *output;
     Bool                         enableOutput;
     const char                  *parentOutput;
     char                         relation;
+    NestedClientBackendPtr       backend;
     NestedClientPrivatePtr       clientData;
+    NestedSetupPtr               setup; /* running host setup, if any */
+    DisplayModePtr               modes;
+    DisplayModePtr               hostModes;
+    unsigned int                 hostWidth;
+    unsigned int                 hostHeight;
+    OsTimerPtr                   resizeTimer;
+    Bool                         detach; /* go on without the host */
+    int                          reattachInterval; /* ms */
+    OsTimerPtr                   reattachTimer;
+    const char                  *captureSocket; /* NULL for no capture */
+    int                          captureFrames;
+    const char                  *mirrorDisplays; /* NULL for no mirrors */
+    const char                  *damageTrace; /* NULL for no trace */
+    Bool                         damageTracePixels;
+    Bool                         screenSaverActive;
+    int                          dpmsMode;
+    Bool                         blanked;
+    char                        *shadowFb; /* what fb draws to while the CRTC
+                                              is rotated; the client image then
+                                              holds the rotated picture */
+    Bool                         screenPixmapReady;
     CreateScreenResourcesProcPtr CreateScreenResources;
     CloseScreenProcPtr           CloseScreen;
     ShadowUpdateProc             update;
@@ -200,6 +313,10 @@ typedef struct NestedPrivate {
 #define PNESTED(p)     ((NestedPrivatePtr)((p)->driverPrivate))
 #define PCLIENTDATA(p) (PNESTED(p)->clientData)
 
+static const xf86CrtcConfigFuncsRec NestedCrtcConfigFuncs = {
+    NestedCrtcResize
+};
+
 /*static ScrnInfoPtr NESTEDScrn;*/
 
 static pointer
@@ -292,13 +409,14 @@ NestedDriverFunc(ScrnInfoPtr pScrn, xorgDriverFuncOp op, pointer ptr) {
     CARD32 *flag;
     xf86Msg(X_INFO, "NestedDriverFunc\n");
 
-    /* XXX implement */
     switch(op) {
         case GET_REQUIRED_HW_INTERFACES:
             flag = (CARD32*)ptr;
             (*flag) = HW_SKIP_CONSOLE;
             return TRUE;
 
+        /* RandR is handled by xf86Crtc, these are only used by RandR 1.1
+         * drivers */
         case RR_GET_INFO:
         case RR_SET_CONFIG:
         case RR_GET_MODE_MM:
@@ -327,15 +445,106 @@ static void NestedFreePrivate(ScrnInfoPtr pScrn) {
         return;
     }
 
+    free(PNESTED(pScrn)->displayName);
+    free(PNESTED(pScrn)->xauthority);
     free(pScrn->driverPrivate);
     pScrn->driverPrivate = NULL;
 }
 
 /* Data from here is valid to all server generations */
+static NestedClientPrivatePtr
+NestedCreateClientScreen(ScrnInfoPtr pScrn, Pixel *redMask, Pixel *greenMask,
+                         Pixel *blueMask) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    return NestedClientCreateScreen(pNested->backend,
+                                    pScrn->scrnIndex,
+                                    pNested->displayName,
+                                    pNested->xauthority,
+                                    pNested->output != NULL || pNested->fullscreen,
+                                    pNested->rootless,
+                                    TRUE,
+                                    pScrn->virtualX,
+                                    pScrn->virtualY,
+                                    pScrn->currentMode->HDisplay,
+                                    pScrn->currentMode->VDisplay,
+                                    pNested->originX,
+                                    pNested->originY,
+                                    pNested->scale,
+                                    pScrn->depth,
+                                    pScrn->bitsPerPixel,
+                                    redMask, greenMask, blueMask);
+}
+
+static void *
+NestedSetupThread(void *arg) {
+    NestedSetupPtr setup = arg;
+
+    /* Only the server thread may log, NestedJoinSetup() does it for us */
+    NestedClientDeferMessages(TRUE);
+
+    setup->clientData = NestedCreateClientScreen(setup->pScrn,
+                                                 &setup->redMask,
+                                                 &setup->greenMask,
+                                                 &setup->blueMask);
+    return NULL;
+}
+
+/* Nothing else in the screen private changes until the setup is joined. If
+ * no thread can be started, the screen is set up by NestedScreenInit(). */
+static void
+NestedStartSetup(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedSetupPtr setup = calloc(1, sizeof(NestedSetupRec));
+    sigset_t allSignals, oldSignals;
+    int err;
+
+    if (!setup)
+        return;
+
+    setup->pScrn = pScrn;
+
+    /* Signals (input, timers, ...) must keep going to the server thread */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+    err = pthread_create(&setup->thread, NULL, NestedSetupThread, setup);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    if (err != 0) {
+        free(setup);
+        return;
+    }
+
+    pNested->setup = setup;
+}
+
+static NestedClientPrivatePtr
+NestedJoinSetup(ScrnInfoPtr pScrn, Pixel *redMask, Pixel *greenMask,
+                Pixel *blueMask) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    NestedSetupPtr setup = pNested->setup;
+    NestedClientPrivatePtr clientData;
+
+    if (!setup)
+        return NULL;
+
+    pthread_join(setup->thread, NULL);
+    NestedClientFlushMessages();
+
+    clientData = setup->clientData;
+    *redMask = setup->redMask;
+    *greenMask = setup->greenMask;
+    *blueMask = setup->blueMask;
+
+    free(setup);
+    pNested->setup = NULL;
+    return clientData;
+}
+
 static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     NestedPrivatePtr pNested;
-    const char *displayName = getenv("DISPLAY");
     const char *originString = NULL;
+    const char *backendName;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedPreInit\n");
 
@@ -356,6 +565,11 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     pNested->output = NULL;
     pNested->parentOutput = NULL;
     pNested->relation = '\0';
+    pNested->modes = NULL;
+    pNested->hostModes = NULL;
+    pNested->resizeTimer = NULL;
+    pNested->reattachTimer = NULL;
+    pNested->setup = NULL;
 
     if (!xf86SetDepthBpp(pScrn, 0, 0, 0, Support24bppFb | Support32bppFb))
         return FALSE;
@@ -377,18 +591,20 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
     xf86CollectOptions(pScrn, NULL);
     xf86ProcessOptions(pScrn->scrnIndex, pScrn->options, NestedOptions);
 
+    /* Kept per screen rather than in the environment, so that each screen
+     * can be shown by a different host server */
     if (xf86IsOptionSet(NestedOptions, OPTION_DISPLAY)) {
-        displayName = xf86GetOptValString(NestedOptions,
-                                          OPTION_DISPLAY);
+        pNested->displayName = xnfstrdup(xf86GetOptValString(NestedOptions,
+                                                             OPTION_DISPLAY));
         xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using display \"%s\"\n",
-                   displayName);
-        setenv("DISPLAY", displayName, 1);
+                   pNested->displayName);
     }
 
     if (xf86IsOptionSet(NestedOptions, OPTION_XAUTHORITY)) {
-        setenv("XAUTHORITY",
-               xf86GetOptValString(NestedOptions,
-                                   OPTION_XAUTHORITY), 1);
+        pNested->xauthority = xnfstrdup(xf86GetOptValString(NestedOptions,
+                                                            OPTION_XAUTHORITY));
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using authority file \"%s\"\n",
+                   pNested->xauthority);
     }
 
     if (xf86IsOptionSet(NestedOptions, OPTION_ORIGIN)) {
@@ -403,6 +619,97 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
                    pNested->originX, pNested->originY);
     }
 
+    /* "Scale" is either a factor or "fit", to scale the output to whatever
+     * size the host window has */
+    pNested->scale = 1.0;
+    if (xf86IsOptionSet(NestedOptions, OPTION_SCALE)) {
+        const char *scaleString = xf86GetOptValString(NestedOptions,
+                                                      OPTION_SCALE);
+        char *end;
+
+        if (!xf86NameCmp(scaleString, "fit")) {
+            pNested->scale = 0;
+            xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                       "Scaling output to the host window\n");
+        } else {
+            pNested->scale = strtod(scaleString, &end);
+            if (end == scaleString || *end != '\0' || pNested->scale <= 0) {
+                xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                           "Invalid value for option \"Scale\"\n");
+                return FALSE;
+            }
+            xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using scale %g\n",
+                       pNested->scale);
+        }
+    }
+
+    pNested->proxyRender = FALSE;
+    if (xf86GetOptValBool(NestedOptions, OPTION_PROXY_RENDER,
+                          &pNested->proxyRender))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "RENDER forwarding %s\n",
+                   pNested->proxyRender ? "enabled" : "disabled");
+
+    pNested->proxyCore = FALSE;
+    if (xf86GetOptValBool(NestedOptions, OPTION_PROXY_CORE,
+                          &pNested->proxyCore))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Core drawing forwarding %s\n",
+                   pNested->proxyCore ? "enabled" : "disabled");
+
+    /* A few threads are enough to keep up with the host; beyond that the
+     * bands get too thin to pay off */
+    pNested->threads = min(max(sysconf(_SC_NPROCESSORS_ONLN), 1), 4);
+    if (xf86GetOptValInteger(NestedOptions, OPTION_THREADS,
+                             &pNested->threads))
+        xf86DrvMsg(pScrn->scrnIndex, X_CONFIG, "Using %d drawing threads\n",
+                   pNested->threads);
+
+    pNested->parallelThreshold = 256 * 256;
+    xf86GetOptValInteger(NestedOptions, OPTION_PARALLEL_THRESHOLD,
+                         &pNested->parallelThreshold);
+
+    pNested->rootless = FALSE;
+    if (xf86GetOptValBool(NestedOptions, OPTION_ROOTLESS, &pNested->rootless))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Rootless mode %s\n",
+                   pNested->rootless ? "enabled" : "disabled");
+
+    pNested->captureSocket = xf86GetOptValString(NestedOptions,
+                                                 OPTION_CAPTURE_SOCKET);
+    pNested->captureFrames = 3;
+    xf86GetOptValInteger(NestedOptions, OPTION_CAPTURE_FRAMES,
+                         &pNested->captureFrames);
+    pNested->captureFrames = max(pNested->captureFrames, 2);
+
+    pNested->mirrorDisplays = xf86GetOptValString(NestedOptions,
+                                                  OPTION_MIRROR_DISPLAYS);
+
+    pNested->damageTrace = xf86GetOptValString(NestedOptions,
+                                               OPTION_DAMAGE_TRACE);
+    pNested->damageTracePixels = FALSE;
+    xf86GetOptValBool(NestedOptions, OPTION_DAMAGE_TRACE_PIXELS,
+                      &pNested->damageTracePixels);
+
+    /* Forwarded drawing is taken out of the damage, which is all the copies
+     * of the screen get to see */
+    if ((pNested->proxyRender || pNested->proxyCore) &&
+        (pNested->captureSocket || pNested->mirrorDisplays ||
+         pNested->damageTrace)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Forwarding disabled, the screen is captured, mirrored "
+                   "or traced\n");
+        pNested->proxyRender = FALSE;
+        pNested->proxyCore = FALSE;
+    }
+
+    pNested->detach = FALSE;
+    if (xf86GetOptValBool(NestedOptions, OPTION_DETACH, &pNested->detach))
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Detaching from the host %s\n",
+                   pNested->detach ? "enabled" : "disabled");
+
+    pNested->reattachInterval = 2000;
+    xf86GetOptValInteger(NestedOptions, OPTION_REATTACH_INTERVAL,
+                         &pNested->reattachInterval);
+    pNested->reattachInterval = max(pNested->reattachInterval, 1);
+
     if (xf86GetOptValBool(NestedOptions, OPTION_FULLSCREEN, &pNested->fullscreen))
         xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Fullscreen mode %s\n",
                    pNested->fullscreen ? "enabled" : "disabled");
@@ -444,7 +751,22 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
 
     xf86ShowUnusedOptions(pScrn->scrnIndex, pScrn->options);
 
-    if (!NestedClientCheckDisplay(pScrn->scrnIndex,
+    /* Picked before anything talks to the host, unset or "auto" probes it */
+    backendName = xf86GetOptValString(NestedOptions, OPTION_BACKEND);
+    pNested->backend = NestedClientFindBackend(pScrn->scrnIndex,
+                                               backendName,
+                                               pNested->displayName,
+                                               pNested->xauthority);
+    if (!pNested->backend)
+        return FALSE;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Using the %s backend\n",
+               pNested->backend->name);
+
+    if (!NestedClientCheckDisplay(pNested->backend,
+                                  pScrn->scrnIndex,
+                                  pNested->displayName,
+                                  pNested->xauthority,
                                   pNested->output,
                                   pNested->enableOutput,
                                   pNested->parentOutput,
@@ -453,11 +775,13 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
                                   &pNested->fullHeight,
                                   &pNested->originX,
                                   &pNested->originY)) {
-        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Can't open display: %s\n", displayName);
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Can't open display: %s\n",
+                   pNested->displayName ? pNested->displayName :
+                                          getenv("DISPLAY"));
         return FALSE;
     }
 
-    if (!NestedClientValidDepth(pScrn->depth)) {
+    if (!NestedClientValidDepth(pNested->backend, pScrn->depth)) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Invalid depth: %d\n",
                    pScrn->depth);
         return FALSE;
@@ -469,19 +793,28 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
             return FALSE;
     }*/
 
+    xf86CrtcConfigInit(pScrn, &NestedCrtcConfigFuncs);
+    xf86CrtcSetSizeRange(pScrn, 1, 1, NESTED_MAX_WIDTH, NESTED_MAX_HEIGHT);
+
+    if (!NestedCrtcCreate(pScrn)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to create CRTC\n");
+        return FALSE;
+    }
+
     if (NestedValidateModes(pScrn) < 1) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "No valid modes\n");
         return FALSE;
     }
 
-
-    if (!pScrn->modes) {
+    if (!xf86InitialConfiguration(pScrn, TRUE)) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "No valid modes found\n");
         return FALSE;
     }
-    xf86SetCrtcForModes(pScrn, 0);
 
-    pScrn->currentMode = pScrn->modes;
+    pScrn->displayWidth = pScrn->virtualX;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Virtual size: %dx%d\n",
+               pScrn->virtualX, pScrn->virtualY);
 
     xf86SetDpi(pScrn, 0, 0);
 
@@ -492,19 +825,22 @@ static Bool NestedPreInit(ScrnInfoPtr pScrn, int flags) {
 
     pScrn->memPhysBase = 0;
     pScrn->fbOffset = 0;
+
+    NestedStartSetup(pScrn);
     
     return TRUE;
 }
 
+/* Builds the list of modes offered by our output. The screen size and the
+ * initial mode are then chosen by xf86InitialConfiguration() */
 int
 NestedValidateModes(ScrnInfoPtr pScrn) {
     DisplayModePtr mode;
     int i, width, height, ret = 0;
-    int maxX = 0, maxY = 0;
     NestedPrivatePtr pNested = PNESTED(pScrn);
 
     if (pNested->output != NULL || pNested->fullscreen) {
-        if (!NestedAddMode(pScrn, pNested->fullWidth, pNested->fullHeight)) {
+        if (!NestedAddMode(&pNested->modes, pNested->fullWidth, pNested->fullHeight)) {
             return 0;
         }
     } else {
@@ -528,61 +864,29 @@ NestedValidateModes(ScrnInfoPtr pScrn) {
                                "This is not the mode name I was expecting...\n");
                     return 0;
                 }
-                if (!NestedAddMode(pScrn, width, height)) {
+                if (!NestedAddMode(&pNested->modes, width, height)) {
                     return 0;
                 }
             }
         } else {
-            if (!NestedAddMode(pScrn, 640, 480)) {
+            if (!NestedAddMode(&pNested->modes, 640, 480)) {
                 return 0;
             }
         }
     }
 
-    pScrn->modePool = NULL;
-
-    /* Now set virtualX, virtualY, displayWidth and virtualFrom */
-    if (pScrn->display->virtualX >= pScrn->modes->HDisplay &&
-        pScrn->display->virtualY >= pScrn->modes->VDisplay) {
-        pScrn->virtualX = pScrn->display->virtualX;
-        pScrn->virtualY = pScrn->display->virtualY;
-    } else {
-        /* XXX: if not specified, make virtualX and virtualY as big as the max X
-         * and Y. I'm not sure this is correct */
-        mode = pScrn->modes;
-        while (mode != NULL) {
-            if (mode->HDisplay > maxX)
-                maxX = mode->HDisplay;
-       
-            if (mode->VDisplay > maxY)
-                maxY = mode->VDisplay;
-          
-            mode = mode->next;
-        }
-        pScrn->virtualX = maxX;
-        pScrn->virtualY = maxY;
-    }
-    pScrn->virtualFrom = X_DEFAULT;
-    pScrn->displayWidth = pScrn->virtualX;
-
-    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Virtual size: %dx%d\n",
-               pScrn->virtualX, pScrn->virtualY);
+    /* The first mode is the one we start with */
+    pNested->modes->type |= M_T_PREFERRED;
 
     /* Calculate the return value */
-    mode = pScrn->modes;
-    while (mode != NULL) {
-        mode = mode->next;
+    for (mode = pNested->modes; mode != NULL; mode = mode->next)
         ret++;
-    }
-
-    /* Finally, make the mode list circular */
-    pScrn->modes->prev->next = pScrn->modes;
 
     return ret;
 }
 
 Bool
-NestedAddMode(ScrnInfoPtr pScrn, int width, int height) {
+NestedAddMode(DisplayModePtr *modeList, int width, int height) {
     DisplayModePtr mode;
     char nameBuf[64];
     size_t len;
@@ -596,27 +900,543 @@ NestedAddMode(ScrnInfoPtr pScrn, int width, int height) {
     mode->HDisplay = width;
     mode->VDisplay = height;
 
+    /* There is no real hardware behind this mode, but RandR clients still
+     * expect sane timings to compute the refresh rate from */
+    mode->HSyncStart = mode->HSyncEnd = mode->HTotal = width;
+    mode->VSyncStart = mode->VSyncEnd = mode->VTotal = height;
+    mode->Clock = (int)(((long)width * height * NESTED_REFRESH_RATE) / 1000);
+    mode->VRefresh = NESTED_REFRESH_RATE;
+
     len = strlen(nameBuf);
     mode->name = XNFalloc(len+1);
     strcpy((char *)mode->name, nameBuf);
 
-    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Adding mode %s\n", mode->name);
-
-    /* Now add mode to pScrn->modes. We'll keep the list non-circular for now,
-     * but we'll maintain pScrn->modes->prev to know the last element */
+    /* Now add mode to the list. We'll keep the list non-circular, but we'll
+     * maintain (*modeList)->prev to know the last element */
     mode->next = NULL;
-    if (!pScrn->modes) {
-        pScrn->modes = mode;
+    if (!*modeList) {
+        *modeList = mode;
         mode->prev = mode;
     } else {
-        mode->prev = pScrn->modes->prev;
-        pScrn->modes->prev->next = mode;
-        pScrn->modes->prev = mode;
+        mode->prev = (*modeList)->prev;
+        (*modeList)->prev->next = mode;
+        (*modeList)->prev = mode;
+    }
+
+    return TRUE;
+}
+
+void
+NestedFreeModes(DisplayModePtr *modeList) {
+    DisplayModePtr mode, next;
+
+    for (mode = *modeList; mode != NULL; mode = next) {
+        next = mode->next;
+        free((char *)mode->name);
+        free(mode);
+    }
+
+    *modeList = NULL;
+}
+
+/* CRTC/output model: every nested screen has a single CRTC driving a single
+ * output, which is shown in the host window. The CRTC mode is the size of the
+ * host window and the screen size is the size of the frame buffer; the CRTC
+ * position is the viewport into the frame buffer, so a frame buffer bigger
+ * than the mode can be panned around. */
+static void
+NestedCrtcGetFrameBufferSize(xf86CrtcPtr crtc, int *width, int *height) {
+    if (crtc->rotation & (RR_Rotate_90 | RR_Rotate_270)) {
+        *width = crtc->mode.VDisplay;
+        *height = crtc->mode.HDisplay;
+    } else {
+        *width = crtc->mode.HDisplay;
+        *height = crtc->mode.VDisplay;
+    }
+}
+
+/* Returns the buffer fb draws to */
+static char *
+NestedGetFrameBuffer(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    if (pNested->shadowFb)
+        return pNested->shadowFb;
+
+    return NestedClientGetFrameBuffer(pNested->clientData);
+}
+
+static void
+NestedUpdateScreenPixmap(ScrnInfoPtr pScrn) {
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+
+    /* Until NestedCreateScreenResources() runs, fb still holds the pointer
+     * given to fbScreenInit() instead of the screen pixmap */
+    if (!PNESTED(pScrn)->screenPixmapReady)
+        return;
+
+    pScreen->ModifyPixmapHeader(pScreen->GetScreenPixmap(pScreen),
+                                pScrn->virtualX, pScrn->virtualY, -1, -1,
+                                PixmapBytePad(pScrn->virtualX, pScrn->depth),
+                                NestedGetFrameBuffer(pScrn));
+}
+
+/* Unrotated, fb draws straight into the client image and the host window
+ * shows a viewport of it. Rotated, fb draws into a shadow frame buffer and
+ * damage is rotated into a client image the size of the mode, which needs
+ * one copy instead of going through the generic shadow rotation and then
+ * uploading. */
+static Bool
+NestedCrtcSetRotation(xf86CrtcPtr crtc) {
+    ScrnInfoPtr pScrn = crtc->scrn;
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    size_t size = (size_t)PixmapBytePad(pScrn->virtualX, pScrn->depth) *
+                  pScrn->virtualY;
+    BoxRec box;
+
+    if (crtc->rotation != RR_Rotate_0) {
+        if (!pNested->shadowFb) {
+            pNested->shadowFb = malloc(size);
+            if (!pNested->shadowFb)
+                return FALSE;
+
+            memcpy(pNested->shadowFb,
+                   NestedClientGetFrameBuffer(pNested->clientData), size);
+        }
+
+        if (!NestedClientResizeFrameBuffer(pNested->clientData,
+                                           crtc->mode.HDisplay,
+                                           crtc->mode.VDisplay))
+            return FALSE;
+
+        NestedClientSetViewport(pNested->clientData, 0, 0);
+        NestedUpdateScreenPixmap(pScrn);
+
+        box.x1 = 0;
+        box.y1 = 0;
+        box.x2 = pScrn->virtualX;
+        box.y2 = pScrn->virtualY;
+        NestedUpdateRotated(pScrn, &box, 1);
+        return TRUE;
+    }
+
+    if (!pNested->shadowFb) {
+        NestedClientSetViewport(pNested->clientData, crtc->x, crtc->y);
+        return TRUE;
+    }
+
+    if (!NestedClientResizeFrameBuffer(pNested->clientData,
+                                       pScrn->virtualX, pScrn->virtualY))
+        return FALSE;
+
+    memcpy(NestedClientGetFrameBuffer(pNested->clientData),
+           pNested->shadowFb, size);
+    free(pNested->shadowFb);
+    pNested->shadowFb = NULL;
+    NestedUpdateScreenPixmap(pScrn);
+    NestedClientSetViewport(pNested->clientData, crtc->x, crtc->y);
+
+    /* The window still shows the rotated picture */
+    if (!pNested->blanked)
+        NestedClientUpdateScreen(pNested->clientData, crtc->x, crtc->y,
+                                 crtc->x + crtc->mode.HDisplay,
+                                 crtc->y + crtc->mode.VDisplay);
+
+    return TRUE;
+}
+
+/* Rotates the parts of the given frame buffer boxes shown by the CRTC into
+ * the client image, and uploads them unless the screen is blanked */
+static void
+NestedUpdateRotated(ScrnInfoPtr pScrn, BoxPtr pBox, int nBox) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    xf86CrtcPtr crtc = XF86_CRTC_CONFIG_PTR(pScrn)->crtc[0];
+    int srcStride = PixmapBytePad(pScrn->virtualX, pScrn->depth);
+    int dstStride = PixmapBytePad(crtc->mode.HDisplay, pScrn->depth);
+    int cpp = pScrn->bitsPerPixel / 8;
+    int fbWidth, fbHeight;
+    BoxRec box, extents;
+    Bool damaged = FALSE;
+    const char *src;
+
+    NestedCrtcGetFrameBufferSize(crtc, &fbWidth, &fbHeight);
+    src = pNested->shadowFb + (long)crtc->y * srcStride + crtc->x * cpp;
+
+    for (; nBox > 0; nBox--, pBox++) {
+        box.x1 = max(pBox->x1, crtc->x) - crtc->x;
+        box.y1 = max(pBox->y1, crtc->y) - crtc->y;
+        box.x2 = min(pBox->x2, crtc->x + fbWidth) - crtc->x;
+        box.y2 = min(pBox->y2, crtc->y + fbHeight) - crtc->y;
+
+        if (box.x1 >= box.x2 || box.y1 >= box.y2)
+            continue;
+
+        NestedRotateBox(crtc->rotation, crtc->mode.HDisplay,
+                        crtc->mode.VDisplay, &box);
+        NestedRotateCopy(crtc->rotation, crtc->mode.HDisplay,
+                         crtc->mode.VDisplay, src, srcStride,
+                         NestedClientGetFrameBuffer(pNested->clientData),
+                         dstStride, cpp, &box);
+
+        if (!damaged) {
+            extents = box;
+            damaged = TRUE;
+        } else {
+            extents.x1 = min(extents.x1, box.x1);
+            extents.y1 = min(extents.y1, box.y1);
+            extents.x2 = max(extents.x2, box.x2);
+            extents.y2 = max(extents.y2, box.y2);
+        }
+    }
+
+    if (damaged && !pNested->blanked)
+        NestedClientUpdateScreen(pNested->clientData,
+                                 extents.x1, extents.y1,
+                                 extents.x2, extents.y2);
+}
+
+static void
+NestedCrtcDPMS(xf86CrtcPtr crtc, int mode) {
+    ScrnInfoPtr pScrn = crtc->scrn;
+
+    PNESTED(pScrn)->dpmsMode = mode;
+    NestedUpdateBlanking(pScrn);
+}
+
+static Bool
+NestedCrtcSetModeMajor(xf86CrtcPtr crtc, DisplayModePtr mode,
+                       Rotation rotation, int x, int y) {
+    ScrnInfoPtr pScrn = crtc->scrn;
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedCrtcSetModeMajor: %s+%d+%d\n",
+               mode->name, x, y);
+
+    if (pNested->clientData &&
+        !NestedClientResizeWindow(pNested->clientData,
+                                  mode->HDisplay, mode->VDisplay)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to resize host window\n");
+        return FALSE;
     }
 
+    crtc->mode = *mode;
+    crtc->x = x;
+    crtc->y = y;
+    crtc->rotation = rotation;
+
+    if (pNested->clientData && !NestedCrtcSetRotation(crtc)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to set rotation\n");
+        return FALSE;
+    }
+
+    NestedCrtcDPMS(crtc, DPMSModeOn);
     return TRUE;
 }
 
+/* Called by RandR panning and by NestedAdjustFrame() */
+static void
+NestedCrtcSetOrigin(xf86CrtcPtr crtc, int x, int y) {
+    NestedPrivatePtr pNested = PNESTED(crtc->scrn);
+
+    BoxRec box;
+
+    crtc->x = x;
+    crtc->y = y;
+
+    if (!pNested->clientData)
+        return;
+
+    if (!pNested->shadowFb) {
+        NestedClientSetViewport(pNested->clientData, x, y);
+        return;
+    }
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = crtc->scrn->virtualX;
+    box.y2 = crtc->scrn->virtualY;
+    NestedUpdateRotated(crtc->scrn, &box, 1);
+}
+
+static void
+NestedCrtcDestroy(xf86CrtcPtr crtc) {
+}
+
+static const xf86CrtcFuncsRec NestedCrtcFuncs = {
+    .dpms           = NestedCrtcDPMS,
+    .set_mode_major = NestedCrtcSetModeMajor,
+    .set_origin     = NestedCrtcSetOrigin,
+    .destroy        = NestedCrtcDestroy,
+};
+
+static void
+NestedOutputDPMS(xf86OutputPtr output, int mode) {
+}
+
+static xf86OutputStatus
+NestedOutputDetect(xf86OutputPtr output) {
+    return XF86OutputStatusConnected;
+}
+
+static int
+NestedOutputModeValid(xf86OutputPtr output, DisplayModePtr mode) {
+    if (mode->HDisplay > NESTED_MAX_WIDTH || mode->VDisplay > NESTED_MAX_HEIGHT)
+        return MODE_BAD;
+
+    return MODE_OK;
+}
+
+static DisplayModePtr
+NestedOutputGetModes(xf86OutputPtr output) {
+    NestedPrivatePtr pNested = PNESTED(output->scrn);
+    DisplayModePtr modes, hostModes;
+
+    modes = xf86DuplicateModes(output->scrn, pNested->modes);
+    hostModes = xf86DuplicateModes(output->scrn, pNested->hostModes);
+
+    return xf86ModesAdd(modes, hostModes);
+}
+
+static void
+NestedOutputDestroy(xf86OutputPtr output) {
+}
+
+static const xf86OutputFuncsRec NestedOutputFuncs = {
+    .dpms       = NestedOutputDPMS,
+    .detect     = NestedOutputDetect,
+    .mode_valid = NestedOutputModeValid,
+    .get_modes  = NestedOutputGetModes,
+    .destroy    = NestedOutputDestroy,
+};
+
+static Bool
+NestedCrtcCreate(ScrnInfoPtr pScrn) {
+    xf86CrtcPtr crtc;
+    xf86OutputPtr output;
+
+    crtc = xf86CrtcCreate(pScrn, &NestedCrtcFuncs);
+    if (!crtc)
+        return FALSE;
+
+    output = xf86OutputCreate(pScrn, &NestedOutputFuncs, "NESTED-0");
+    if (!output)
+        return FALSE;
+
+    output->possible_crtcs = 1;
+    output->possible_clones = 0;
+
+    return TRUE;
+}
+
+/* Called when RandR changes the screen size. The frame buffer is reallocated
+ * by the client and the screen pixmap is pointed to it. */
+static Bool
+NestedCrtcResize(ScrnInfoPtr pScrn, int width, int height) {
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    PixmapPtr pPixmap;
+
+    if (width == pScrn->virtualX && height == pScrn->virtualY)
+        return TRUE;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedCrtcResize: %dx%d\n",
+               width, height);
+
+    /* While rotated, the client image keeps the size of the mode */
+    if (pNested->shadowFb) {
+        char *shadowFb = malloc((size_t)PixmapBytePad(width, pScrn->depth) *
+                                height);
+
+        if (!shadowFb) {
+            xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                       "Failed to allocate a %dx%d shadow frame buffer\n",
+                       width, height);
+            return FALSE;
+        }
+
+        free(pNested->shadowFb);
+        pNested->shadowFb = shadowFb;
+    } else if (!NestedClientResizeFrameBuffer(pNested->clientData,
+                                              width, height)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Failed to resize frame buffer to %dx%d\n", width, height);
+        return FALSE;
+    }
+
+    pScrn->virtualX = width;
+    pScrn->virtualY = height;
+    pScrn->displayWidth = width;
+
+    pPixmap = pScreen->GetScreenPixmap(pScreen);
+    pScreen->ModifyPixmapHeader(pPixmap, width, height, -1, -1,
+                                PixmapBytePad(width, pScrn->depth),
+                                NestedGetFrameBuffer(pScrn));
+
+    return TRUE;
+}
+
+/* The host window was resized by the user or the host window manager. Make
+ * the nested screen follow it, as if xrandr had been called. */
+static CARD32
+NestedResizeTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
+    ScrnInfoPtr pScrn = arg;
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+    xf86CrtcPtr crtc = config->crtc[0];
+    int width = pNested->hostWidth;
+    int height = pNested->hostHeight;
+    int fbWidth, fbHeight;
+    DisplayModePtr mode;
+
+    if (crtc->enabled &&
+        crtc->mode.HDisplay == width && crtc->mode.VDisplay == height)
+        return 0;
+
+    for (mode = pNested->hostModes; mode != NULL; mode = mode->next)
+        if (mode->HDisplay == width && mode->VDisplay == height)
+            break;
+
+    if (!mode) {
+        for (mode = pNested->modes; mode != NULL; mode = mode->next)
+            if (mode->HDisplay == width && mode->VDisplay == height)
+                break;
+    }
+
+    if (!mode) {
+        /* Host modes are never freed before the screen, since RandR may still
+         * reference them */
+        if (!NestedAddMode(&pNested->hostModes, width, height))
+            return 0;
+
+        mode = pNested->hostModes->prev;
+    }
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Host window resized to %dx%d\n",
+               width, height);
+
+    /* The window shows the frame buffer rotated */
+    if (crtc->rotation & (RR_Rotate_90 | RR_Rotate_270)) {
+        fbWidth = height;
+        fbHeight = width;
+    } else {
+        fbWidth = width;
+        fbHeight = height;
+    }
+
+    if (!RRScreenSizeSet(pScreen, fbWidth, fbHeight,
+                         pScreen->mmWidth * fbWidth / pScreen->width,
+                         pScreen->mmHeight * fbHeight / pScreen->height))
+        return 0;
+
+    xf86ProbeOutputModes(pScrn, 0, 0);
+    xf86CrtcSetMode(crtc, mode, crtc->rotation, 0, 0);
+    xf86RandR12TellChanged(pScreen);
+
+    return 0;
+}
+
+void
+NestedHostResized(int scrnIndex, unsigned int width, unsigned int height) {
+    ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    /* Mirror windows don't size the screen */
+    if (NestedMirrorHostCallback())
+        return;
+
+    if (width < 1 || height < 1 ||
+        width > NESTED_MAX_WIDTH || height > NESTED_MAX_HEIGHT)
+        return;
+
+    pNested->hostWidth = width;
+    pNested->hostHeight = height;
+
+    /* Don't reconfigure the screen from inside the event handling, it may
+     * be running from the block handler */
+    pNested->resizeTimer = TimerSet(pNested->resizeTimer, 0, 1,
+                                    NestedResizeTimer, pScrn);
+}
+
+/* A detached screen tries to reconnect until it succeeds; the backend
+ * connects without blocking, so this only polls it. A display name in the
+ * _NESTED_DISPLAY property of its root window replaces the one it was
+ * configured with, e.g. xprop -root -f _NESTED_DISPLAY 8s -set
+ * _NESTED_DISPLAY host2:0 */
+static CARD32
+NestedReattachTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
+    ScrnInfoPtr pScrn = arg;
+    ScreenPtr pScreen = xf86ScrnToScreen(pScrn);
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    char *oldName = NULL;
+    PropertyPtr pProp;
+    Atom atom;
+
+    atom = MakeAtom(NESTED_DISPLAY_PROPERTY,
+                    strlen(NESTED_DISPLAY_PROPERTY), FALSE);
+
+    if (atom != None && pScreen->root &&
+        dixLookupProperty(&pProp, pScreen->root, atom, serverClient,
+                          DixReadAccess) == Success &&
+        pProp->type == XA_STRING && pProp->format == 8 && pProp->size > 0 &&
+        (!pNested->displayName ||
+         strlen(pNested->displayName) != pProp->size ||
+         strncmp(pNested->displayName, pProp->data, pProp->size))) {
+        oldName = pNested->displayName;
+        pNested->displayName = xnfalloc(pProp->size + 1);
+        memcpy(pNested->displayName, pProp->data, pProp->size);
+        pNested->displayName[pProp->size] = '\0';
+    }
+
+    if (!NestedClientReattach(pNested->clientData, pNested->displayName,
+                              pNested->xauthority)) {
+        free(oldName);
+        return pNested->reattachInterval;
+    }
+
+    free(oldName);
+    NestedUpdateScreenPixmap(pScrn);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Reattached to display %s\n",
+               pNested->displayName ? pNested->displayName : getenv("DISPLAY"));
+    return 0;
+}
+
+Bool
+NestedHostDetached(int scrnIndex) {
+    ScrnInfoPtr pScrn = xf86Screens[scrnIndex];
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+
+    /* A lost mirror is only dropped, the screen goes on */
+    if (NestedMirrorHostDetached())
+        return TRUE;
+
+    /* Rootless windows would all have to be created again */
+    if (!pNested->detach || NestedClientRootlessReady(pNested->clientData))
+        return FALSE;
+
+    xf86DrvMsg(scrnIndex, X_WARNING,
+               "Detached from the host, reattaching every %d ms\n",
+               pNested->reattachInterval);
+
+    pNested->reattachTimer = TimerSet(pNested->reattachTimer, 0,
+                                      pNested->reattachInterval,
+                                      NestedReattachTimer, pScrn);
+    return TRUE;
+}
+
+void
+NestedHostToScreen(int scrnIndex, int *x, int *y) {
+    xf86CrtcPtr crtc = XF86_CRTC_CONFIG_PTR(xf86Screens[scrnIndex])->crtc[0];
+
+    if (crtc->rotation != RR_Rotate_0)
+        NestedRotatePoint(crtc->rotation, crtc->mode.HDisplay,
+                          crtc->mode.VDisplay, *x, *y, x, y);
+
+    *x += crtc->x;
+    *y += crtc->y;
+}
+
 // Wrapper for timed call to NestedInputLoadDriver.  Used with timer in order
 // to force the initialization to wait until the input core is initialized.
 static CARD32
@@ -625,10 +1445,29 @@ NestedMouseTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
     return 0;
 }
 
+/* All screens share one block handler. The screen block handlers, and the
+ * shadow updates queued by them, have already run by the time it is called,
+ * so the events of every host are drained and then all hosts work on their
+ * uploads at the same time: one round trip per iteration, not one per
+ * screen. */
+static NestedClientPrivatePtr nestedClients[MAXSCREENS];
+static int nestedNumClients;
+
 static void
 NestedBlockHandler(pointer data, OSTimePtr wt, pointer LastSelectMask) {
-    NestedClientPrivatePtr pNestedClient = data;
-    NestedClientCheckEvents(pNestedClient);
+    int i;
+
+    for (i = 0; i < MAXSCREENS; i++)
+        if (nestedClients[i])
+            NestedClientCheckEvents(nestedClients[i]);
+
+    for (i = 0; i < MAXSCREENS; i++)
+        if (nestedClients[i])
+            NestedClientBeginSync(nestedClients[i]);
+
+    for (i = 0; i < MAXSCREENS; i++)
+        if (nestedClients[i])
+            NestedClientFinishSync(nestedClients[i]);
 }
 
 static void
@@ -641,6 +1480,7 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
     NestedPrivatePtr pNested;
     Pixel redMask, greenMask, blueMask;
+    Bool rootless;
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedScreenInit\n");
 
@@ -654,20 +1494,40 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
     
     //Load_Nested_Mouse();
 
-    pNested->clientData = NestedClientCreateScreen(pScrn->scrnIndex,
-                                                   pNested->output != NULL || pNested->fullscreen,
-                                                   pScrn->virtualX,
-                                                   pScrn->virtualY,
-                                                   pNested->originX,
-                                                   pNested->originY,
-                                                   pScrn->depth,
-                                                   pScrn->bitsPerPixel,
-                                                   &redMask, &greenMask, &blueMask);
+    /* The host side of the previous generation is taken over if it still
+     * fits, see NestedCloseScreen() */
+    if (pNested->clientData &&
+        !NestedClientReuseScreen(pNested->clientData,
+                                 pScrn->virtualX, pScrn->virtualY,
+                                 pScrn->currentMode->HDisplay,
+                                 pScrn->currentMode->VDisplay,
+                                 &redMask, &greenMask, &blueMask)) {
+        NestedClientCloseScreen(pNested->clientData);
+        pNested->clientData = NULL;
+    }
+
+    /* The first generation was set up along with the other screens, later
+     * ones start from scratch */
+    if (pNested->clientData)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Reusing the host window\n");
+    else if (pNested->setup)
+        pNested->clientData = NestedJoinSetup(pScrn, &redMask, &greenMask,
+                                              &blueMask);
+    else
+        pNested->clientData = NestedCreateClientScreen(pScrn, &redMask,
+                                                       &greenMask, &blueMask);
     
     if (!pNested->clientData) {
         xf86DrvMsg(pScrn->scrnIndex, X_ERROR, "Failed to create client screen\n");
         return FALSE;
     }
+
+    /* The screen window isn't shown when rootless, so nothing that draws to
+     * it or transforms it is set up */
+    rootless = NestedClientRootlessReady(pNested->clientData);
+    if (pNested->rootless && !rootless)
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Rootless mode not supported, showing the whole screen\n");
     
     // Schedule the NestedInputLoadDriver function to load once the
     // input core is initialized.
@@ -691,26 +1551,86 @@ static Bool NestedScreenInit(SCREEN_INIT_ARGS_DECL)
 
     fbPictureInit(pScreen, 0, 0);
 
+    /* Below the damage layer, so operations are still damaged once */
+    NestedParallelScreenInit(pScreen, pNested->threads,
+                             pNested->parallelThreshold);
+
     xf86SetBlackWhitePixels(pScreen);
     xf86SetBackingStore(pScreen);
     miDCInitialize(pScreen, xf86GetPointerScreenFuncs());
+
+    if (!xf86CrtcScreenInit(pScreen))
+        return FALSE;
+
+    /* Rotation is done by NestedCrtcSetRotation(), not by the xf86Crtc
+     * shadow, so xf86CrtcScreenInit() didn't advertise it */
+    if (!rootless)
+        xf86RandR12SetRotations(pScreen, RR_Rotate_0 | RR_Rotate_90 |
+                                         RR_Rotate_180 | RR_Rotate_270 |
+                                         RR_Reflect_X | RR_Reflect_Y);
     
     if (!miCreateDefColormap(pScreen))
         return FALSE;
 
     pNested->update = NestedShadowUpdate;
+    pNested->screenSaverActive = FALSE;
+    pNested->dpmsMode = DPMSModeOn;
+    pNested->blanked = FALSE;
+    pNested->screenPixmapReady = FALSE;
     pScreen->SaveScreen = NestedSaveScreen;
 
+    if (!xf86DPMSInit(pScreen, xf86DPMSSet, 0))
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING, "DPMS initialization failed\n");
+
+    if (!rootless)
+        NestedXvScreenInit(pScreen, pNested->clientData);
+
     if (!shadowSetup(pScreen))
         return FALSE;
 
+    /* Both wrap drawing outside of the damage layer set up by
+     * shadowSetup() */
+    if (pNested->proxyRender && !rootless)
+        NestedRenderScreenInit(pScreen, pNested->clientData);
+
+    if (pNested->proxyCore && !rootless)
+        NestedCoreScreenInit(pScreen, pNested->clientData);
+
+    if (rootless)
+        NestedRootlessScreenInit(pScreen, pNested->clientData);
+
+    if (pNested->captureSocket)
+        NestedCaptureScreenInit(pScreen, pNested->captureSocket,
+                                pNested->captureFrames);
+
+    /* Mirrors show the screen pixmap, so a rootless screen has nothing to
+     * show on them */
+    if (pNested->mirrorDisplays && rootless)
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                   "Rootless screens can't be mirrored\n");
+    else if (pNested->mirrorDisplays)
+        NestedMirrorScreenInit(pScreen, pNested->backend,
+                               pNested->mirrorDisplays, pNested->xauthority,
+                               pNested->fullscreen, pNested->scale,
+                               redMask, greenMask, blueMask);
+
+    if (pNested->damageTrace)
+        NestedTraceScreenInit(pScreen, pNested->damageTrace,
+                              pNested->damageTracePixels,
+                              redMask, greenMask, blueMask);
+
     pNested->CreateScreenResources = pScreen->CreateScreenResources;
     pScreen->CreateScreenResources = NestedCreateScreenResources;
 
     pNested->CloseScreen = pScreen->CloseScreen;
     pScreen->CloseScreen = NestedCloseScreen;
 
-    RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, pNested->clientData);
+    if (nestedNumClients++ == 0)
+        RegisterBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, NULL);
+    nestedClients[pScreen->myNum] = pNested->clientData;
+
+    if (!xf86SetDesiredModes(pScrn))
+        return FALSE;
 
     return TRUE;
 }
@@ -726,6 +1646,10 @@ NestedCreateScreenResources(ScreenPtr pScreen) {
     ret = pScreen->CreateScreenResources(pScreen);
     pScreen->CreateScreenResources = NestedCreateScreenResources;
 
+    /* The CRTC may have been rotated by xf86SetDesiredModes() already */
+    pNested->screenPixmapReady = TRUE;
+    NestedUpdateScreenPixmap(pScrn);
+
     if(!shadowAdd(pScreen, pScreen->GetScreenPixmap(pScreen),
                   pNested->update, NULL, 0, 0)) {
         xf86DrvMsg(pScreen->myNum, X_ERROR, "NestedCreateScreenResources failed to shadowAdd.\n");
@@ -735,12 +1659,79 @@ NestedCreateScreenResources(ScreenPtr pScreen) {
     return ret;
 }
 
+/* Uploads each damaged rectangle, or each band of them when there are many.
+ * The bounding box would upload again what RENDER and core forwarding took
+ * out of the damage because the host drew it already. */
+static void
+NestedUploadRegion(ScrnInfoPtr pScrn, RegionPtr pRegion) {
+    BoxPtr boxes = RegionRects(pRegion);
+    int numBoxes = RegionNumRects(pRegion);
+    BoxRec band;
+    int i;
+
+    if (numBoxes <= NESTED_MAX_UPDATE_RECTS) {
+        for (i = 0; i < numBoxes; i++)
+            NestedClientUpdateScreen(PCLIENTDATA(pScrn),
+                                     boxes[i].x1, boxes[i].y1,
+                                     boxes[i].x2, boxes[i].y2);
+        return;
+    }
+
+    /* Rectangles are sorted in bands of the same y1 and y2 */
+    for (i = 0; i < numBoxes; i++) {
+        if (i == 0 || boxes[i].y1 != band.y1) {
+            if (i > 0)
+                NestedClientUpdateScreen(PCLIENTDATA(pScrn), band.x1, band.y1,
+                                         band.x2, band.y2);
+            band = boxes[i];
+        } else {
+            band.x1 = min(band.x1, boxes[i].x1);
+            band.x2 = max(band.x2, boxes[i].x2);
+        }
+    }
+
+    if (numBoxes > 0)
+        NestedClientUpdateScreen(PCLIENTDATA(pScrn), band.x1, band.y1,
+                                 band.x2, band.y2);
+}
+
+/* The capture ring, the mirrors and the damage trace copy the screen */
+static void
+NestedUpdateCopies(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedCaptureUpdate(pScreen, pRegion);
+    NestedMirrorUpdate(pScreen, pRegion);
+    NestedTraceUpdate(pScreen, pRegion);
+}
+
 static void
 NestedShadowUpdate(ScreenPtr pScreen, shadowBufPtr pBuf) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
     RegionPtr pRegion = DamageRegion(pBuf->pDamage);
-    NestedClientUpdateScreen(PCLIENTDATA(xf86ScreenToScrn(pScreen)),
-                             pRegion->extents.x1, pRegion->extents.y1,
-                             pRegion->extents.x2, pRegion->extents.y2);
+
+    /* Nothing is shown while blanked, on the copies neither; they get the
+     * whole screen from NestedUpdateBlanking() when we unblank */
+    if (!PNESTED(pScrn)->blanked)
+        NestedUpdateCopies(pScreen, pRegion);
+
+    /* Top-level windows keep track of their own damage */
+    if (NestedRootlessUpdate(pScreen))
+        return;
+
+    /* Keep the rotated picture current even while blanked, since unblanking
+     * uploads the client image */
+    if (PNESTED(pScrn)->shadowFb) {
+        NestedUpdateRotated(pScrn, RegionRects(pRegion),
+                            RegionNumRects(pRegion));
+        return;
+    }
+
+    /* Nothing is shown while blanked; the host gets the whole screen from
+     * NestedUpdateBlanking(), through NestedClientSetBlanked(), when we
+     * unblank */
+    if (PNESTED(pScrn)->blanked)
+        return;
+
+    NestedUploadRegion(pScrn, pRegion);
 }
 
 static Bool
@@ -749,33 +1740,116 @@ NestedCloseScreen(CLOSE_SCREEN_ARGS_DECL) {
 
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedCloseScreen\n");
 
+    NestedCaptureCloseScreen(pScreen);
+    NestedMirrorCloseScreen(pScreen);
+    NestedTraceCloseScreen(pScreen);
+    NestedRootlessCloseScreen(pScreen);
+    NestedCoreCloseScreen(pScreen);
+    NestedRenderCloseScreen(pScreen);
     shadowRemove(pScreen, pScreen->GetScreenPixmap(pScreen));
-
-    RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, PNESTED(pScrn)->clientData);
-    NestedClientCloseScreen(PCLIENTDATA(pScrn));
+    NestedXvCloseScreen(pScreen);
+
+    /* Nothing may be left queued for a connection about to be closed */
+    NestedClientBeginSync(PCLIENTDATA(pScrn));
+    NestedClientFinishSync(PCLIENTDATA(pScrn));
+    nestedClients[pScreen->myNum] = NULL;
+    if (--nestedNumClients == 0)
+        RemoveBlockAndWakeupHandlers(NestedBlockHandler, NestedWakeupHandler, NULL);
+
+    /* Unless the server is going away, the connection, the window and the
+     * frame buffer are kept for the next generation */
+    if (dispatchException & DE_TERMINATE) {
+        NestedClientCloseScreen(PCLIENTDATA(pScrn));
+        PCLIENTDATA(pScrn) = NULL;
+    } else
+        NestedClientResetScreen(PCLIENTDATA(pScrn));
 
     pScreen->CloseScreen = PNESTED(pScrn)->CloseScreen;
     
     if (timer != NULL)
         free(timer);
 
+    TimerFree(PNESTED(pScrn)->resizeTimer);
+    PNESTED(pScrn)->resizeTimer = NULL;
+    TimerFree(PNESTED(pScrn)->reattachTimer);
+    PNESTED(pScrn)->reattachTimer = NULL;
+
+    free(PNESTED(pScrn)->shadowFb);
+    PNESTED(pScrn)->shadowFb = NULL;
+    PNESTED(pScrn)->screenPixmapReady = FALSE;
+
     return (*pScreen->CloseScreen)(CLOSE_SCREEN_ARGS);
 }
 
+/* The host window is blanked whenever either the screen saver or DPMS wants
+ * it to be, so both can be toggled independently. */
+static void
+NestedUpdateBlanking(ScrnInfoPtr pScrn) {
+    NestedPrivatePtr pNested = PNESTED(pScrn);
+    Bool blanked = pNested->screenSaverActive ||
+                   pNested->dpmsMode != DPMSModeOn;
+
+    if (blanked == pNested->blanked)
+        return;
+
+    pNested->blanked = blanked;
+
+    if (pNested->clientData)
+        NestedClientSetBlanked(pNested->clientData, blanked);
+
+    if (!blanked && pNested->screenPixmapReady) {
+        BoxRec box = { 0, 0, pScrn->virtualX, pScrn->virtualY };
+        RegionRec region;
+
+        RegionInit(&region, &box, 1);
+        NestedUpdateCopies(xf86ScrnToScreen(pScrn), &region);
+        RegionUninit(&region);
+    }
+}
+
 static Bool NestedSaveScreen(ScreenPtr pScreen, int mode) {
-    xf86DrvMsg(pScreen->myNum, X_INFO, "NestedSaveScreen\n");
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedSaveScreen\n");
+
+    PNESTED(pScrn)->screenSaverActive = !xf86IsUnblank(mode);
+    NestedUpdateBlanking(pScrn);
     return TRUE;
 }
 
+
 static Bool NestedSwitchMode(SWITCH_MODE_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedSwitchMode\n");
-    return TRUE;
+    return xf86SetSingleMode(pScrn, mode,
+                             XF86_CRTC_CONFIG_PTR(pScrn)->crtc[0]->rotation);
 }
 
 static void NestedAdjustFrame(ADJUST_FRAME_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
-    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedAdjustFrame\n");
+    xf86CrtcConfigPtr config = XF86_CRTC_CONFIG_PTR(pScrn);
+    xf86CrtcPtr crtc = config->crtc[0];
+    int fbWidth, fbHeight;
+
+    /* This is called for every pointer motion while panning */
+    xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 5, "NestedAdjustFrame %d,%d\n",
+                   x, y);
+
+    if (!crtc->enabled)
+        return;
+
+    NestedCrtcGetFrameBufferSize(crtc, &fbWidth, &fbHeight);
+
+    if (x > pScrn->virtualX - fbWidth)
+        x = pScrn->virtualX - fbWidth;
+    if (y > pScrn->virtualY - fbHeight)
+        y = pScrn->virtualY - fbHeight;
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+
+    NestedCrtcSetOrigin(crtc, x, y);
 }
 
 static Bool NestedEnterVT(VT_FUNC_ARGS_DECL) {
@@ -792,6 +1866,25 @@ static void NestedLeaveVT(VT_FUNC_ARGS_DECL) {
 static void NestedFreeScreen(FREE_SCREEN_ARGS_DECL) {
     SCRN_INFO_PTR(arg);
     xf86DrvMsg(pScrn->scrnIndex, X_INFO, "NestedFreeScreen\n");
+
+    if (pScrn->driverPrivate) {
+        Pixel redMask, greenMask, blueMask;
+        NestedClientPrivatePtr clientData;
+
+        /* The screen went away before it was initialized */
+        clientData = NestedJoinSetup(pScrn, &redMask, &greenMask, &blueMask);
+        if (clientData)
+            NestedClientCloseScreen(clientData);
+
+        if (PCLIENTDATA(pScrn)) {
+            NestedClientCloseScreen(PCLIENTDATA(pScrn));
+            PCLIENTDATA(pScrn) = NULL;
+        }
+
+        NestedFreeModes(&PNESTED(pScrn)->modes);
+        NestedFreeModes(&PNESTED(pScrn)->hostModes);
+    }
+
     NestedFreePrivate(pScrn);
 }
 
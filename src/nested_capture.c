@@ -0,0 +1,455 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* memfd_create() and file sealing */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <scrnintstr.h>
+#include <pixmapstr.h>
+#include <regionstr.h>
+
+#include "nested_capture.h"
+
+#define NESTED_CAPTURE_PAGE_SIZE 4096
+
+/* Each slot holds a whole frame. Damage is added to the pending region of
+ * every slot, and a slot only copies its own pending region when it is
+ * written again, so each frame costs one copy of what changed since the
+ * slot was last used. */
+typedef struct {
+    int                socket;
+    pointer            handler;
+    char              *socketPath;
+    int                numSlots;
+    Bool               failed;  /* the ring couldn't be created */
+    int                fd;      /* of the ring, -1 for none */
+    int                readFd;  /* read-only, handed out to readers */
+    size_t             size;
+    /* The layout is only published in the ring: the server never reads it
+     * back from memory its readers share */
+    int                width;
+    int                height;
+    int                stride;
+    size_t             headerSize;
+    size_t             frameSize;
+    NestedCaptureRing *ring;
+    RegionRec         *pending; /* one per slot */
+    uint64_t           frame;
+} NestedCaptureScreenRec, *NestedCaptureScreenPtr;
+
+static NestedCaptureScreenPtr nestedCaptureScreens[MAXSCREENS];
+
+#define NESTED_CAPTURE_PRIV(pScreen) nestedCaptureScreens[(pScreen)->myNum]
+
+static size_t
+NestedCapturePageAlign(size_t size) {
+    return (size + NESTED_CAPTURE_PAGE_SIZE - 1) &
+           ~(size_t)(NESTED_CAPTURE_PAGE_SIZE - 1);
+}
+
+/* Returns the ring file, writable, and in readFd a read-only descriptor of
+ * it for the readers */
+static int
+NestedCaptureCreateFile(size_t size, int *readFd) {
+    int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+    char path[32];
+
+    fd = memfd_create("nested-capture", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    *readFd = open(path, O_RDONLY | O_CLOEXEC);
+#else
+    char path[] = "/tmp/nested-capture-XXXXXX";
+
+    fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    *readFd = open(path, O_RDONLY | O_CLOEXEC);
+    unlink(path);
+#endif
+
+    if (*readFd < 0 || ftruncate(fd, size) < 0) {
+        if (*readFd >= 0)
+            close(*readFd);
+        close(fd);
+        return -1;
+    }
+
+#ifdef F_ADD_SEALS
+    /* Readers map the size they see */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#endif
+
+    return fd;
+}
+
+static void
+NestedCaptureReleaseRing(NestedCaptureScreenPtr priv) {
+    int i;
+
+    if (!priv->ring)
+        return;
+
+    __atomic_store_n(&priv->ring->stale, 1, __ATOMIC_RELEASE);
+    munmap(priv->ring, priv->size);
+    close(priv->fd);
+    close(priv->readFd);
+
+    for (i = 0; i < priv->numSlots; i++)
+        RegionUninit(&priv->pending[i]);
+    free(priv->pending);
+
+    priv->ring = NULL;
+    priv->pending = NULL;
+    priv->fd = -1;
+    priv->readFd = -1;
+}
+
+static void
+NestedCaptureWriteFrame(NestedCaptureScreenPtr priv, PixmapPtr pPixmap,
+                        RegionPtr pRegion) {
+    NestedCaptureRing *ring = priv->ring;
+    int index = priv->frame % priv->numSlots;
+    NestedCaptureSlot *slot = &ring->slots[index];
+    RegionPtr pending = &priv->pending[index];
+    const char *src = pPixmap->devPrivate.ptr;
+    char *dst = (char *)ring + priv->headerSize + index * priv->frameSize;
+    int cpp = pPixmap->drawable.bitsPerPixel / 8;
+    BoxPtr boxes;
+    struct timespec ts;
+    int i, y, numBoxes;
+
+    for (i = 0; i < priv->numSlots; i++)
+        RegionUnion(&priv->pending[i], &priv->pending[i], pRegion);
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    boxes = RegionRects(pending);
+    numBoxes = RegionNumRects(pending);
+
+    for (i = 0; i < numBoxes; i++) {
+        size_t offset = (size_t)boxes[i].y1 * priv->stride + boxes[i].x1 * cpp;
+        size_t len = (size_t)(boxes[i].x2 - boxes[i].x1) * cpp;
+
+        for (y = boxes[i].y1; y < boxes[i].y2; y++, offset += priv->stride)
+            memcpy(dst + offset, src + offset, len);
+    }
+
+    RegionEmpty(pending);
+
+    numBoxes = RegionNumRects(pRegion);
+    if (numBoxes > NESTED_CAPTURE_MAX_RECTS) {
+        boxes = RegionExtents(pRegion);
+        numBoxes = 1;
+    } else {
+        boxes = RegionRects(pRegion);
+    }
+
+    for (i = 0; i < numBoxes; i++) {
+        slot->rects[i].x1 = boxes[i].x1;
+        slot->rects[i].y1 = boxes[i].y1;
+        slot->rects[i].x2 = boxes[i].x2;
+        slot->rects[i].y2 = boxes[i].y2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    slot->numRects = numBoxes;
+    slot->frame = ++priv->frame;
+    slot->usec = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->frame, priv->frame, __ATOMIC_RELEASE);
+}
+
+/* Creates the ring for the current screen pixmap, replacing the one of an
+ * older size. Its first frame is the whole screen. */
+static Bool
+NestedCaptureGetRing(ScreenPtr pScreen, NestedCaptureScreenPtr priv) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    NestedCaptureRing *ring = priv->ring;
+    RegionRec region;
+    BoxRec box;
+    int i;
+
+    if (priv->failed || !pPixmap || !pPixmap->devPrivate.ptr)
+        return FALSE;
+
+    if (ring && priv->width == pPixmap->drawable.width &&
+        priv->height == pPixmap->drawable.height &&
+        priv->stride == pPixmap->devKind)
+        return TRUE;
+
+    NestedCaptureReleaseRing(priv);
+
+    priv->width = pPixmap->drawable.width;
+    priv->height = pPixmap->drawable.height;
+    priv->stride = pPixmap->devKind;
+    priv->headerSize = NestedCapturePageAlign(sizeof(NestedCaptureRing) +
+                                              priv->numSlots *
+                                              sizeof(NestedCaptureSlot));
+    priv->frameSize = NestedCapturePageAlign((size_t)priv->stride *
+                                             priv->height);
+    priv->size = priv->headerSize + priv->numSlots * priv->frameSize;
+
+    priv->fd = NestedCaptureCreateFile(priv->size, &priv->readFd);
+    if (priv->fd < 0) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Can't create the capture ring: %s\n", strerror(errno));
+        priv->failed = TRUE;
+        return FALSE;
+    }
+
+    ring = mmap(NULL, priv->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                priv->fd, 0);
+    priv->pending = calloc(priv->numSlots, sizeof(RegionRec));
+
+    if (ring == MAP_FAILED || !priv->pending) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Can't map the capture ring\n");
+        if (ring != MAP_FAILED)
+            munmap(ring, priv->size);
+        free(priv->pending);
+        priv->pending = NULL;
+        close(priv->fd);
+        close(priv->readFd);
+        priv->fd = -1;
+        priv->readFd = -1;
+        priv->failed = TRUE;
+        return FALSE;
+    }
+
+#ifdef F_SEAL_FUTURE_WRITE
+    /* The server keeps its mapping; nobody can map the ring for writing
+     * again, not even through a reopened /proc/<pid>/fd of the reader's */
+    fcntl(priv->fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+
+    ring->magic = NESTED_CAPTURE_MAGIC;
+    ring->version = NESTED_CAPTURE_VERSION;
+    ring->width = priv->width;
+    ring->height = priv->height;
+    ring->stride = priv->stride;
+    ring->bitsPerPixel = pPixmap->drawable.bitsPerPixel;
+    ring->depth = pPixmap->drawable.depth;
+    ring->redMask = pScrn->mask.red;
+    ring->greenMask = pScrn->mask.green;
+    ring->blueMask = pScrn->mask.blue;
+    ring->numSlots = priv->numSlots;
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = priv->width;
+    box.y2 = priv->height;
+
+    for (i = 0; i < priv->numSlots; i++) {
+        ring->slots[i].offset = priv->headerSize + i * priv->frameSize;
+        RegionInit(&priv->pending[i], &box, 1);
+    }
+
+    priv->ring = ring;
+    priv->frame = 0;
+
+    RegionInit(&region, &box, 1);
+    NestedCaptureWriteFrame(priv, pPixmap, &region);
+    RegionUninit(&region);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Capture ring of %d frames of %dx%d, %lu KB\n",
+               priv->numSlots, priv->width, priv->height,
+               (unsigned long)(priv->size / 1024));
+    return TRUE;
+}
+
+/* Each connection gets the ring and is closed right away */
+static void
+NestedCaptureAccept(int fd, pointer data) {
+    ScreenPtr pScreen = data;
+    NestedCaptureScreenPtr priv = NESTED_CAPTURE_PRIV(pScreen);
+    union {
+        struct cmsghdr header;
+        char           buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char byte = 0;
+    int client;
+
+    client = accept(fd, NULL, NULL);
+    if (client < 0)
+        return;
+
+    if (NestedCaptureGetRing(pScreen, priv)) {
+        memset(&msg, 0, sizeof(msg));
+        memset(&control, 0, sizeof(control));
+
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &priv->readFd, sizeof(int));
+
+        sendmsg(client, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    close(client);
+}
+
+static int
+NestedCaptureListen(int scrnIndex, const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask;
+    int fd, err;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "Capture socket path too long\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Left over by a server that didn't exit cleanly; anything else at
+     * that path isn't ours to remove */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    /* The frames are the user's only, the socket is 0600 from the start */
+    mask = umask(077);
+    err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (err < 0 || listen(fd, 4) < 0) {
+        xf86DrvMsg(scrnIndex, X_ERROR, "Can't listen on %s: %s\n", path,
+                   strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+Bool
+NestedCaptureScreenInit(ScreenPtr pScreen, const char *socketPath,
+                        int numSlots) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedCaptureScreenPtr priv;
+
+    priv = calloc(1, sizeof(NestedCaptureScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->fd = -1;
+    priv->readFd = -1;
+    priv->numSlots = numSlots;
+    priv->socketPath = strdup(socketPath);
+    priv->socket = NestedCaptureListen(pScrn->scrnIndex, socketPath);
+
+    if (!priv->socketPath || priv->socket < 0) {
+        if (priv->socket >= 0)
+            close(priv->socket);
+        free(priv->socketPath);
+        free(priv);
+        return FALSE;
+    }
+
+    priv->handler = xf86AddGeneralHandler(priv->socket, NestedCaptureAccept,
+                                          pScreen);
+    NESTED_CAPTURE_PRIV(pScreen) = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Publishing frames on %s\n",
+               socketPath);
+    return TRUE;
+}
+
+void
+NestedCaptureUpdate(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedCaptureScreenPtr priv = NESTED_CAPTURE_PRIV(pScreen);
+
+    /* Nobody asked for the ring yet */
+    if (!priv || !priv->ring)
+        return;
+
+    if (!NestedCaptureGetRing(pScreen, priv))
+        return;
+
+    NestedCaptureWriteFrame(priv, pScreen->GetScreenPixmap(pScreen), pRegion);
+}
+
+void
+NestedCaptureCloseScreen(ScreenPtr pScreen) {
+    NestedCaptureScreenPtr priv = NESTED_CAPTURE_PRIV(pScreen);
+
+    if (!priv)
+        return;
+
+    xf86RemoveGeneralHandler(priv->handler);
+    close(priv->socket);
+    unlink(priv->socketPath);
+
+    NestedCaptureReleaseRing(priv);
+
+    free(priv->socketPath);
+    free(priv);
+    NESTED_CAPTURE_PRIV(pScreen) = NULL;
+}
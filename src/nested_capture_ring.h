@@ -0,0 +1,85 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Layout of the frame ring published with the "CaptureSocket" option. It
+ * only uses fixed size types, so capture tools can include it without the
+ * server headers.
+ *
+ * Connecting to the socket returns a read-only file descriptor of the ring
+ * in an SCM_RIGHTS message; map its size (fstat) with PROT_READ. The ring holds the
+ * last numSlots frames of the nested screen, each with the rectangles damaged
+ * since the frame before. The server never waits for readers: a frame is read
+ * with a sequence lock and read again if it was overwritten meanwhile.
+ *
+ *   again:
+ *     frame = __atomic_load_n(&ring->frame, __ATOMIC_ACQUIRE);
+ *     slot = &ring->slots[(frame - 1) % ring->numSlots];
+ *     seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+ *     if (frame == 0 || (seq & 1) || slot->frame != frame)
+ *         goto again;
+ *     ...copy the rectangles and the pixels out of the slot...
+ *     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *     if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+ *         goto again;
+ *
+ * When the screen is resized, the ring is replaced: stale is set in the old
+ * one, and readers have to connect again. */
+
+#ifndef NESTED_CAPTURE_RING_H
+#define NESTED_CAPTURE_RING_H
+
+#include <stdint.h>
+
+#define NESTED_CAPTURE_MAGIC     0x4e435247 /* "NCRG" */
+#define NESTED_CAPTURE_VERSION   1
+#define NESTED_CAPTURE_MAX_RECTS 64 /* more are merged into their extents */
+
+typedef struct {
+    int16_t x1, y1, x2, y2;
+} NestedCaptureRect;
+
+typedef struct {
+    uint32_t          seq;      /* odd while the slot is being written */
+    uint32_t          numRects;
+    uint64_t          frame;    /* 1 for the first frame */
+    uint64_t          usec;     /* CLOCK_MONOTONIC time of the frame */
+    uint64_t          offset;   /* of the pixels, from the start of the ring */
+    NestedCaptureRect rects[NESTED_CAPTURE_MAX_RECTS];
+} NestedCaptureSlot;
+
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          width;
+    uint32_t          height;
+    uint32_t          stride;   /* bytes per line of the pixels */
+    uint32_t          bitsPerPixel;
+    uint32_t          depth;
+    uint32_t          redMask;
+    uint32_t          greenMask;
+    uint32_t          blueMask;
+    uint32_t          stale;    /* the ring was replaced, connect again */
+    uint32_t          numSlots;
+    uint64_t          frame;    /* the last complete frame, 0 for none */
+    NestedCaptureSlot slots[];
+} NestedCaptureRing;
+
+#endif
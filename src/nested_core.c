@@ -0,0 +1,568 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <fb.h>
+#include <gcstruct.h>
+#include <pixmapstr.h>
+#include <windowstr.h>
+
+#include "nested_forward.h"
+#include "nested_core.h"
+
+/* Clips with more rectangles than this aren't worth sending along */
+#define NESTED_CORE_MAX_CLIP_RECTS 16
+
+typedef struct {
+    NestedClientPrivatePtr clientData;
+    CreateGCProcPtr        CreateGC;
+} NestedCoreScreenRec, *NestedCoreScreenPtr;
+
+/* The usual GC wrapper: ops are only wrapped once the GC was validated */
+typedef struct {
+    const GCFuncs *funcs;
+    const GCOps   *ops;
+} NestedGCPrivRec, *NestedGCPrivPtr;
+
+static NestedCoreScreenPtr nestedCoreScreens[MAXSCREENS];
+
+static DevPrivateKeyRec nestedGCPrivateKeyRec;
+
+#define NESTED_CORE_PRIV(pScreen) nestedCoreScreens[(pScreen)->myNum]
+#define NESTED_GC_PRIV(pGC) ((NestedGCPrivPtr) \
+    dixGetPrivateAddr(&(pGC)->devPrivates, &nestedGCPrivateKeyRec))
+
+static const GCFuncs NestedGCFuncs;
+static const GCOps NestedGCOps;
+
+#define NESTED_GC_FUNC_PROLOGUE(pGC)                    \
+    NestedGCPrivPtr pGCPriv = NESTED_GC_PRIV(pGC);      \
+    (pGC)->funcs = pGCPriv->funcs;                      \
+    if (pGCPriv->ops)                                   \
+        (pGC)->ops = pGCPriv->ops
+
+#define NESTED_GC_FUNC_EPILOGUE(pGC)                    \
+    pGCPriv->funcs = (pGC)->funcs;                      \
+    (pGC)->funcs = &NestedGCFuncs;                      \
+    if (pGCPriv->ops) {                                 \
+        pGCPriv->ops = (pGC)->ops;                      \
+        (pGC)->ops = &NestedGCOps;                      \
+    }
+
+#define NESTED_GC_OP_PROLOGUE(pGC)                      \
+    NestedGCPrivPtr pGCPriv = NESTED_GC_PRIV(pGC);      \
+    const GCFuncs *oldFuncs = (pGC)->funcs;             \
+    (pGC)->funcs = pGCPriv->funcs;                      \
+    (pGC)->ops = pGCPriv->ops
+
+#define NESTED_GC_OP_EPILOGUE(pGC)                      \
+    pGCPriv->funcs = (pGC)->funcs;                      \
+    (pGC)->funcs = oldFuncs;                            \
+    pGCPriv->ops = (pGC)->ops;                          \
+    (pGC)->ops = &NestedGCOps
+
+static short
+NestedCoreClamp(int value) {
+    return value < MINSHORT ? MINSHORT : value > MAXSHORT ? MAXSHORT : value;
+}
+
+/* Checks what all forwarded requests have in common. Fill style, line
+ * attributes and so on are left to each request. */
+static Bool
+NestedCoreCanForward(DrawablePtr pDraw, GCPtr pGC) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDraw->pScreen);
+
+    return NestedClientCoreReady(priv->clientData) &&
+           NestedForwardCanDraw(pDraw) &&
+           RegionNumRects(fbGetCompositeClip(pGC)) <=
+               NESTED_CORE_MAX_CLIP_RECTS;
+}
+
+/* Sets up the host GC for drawing inside box, given relative to the
+ * drawable. Returns FALSE if nothing would be drawn. */
+static Bool
+NestedCoreBegin(DrawablePtr pDraw, GCPtr pGC, int x1, int y1, int x2, int y2,
+                NestedForwardOpPtr pOp) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDraw->pScreen);
+    BoxRec box;
+
+    box.x1 = NestedCoreClamp(x1 + pDraw->x);
+    box.y1 = NestedCoreClamp(y1 + pDraw->y);
+    box.x2 = NestedCoreClamp(x2 + pDraw->x);
+    box.y2 = NestedCoreClamp(y2 + pDraw->y);
+
+    if (!NestedForwardBegin(pDraw->pScreen, &box, fbGetCompositeClip(pGC),
+                            pOp))
+        return FALSE;
+
+    NestedClientCoreSetGC(priv->clientData, pGC->alu, pGC->planemask,
+                          pGC->fgPixel, pGC->capStyle,
+                          RegionRects(&pOp->drawn),
+                          RegionNumRects(&pOp->drawn));
+    return TRUE;
+}
+
+static void
+NestedCorePolyFillRect(DrawablePtr pDraw, GCPtr pGC,
+                       int nrectFill, xRectangle *prectInit) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDraw->pScreen);
+    NestedForwardOpRec op;
+    Bool forwarded = FALSE;
+    int x1 = MAXSHORT, y1 = MAXSHORT, x2 = MINSHORT, y2 = MINSHORT;
+    int i;
+
+    if (nrectFill > 0 && pGC->fillStyle == FillSolid &&
+        NestedCoreCanForward(pDraw, pGC)) {
+        for (i = 0; i < nrectFill; i++) {
+            x1 = min(x1, prectInit[i].x);
+            y1 = min(y1, prectInit[i].y);
+            x2 = max(x2, prectInit[i].x + (int)prectInit[i].width);
+            y2 = max(y2, prectInit[i].y + (int)prectInit[i].height);
+        }
+
+        forwarded = NestedCoreBegin(pDraw, pGC, x1, y1, x2, y2, &op);
+    }
+
+    if (forwarded)
+        NestedClientCorePolyFillRect(priv->clientData, pDraw->x, pDraw->y,
+                                     nrectFill, prectInit);
+
+    {
+        NESTED_GC_OP_PROLOGUE(pGC);
+        (*pGC->ops->PolyFillRect)(pDraw, pGC, nrectFill, prectInit);
+        NESTED_GC_OP_EPILOGUE(pGC);
+    }
+
+    if (forwarded)
+        NestedForwardDone(pDraw->pScreen, &op, TRUE);
+}
+
+/* Thin solid lines only; wide and dashed lines are left to fb */
+static void
+NestedCorePolySegment(DrawablePtr pDraw, GCPtr pGC,
+                      int nseg, xSegment *pSegs) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDraw->pScreen);
+    NestedForwardOpRec op;
+    Bool forwarded = FALSE;
+    int x1 = MAXSHORT, y1 = MAXSHORT, x2 = MINSHORT, y2 = MINSHORT;
+    int i;
+
+    if (nseg > 0 && pGC->fillStyle == FillSolid &&
+        pGC->lineWidth == 0 && pGC->lineStyle == LineSolid &&
+        NestedCoreCanForward(pDraw, pGC)) {
+        for (i = 0; i < nseg; i++) {
+            x1 = min(x1, min(pSegs[i].x1, pSegs[i].x2));
+            y1 = min(y1, min(pSegs[i].y1, pSegs[i].y2));
+            x2 = max(x2, max(pSegs[i].x1, pSegs[i].x2) + 1);
+            y2 = max(y2, max(pSegs[i].y1, pSegs[i].y2) + 1);
+        }
+
+        forwarded = NestedCoreBegin(pDraw, pGC, x1, y1, x2, y2, &op);
+    }
+
+    if (forwarded)
+        NestedClientCorePolySegment(priv->clientData, pDraw->x, pDraw->y,
+                                    nseg, pSegs);
+
+    {
+        NESTED_GC_OP_PROLOGUE(pGC);
+        (*pGC->ops->PolySegment)(pDraw, pGC, nseg, pSegs);
+        NESTED_GC_OP_EPILOGUE(pGC);
+    }
+
+    if (forwarded)
+        NestedForwardDone(pDraw->pScreen, &op, TRUE);
+}
+
+/* A window to window copy can be done by the host if the source is wholly
+ * visible in the nested screen and already uploaded. Otherwise fb has to
+ * leave parts out or the host would copy stale pixels. */
+static Bool
+NestedCoreCanCopyFrom(DrawablePtr pSrc, GCPtr pGC, int x, int y, int w, int h) {
+    WindowPtr pWin = (WindowPtr)pSrc;
+    RegionPtr pVisible;
+    BoxRec box;
+
+    if (!NestedForwardCanDraw(pSrc))
+        return FALSE;
+
+    box.x1 = NestedCoreClamp(x + pSrc->x);
+    box.y1 = NestedCoreClamp(y + pSrc->y);
+    box.x2 = NestedCoreClamp(x + w + pSrc->x);
+    box.y2 = NestedCoreClamp(y + h + pSrc->y);
+
+    pVisible = pGC->subWindowMode == IncludeInferiors ? &pWin->borderClip
+                                                      : &pWin->clipList;
+
+    return RegionContainsRect(pVisible, &box) == rgnIN &&
+           !NestedForwardPending(pSrc->pScreen, &box);
+}
+
+static RegionPtr
+NestedCoreCopyArea(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+                   int srcx, int srcy, int w, int h, int dstx, int dsty) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDst->pScreen);
+    NestedForwardOpRec op;
+    Bool forwarding = FALSE, forwarded = FALSE;
+    RegionPtr ret;
+
+    if (w > 0 && h > 0 && NestedCoreCanForward(pDst, pGC) &&
+        NestedCoreCanCopyFrom(pSrc, pGC, srcx, srcy, w, h))
+        forwarding = NestedCoreBegin(pDst, pGC, dstx, dsty,
+                                     dstx + w, dsty + h, &op);
+
+    if (forwarding)
+        forwarded = NestedClientCoreCopyArea(priv->clientData,
+                                             srcx + pSrc->x, srcy + pSrc->y,
+                                             w, h,
+                                             dstx + pDst->x, dsty + pDst->y);
+
+    {
+        NESTED_GC_OP_PROLOGUE(pGC);
+        ret = (*pGC->ops->CopyArea)(pSrc, pDst, pGC, srcx, srcy, w, h,
+                                    dstx, dsty);
+        NESTED_GC_OP_EPILOGUE(pGC);
+    }
+
+    if (forwarding)
+        NestedForwardDone(pDst->pScreen, &op, forwarded);
+
+    return ret;
+}
+
+/* Only ZPixmap images of the drawable's depth are sent as they are */
+static void
+NestedCorePutImage(DrawablePtr pDraw, GCPtr pGC, int depth, int x, int y,
+                   int w, int h, int leftPad, int format, char *pBits) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pDraw->pScreen);
+    NestedForwardOpRec op;
+    Bool forwarding = FALSE, forwarded = FALSE;
+
+    if (w > 0 && h > 0 && format == ZPixmap && depth == pDraw->depth &&
+        NestedCoreCanForward(pDraw, pGC))
+        forwarding = NestedCoreBegin(pDraw, pGC, x, y, x + w, y + h, &op);
+
+    if (forwarding)
+        forwarded = NestedClientCorePutImage(priv->clientData, depth,
+                                             x + pDraw->x, y + pDraw->y, w, h,
+                                             PixmapBytePad(w, depth), pBits);
+
+    {
+        NESTED_GC_OP_PROLOGUE(pGC);
+        (*pGC->ops->PutImage)(pDraw, pGC, depth, x, y, w, h, leftPad, format,
+                              pBits);
+        NESTED_GC_OP_EPILOGUE(pGC);
+    }
+
+    if (forwarding)
+        NestedForwardDone(pDraw->pScreen, &op, forwarded);
+}
+
+/* Everything else goes straight to fb */
+
+static void
+NestedCoreFillSpans(DrawablePtr pDraw, GCPtr pGC, int nInit,
+                    DDXPointPtr pptInit, int *pwidthInit, int fSorted) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->FillSpans)(pDraw, pGC, nInit, pptInit, pwidthInit, fSorted);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreSetSpans(DrawablePtr pDraw, GCPtr pGC, char *psrc,
+                   DDXPointPtr ppt, int *pwidth, int nspans, int fSorted) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->SetSpans)(pDraw, pGC, psrc, ppt, pwidth, nspans, fSorted);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static RegionPtr
+NestedCoreCopyPlane(DrawablePtr pSrc, DrawablePtr pDst, GCPtr pGC,
+                    int srcx, int srcy, int w, int h, int dstx, int dsty,
+                    unsigned long bitPlane) {
+    RegionPtr ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->CopyPlane)(pSrc, pDst, pGC, srcx, srcy, w, h,
+                                 dstx, dsty, bitPlane);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static void
+NestedCorePolyPoint(DrawablePtr pDraw, GCPtr pGC, int mode, int npt,
+                    DDXPointPtr pptInit) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyPoint)(pDraw, pGC, mode, npt, pptInit);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePolylines(DrawablePtr pDraw, GCPtr pGC, int mode, int npt,
+                    DDXPointPtr pptInit) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->Polylines)(pDraw, pGC, mode, npt, pptInit);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePolyRectangle(DrawablePtr pDraw, GCPtr pGC, int nrects,
+                        xRectangle *pRects) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyRectangle)(pDraw, pGC, nrects, pRects);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePolyArc(DrawablePtr pDraw, GCPtr pGC, int narcs, xArc *parcs) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyArc)(pDraw, pGC, narcs, parcs);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreFillPolygon(DrawablePtr pDraw, GCPtr pGC, int shape, int mode,
+                      int count, DDXPointPtr pPts) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->FillPolygon)(pDraw, pGC, shape, mode, count, pPts);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePolyFillArc(DrawablePtr pDraw, GCPtr pGC, int narcs, xArc *parcs) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyFillArc)(pDraw, pGC, narcs, parcs);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static int
+NestedCorePolyText8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                    int count, char *chars) {
+    int ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->PolyText8)(pDraw, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static int
+NestedCorePolyText16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                     int count, unsigned short *chars) {
+    int ret;
+
+    NESTED_GC_OP_PROLOGUE(pGC);
+    ret = (*pGC->ops->PolyText16)(pDraw, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+    return ret;
+}
+
+static void
+NestedCoreImageText8(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                     int count, char *chars) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageText8)(pDraw, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreImageText16(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                      int count, unsigned short *chars) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageText16)(pDraw, pGC, x, y, count, chars);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreImageGlyphBlt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                        unsigned int nglyph, CharInfoPtr *ppci,
+                        pointer pglyphBase) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->ImageGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci, pglyphBase);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePolyGlyphBlt(DrawablePtr pDraw, GCPtr pGC, int x, int y,
+                       unsigned int nglyph, CharInfoPtr *ppci,
+                       pointer pglyphBase) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PolyGlyphBlt)(pDraw, pGC, x, y, nglyph, ppci, pglyphBase);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static void
+NestedCorePushPixels(GCPtr pGC, PixmapPtr pBitMap, DrawablePtr pDst,
+                     int dx, int dy, int xOrg, int yOrg) {
+    NESTED_GC_OP_PROLOGUE(pGC);
+    (*pGC->ops->PushPixels)(pGC, pBitMap, pDst, dx, dy, xOrg, yOrg);
+    NESTED_GC_OP_EPILOGUE(pGC);
+}
+
+static const GCOps NestedGCOps = {
+    NestedCoreFillSpans,
+    NestedCoreSetSpans,
+    NestedCorePutImage,
+    NestedCoreCopyArea,
+    NestedCoreCopyPlane,
+    NestedCorePolyPoint,
+    NestedCorePolylines,
+    NestedCorePolySegment,
+    NestedCorePolyRectangle,
+    NestedCorePolyArc,
+    NestedCoreFillPolygon,
+    NestedCorePolyFillRect,
+    NestedCorePolyFillArc,
+    NestedCorePolyText8,
+    NestedCorePolyText16,
+    NestedCoreImageText8,
+    NestedCoreImageText16,
+    NestedCoreImageGlyphBlt,
+    NestedCorePolyGlyphBlt,
+    NestedCorePushPixels,
+};
+
+static void
+NestedCoreValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDraw) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ValidateGC)(pGC, changes, pDraw);
+    pGCPriv->ops = pGC->ops; /* wrap the ops from now on */
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreChangeGC(GCPtr pGC, unsigned long mask) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ChangeGC)(pGC, mask);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst) {
+    NESTED_GC_FUNC_PROLOGUE(pGCDst);
+    (*pGCDst->funcs->CopyGC)(pGCSrc, mask, pGCDst);
+    NESTED_GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static void
+NestedCoreDestroyGC(GCPtr pGC) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->DestroyGC)(pGC);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreChangeClip(GCPtr pGC, int type, pointer pvalue, int nrects) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->ChangeClip)(pGC, type, pvalue, nrects);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreDestroyClip(GCPtr pGC) {
+    NESTED_GC_FUNC_PROLOGUE(pGC);
+    (*pGC->funcs->DestroyClip)(pGC);
+    NESTED_GC_FUNC_EPILOGUE(pGC);
+}
+
+static void
+NestedCoreCopyClip(GCPtr pGCDst, GCPtr pGCSrc) {
+    NESTED_GC_FUNC_PROLOGUE(pGCDst);
+    (*pGCDst->funcs->CopyClip)(pGCDst, pGCSrc);
+    NESTED_GC_FUNC_EPILOGUE(pGCDst);
+}
+
+static const GCFuncs NestedGCFuncs = {
+    NestedCoreValidateGC,
+    NestedCoreChangeGC,
+    NestedCoreCopyGC,
+    NestedCoreDestroyGC,
+    NestedCoreChangeClip,
+    NestedCoreDestroyClip,
+    NestedCoreCopyClip,
+};
+
+static Bool
+NestedCoreCreateGC(GCPtr pGC) {
+    ScreenPtr pScreen = pGC->pScreen;
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pScreen);
+    NestedGCPrivPtr pGCPriv = NESTED_GC_PRIV(pGC);
+    Bool ret;
+
+    pScreen->CreateGC = priv->CreateGC;
+    ret = (*pScreen->CreateGC)(pGC);
+    pScreen->CreateGC = NestedCoreCreateGC;
+
+    if (ret) {
+        pGCPriv->ops = NULL;
+        pGCPriv->funcs = pGC->funcs;
+        pGC->funcs = &NestedGCFuncs;
+    }
+
+    return ret;
+}
+
+Bool
+NestedCoreScreenInit(ScreenPtr pScreen, NestedClientPrivatePtr clientData) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedCoreScreenPtr priv;
+
+    if (!dixRegisterPrivateKey(&nestedGCPrivateKeyRec, PRIVATE_GC,
+                               sizeof(NestedGCPrivRec)))
+        return FALSE;
+
+    if (!NestedClientCoreInit(clientData))
+        return FALSE;
+
+    priv = calloc(1, sizeof(NestedCoreScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->clientData = clientData;
+    priv->CreateGC = pScreen->CreateGC;
+    pScreen->CreateGC = NestedCoreCreateGC;
+
+    NESTED_CORE_PRIV(pScreen) = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Forwarding core drawing to the host\n");
+    return TRUE;
+}
+
+void
+NestedCoreCloseScreen(ScreenPtr pScreen) {
+    NestedCoreScreenPtr priv = NESTED_CORE_PRIV(pScreen);
+
+    if (!priv)
+        return;
+
+    pScreen->CreateGC = priv->CreateGC;
+
+    free(priv);
+    NESTED_CORE_PRIV(pScreen) = NULL;
+}
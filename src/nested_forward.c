@@ -0,0 +1,100 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <shadow.h>
+#include "xf86Crtc.h"
+
+#include "nested_forward.h"
+
+static RegionPtr
+NestedForwardDamage(ScreenPtr pScreen) {
+    shadowBufPtr pBuf = shadowGetBuf(pScreen);
+
+    return pBuf && pBuf->pDamage ? DamageRegion(pBuf->pDamage) : NULL;
+}
+
+Bool
+NestedForwardCanDraw(DrawablePtr pDraw) {
+    ScreenPtr pScreen = pDraw->pScreen;
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+
+    if (pDraw->type != DRAWABLE_WINDOW ||
+        pDraw->depth != pScreen->rootDepth)
+        return FALSE;
+
+    /* The host window shows the rotated picture of another buffer */
+    if (XF86_CRTC_CONFIG_PTR(pScrn)->crtc[0]->rotation != RR_Rotate_0 ||
+        !NestedForwardDamage(pScreen))
+        return FALSE;
+
+    /* Redirected windows are drawn to their own pixmap */
+    return (*pScreen->GetWindowPixmap)((WindowPtr)pDraw) ==
+           (*pScreen->GetScreenPixmap)(pScreen);
+}
+
+Bool
+NestedForwardBegin(ScreenPtr pScreen, BoxPtr box, RegionPtr clip,
+                   NestedForwardOpPtr pOp) {
+    RegionPtr pDamage = NestedForwardDamage(pScreen);
+
+    if (box->x1 >= box->x2 || box->y1 >= box->y2)
+        return FALSE;
+
+    RegionInit(&pOp->drawn, box, 1);
+    RegionIntersect(&pOp->drawn, &pOp->drawn, clip);
+
+    if (!RegionNotEmpty(&pOp->drawn)) {
+        RegionUninit(&pOp->drawn);
+        return FALSE;
+    }
+
+    RegionNull(&pOp->pending);
+    RegionCopy(&pOp->pending, pDamage);
+    return TRUE;
+}
+
+/* Damage from before the operation is kept: it gets uploaded with the new
+ * content, which also fixes up what the host drew over stale pixels */
+void
+NestedForwardDone(ScreenPtr pScreen, NestedForwardOpPtr pOp, Bool forwarded) {
+    RegionPtr pDamage = NestedForwardDamage(pScreen);
+
+    if (forwarded && pDamage) {
+        RegionSubtract(pDamage, pDamage, &pOp->drawn);
+        RegionUnion(pDamage, pDamage, &pOp->pending);
+    }
+
+    RegionUninit(&pOp->drawn);
+    RegionUninit(&pOp->pending);
+}
+
+Bool
+NestedForwardPending(ScreenPtr pScreen, BoxPtr box) {
+    RegionPtr pDamage = NestedForwardDamage(pScreen);
+
+    return !pDamage || RegionContainsRect(pDamage, box) != rgnOUT;
+}
@@ -0,0 +1,51 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <xf86.h>
+
+/* Drawing replayed on the host window is still done by fb, so the frame
+ * buffer stays right for exposes, fallbacks and later uploads; only its
+ * upload is skipped. */
+typedef struct {
+    RegionRec drawn;   /* what the host drew, in screen coordinates */
+    RegionRec pending; /* shadow damage that wasn't uploaded yet */
+} NestedForwardOpRec, *NestedForwardOpPtr;
+
+// Tells whether drawing to pDraw lands in the frame buffer as the host
+// window shows it.
+Bool
+NestedForwardCanDraw(DrawablePtr pDraw);
+
+// Starts an operation drawing inside box, given in screen coordinates, and
+// clipped by clip. Returns FALSE if nothing would be drawn.
+Bool
+NestedForwardBegin(ScreenPtr pScreen, BoxPtr box, RegionPtr clip,
+                   NestedForwardOpPtr pOp);
+
+// Ends an operation, after fb drew it too. If the host drew it, what fb
+// drew needn't be uploaded.
+void
+NestedForwardDone(ScreenPtr pScreen, NestedForwardOpPtr pOp, Bool forwarded);
+
+// Tells whether a rectangle of the screen, in screen coordinates, waits to
+// be uploaded.
+Bool
+NestedForwardPending(ScreenPtr pScreen, BoxPtr box);
@@ -240,12 +240,33 @@ nested_input_on(OsTimerPtr timer, CARD32 time, pointer arg) {
     if(device->public.on)
     {
         pInfo->fd = NestedClientGetFileDescriptor(pNestedInput->clientData);
-        xf86FlushInput(pInfo->fd);
-        xf86AddEnabledDevice(pInfo);
+        if (pInfo->fd >= 0) {
+            xf86FlushInput(pInfo->fd);
+            xf86AddEnabledDevice(pInfo);
+        }
     }
     return 0;
 }
 
+void
+NestedInputSetFileDescriptor(DeviceIntPtr dev, int fd) {
+    InputInfoPtr pInfo = dev->public.devicePrivate;
+
+    /* Devices that aren't on yet get it from nested_input_on() */
+    if (!dev->public.on)
+        return;
+
+    if (pInfo->fd >= 0)
+        xf86RemoveEnabledDevice(pInfo);
+
+    pInfo->fd = fd;
+
+    if (fd >= 0) {
+        xf86FlushInput(fd);
+        xf86AddEnabledDevice(pInfo);
+    }
+}
+
 static int 
 NestedInputControl(DeviceIntPtr device, int what) {
     int err;
@@ -36,6 +36,10 @@
 void
 NestedInputLoadDriver(NestedClientPrivatePtr clientData);
 
+// Follows the host connection of the device, -1 while there is none.
+void
+NestedInputSetFileDescriptor(DeviceIntPtr dev, int fd);
+
 // Driver init functions.
 int
 NestedInputPreInit(InputDriverPtr drv, InputInfoPtr pInfo, int flags);
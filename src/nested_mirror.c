@@ -0,0 +1,778 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <scrnintstr.h>
+#include <pixmapstr.h>
+#include <regionstr.h>
+
+#include "nested_mirror.h"
+
+/* Larger damage is uploaded as its extents */
+#define NESTED_MIRROR_MAX_RECTS 16
+
+/* How often an idle mirror looks at the events of its host, in ms */
+#define NESTED_MIRROR_EVENT_INTERVAL 100
+
+/* How long closing the screen waits for the mirror threads, in ms; one
+ * stuck on its host is left to clean up after itself */
+#define NESTED_MIRROR_CLOSE_TIMEOUT 1000
+
+/* A mirror is only touched by the server while it is idle. Damage is
+ * copied to its frame buffer once per frame at most; while its thread is
+ * busy uploading, the damage of later frames piles up in one region, so a
+ * slow host skips frames instead of delaying anybody. */
+typedef enum {
+    NESTED_MIRROR_CONNECTING,
+    NESTED_MIRROR_IDLE,
+    NESTED_MIRROR_QUEUED, /* upload is ready for the thread */
+    NESTED_MIRROR_BUSY,
+    NESTED_MIRROR_LOST
+} NestedMirrorState;
+
+struct NestedMirrorScreen;
+
+typedef struct {
+    int shift; /* of the channel in a screen pixel */
+    int bits;
+    int hostShift; /* and in a pixel of the host */
+    int hostBits;
+} NestedMirrorChannel;
+
+/* Hosts with other masks than the screen are shown a converted copy of it,
+ * shared by all the mirrors with the same masks: each change is converted
+ * once, however many of them show it */
+typedef struct {
+    Pixel                      redMask;
+    Pixel                      greenMask;
+    Pixel                      blueMask;
+    NestedMirrorChannel        channels[3];
+    char                      *pixels; /* with the stride of the screen */
+    int                        width;
+    int                        height;
+    RegionRec                  stale; /* changed since it was converted */
+} NestedMirrorFormatRec, *NestedMirrorFormatPtr;
+
+typedef struct {
+    struct NestedMirrorScreen *screen;
+    char                      *displayName;
+    NestedMirrorState          state;
+    Bool                       wanted; /* the server has damage waiting */
+    Bool                       lost;   /* set by the thread, see state */
+    NestedClientPrivatePtr     clientData;
+    Pixel                      redMask; /* of the host, set when connected */
+    Pixel                      greenMask;
+    Pixel                      blueMask;
+    Bool                       formatKnown;
+    NestedMirrorFormatPtr      format; /* NULL for the screen pixels as such */
+    int                        width;
+    int                        height;
+    RegionRec                  pending; /* server side, not copied yet */
+    RegionRec                  upload;  /* copied, for the thread */
+    uint64_t                   frames;
+    uint64_t                   skipped;
+} NestedMirrorRec, *NestedMirrorPtr;
+
+typedef struct NestedMirrorScreen {
+    int                    scrnIndex;
+    NestedClientBackendPtr backend;
+    char                  *xauthority;
+    Bool                   fullscreen;
+    double                 scale;
+    int                    width;
+    int                    height;
+    int                    depth;
+    int                    bitsPerPixel;
+    Pixel                  redMask;
+    Pixel                  greenMask;
+    Pixel                  blueMask;
+    pthread_mutex_t        mutex;
+    pthread_cond_t         cond;
+    Bool                   quit;
+    Bool                   closed; /* the last thread to exit frees it all */
+    int                    numThreads;
+    int                    wakeFds[2]; /* threads tell the server they're idle */
+    pointer                handler;
+    int                    numMirrors;
+    NestedMirrorPtr        mirrors;
+    int                    numFormats;
+    NestedMirrorFormatPtr  formats; /* one per mirror at most */
+} NestedMirrorScreenRec, *NestedMirrorScreenPtr;
+
+static NestedMirrorScreenPtr nestedMirrorScreens[MAXSCREENS];
+
+#define NESTED_MIRROR_PRIV(pScreen) nestedMirrorScreens[(pScreen)->myNum]
+
+/* The mirror whose thread this is */
+static __thread NestedMirrorPtr nestedMirrorCurrent;
+
+Bool
+NestedMirrorHostCallback(void) {
+    return nestedMirrorCurrent != NULL;
+}
+
+Bool
+NestedMirrorHostDetached(void) {
+    if (!nestedMirrorCurrent)
+        return FALSE;
+
+    nestedMirrorCurrent->lost = TRUE;
+    return TRUE;
+}
+
+static void
+NestedMirrorUpload(NestedMirrorPtr m) {
+    BoxPtr boxes = RegionRects(&m->upload);
+    int i, numBoxes = RegionNumRects(&m->upload);
+
+    if (numBoxes > NESTED_MIRROR_MAX_RECTS) {
+        boxes = RegionExtents(&m->upload);
+        numBoxes = 1;
+    }
+
+    for (i = 0; i < numBoxes; i++)
+        NestedClientUpdateScreen(m->clientData, boxes[i].x1, boxes[i].y1,
+                                 boxes[i].x2, boxes[i].y2);
+
+    RegionEmpty(&m->upload);
+
+    NestedClientBeginSync(m->clientData);
+    NestedClientFinishSync(m->clientData);
+    m->frames++;
+}
+
+static Bool
+NestedMirrorConnect(NestedMirrorPtr m) {
+    NestedMirrorScreenPtr priv = m->screen;
+    Pixel redMask, greenMask, blueMask;
+
+    m->clientData = NestedClientCreateScreen(priv->backend, priv->scrnIndex,
+                                             m->displayName, priv->xauthority,
+                                             priv->fullscreen, FALSE, FALSE,
+                                             priv->width, priv->height,
+                                             priv->width, priv->height,
+                                             0, 0, priv->scale, priv->depth,
+                                             priv->bitsPerPixel, &redMask,
+                                             &greenMask, &blueMask);
+    if (!m->clientData) {
+        NestedClientMsg(priv->scrnIndex, X_ERROR, "Can't mirror to %s\n",
+                        m->displayName);
+        return FALSE;
+    }
+
+    /* Other masks are converted to a pixel at a time, see
+     * NestedMirrorConvert() */
+    if ((redMask != priv->redMask || greenMask != priv->greenMask ||
+         blueMask != priv->blueMask) &&
+        priv->bitsPerPixel != 16 && priv->bitsPerPixel != 32) {
+        NestedClientMsg(priv->scrnIndex, X_ERROR,
+                        "Mirror %s has another visual, not mirroring\n",
+                        m->displayName);
+        NestedClientCloseScreen(m->clientData);
+        m->clientData = NULL;
+        return FALSE;
+    }
+
+    m->redMask = redMask;
+    m->greenMask = greenMask;
+    m->blueMask = blueMask;
+    m->width = priv->width;
+    m->height = priv->height;
+
+    NestedClientMsg(priv->scrnIndex, X_INFO, "Mirroring to %s\n",
+                    m->displayName);
+    return TRUE;
+}
+
+static void
+NestedMirrorFree(NestedMirrorScreenPtr priv);
+
+static void
+NestedMirrorWake(NestedMirrorScreenPtr priv) {
+    char byte = 0;
+
+    /* If the pipe is full, a wakeup is pending already */
+    while (write(priv->wakeFds[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+}
+
+static void *
+NestedMirrorThread(void *arg) {
+    NestedMirrorPtr m = arg;
+    NestedMirrorScreenPtr priv = m->screen;
+    struct timespec deadline;
+    Bool connected, upload, last;
+    uint64_t skipped;
+
+    nestedMirrorCurrent = m;
+
+    /* The server logs what this thread has to say when it wakes up */
+    NestedClientDeferMessages(TRUE);
+
+    connected = NestedMirrorConnect(m);
+
+    pthread_mutex_lock(&priv->mutex);
+
+    m->state = connected ? NESTED_MIRROR_IDLE : NESTED_MIRROR_LOST;
+    NestedMirrorWake(priv);
+
+    while (m->state != NESTED_MIRROR_LOST && !priv->quit) {
+        /* The events are looked at now and then even without uploads, so
+         * they don't pile up and exposed windows get repainted */
+        if (m->state == NESTED_MIRROR_IDLE) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += NESTED_MIRROR_EVENT_INTERVAL * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            if (pthread_cond_timedwait(&priv->cond, &priv->mutex,
+                                       &deadline) != ETIMEDOUT ||
+                m->state != NESTED_MIRROR_IDLE)
+                continue;
+        }
+
+        upload = m->state == NESTED_MIRROR_QUEUED;
+        m->state = NESTED_MIRROR_BUSY;
+        pthread_mutex_unlock(&priv->mutex);
+
+        if (upload)
+            NestedMirrorUpload(m);
+
+        NestedClientCheckEvents(m->clientData);
+
+        pthread_mutex_lock(&priv->mutex);
+
+        if (m->lost) {
+            NestedClientMsg(priv->scrnIndex, X_WARNING,
+                            "Lost the mirror on %s\n", m->displayName);
+            m->state = NESTED_MIRROR_LOST;
+            NestedMirrorWake(priv);
+        } else
+            m->state = NESTED_MIRROR_IDLE;
+
+        if (m->wanted) {
+            m->wanted = FALSE;
+            NestedMirrorWake(priv);
+        }
+    }
+
+    /* The server leaves a lost mirror alone, and is done with all of them
+     * once it quits */
+    skipped = m->skipped;
+    pthread_mutex_unlock(&priv->mutex);
+
+    if (m->clientData) {
+        NestedClientMsg(priv->scrnIndex, X_INFO,
+                        "Mirror %s: %llu frames shown, %llu skipped\n",
+                        m->displayName, (unsigned long long)m->frames,
+                        (unsigned long long)skipped);
+        NestedClientCloseScreen(m->clientData);
+        m->clientData = NULL;
+    }
+
+    pthread_mutex_lock(&priv->mutex);
+    last = --priv->numThreads == 0 && priv->closed;
+    pthread_cond_broadcast(&priv->cond);
+    pthread_mutex_unlock(&priv->mutex);
+
+    if (last)
+        NestedMirrorFree(priv);
+
+    return NULL;
+}
+
+static void
+NestedMirrorMaskChannel(Pixel mask, int *shift, int *bits) {
+    *shift = 0;
+    *bits = 0;
+
+    if (!mask)
+        return;
+
+    while (!(mask & 1)) {
+        mask >>= 1;
+        (*shift)++;
+    }
+
+    while (mask & 1) {
+        mask >>= 1;
+        (*bits)++;
+    }
+}
+
+/* The format of the mirrors with the masks of m, shared with those found
+ * before; NULL if the screen pixels do */
+static NestedMirrorFormatPtr
+NestedMirrorGetFormat(NestedMirrorScreenPtr priv, NestedMirrorPtr m) {
+    Pixel screenMasks[3] = { priv->redMask, priv->greenMask, priv->blueMask };
+    Pixel hostMasks[3] = { m->redMask, m->greenMask, m->blueMask };
+    NestedMirrorFormatPtr f;
+    int i;
+
+    if (m->redMask == priv->redMask && m->greenMask == priv->greenMask &&
+        m->blueMask == priv->blueMask)
+        return NULL;
+
+    for (i = 0; i < priv->numFormats; i++) {
+        f = &priv->formats[i];
+        if (f->redMask == m->redMask && f->greenMask == m->greenMask &&
+            f->blueMask == m->blueMask)
+            return f;
+    }
+
+    f = &priv->formats[priv->numFormats++];
+    f->redMask = m->redMask;
+    f->greenMask = m->greenMask;
+    f->blueMask = m->blueMask;
+
+    for (i = 0; i < 3; i++) {
+        NestedMirrorMaskChannel(screenMasks[i], &f->channels[i].shift,
+                                &f->channels[i].bits);
+        NestedMirrorMaskChannel(hostMasks[i], &f->channels[i].hostShift,
+                                &f->channels[i].hostBits);
+    }
+
+    /* Converted in full on first use */
+    RegionNull(&f->stale);
+    return f;
+}
+
+static CARD32
+NestedMirrorConvertPixel(NestedMirrorFormatPtr f, CARD32 pixel) {
+    CARD32 out = 0, v;
+    int i, up;
+
+    for (i = 0; i < 3; i++) {
+        const NestedMirrorChannel *c = &f->channels[i];
+
+        if (!c->bits || !c->hostBits)
+            continue;
+
+        v = (pixel >> c->shift) & ((1U << c->bits) - 1);
+
+        /* Widened channels repeat their top bits, so white stays white */
+        if (c->hostBits <= c->bits) {
+            v >>= c->bits - c->hostBits;
+        } else {
+            up = c->hostBits - c->bits;
+            v = (v << up) | (up <= c->bits ? v >> (c->bits - up) : 0);
+        }
+
+        out |= v << c->hostShift;
+    }
+
+    return out;
+}
+
+/* Brings the part of the converted copy under pRegion up to date */
+static Bool
+NestedMirrorConvert(NestedMirrorScreenPtr priv, NestedMirrorFormatPtr f,
+                    PixmapPtr pPixmap, RegionPtr pRegion) {
+    int width = pPixmap->drawable.width;
+    int height = pPixmap->drawable.height;
+    int stride = pPixmap->devKind;
+    const char *src = pPixmap->devPrivate.ptr;
+    RegionRec convert;
+    BoxPtr boxes;
+    int i, x, y, numBoxes;
+
+    if (width != f->width || height != f->height) {
+        BoxRec box = { 0, 0, width, height };
+        char *pixels = realloc(f->pixels, (size_t)stride * height);
+
+        if (!pixels)
+            return FALSE;
+
+        f->pixels = pixels;
+        f->width = width;
+        f->height = height;
+        RegionReset(&f->stale, &box);
+    }
+
+    RegionNull(&convert);
+    RegionIntersect(&convert, &f->stale, pRegion);
+    RegionSubtract(&f->stale, &f->stale, &convert);
+
+    boxes = RegionRects(&convert);
+    numBoxes = RegionNumRects(&convert);
+
+    for (i = 0; i < numBoxes; i++) {
+        for (y = boxes[i].y1; y < boxes[i].y2; y++) {
+            size_t offset = (size_t)y * stride;
+
+            if (priv->bitsPerPixel == 16) {
+                const CARD16 *s = (const CARD16 *)(src + offset);
+                CARD16 *d = (CARD16 *)(f->pixels + offset);
+
+                for (x = boxes[i].x1; x < boxes[i].x2; x++)
+                    d[x] = NestedMirrorConvertPixel(f, s[x]);
+            } else {
+                const CARD32 *s = (const CARD32 *)(src + offset);
+                CARD32 *d = (CARD32 *)(f->pixels + offset);
+
+                for (x = boxes[i].x1; x < boxes[i].x2; x++)
+                    d[x] = NestedMirrorConvertPixel(f, s[x]);
+            }
+        }
+    }
+
+    RegionUninit(&convert);
+    return TRUE;
+}
+
+/* Called with the mutex held, for an idle mirror */
+static void
+NestedMirrorCopy(NestedMirrorScreenPtr priv, NestedMirrorPtr m,
+                 PixmapPtr pPixmap) {
+    int width = pPixmap->drawable.width;
+    int height = pPixmap->drawable.height;
+    int cpp = pPixmap->drawable.bitsPerPixel / 8;
+    int stride = pPixmap->devKind;
+    const char *src = pPixmap->devPrivate.ptr;
+    char *dst;
+    BoxPtr boxes;
+    int i, y, numBoxes;
+
+    if (!m->formatKnown) {
+        m->format = NestedMirrorGetFormat(priv, m);
+        m->formatKnown = TRUE;
+    }
+
+    /* Both frame buffers have the PixmapBytePad() stride of their width */
+    if (width != m->width || height != m->height) {
+        BoxRec box = { 0, 0, width, height };
+        Bool resized;
+
+        /* Callbacks from here are the mirror's too */
+        nestedMirrorCurrent = m;
+        resized = NestedClientResizeFrameBuffer(m->clientData, width, height);
+        if (resized)
+            NestedClientResizeWindow(m->clientData, width, height);
+        nestedMirrorCurrent = NULL;
+
+        if (!resized || m->lost) {
+            xf86DrvMsg(priv->scrnIndex, X_ERROR,
+                       "Can't resize the mirror on %s\n", m->displayName);
+            m->state = NESTED_MIRROR_LOST;
+            return;
+        }
+
+        m->width = width;
+        m->height = height;
+        RegionReset(&m->pending, &box);
+    }
+
+    if (m->format) {
+        if (!NestedMirrorConvert(priv, m->format, pPixmap, &m->pending)) {
+            m->wanted = TRUE;
+            return;
+        }
+        src = m->format->pixels;
+    }
+
+    dst = NestedClientGetFrameBuffer(m->clientData);
+    boxes = RegionRects(&m->pending);
+    numBoxes = RegionNumRects(&m->pending);
+
+    for (i = 0; i < numBoxes; i++) {
+        size_t offset = (size_t)boxes[i].y1 * stride + boxes[i].x1 * cpp;
+        size_t len = (size_t)(boxes[i].x2 - boxes[i].x1) * cpp;
+
+        for (y = boxes[i].y1; y < boxes[i].y2; y++, offset += stride)
+            memcpy(dst + offset, src + offset, len);
+    }
+
+    RegionCopy(&m->upload, &m->pending);
+    RegionEmpty(&m->pending);
+    m->state = NESTED_MIRROR_QUEUED;
+}
+
+/* newFrame tells damage of a new frame from a mirror that became idle */
+static void
+NestedMirrorKick(ScreenPtr pScreen, NestedMirrorScreenPtr priv,
+                 Bool newFrame) {
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    Bool queued = FALSE;
+    int i;
+
+    if (!pPixmap || !pPixmap->devPrivate.ptr)
+        return;
+
+    pthread_mutex_lock(&priv->mutex);
+
+    for (i = 0; i < priv->numMirrors; i++) {
+        NestedMirrorPtr m = &priv->mirrors[i];
+
+        if (!RegionNotEmpty(&m->pending))
+            continue;
+
+        switch (m->state) {
+        case NESTED_MIRROR_IDLE:
+            NestedMirrorCopy(priv, m, pPixmap);
+            queued = queued || m->state == NESTED_MIRROR_QUEUED;
+            break;
+        case NESTED_MIRROR_LOST:
+            RegionEmpty(&m->pending);
+            break;
+        default:
+            if (newFrame)
+                m->skipped++;
+            m->wanted = TRUE;
+            break;
+        }
+    }
+
+    if (queued)
+        pthread_cond_broadcast(&priv->cond);
+
+    pthread_mutex_unlock(&priv->mutex);
+}
+
+static void
+NestedMirrorWakeup(int fd, pointer data) {
+    ScreenPtr pScreen = data;
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    NestedClientFlushMessages();
+    NestedMirrorKick(pScreen, NESTED_MIRROR_PRIV(pScreen), FALSE);
+}
+
+/* Runs on the server or on the last mirror thread, whichever is done last;
+ * the general handler is already gone */
+static void
+NestedMirrorFree(NestedMirrorScreenPtr priv) {
+    int i;
+
+    for (i = 0; i < priv->numMirrors; i++) {
+        NestedMirrorPtr m = &priv->mirrors[i];
+
+        if (m->clientData)
+            NestedClientCloseScreen(m->clientData);
+
+        RegionUninit(&m->pending);
+        RegionUninit(&m->upload);
+        free(m->displayName);
+    }
+
+    for (i = 0; i < priv->numFormats; i++) {
+        RegionUninit(&priv->formats[i].stale);
+        free(priv->formats[i].pixels);
+    }
+
+    close(priv->wakeFds[0]);
+    close(priv->wakeFds[1]);
+    pthread_mutex_destroy(&priv->mutex);
+    pthread_cond_destroy(&priv->cond);
+    free(priv->mirrors);
+    free(priv->formats);
+    free(priv->xauthority);
+    free(priv);
+}
+
+Bool
+NestedMirrorScreenInit(ScreenPtr pScreen, NestedClientBackendPtr backend,
+                       const char *displays, const char *xauthority,
+                       Bool fullscreen, double scale, Pixel redMask,
+                       Pixel greenMask, Pixel blueMask) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedMirrorScreenPtr priv;
+    char *list, *name, *save;
+    BoxRec box = { 0, 0, pScrn->virtualX, pScrn->virtualY };
+    sigset_t allSignals, oldSignals;
+    pthread_t thread;
+    int i;
+
+    priv = calloc(1, sizeof(NestedMirrorScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->scrnIndex = pScrn->scrnIndex;
+    priv->backend = backend;
+    priv->xauthority = xauthority ? strdup(xauthority) : NULL;
+    priv->fullscreen = fullscreen;
+    priv->scale = scale;
+    priv->width = pScrn->virtualX;
+    priv->height = pScrn->virtualY;
+    priv->depth = pScrn->depth;
+    priv->bitsPerPixel = pScrn->bitsPerPixel;
+    priv->redMask = redMask;
+    priv->greenMask = greenMask;
+    priv->blueMask = blueMask;
+    pthread_mutex_init(&priv->mutex, NULL);
+    pthread_cond_init(&priv->cond, NULL);
+
+    if (pipe(priv->wakeFds) < 0) {
+        priv->wakeFds[0] = priv->wakeFds[1] = -1;
+        NestedMirrorFree(priv);
+        return FALSE;
+    }
+
+    for (i = 0; i < 2; i++) {
+        fcntl(priv->wakeFds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(priv->wakeFds[i], F_SETFL, O_NONBLOCK);
+    }
+
+    list = strdup(displays);
+    priv->mirrors = calloc(strlen(displays) / 2 + 1, sizeof(NestedMirrorRec));
+    priv->formats = calloc(strlen(displays) / 2 + 1,
+                           sizeof(NestedMirrorFormatRec));
+    if (!list || !priv->mirrors || !priv->formats) {
+        free(list);
+        NestedMirrorFree(priv);
+        return FALSE;
+    }
+
+    for (name = strtok_r(list, ", ", &save); name;
+         name = strtok_r(NULL, ", ", &save)) {
+        NestedMirrorPtr m = &priv->mirrors[priv->numMirrors++];
+
+        m->screen = priv;
+        m->displayName = strdup(name);
+        m->state = NESTED_MIRROR_CONNECTING;
+        RegionInit(&m->pending, &box, 1);
+        RegionNull(&m->upload);
+    }
+
+    free(list);
+
+    priv->handler = xf86AddGeneralHandler(priv->wakeFds[0],
+                                          NestedMirrorWakeup, pScreen);
+
+    /* Connecting takes host round trips, the threads do that too. They
+     * are never joined, one may be stuck connecting to a dead host; signals
+     * (input, timers, ...) must keep going to the server thread. */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    for (i = 0; i < priv->numMirrors; i++) {
+        NestedMirrorPtr m = &priv->mirrors[i];
+
+        if (!m->displayName) {
+            m->state = NESTED_MIRROR_LOST;
+            continue;
+        }
+
+        /* Counted first, the thread may be gone before pthread_create()
+         * returns */
+        pthread_mutex_lock(&priv->mutex);
+        priv->numThreads++;
+        pthread_mutex_unlock(&priv->mutex);
+
+        if (pthread_create(&thread, NULL, NestedMirrorThread, m) != 0) {
+            pthread_mutex_lock(&priv->mutex);
+            priv->numThreads--;
+            m->state = NESTED_MIRROR_LOST;
+            pthread_mutex_unlock(&priv->mutex);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    NESTED_MIRROR_PRIV(pScreen) = priv;
+    return TRUE;
+}
+
+void
+NestedMirrorUpdate(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedMirrorScreenPtr priv = NESTED_MIRROR_PRIV(pScreen);
+    int i;
+
+    if (!priv)
+        return;
+
+    /* Only the server thread touches the pending and stale regions */
+    for (i = 0; i < priv->numMirrors; i++)
+        RegionUnion(&priv->mirrors[i].pending, &priv->mirrors[i].pending,
+                    pRegion);
+
+    for (i = 0; i < priv->numFormats; i++)
+        RegionUnion(&priv->formats[i].stale, &priv->formats[i].stale,
+                    pRegion);
+
+    NestedMirrorKick(pScreen, priv, TRUE);
+}
+
+void
+NestedMirrorCloseScreen(ScreenPtr pScreen) {
+    NestedMirrorScreenPtr priv = NESTED_MIRROR_PRIV(pScreen);
+    struct timespec deadline;
+    Bool last;
+
+    if (!priv)
+        return;
+
+    NESTED_MIRROR_PRIV(pScreen) = NULL;
+    xf86RemoveGeneralHandler(priv->handler);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += NESTED_MIRROR_CLOSE_TIMEOUT / 1000;
+    deadline.tv_nsec += (NESTED_MIRROR_CLOSE_TIMEOUT % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&priv->mutex);
+    priv->quit = TRUE;
+    pthread_cond_broadcast(&priv->cond);
+
+    while (priv->numThreads > 0 &&
+           pthread_cond_timedwait(&priv->cond, &priv->mutex,
+                                  &deadline) != ETIMEDOUT)
+        ;
+
+    if (priv->numThreads > 0)
+        xf86DrvMsg(priv->scrnIndex, X_WARNING,
+                   "%d mirror hosts still busy, leaving them behind\n",
+                   priv->numThreads);
+
+    priv->closed = TRUE;
+    last = priv->numThreads == 0;
+    pthread_mutex_unlock(&priv->mutex);
+
+    NestedClientFlushMessages();
+
+    if (last)
+        NestedMirrorFree(priv);
+}
@@ -0,0 +1,51 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <xf86.h>
+
+#include "client.h"
+
+// Shows the screen in a window on each of the comma separated displays too,
+// through the given backend. Each mirror connects and uploads from a thread
+// of its own, so a slow one never holds up the screen or the others.
+Bool
+NestedMirrorScreenInit(ScreenPtr pScreen, NestedClientBackendPtr backend,
+                       const char *displays, const char *xauthority,
+                       Bool fullscreen, double scale, Pixel redMask,
+                       Pixel greenMask, Pixel blueMask);
+
+// Copies the damaged part of the screen pixmap to the idle mirrors and
+// queues the rest for when they are done.
+void
+NestedMirrorUpdate(ScreenPtr pScreen, RegionPtr pRegion);
+
+// Waits for the mirror threads and closes the mirror windows.
+void
+NestedMirrorCloseScreen(ScreenPtr pScreen);
+
+// The backends call back with the scrnIndex of the screen. These tell the
+// driver whether the host of a mirror is calling, which the screen must not
+// react to. NestedMirrorHostDetached() drops the mirror if so.
+Bool
+NestedMirrorHostCallback(void);
+
+Bool
+NestedMirrorHostDetached(void);
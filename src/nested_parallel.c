@@ -0,0 +1,692 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <fb.h>
+#include <gcstruct.h>
+#include <picturestr.h>
+#include <mipict.h>
+#include <servermd.h>
+
+#include "compat-api.h"
+#include "nested_parallel.h"
+
+/* Bands are never thinner than this, so each thread gets a few of them to
+ * balance the load without paying the setup of a band too often */
+#define NESTED_PARALLEL_MIN_BAND_HEIGHT 16
+#define NESTED_PARALLEL_BANDS_PER_THREAD 4
+
+typedef void (*NestedParallelBandProc)(void *closure, int y1, int y2);
+
+/* Each thread starts on a contiguous run of bands and takes them from the
+ * front; once it runs dry it steals from the back of the others' runs. */
+typedef struct {
+    pthread_mutex_t lock;
+    int             next;
+    int             end;
+} NestedParallelQueueRec, *NestedParallelQueuePtr;
+
+typedef struct {
+    int                    numThreads; /* including the server thread */
+    pthread_t             *threads;
+    NestedParallelQueuePtr queues;
+    pthread_mutex_t        lock;
+    pthread_cond_t         start;
+    pthread_cond_t         done;
+    unsigned int           generation; /* bumped for each operation */
+    int                    busyThreads;
+    Bool                   quit;
+    unsigned long          steals;
+
+    /* The operation being drawn */
+    NestedParallelBandProc proc;
+    void                  *closure;
+    int                    y1;
+    int                    y2;
+    int                    bandHeight;
+    int                    numBands;
+} NestedParallelPoolRec, *NestedParallelPoolPtr;
+
+enum {
+    NESTED_PARALLEL_COMPOSITE,
+    NESTED_PARALLEL_FILL,
+    NESTED_PARALLEL_PUT_IMAGE,
+    NESTED_PARALLEL_NUM_OPS
+};
+
+static const char *nestedParallelOpNames[NESTED_PARALLEL_NUM_OPS] = {
+    "Composite", "PolyFillRect", "PutImage"
+};
+
+typedef struct {
+    unsigned long serial;   /* left to fb as they came */
+    unsigned long parallel; /* split into bands */
+    unsigned long pixels;   /* drawn by split operations */
+} NestedParallelCounterRec;
+
+typedef struct {
+    int                      threshold;
+    CompositeProcPtr         Composite;
+    CreateGCProcPtr          CreateGC;
+    CloseScreenProcPtr       CloseScreen;
+    GCOps                    ops; /* fb's, with ours in between */
+    NestedParallelCounterRec counters[NESTED_PARALLEL_NUM_OPS];
+} NestedParallelScreenRec, *NestedParallelScreenPtr;
+
+static NestedParallelScreenPtr nestedParallelScreens[MAXSCREENS];
+
+/* All screens are drawn from the server thread, so they share one pool */
+static NestedParallelPoolPtr nestedParallelPool;
+static int nestedParallelPoolUsers;
+
+#define NESTED_PARALLEL_PRIV(pScreen) nestedParallelScreens[(pScreen)->myNum]
+
+static int
+NestedParallelTake(NestedParallelQueuePtr queue, Bool steal) {
+    int band = -1;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->next < queue->end)
+        band = steal ? --queue->end : queue->next++;
+
+    pthread_mutex_unlock(&queue->lock);
+    return band;
+}
+
+static void
+NestedParallelRunBand(NestedParallelPoolPtr pool, int band) {
+    int y1 = pool->y1 + band * pool->bandHeight;
+
+    (*pool->proc)(pool->closure, y1, min(y1 + pool->bandHeight, pool->y2));
+}
+
+static void
+NestedParallelWork(NestedParallelPoolPtr pool, int self) {
+    unsigned long steals = 0;
+    int band, i;
+
+    while ((band = NestedParallelTake(&pool->queues[self], FALSE)) >= 0)
+        NestedParallelRunBand(pool, band);
+
+    for (i = 1; i < pool->numThreads; i++) {
+        NestedParallelQueuePtr victim =
+            &pool->queues[(self + i) % pool->numThreads];
+
+        while ((band = NestedParallelTake(victim, TRUE)) >= 0) {
+            NestedParallelRunBand(pool, band);
+            steals++;
+        }
+    }
+
+    if (steals) {
+        pthread_mutex_lock(&pool->lock);
+        pool->steals += steals;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *
+NestedParallelThread(void *data) {
+    NestedParallelPoolPtr pool = data;
+    unsigned int generation = 0;
+    int self;
+
+    pthread_mutex_lock(&pool->lock);
+
+    /* Threads are numbered from 1 in the order they start */
+    self = pool->numThreads - pool->busyThreads;
+    pool->busyThreads--;
+    pthread_cond_signal(&pool->done);
+
+    for (;;) {
+        while (!pool->quit && generation == pool->generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+
+        if (pool->quit)
+            break;
+
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        NestedParallelWork(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busyThreads == 0)
+            pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void
+NestedParallelDestroyPool(NestedParallelPoolPtr pool, int numStarted) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < numStarted; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (i = 0; i < pool->numThreads; i++)
+        pthread_mutex_destroy(&pool->queues[i].lock);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+}
+
+static NestedParallelPoolPtr
+NestedParallelCreatePool(int numThreads) {
+    NestedParallelPoolPtr pool = calloc(1, sizeof(NestedParallelPoolRec));
+    sigset_t allSignals, oldSignals;
+    int i, numStarted = 0;
+
+    if (!pool)
+        return NULL;
+
+    pool->numThreads = numThreads;
+    pool->threads = calloc(numThreads - 1, sizeof(pthread_t));
+    pool->queues = calloc(numThreads, sizeof(NestedParallelQueueRec));
+
+    if (!pool->threads || !pool->queues) {
+        free(pool->queues);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < numThreads; i++)
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+    /* Signals (input, timers, ...) must keep going to the server thread */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busyThreads = numThreads - 1;
+
+    for (i = 0; i < numThreads - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL,
+                           NestedParallelThread, pool))
+            break;
+        numStarted++;
+    }
+
+    /* Wait until all threads know their number */
+    pool->busyThreads -= numThreads - 1 - numStarted;
+    while (pool->busyThreads > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    if (numStarted < numThreads - 1) {
+        NestedParallelDestroyPool(pool, numStarted);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/* Draws lines y1 to y2 in bands and returns once all of them are done.
+ * Bands are disjoint sets of lines, so no pixel is touched by two threads
+ * and each one is drawn exactly as fb would. */
+static void
+NestedParallelRun(NestedParallelBandProc proc, void *closure, int y1, int y2) {
+    NestedParallelPoolPtr pool = nestedParallelPool;
+    int height = y2 - y1;
+    int numBands = min(pool->numThreads * NESTED_PARALLEL_BANDS_PER_THREAD,
+                       max(1, height / NESTED_PARALLEL_MIN_BAND_HEIGHT));
+    int i;
+
+    pool->proc = proc;
+    pool->closure = closure;
+    pool->y1 = y1;
+    pool->y2 = y2;
+    pool->bandHeight = (height + numBands - 1) / numBands;
+    pool->numBands = (height + pool->bandHeight - 1) / pool->bandHeight;
+
+    for (i = 0; i < pool->numThreads; i++) {
+        pool->queues[i].next = pool->numBands * i / pool->numThreads;
+        pool->queues[i].end = pool->numBands * (i + 1) / pool->numThreads;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busyThreads = pool->numThreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    NestedParallelWork(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busyThreads > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static PixmapPtr
+NestedParallelGetPixmap(DrawablePtr pDraw) {
+    if (pDraw->type == DRAWABLE_WINDOW)
+        return (*pDraw->pScreen->GetWindowPixmap)((WindowPtr)pDraw);
+
+    return (PixmapPtr)pDraw;
+}
+
+/* Bands of the destination can only be drawn independently if they don't
+ * read what another band writes */
+static Bool
+NestedParallelCanSplitPicture(PicturePtr pict, PixmapPtr pDstPixmap) {
+    if (!pict)
+        return TRUE;
+
+    if (pict->alphaMap)
+        return FALSE;
+
+    return !pict->pDrawable ||
+           NestedParallelGetPixmap(pict->pDrawable) != pDstPixmap;
+}
+
+typedef struct {
+    CARD8      op;
+    PicturePtr pSrc;
+    PicturePtr pMask;
+    PicturePtr pDst;
+    INT16      xSrc, ySrc;
+    INT16      xMask, yMask;
+    INT16      xDst, yDst;
+    CARD16     width;
+} NestedParallelCompositeRec;
+
+/* Does what fbComposite() does, for the lines of the band. Every band makes
+ * its own pixman images, so no pixman state is shared between threads. */
+static void
+NestedParallelCompositeBand(void *closure, int y1, int y2) {
+    NestedParallelCompositeRec *c = closure;
+    pixman_image_t *src, *mask, *dst;
+    int srcXoff, srcYoff, maskXoff, maskYoff, dstXoff, dstYoff;
+    int dy = y1 - c->yDst;
+
+    src = image_from_pict(c->pSrc, FALSE, &srcXoff, &srcYoff);
+    mask = image_from_pict(c->pMask, FALSE, &maskXoff, &maskYoff);
+    dst = image_from_pict(c->pDst, TRUE, &dstXoff, &dstYoff);
+
+    if (src && dst && !(c->pMask && !mask))
+        pixman_image_composite(c->op, src, mask, dst,
+                               c->xSrc + srcXoff, c->ySrc + dy + srcYoff,
+                               c->xMask + maskXoff, c->yMask + dy + maskYoff,
+                               c->xDst + dstXoff, y1 + dstYoff,
+                               c->width, y2 - y1);
+
+    free_pixman_pict(c->pSrc, src);
+    free_pixman_pict(c->pMask, mask);
+    free_pixman_pict(c->pDst, dst);
+}
+
+static void
+NestedParallelComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+                        PicturePtr pDst, INT16 xSrc, INT16 ySrc,
+                        INT16 xMask, INT16 yMask, INT16 xDst, INT16 yDst,
+                        CARD16 width, CARD16 height) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    NestedParallelScreenPtr priv = NESTED_PARALLEL_PRIV(pScreen);
+    NestedParallelCounterRec *counter =
+        &priv->counters[NESTED_PARALLEL_COMPOSITE];
+    PixmapPtr pDstPixmap = NestedParallelGetPixmap(pDst->pDrawable);
+    NestedParallelCompositeRec c = {
+        op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask, xDst, yDst, width
+    };
+
+    if ((long)width * height < priv->threshold ||
+        height < 2 * NESTED_PARALLEL_MIN_BAND_HEIGHT || pDst->alphaMap ||
+        !NestedParallelCanSplitPicture(pSrc, pDstPixmap) ||
+        !NestedParallelCanSplitPicture(pMask, pDstPixmap)) {
+        counter->serial++;
+        (*priv->Composite)(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
+                           xDst, yDst, width, height);
+        return;
+    }
+
+    /* May take the software cursor down, so not from the threads */
+    miCompositeSourceValidate(pSrc);
+    if (pMask)
+        miCompositeSourceValidate(pMask);
+
+    NestedParallelRun(NestedParallelCompositeBand, &c, yDst, yDst + height);
+
+    counter->parallel++;
+    counter->pixels += (unsigned long)width * height;
+}
+
+typedef struct {
+    FbBits   *dst;
+    FbStride  stride;
+    int       bpp;
+    int       xoff, yoff;
+    FbBits    and, xor;
+    BoxPtr    boxes; /* screen coordinates */
+    int       numBoxes;
+} NestedParallelFillRec;
+
+/* Does what fbFill() does for solid fills, for the lines of the band */
+static void
+NestedParallelFillBand(void *closure, int y1, int y2) {
+    NestedParallelFillRec *f = closure;
+    int i;
+
+    for (i = 0; i < f->numBoxes; i++) {
+        BoxPtr box = &f->boxes[i];
+        int x = box->x1, width = box->x2 - box->x1;
+        int y = max(box->y1, y1);
+        int height = min(box->y2, y2) - y;
+
+        if (height <= 0)
+            continue;
+
+        if (f->and ||
+            !pixman_fill((uint32_t *)f->dst, f->stride, f->bpp,
+                         x + f->xoff, y + f->yoff, width, height, f->xor))
+            fbSolid(f->dst + (y + f->yoff) * f->stride, f->stride,
+                    (x + f->xoff) * f->bpp, f->bpp, width * f->bpp, height,
+                    f->and, f->xor);
+    }
+}
+
+/* The rectangles clipped like fbPolyFillRect() clips them, and the pixels
+ * they cover. Returns NULL if there are too few of them. */
+static BoxPtr
+NestedParallelClipRects(DrawablePtr pDraw, GCPtr pGC, int nrect,
+                        xRectangle *prect, int threshold,
+                        int *retNumBoxes, int *retY1, int *retY2) {
+    RegionPtr pClip = fbGetCompositeClip(pGC);
+    BoxPtr clipBoxes = RegionRects(pClip);
+    int numClipBoxes = RegionNumRects(pClip);
+    BoxPtr boxes;
+    long pixels = 0;
+    int i, j, n = 0;
+    int y1 = MAXSHORT, y2 = MINSHORT;
+
+    if (!nrect || !numClipBoxes ||
+        nrect > INT_MAX / numClipBoxes / (int)sizeof(BoxRec))
+        return NULL;
+
+    boxes = malloc(nrect * numClipBoxes * sizeof(BoxRec));
+    if (!boxes)
+        return NULL;
+
+    for (i = 0; i < nrect; i++) {
+        int x1 = prect[i].x + pDraw->x;
+        int ry1 = prect[i].y + pDraw->y;
+        int x2 = x1 + prect[i].width;
+        int ry2 = ry1 + prect[i].height;
+
+        for (j = 0; j < numClipBoxes; j++) {
+            BoxRec box;
+
+            box.x1 = max(x1, clipBoxes[j].x1);
+            box.y1 = max(ry1, clipBoxes[j].y1);
+            box.x2 = min(x2, clipBoxes[j].x2);
+            box.y2 = min(ry2, clipBoxes[j].y2);
+
+            if (box.x1 >= box.x2 || box.y1 >= box.y2)
+                continue;
+
+            pixels += (long)(box.x2 - box.x1) * (box.y2 - box.y1);
+            y1 = min(y1, box.y1);
+            y2 = max(y2, box.y2);
+            boxes[n++] = box;
+        }
+    }
+
+    if (pixels < threshold || y2 - y1 < 2 * NESTED_PARALLEL_MIN_BAND_HEIGHT) {
+        free(boxes);
+        return NULL;
+    }
+
+    *retNumBoxes = n;
+    *retY1 = y1;
+    *retY2 = y2;
+    return boxes;
+}
+
+static void
+NestedParallelPolyFillRect(DrawablePtr pDraw, GCPtr pGC,
+                           int nrect, xRectangle *prect) {
+    NestedParallelScreenPtr priv = NESTED_PARALLEL_PRIV(pDraw->pScreen);
+    NestedParallelCounterRec *counter = &priv->counters[NESTED_PARALLEL_FILL];
+    FbGCPrivPtr pPriv = fbGetGCPrivate(pGC);
+    NestedParallelFillRec f;
+    BoxPtr boxes = NULL;
+    int y1, y2, i;
+
+    if (pGC->fillStyle == FillSolid)
+        boxes = NestedParallelClipRects(pDraw, pGC, nrect, prect,
+                                        priv->threshold,
+                                        &f.numBoxes, &y1, &y2);
+
+    if (!boxes) {
+        counter->serial++;
+        fbPolyFillRect(pDraw, pGC, nrect, prect);
+        return;
+    }
+
+    fbGetDrawable(pDraw, f.dst, f.stride, f.bpp, f.xoff, f.yoff);
+    f.and = pPriv->and;
+    f.xor = pPriv->xor;
+    f.boxes = boxes;
+
+    NestedParallelRun(NestedParallelFillBand, &f, y1, y2);
+    fbFinishAccess(pDraw);
+
+    counter->parallel++;
+    for (i = 0; i < f.numBoxes; i++)
+        counter->pixels += (unsigned long)(boxes[i].x2 - boxes[i].x1) *
+                           (boxes[i].y2 - boxes[i].y1);
+
+    free(boxes);
+}
+
+typedef struct {
+    DrawablePtr pDraw;
+    RegionPtr   pClip;
+    int         alu;
+    FbBits      pm;
+    int         x, y, width, height;
+    FbStip     *src;
+    FbStride    srcStride;
+} NestedParallelPutImageRec;
+
+static void
+NestedParallelPutImageBand(void *closure, int y1, int y2) {
+    NestedParallelPutImageRec *p = closure;
+    BoxRec band = { p->x, y1, p->x + p->width, y2 };
+    RegionRec clip;
+
+    /* Only the pixman region code is used here, which is reentrant */
+    RegionInit(&clip, &band, 1);
+    RegionIntersect(&clip, &clip, p->pClip);
+    fbPutZImage(p->pDraw, &clip, p->alu, p->pm, p->x, p->y,
+                p->width, p->height, p->src, p->srcStride);
+    RegionUninit(&clip);
+}
+
+/* ZPixmap images are blitted in bands like fbPutImage() blits them whole */
+static void
+NestedParallelPutImage(DrawablePtr pDraw, GCPtr pGC, int depth,
+                       int x, int y, int w, int h, int leftPad, int format,
+                       char *pImage) {
+    NestedParallelScreenPtr priv = NESTED_PARALLEL_PRIV(pDraw->pScreen);
+    NestedParallelCounterRec *counter =
+        &priv->counters[NESTED_PARALLEL_PUT_IMAGE];
+    NestedParallelPutImageRec p;
+
+    if (format != ZPixmap || (long)w * h < priv->threshold ||
+        h < 2 * NESTED_PARALLEL_MIN_BAND_HEIGHT ||
+        pDraw->bitsPerPixel != BitsPerPixel(pDraw->depth)) {
+        counter->serial++;
+        fbPutImage(pDraw, pGC, depth, x, y, w, h, leftPad, format, pImage);
+        return;
+    }
+
+    p.pDraw = pDraw;
+    p.pClip = fbGetCompositeClip(pGC);
+    p.alu = pGC->alu;
+    p.pm = fbGetGCPrivate(pGC)->pm;
+    p.x = x + pDraw->x;
+    p.y = y + pDraw->y;
+    p.width = w;
+    p.height = h;
+    p.src = (FbStip *)pImage;
+    p.srcStride = PixmapBytePad(w, pDraw->depth) / sizeof(FbStip);
+
+    NestedParallelRun(NestedParallelPutImageBand, &p, p.y, p.y + h);
+
+    counter->parallel++;
+    counter->pixels += (unsigned long)w * h;
+}
+
+static Bool
+NestedParallelCloseScreen(CLOSE_SCREEN_ARGS_DECL);
+
+/* fb uses the same ops for every GC and never changes them */
+static Bool
+NestedParallelCreateGC(GCPtr pGC) {
+    ScreenPtr pScreen = pGC->pScreen;
+    NestedParallelScreenPtr priv = NESTED_PARALLEL_PRIV(pScreen);
+    Bool ret;
+
+    pScreen->CreateGC = priv->CreateGC;
+    ret = (*pScreen->CreateGC)(pGC);
+    pScreen->CreateGC = NestedParallelCreateGC;
+
+    if (ret && pGC->ops == &fbGCOps)
+        pGC->ops = &priv->ops;
+
+    return ret;
+}
+
+Bool
+NestedParallelScreenInit(ScreenPtr pScreen, int numThreads, int threshold) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedParallelScreenPtr priv;
+
+    if (numThreads < 2)
+        return FALSE;
+
+    if (!nestedParallelPool) {
+        nestedParallelPool = NestedParallelCreatePool(numThreads);
+        if (!nestedParallelPool) {
+            xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+                       "Failed to start %d drawing threads\n", numThreads - 1);
+            return FALSE;
+        }
+    }
+
+    priv = calloc(1, sizeof(NestedParallelScreenRec));
+    if (!priv) {
+        if (!nestedParallelPoolUsers) {
+            NestedParallelDestroyPool(nestedParallelPool, numThreads - 1);
+            nestedParallelPool = NULL;
+        }
+        return FALSE;
+    }
+
+    nestedParallelPoolUsers++;
+
+    priv->threshold = threshold;
+    priv->ops = fbGCOps;
+    priv->ops.PolyFillRect = NestedParallelPolyFillRect;
+    priv->ops.PutImage = NestedParallelPutImage;
+    priv->CreateGC = pScreen->CreateGC;
+    pScreen->CreateGC = NestedParallelCreateGC;
+
+    if (ps) {
+        priv->Composite = ps->Composite;
+        ps->Composite = NestedParallelComposite;
+    }
+
+    priv->CloseScreen = pScreen->CloseScreen;
+    pScreen->CloseScreen = NestedParallelCloseScreen;
+
+    NESTED_PARALLEL_PRIV(pScreen) = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Drawing operations over %d pixels use %d threads\n",
+               threshold, nestedParallelPool->numThreads);
+    return TRUE;
+}
+
+/* Runs after the CloseScreen of damage, which wrapped on top of us and has
+ * given CreateGC and Composite back by now */
+static Bool
+NestedParallelCloseScreen(CLOSE_SCREEN_ARGS_DECL) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedParallelScreenPtr priv = NESTED_PARALLEL_PRIV(pScreen);
+    int i;
+
+    for (i = 0; i < NESTED_PARALLEL_NUM_OPS; i++)
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "%s: %lu split into bands (%lu pixels), %lu left whole\n",
+                   nestedParallelOpNames[i], priv->counters[i].parallel,
+                   priv->counters[i].pixels, priv->counters[i].serial);
+
+    pScreen->CreateGC = priv->CreateGC;
+    pScreen->CloseScreen = priv->CloseScreen;
+    if (ps)
+        ps->Composite = priv->Composite;
+
+    free(priv);
+    NESTED_PARALLEL_PRIV(pScreen) = NULL;
+
+    if (--nestedParallelPoolUsers == 0) {
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO, "%lu bands stolen\n",
+                   nestedParallelPool->steals);
+        NestedParallelDestroyPool(nestedParallelPool,
+                                  nestedParallelPool->numThreads - 1);
+        nestedParallelPool = NULL;
+    }
+
+    return (*pScreen->CloseScreen)(CLOSE_SCREEN_ARGS);
+}
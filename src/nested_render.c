@@ -0,0 +1,524 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <picturestr.h>
+#include <glyphstr.h>
+#include <mipict.h>
+
+#include "nested_forward.h"
+#include "nested_render.h"
+
+/* Glyphs uploaded to the host, by glyph hash. The table is emptied along
+ * with the host glyph set once it is 3/4 full. */
+#define NESTED_GLYPH_CACHE_SIZE 4096
+
+typedef struct {
+    CARD32        id; /* 0 if the slot is free */
+    unsigned char sha1[20];
+} NestedGlyphCacheEntry;
+
+typedef struct {
+    NestedGlyphCacheEntry entries[NESTED_GLYPH_CACHE_SIZE];
+    int                   count;
+    CARD32                nextId;
+} NestedGlyphCacheRec, *NestedGlyphCachePtr;
+
+typedef struct {
+    NestedClientPrivatePtr clientData;
+    CompositeProcPtr       Composite;
+    GlyphsProcPtr          Glyphs;
+    TrapezoidsProcPtr      Trapezoids;
+    NestedGlyphCacheRec    glyphCache[NESTED_NUM_FORMATS];
+} NestedRenderScreenRec, *NestedRenderScreenPtr;
+
+static NestedRenderScreenPtr nestedRenderScreens[MAXSCREENS];
+
+#define NESTED_RENDER_PRIV(pScreen) nestedRenderScreens[(pScreen)->myNum]
+
+static int
+NestedRenderFormat(PictFormatPtr pFormat) {
+    if (!pFormat)
+        return NESTED_FORMAT_NONE;
+
+    switch (pFormat->format) {
+    case PICT_a8:
+        return NESTED_FORMAT_A8;
+    case PICT_a8r8g8b8:
+        return NESTED_FORMAT_ARGB32;
+    default:
+        return -1;
+    }
+}
+
+static Bool
+NestedRenderCanForward(PicturePtr pDst) {
+    DrawablePtr pDraw = pDst->pDrawable;
+
+    return pDraw && !pDst->alphaMap &&
+           NestedClientRenderReady(NESTED_RENDER_PRIV(pDraw->pScreen)->clientData) &&
+           NestedForwardCanDraw(pDraw);
+}
+
+/* Reads the pixel of a 1x1 repeating picture */
+static Bool
+NestedRenderGetSolid(PicturePtr pict, xRenderColor *color) {
+    DrawablePtr pDraw = pict->pDrawable;
+    union {
+        CARD32 b32;
+        CARD16 b16;
+        CARD8  b8;
+    } pixel;
+
+    if (pDraw->width != 1 || pDraw->height != 1 ||
+        !pict->repeat || pict->repeatType != RepeatNormal ||
+        pict->pFormat->type != PictTypeDirect)
+        return FALSE;
+
+    pixel.b32 = 0;
+    (*pDraw->pScreen->GetImage)(pDraw, 0, 0, 1, 1, ZPixmap, ~0,
+                                (char *)&pixel);
+
+    switch (pDraw->bitsPerPixel) {
+    case 32:
+        miRenderPixelToColor(pict->pFormat, pixel.b32, color);
+        return TRUE;
+    case 16:
+        miRenderPixelToColor(pict->pFormat, pixel.b16, color);
+        return TRUE;
+    case 8:
+        miRenderPixelToColor(pict->pFormat, pixel.b8, color);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* Creates a host picture that looks like a source or mask picture. Only
+ * pictures whose content doesn't depend on the nested frame buffer or on
+ * pixmaps the host doesn't have are mirrored. */
+static CARD32
+NestedRenderMirrorPicture(NestedRenderScreenPtr priv, PicturePtr pict) {
+    SourcePictPtr pSource = pict->pSourcePict;
+    int repeat = pict->repeat ? pict->repeatType : RepeatNone;
+    xRenderColor color;
+
+    if (pict->transform || pict->alphaMap || pict->componentAlpha ||
+        pict->clientClip)
+        return None;
+
+    if (!pSource) {
+        if (!pict->pDrawable || !NestedRenderGetSolid(pict, &color))
+            return None;
+
+        return NestedClientRenderCreateSolid(priv->clientData, &color);
+    }
+
+    switch (pSource->type) {
+    case SourcePictTypeSolidFill:
+        color.alpha = (pSource->solidFill.color >> 24) * 0x101;
+        color.red = ((pSource->solidFill.color >> 16) & 0xff) * 0x101;
+        color.green = ((pSource->solidFill.color >> 8) & 0xff) * 0x101;
+        color.blue = (pSource->solidFill.color & 0xff) * 0x101;
+        return NestedClientRenderCreateSolid(priv->clientData, &color);
+    case SourcePictTypeLinear:
+    case SourcePictTypeRadial: {
+        PictGradient *gradient = &pSource->gradient;
+        xFixed *stops = malloc(gradient->nstops * sizeof(xFixed));
+        xRenderColor *colors = malloc(gradient->nstops * sizeof(xRenderColor));
+        CARD32 picture = None;
+        int i;
+
+        if (stops && colors) {
+            for (i = 0; i < gradient->nstops; i++) {
+                stops[i] = gradient->stops[i].x;
+                colors[i] = gradient->stops[i].color;
+            }
+
+            if (pSource->type == SourcePictTypeLinear)
+                picture = NestedClientRenderCreateLinearGradient(
+                              priv->clientData,
+                              &pSource->linear.p1, &pSource->linear.p2,
+                              gradient->nstops, stops, colors, repeat);
+            else {
+                xPointFixed inner = { pSource->radial.c1.x,
+                                      pSource->radial.c1.y };
+                xPointFixed outer = { pSource->radial.c2.x,
+                                      pSource->radial.c2.y };
+
+                picture = NestedClientRenderCreateRadialGradient(
+                              priv->clientData, &inner, &outer,
+                              pSource->radial.c1.radius,
+                              pSource->radial.c2.radius,
+                              gradient->nstops, stops, colors, repeat);
+            }
+        }
+
+        free(stops);
+        free(colors);
+        return picture;
+    }
+    default:
+        return None;
+    }
+}
+
+/* Clips the host window picture to the operation's box, given relative to
+ * the destination drawable. Returns FALSE if nothing would be drawn. */
+static Bool
+NestedRenderBegin(NestedRenderScreenPtr priv, PicturePtr pDst, BoxPtr pBox,
+                  NestedForwardOpPtr pOp) {
+    DrawablePtr pDraw = pDst->pDrawable;
+    BoxRec box = *pBox;
+
+    box.x1 += pDraw->x;
+    box.y1 += pDraw->y;
+    box.x2 += pDraw->x;
+    box.y2 += pDraw->y;
+
+    if (!NestedForwardBegin(pDraw->pScreen, &box, pDst->pCompositeClip, pOp))
+        return FALSE;
+
+    NestedClientRenderSetClip(priv->clientData,
+                              RegionRects(&pOp->drawn),
+                              RegionNumRects(&pOp->drawn));
+    return TRUE;
+}
+
+static void
+NestedRenderComposite(CARD8 op, PicturePtr pSrc, PicturePtr pMask,
+                      PicturePtr pDst, INT16 xSrc, INT16 ySrc,
+                      INT16 xMask, INT16 yMask, INT16 xDst, INT16 yDst,
+                      CARD16 width, CARD16 height) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedRenderScreenPtr priv = NESTED_RENDER_PRIV(pScreen);
+    NestedForwardOpRec nestedOp;
+    Bool forwarded = FALSE;
+    CARD32 src = None, mask = None;
+    BoxRec box = { xDst, yDst, xDst + width, yDst + height };
+
+    if (NestedRenderCanForward(pDst) &&
+        (src = NestedRenderMirrorPicture(priv, pSrc)) != None &&
+        (!pMask || (mask = NestedRenderMirrorPicture(priv, pMask)) != None) &&
+        NestedRenderBegin(priv, pDst, &box, &nestedOp)) {
+        NestedClientRenderComposite(priv->clientData, op, src, mask,
+                                    xSrc, ySrc, xMask, yMask,
+                                    xDst + pDst->pDrawable->x,
+                                    yDst + pDst->pDrawable->y,
+                                    width, height);
+        forwarded = TRUE;
+    }
+
+    if (src != None)
+        NestedClientRenderFreePicture(priv->clientData, src);
+    if (mask != None)
+        NestedClientRenderFreePicture(priv->clientData, mask);
+
+    ps->Composite = priv->Composite;
+    (*ps->Composite)(op, pSrc, pMask, pDst, xSrc, ySrc, xMask, yMask,
+                     xDst, yDst, width, height);
+    ps->Composite = NestedRenderComposite;
+
+    if (forwarded)
+        NestedForwardDone(pScreen, &nestedOp, TRUE);
+}
+
+static void
+NestedRenderResetGlyphCache(NestedRenderScreenPtr priv, int format) {
+    NestedGlyphCachePtr cache = &priv->glyphCache[format];
+
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->count = 0;
+    cache->nextId = 1;
+    NestedClientRenderResetGlyphs(priv->clientData, format);
+}
+
+/* Uploads the glyph image as the host server wants it: ZPixmap, lines
+ * padded to 32 bits */
+static Bool
+NestedRenderUploadGlyph(NestedRenderScreenPtr priv, ScreenPtr pScreen,
+                        int format, CARD32 id, GlyphPtr glyph) {
+    PicturePtr pPicture = NULL;
+    int size = 0;
+    char *data;
+
+    /* Blanks only have metrics */
+    if (glyph->info.width && glyph->info.height) {
+        pPicture = GetGlyphPicture(glyph, pScreen);
+        if (!pPicture)
+            return FALSE;
+
+        size = PixmapBytePad(glyph->info.width, pPicture->pDrawable->depth) *
+               glyph->info.height;
+    }
+
+    data = malloc(size ? size : 1);
+    if (!data)
+        return FALSE;
+
+    if (pPicture)
+        (*pScreen->GetImage)(pPicture->pDrawable, 0, 0, glyph->info.width,
+                             glyph->info.height, ZPixmap, ~0, data);
+
+    NestedClientRenderAddGlyph(priv->clientData, format, id, &glyph->info,
+                               data, size);
+    free(data);
+    return TRUE;
+}
+
+/* Returns the host id of a glyph, uploading it if the host doesn't have it.
+ * Returns 0 if the cache is full. */
+static CARD32
+NestedRenderGlyphId(NestedRenderScreenPtr priv, ScreenPtr pScreen,
+                    int format, GlyphPtr glyph) {
+    NestedGlyphCachePtr cache = &priv->glyphCache[format];
+    unsigned int i = (glyph->sha1[0] | glyph->sha1[1] << 8 |
+                      glyph->sha1[2] << 16 | (unsigned)glyph->sha1[3] << 24) &
+                     (NESTED_GLYPH_CACHE_SIZE - 1);
+    NestedGlyphCacheEntry *entry;
+
+    for (;; i = (i + 1) & (NESTED_GLYPH_CACHE_SIZE - 1)) {
+        entry = &cache->entries[i];
+
+        if (!entry->id)
+            break;
+
+        if (!memcmp(entry->sha1, glyph->sha1, sizeof(entry->sha1)))
+            return entry->id;
+    }
+
+    if (cache->count >= NESTED_GLYPH_CACHE_SIZE * 3 / 4)
+        return 0;
+
+    if (!NestedRenderUploadGlyph(priv, pScreen, format, cache->nextId, glyph))
+        return 0;
+
+    entry->id = cache->nextId++;
+    memcpy(entry->sha1, glyph->sha1, sizeof(entry->sha1));
+    cache->count++;
+
+    return entry->id;
+}
+
+/* Looks up the host ids of all glyphs of the operation, which must all be
+ * in the host glyph set at the same time */
+static Bool
+NestedRenderGlyphIds(NestedRenderScreenPtr priv, ScreenPtr pScreen,
+                     int format, int numGlyphs, GlyphPtr *glyphs,
+                     CARD32 *ids) {
+    int attempt, i;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        for (i = 0; i < numGlyphs; i++)
+            if (!(ids[i] = NestedRenderGlyphId(priv, pScreen, format,
+                                               glyphs[i])))
+                break;
+
+        if (i == numGlyphs)
+            return TRUE;
+
+        NestedRenderResetGlyphCache(priv, format);
+    }
+
+    return FALSE;
+}
+
+static Bool
+NestedRenderForwardGlyphs(NestedRenderScreenPtr priv, CARD8 op,
+                          CARD32 src, PicturePtr pDst,
+                          PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+                          int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    int format = NestedRenderFormat(list[0].format);
+    NestedGlyphListPtr lists;
+    CARD32 *ids;
+    int i, numGlyphs = 0;
+    Bool ret = FALSE;
+
+    for (i = 0; i < nlist; i++) {
+        if (NestedRenderFormat(list[i].format) != format)
+            return FALSE;
+
+        numGlyphs += list[i].len;
+    }
+
+    if (format <= NESTED_FORMAT_NONE)
+        return FALSE;
+
+    lists = malloc(nlist * sizeof(NestedGlyphListRec));
+    ids = malloc(numGlyphs * sizeof(CARD32));
+
+    if (lists && ids &&
+        NestedRenderGlyphIds(priv, pScreen, format, numGlyphs, glyphs, ids)) {
+        for (i = 0; i < nlist; i++) {
+            lists[i].xOff = list[i].xOff;
+            lists[i].yOff = list[i].yOff;
+            lists[i].len = list[i].len;
+        }
+
+        ret = NestedClientRenderCompositeGlyphs(priv->clientData, op, src,
+                                                NestedRenderFormat(maskFormat),
+                                                format, xSrc, ySrc,
+                                                pDst->pDrawable->x,
+                                                pDst->pDrawable->y,
+                                                nlist, lists, ids);
+    }
+
+    free(lists);
+    free(ids);
+    return ret;
+}
+
+static void
+NestedRenderGlyphs(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+                   PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+                   int nlist, GlyphListPtr list, GlyphPtr *glyphs) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedRenderScreenPtr priv = NESTED_RENDER_PRIV(pScreen);
+    NestedForwardOpRec nestedOp;
+    Bool forwarding = FALSE, forwarded = FALSE;
+    CARD32 src = None;
+    BoxRec box;
+
+    if ((op == PictOpOver || op == PictOpAdd) && nlist > 0 &&
+        NestedRenderFormat(maskFormat) >= 0 &&
+        NestedRenderCanForward(pDst) &&
+        (src = NestedRenderMirrorPicture(priv, pSrc)) != None) {
+        miGlyphExtents(nlist, list, glyphs, &box);
+
+        if (box.x1 < box.x2 && box.y1 < box.y2)
+            forwarding = NestedRenderBegin(priv, pDst, &box, &nestedOp);
+    }
+
+    if (forwarding)
+        forwarded = NestedRenderForwardGlyphs(priv, op, src, pDst, maskFormat,
+                                              xSrc, ySrc, nlist, list, glyphs);
+
+    if (src != None)
+        NestedClientRenderFreePicture(priv->clientData, src);
+
+    ps->Glyphs = priv->Glyphs;
+    (*ps->Glyphs)(op, pSrc, pDst, maskFormat, xSrc, ySrc, nlist, list, glyphs);
+    ps->Glyphs = NestedRenderGlyphs;
+
+    if (forwarding)
+        NestedForwardDone(pScreen, &nestedOp, forwarded);
+}
+
+static void
+NestedRenderTrapezoids(CARD8 op, PicturePtr pSrc, PicturePtr pDst,
+                       PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc,
+                       int ntrap, xTrapezoid *traps) {
+    ScreenPtr pScreen = pDst->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedRenderScreenPtr priv = NESTED_RENDER_PRIV(pScreen);
+    NestedForwardOpRec nestedOp;
+    Bool forwarding = FALSE, forwarded = FALSE;
+    CARD32 src = None;
+    BoxRec box;
+
+    if ((op == PictOpOver || op == PictOpAdd) && ntrap > 0 &&
+        NestedRenderFormat(maskFormat) >= 0 &&
+        NestedRenderCanForward(pDst) &&
+        (src = NestedRenderMirrorPicture(priv, pSrc)) != None) {
+        miTrapezoidBounds(ntrap, traps, &box);
+
+        if (box.x1 < box.x2 && box.y1 < box.y2)
+            forwarding = NestedRenderBegin(priv, pDst, &box, &nestedOp);
+    }
+
+    if (forwarding)
+        forwarded = NestedClientRenderTrapezoids(priv->clientData, op, src,
+                                                 NestedRenderFormat(maskFormat),
+                                                 xSrc, ySrc,
+                                                 pDst->pDrawable->x,
+                                                 pDst->pDrawable->y,
+                                                 ntrap, traps);
+
+    if (src != None)
+        NestedClientRenderFreePicture(priv->clientData, src);
+
+    ps->Trapezoids = priv->Trapezoids;
+    (*ps->Trapezoids)(op, pSrc, pDst, maskFormat, xSrc, ySrc, ntrap, traps);
+    ps->Trapezoids = NestedRenderTrapezoids;
+
+    if (forwarding)
+        NestedForwardDone(pScreen, &nestedOp, forwarded);
+}
+
+Bool
+NestedRenderScreenInit(ScreenPtr pScreen, NestedClientPrivatePtr clientData) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedRenderScreenPtr priv;
+    int i;
+
+    if (!ps || !NestedClientRenderInit(clientData))
+        return FALSE;
+
+    priv = calloc(1, sizeof(NestedRenderScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->clientData = clientData;
+
+    for (i = 0; i < NESTED_NUM_FORMATS; i++)
+        priv->glyphCache[i].nextId = 1;
+
+    priv->Composite = ps->Composite;
+    ps->Composite = NestedRenderComposite;
+    priv->Glyphs = ps->Glyphs;
+    ps->Glyphs = NestedRenderGlyphs;
+    priv->Trapezoids = ps->Trapezoids;
+    ps->Trapezoids = NestedRenderTrapezoids;
+
+    nestedRenderScreens[pScreen->myNum] = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Forwarding RENDER operations to the host\n");
+    return TRUE;
+}
+
+void
+NestedRenderCloseScreen(ScreenPtr pScreen) {
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    NestedRenderScreenPtr priv = NESTED_RENDER_PRIV(pScreen);
+
+    if (!priv)
+        return;
+
+    ps->Composite = priv->Composite;
+    ps->Glyphs = priv->Glyphs;
+    ps->Trapezoids = priv->Trapezoids;
+
+    free(priv);
+    NESTED_RENDER_PRIV(pScreen) = NULL;
+}
@@ -0,0 +1,512 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <damage.h>
+#include <inputstr.h>
+#include <propertyst.h>
+#include <windowstr.h>
+#include <X11/Xatom.h>
+
+#include "compat-api.h"
+
+#include "nested_rootless.h"
+
+#define MAKE_ATOM(a) MakeAtom(a, sizeof(a) - 1, TRUE)
+
+/* DamageUnregister() lost its drawable in 1.15 */
+#if XORG_VERSION_CURRENT < XORG_VERSION_NUMERIC(1, 14, 99, 2, 0)
+#define NestedDamageUnregister(pDraw, pDamage) DamageUnregister(pDraw, pDamage)
+#else
+#define NestedDamageUnregister(pDraw, pDamage) DamageUnregister(pDamage)
+#endif
+
+/* What the host asked for, applied by NestedRootlessTimer() */
+#define NESTED_ROOTLESS_CONFIGURE (1 << 0)
+#define NESTED_ROOTLESS_RAISE     (1 << 1)
+#define NESTED_ROOTLESS_CLOSE     (1 << 2)
+
+typedef struct {
+    NestedClientPrivatePtr clientData;
+    RealizeWindowProcPtr   RealizeWindow;
+    UnrealizeWindowProcPtr UnrealizeWindow;
+    PositionWindowProcPtr  PositionWindow;
+    RestackWindowProcPtr   RestackWindow;
+    OsTimerPtr             timer;
+    Bool                   applying; /* changes coming from the host */
+} NestedRootlessScreenRec, *NestedRootlessScreenPtr;
+
+/* Top-level windows only. The geometry is the one of the border, as last
+ * sent to or received from the host. */
+typedef struct {
+    CARD32       hostWindow; /* 0 while unmapped */
+    DamagePtr    pDamage;
+    int          x, y;
+    unsigned int width, height;
+    int          pending;
+} NestedRootlessWindowRec, *NestedRootlessWindowPtr;
+
+static NestedRootlessScreenPtr nestedRootlessScreens[MAXSCREENS];
+
+static DevPrivateKeyRec nestedRootlessWindowKeyRec;
+
+#define NESTED_ROOTLESS_PRIV(pScreen) nestedRootlessScreens[(pScreen)->myNum]
+#define NESTED_ROOTLESS_WINDOW_PRIV(pWin) ((NestedRootlessWindowPtr) \
+    dixGetPrivateAddr(&(pWin)->devPrivates, &nestedRootlessWindowKeyRec))
+
+static Bool
+NestedRootlessIsTopLevel(WindowPtr pWin) {
+    return pWin->parent && !pWin->parent->parent &&
+           pWin->drawable.class == InputOutput;
+}
+
+static void
+NestedRootlessGetGeometry(WindowPtr pWin, int *x, int *y,
+                          unsigned int *width, unsigned int *height) {
+    *x = pWin->drawable.x - wBorderWidth(pWin);
+    *y = pWin->drawable.y - wBorderWidth(pWin);
+    *width = pWin->drawable.width + 2 * wBorderWidth(pWin);
+    *height = pWin->drawable.height + 2 * wBorderWidth(pWin);
+}
+
+static WindowPtr
+NestedRootlessFindWindow(ScreenPtr pScreen, CARD32 hostWindow) {
+    WindowPtr pWin;
+
+    for (pWin = pScreen->root->firstChild; pWin; pWin = pWin->nextSib)
+        if (NESTED_ROOTLESS_WINDOW_PRIV(pWin)->hostWindow == hostWindow)
+            return pWin;
+
+    return NULL;
+}
+
+/* Uploads a region of the window, in screen coordinates. Only what is
+ * visible in the nested screen is right in the frame buffer. */
+static void
+NestedRootlessUpload(NestedRootlessScreenPtr priv, WindowPtr pWin,
+                     RegionPtr pRegion) {
+    NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+    int x, y;
+    unsigned int width, height;
+
+    RegionIntersect(pRegion, pRegion, &pWin->borderClip);
+    NestedRootlessGetGeometry(pWin, &x, &y, &width, &height);
+
+    NestedClientRootlessUpdateWindow(priv->clientData, pWinPriv->hostWindow,
+                                     x, y, RegionRects(pRegion),
+                                     RegionNumRects(pRegion));
+}
+
+static void
+NestedRootlessShow(NestedRootlessScreenPtr priv, WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+    PropertyPtr pProp;
+    const char *name = NULL;
+    int nameLength = 0;
+
+    if (dixLookupProperty(&pProp, pWin, XA_WM_NAME, serverClient,
+                          DixReadAccess) == Success &&
+        pProp->format == 8) {
+        name = pProp->data;
+        nameLength = pProp->size;
+    }
+
+    NestedRootlessGetGeometry(pWin, &pWinPriv->x, &pWinPriv->y,
+                              &pWinPriv->width, &pWinPriv->height);
+
+    pWinPriv->hostWindow =
+        NestedClientRootlessCreateWindow(priv->clientData,
+                                         pWinPriv->x, pWinPriv->y,
+                                         pWinPriv->width, pWinPriv->height,
+                                         pWin->overrideRedirect,
+                                         name, nameLength);
+    if (!pWinPriv->hostWindow)
+        return;
+
+    /* Drawing to the window and its children, clipped to it. The window is
+     * painted once mapped, which uploads all of it. */
+    pWinPriv->pDamage = DamageCreate(NULL, NULL, DamageReportNone, TRUE,
+                                     pScreen, pScreen);
+    if (pWinPriv->pDamage)
+        DamageRegister(&pWin->drawable, pWinPriv->pDamage);
+}
+
+static void
+NestedRootlessHide(NestedRootlessScreenPtr priv, WindowPtr pWin) {
+    NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+
+    if (!pWinPriv->hostWindow)
+        return;
+
+    if (pWinPriv->pDamage) {
+        NestedDamageUnregister(&pWin->drawable, pWinPriv->pDamage);
+        DamageDestroy(pWinPriv->pDamage);
+        pWinPriv->pDamage = NULL;
+    }
+
+    NestedClientRootlessDestroyWindow(priv->clientData, pWinPriv->hostWindow);
+    pWinPriv->hostWindow = 0;
+    pWinPriv->pending = 0;
+}
+
+static Bool
+NestedRootlessRealizeWindow(WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    Bool ret;
+
+    pScreen->RealizeWindow = priv->RealizeWindow;
+    ret = (*pScreen->RealizeWindow)(pWin);
+    pScreen->RealizeWindow = NestedRootlessRealizeWindow;
+
+    if (ret && NestedRootlessIsTopLevel(pWin))
+        NestedRootlessShow(priv, pWin);
+
+    return ret;
+}
+
+static Bool
+NestedRootlessUnrealizeWindow(WindowPtr pWin) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    Bool ret;
+
+    if (NestedRootlessIsTopLevel(pWin))
+        NestedRootlessHide(priv, pWin);
+
+    pScreen->UnrealizeWindow = priv->UnrealizeWindow;
+    ret = (*pScreen->UnrealizeWindow)(pWin);
+    pScreen->UnrealizeWindow = NestedRootlessUnrealizeWindow;
+
+    return ret;
+}
+
+static Bool
+NestedRootlessPositionWindow(WindowPtr pWin, int x, int y) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+    Bool ret;
+
+    pScreen->PositionWindow = priv->PositionWindow;
+    ret = (*pScreen->PositionWindow)(pWin, x, y);
+    pScreen->PositionWindow = NestedRootlessPositionWindow;
+
+    if (pWinPriv->hostWindow && !priv->applying) {
+        int newX, newY;
+        unsigned int width, height;
+
+        NestedRootlessGetGeometry(pWin, &newX, &newY, &width, &height);
+
+        if (newX != pWinPriv->x || newY != pWinPriv->y ||
+            width != pWinPriv->width || height != pWinPriv->height) {
+            pWinPriv->x = newX;
+            pWinPriv->y = newY;
+            pWinPriv->width = width;
+            pWinPriv->height = height;
+            NestedClientRootlessConfigureWindow(priv->clientData,
+                                                pWinPriv->hostWindow,
+                                                newX, newY, width, height);
+        }
+    }
+
+    return ret;
+}
+
+/* Only raises are passed on, the host WM does the rest of the stacking */
+static void
+NestedRootlessRestackWindow(WindowPtr pWin, WindowPtr pOldNextSib) {
+    ScreenPtr pScreen = pWin->drawable.pScreen;
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+
+    if (priv->RestackWindow) {
+        pScreen->RestackWindow = priv->RestackWindow;
+        (*pScreen->RestackWindow)(pWin, pOldNextSib);
+        pScreen->RestackWindow = NestedRootlessRestackWindow;
+    }
+
+    if (pWinPriv->hostWindow && !priv->applying && !pWin->prevSib)
+        NestedClientRootlessRaiseWindow(priv->clientData,
+                                        pWinPriv->hostWindow);
+}
+
+/* Asks the client owning the window to close it, or disconnects it like
+ * xkill if it doesn't know how to */
+static void
+NestedRootlessClose(WindowPtr pWin) {
+    ClientPtr client = wClient(pWin);
+    Atom wmProtocols = MAKE_ATOM("WM_PROTOCOLS");
+    Atom wmDeleteWindow = MAKE_ATOM("WM_DELETE_WINDOW");
+    PropertyPtr pProp;
+    xEvent event;
+    int i;
+
+    if (client == serverClient)
+        return;
+
+    if (dixLookupProperty(&pProp, pWin, wmProtocols, serverClient,
+                          DixReadAccess) == Success &&
+        pProp->format == 32) {
+        for (i = 0; i < pProp->size; i++) {
+            if (((CARD32 *)pProp->data)[i] != wmDeleteWindow)
+                continue;
+
+            memset(&event, 0, sizeof(event));
+            event.u.u.type = ClientMessage;
+            event.u.u.detail = 32;
+            event.u.clientMessage.window = pWin->drawable.id;
+            event.u.clientMessage.u.l.type = wmProtocols;
+            event.u.clientMessage.u.l.longs0 = wmDeleteWindow;
+            event.u.clientMessage.u.l.longs1 = GetTimeInMillis();
+
+            /* No event mask: delivered to the window owner */
+            DeliverEventsToWindow(inputInfo.pointer, pWin, &event, 1,
+                                  NoEventMask, NullGrab);
+            return;
+        }
+    }
+
+    CloseDownClient(client);
+}
+
+/* Applies what the host asked for outside of the event handling, like
+ * NestedResizeTimer() does */
+static CARD32
+NestedRootlessTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
+    ScreenPtr pScreen = arg;
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    WindowPtr pWin, pNext;
+
+    priv->applying = TRUE;
+
+    for (pWin = pScreen->root->firstChild; pWin; pWin = pNext) {
+        NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+        int pending = pWinPriv->pending;
+
+        /* Closing or restacking may change the list */
+        pNext = pWin->nextSib;
+        pWinPriv->pending = 0;
+
+        if (pending & NESTED_ROOTLESS_CONFIGURE) {
+            XID values[4] = {
+                pWinPriv->x, pWinPriv->y,
+                pWinPriv->width - 2 * wBorderWidth(pWin),
+                pWinPriv->height - 2 * wBorderWidth(pWin)
+            };
+
+            ConfigureWindow(pWin, CWX | CWY | CWWidth | CWHeight, values,
+                            serverClient);
+        }
+
+        if (pending & NESTED_ROOTLESS_RAISE) {
+            XID value = Above;
+
+            ConfigureWindow(pWin, CWStackMode, &value, serverClient);
+        }
+
+        if (pending & NESTED_ROOTLESS_CLOSE)
+            NestedRootlessClose(pWin);
+    }
+
+    priv->applying = FALSE;
+    return 0;
+}
+
+static WindowPtr
+NestedRootlessHostWindow(int scrnIndex, CARD32 window,
+                         NestedRootlessScreenPtr *retPriv) {
+    ScreenPtr pScreen = xf86ScrnToScreen(xf86Screens[scrnIndex]);
+
+    *retPriv = NESTED_ROOTLESS_PRIV(pScreen);
+    if (!*retPriv)
+        return NULL;
+
+    return NestedRootlessFindWindow(pScreen, window);
+}
+
+static void
+NestedRootlessSetPending(NestedRootlessScreenPtr priv, WindowPtr pWin,
+                         int pending) {
+    NESTED_ROOTLESS_WINDOW_PRIV(pWin)->pending |= pending;
+    priv->timer = TimerSet(priv->timer, 0, 1, NestedRootlessTimer,
+                           pWin->drawable.pScreen);
+}
+
+void
+NestedRootlessHostExpose(int scrnIndex, CARD32 window, int x, int y,
+                         unsigned int width, unsigned int height) {
+    NestedRootlessScreenPtr priv;
+    WindowPtr pWin = NestedRootlessHostWindow(scrnIndex, window, &priv);
+    RegionRec region;
+    BoxRec box;
+    int winX, winY;
+    unsigned int winWidth, winHeight;
+
+    if (!pWin)
+        return;
+
+    /* Where the window is in the frame buffer, which may not have followed
+     * the host window yet */
+    NestedRootlessGetGeometry(pWin, &winX, &winY, &winWidth, &winHeight);
+    box.x1 = winX + x;
+    box.y1 = winY + y;
+    box.x2 = box.x1 + width;
+    box.y2 = box.y1 + height;
+
+    RegionInit(&region, &box, 1);
+    NestedRootlessUpload(priv, pWin, &region);
+    RegionUninit(&region);
+}
+
+void
+NestedRootlessHostConfigure(int scrnIndex, CARD32 window, int x, int y,
+                            unsigned int width, unsigned int height) {
+    NestedRootlessScreenPtr priv;
+    WindowPtr pWin = NestedRootlessHostWindow(scrnIndex, window, &priv);
+    NestedRootlessWindowPtr pWinPriv;
+
+    if (!pWin)
+        return;
+
+    pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+
+    /* Including our own requests coming back */
+    if (x == pWinPriv->x && y == pWinPriv->y &&
+        width == pWinPriv->width && height == pWinPriv->height)
+        return;
+
+    /* The border stays inside the host window */
+    if (width <= 2 * wBorderWidth(pWin) || height <= 2 * wBorderWidth(pWin))
+        return;
+
+    pWinPriv->x = x;
+    pWinPriv->y = y;
+    pWinPriv->width = width;
+    pWinPriv->height = height;
+    NestedRootlessSetPending(priv, pWin, NESTED_ROOTLESS_CONFIGURE);
+}
+
+void
+NestedRootlessHostRaise(int scrnIndex, CARD32 window) {
+    NestedRootlessScreenPtr priv;
+    WindowPtr pWin = NestedRootlessHostWindow(scrnIndex, window, &priv);
+
+    if (pWin && pWin->prevSib)
+        NestedRootlessSetPending(priv, pWin, NESTED_ROOTLESS_RAISE);
+}
+
+void
+NestedRootlessHostClose(int scrnIndex, CARD32 window) {
+    NestedRootlessScreenPtr priv;
+    WindowPtr pWin = NestedRootlessHostWindow(scrnIndex, window, &priv);
+
+    if (pWin)
+        NestedRootlessSetPending(priv, pWin, NESTED_ROOTLESS_CLOSE);
+}
+
+Bool
+NestedRootlessUpdate(ScreenPtr pScreen) {
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+    WindowPtr pWin;
+
+    if (!priv)
+        return FALSE;
+
+    /* The root window itself is never uploaded */
+    for (pWin = pScreen->root->firstChild; pWin; pWin = pWin->nextSib) {
+        NestedRootlessWindowPtr pWinPriv = NESTED_ROOTLESS_WINDOW_PRIV(pWin);
+        RegionPtr pRegion;
+
+        if (!pWinPriv->pDamage)
+            continue;
+
+        pRegion = DamageRegion(pWinPriv->pDamage);
+        if (!RegionNotEmpty(pRegion))
+            continue;
+
+        RegionTranslate(pRegion, pWin->drawable.x, pWin->drawable.y);
+        NestedRootlessUpload(priv, pWin, pRegion);
+        DamageEmpty(pWinPriv->pDamage);
+    }
+
+    return TRUE;
+}
+
+Bool
+NestedRootlessScreenInit(ScreenPtr pScreen, NestedClientPrivatePtr clientData) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedRootlessScreenPtr priv;
+
+    if (!NestedClientRootlessReady(clientData))
+        return FALSE;
+
+    if (!dixRegisterPrivateKey(&nestedRootlessWindowKeyRec, PRIVATE_WINDOW,
+                               sizeof(NestedRootlessWindowRec)))
+        return FALSE;
+
+    priv = calloc(1, sizeof(NestedRootlessScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->clientData = clientData;
+    priv->RealizeWindow = pScreen->RealizeWindow;
+    pScreen->RealizeWindow = NestedRootlessRealizeWindow;
+    priv->UnrealizeWindow = pScreen->UnrealizeWindow;
+    pScreen->UnrealizeWindow = NestedRootlessUnrealizeWindow;
+    priv->PositionWindow = pScreen->PositionWindow;
+    pScreen->PositionWindow = NestedRootlessPositionWindow;
+    priv->RestackWindow = pScreen->RestackWindow;
+    pScreen->RestackWindow = NestedRootlessRestackWindow;
+
+    NESTED_ROOTLESS_PRIV(pScreen) = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "Rootless: top-level windows are shown in host windows\n");
+    return TRUE;
+}
+
+void
+NestedRootlessCloseScreen(ScreenPtr pScreen) {
+    NestedRootlessScreenPtr priv = NESTED_ROOTLESS_PRIV(pScreen);
+
+    if (!priv)
+        return;
+
+    /* The windows are gone by now, and so are their host windows */
+    pScreen->RealizeWindow = priv->RealizeWindow;
+    pScreen->UnrealizeWindow = priv->UnrealizeWindow;
+    pScreen->PositionWindow = priv->PositionWindow;
+    pScreen->RestackWindow = priv->RestackWindow;
+
+    TimerFree(priv->timer);
+    free(priv);
+    NESTED_ROOTLESS_PRIV(pScreen) = NULL;
+}
@@ -0,0 +1,284 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <xorg-server.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "nested_rotate.h"
+
+/* Transposed copies are done in square tiles, so that both the source lines
+ * and the destination lines touched by a tile stay in the L1 cache. 32x32
+ * pixels is 4KB per side at 32bpp. */
+#define NESTED_ROTATE_TILE 32
+
+/* Every rotation/reflection is a signed permutation of the axes:
+ *   fbX = ax * x + bx * y + cx
+ *   fbY = ay * x + by * y + cy
+ * where (x, y) is a host window pixel and (fbX, fbY) a frame buffer pixel
+ * relative to the CRTC origin. */
+typedef struct {
+    int ax, bx, cx;
+    int ay, by, cy;
+} NestedRotateMatrix;
+
+static void
+NestedRotateGetMatrix(Rotation rotation, int width, int height,
+                      NestedRotateMatrix *m) {
+    int fbWidth = width, fbHeight = height;
+
+    switch (rotation & 0xf) {
+    case RR_Rotate_90:
+        m->ax =  0; m->bx = -1; m->cx = height - 1;
+        m->ay =  1; m->by =  0; m->cy = 0;
+        fbWidth = height;
+        fbHeight = width;
+        break;
+    case RR_Rotate_180:
+        m->ax = -1; m->bx =  0; m->cx = width - 1;
+        m->ay =  0; m->by = -1; m->cy = height - 1;
+        break;
+    case RR_Rotate_270:
+        m->ax =  0; m->bx =  1; m->cx = 0;
+        m->ay = -1; m->by =  0; m->cy = width - 1;
+        fbWidth = height;
+        fbHeight = width;
+        break;
+    default:
+        m->ax =  1; m->bx =  0; m->cx = 0;
+        m->ay =  0; m->by =  1; m->cy = 0;
+        break;
+    }
+
+    /* Reflections are applied to the frame buffer after rotating, as RandR
+     * does */
+    if (rotation & RR_Reflect_X) {
+        m->ax = -m->ax;
+        m->bx = -m->bx;
+        m->cx = fbWidth - 1 - m->cx;
+    }
+
+    if (rotation & RR_Reflect_Y) {
+        m->ay = -m->ay;
+        m->by = -m->by;
+        m->cy = fbHeight - 1 - m->cy;
+    }
+}
+
+void
+NestedRotatePoint(Rotation rotation, int width, int height,
+                  int x, int y, int *retX, int *retY) {
+    NestedRotateMatrix m;
+
+    NestedRotateGetMatrix(rotation, width, height, &m);
+
+    *retX = m.ax * x + m.bx * y + m.cx;
+    *retY = m.ay * x + m.by * y + m.cy;
+}
+
+void
+NestedRotateBox(Rotation rotation, int width, int height, BoxPtr box) {
+    NestedRotateMatrix m;
+    int x1, y1, x2, y2;
+
+    NestedRotateGetMatrix(rotation, width, height, &m);
+
+    /* The inverse of a signed permutation is its transpose. Map the first
+     * and the last pixel of the box, then sort the corners. */
+    x1 = m.ax * (box->x1 - m.cx) + m.ay * (box->y1 - m.cy);
+    y1 = m.bx * (box->x1 - m.cx) + m.by * (box->y1 - m.cy);
+    x2 = m.ax * (box->x2 - 1 - m.cx) + m.ay * (box->y2 - 1 - m.cy);
+    y2 = m.bx * (box->x2 - 1 - m.cx) + m.by * (box->y2 - 1 - m.cy);
+
+    box->x1 = min(x1, x2);
+    box->y1 = min(y1, y2);
+    box->x2 = max(x1, x2) + 1;
+    box->y2 = max(y1, y2) + 1;
+}
+
+static inline void
+NestedRotateCopyPixel(char *dst, const char *src, int bytesPerPixel) {
+    switch (bytesPerPixel) {
+    case 4:
+        *(uint32_t *)dst = *(const uint32_t *)src;
+        break;
+    case 2:
+        *(uint16_t *)dst = *(const uint16_t *)src;
+        break;
+    case 1:
+        *dst = *src;
+        break;
+    default:
+        memcpy(dst, src, bytesPerPixel);
+        break;
+    }
+}
+
+/* Source lines map to destination lines, maybe mirrored: 0 and 180 degrees
+ * and their reflections. */
+static void
+NestedRotateBlitLines(const char *src, long stepX, long stepY,
+                      char *dst, int dstStride,
+                      int width, int height, int bytesPerPixel) {
+    int x, y;
+
+    for (y = 0; y < height; y++, src += stepY, dst += dstStride) {
+        if (stepX == bytesPerPixel) {
+            memcpy(dst, src, (size_t)width * bytesPerPixel);
+            continue;
+        }
+
+        for (x = 0; x < width; x++)
+            NestedRotateCopyPixel(dst + x * bytesPerPixel, src + x * stepX,
+                                  bytesPerPixel);
+    }
+}
+
+#ifdef __SSE2__
+/* Transposes a 4x4 block of 32bpp pixels. Each source line segment becomes a
+ * destination column; stepY is +4 or -4, in which case the segment is loaded
+ * from its far end and reversed. */
+static inline void
+NestedRotateTranspose4x4(const char *src, long stepX, long stepY,
+                         char *dst, int dstStride) {
+    __m128i c0, c1, c2, c3, t0, t1, t2, t3;
+
+    if (stepY > 0) {
+        c0 = _mm_loadu_si128((const __m128i *)(src));
+        c1 = _mm_loadu_si128((const __m128i *)(src + stepX));
+        c2 = _mm_loadu_si128((const __m128i *)(src + 2 * stepX));
+        c3 = _mm_loadu_si128((const __m128i *)(src + 3 * stepX));
+    } else {
+        c0 = _mm_loadu_si128((const __m128i *)(src - 12));
+        c1 = _mm_loadu_si128((const __m128i *)(src + stepX - 12));
+        c2 = _mm_loadu_si128((const __m128i *)(src + 2 * stepX - 12));
+        c3 = _mm_loadu_si128((const __m128i *)(src + 3 * stepX - 12));
+        c0 = _mm_shuffle_epi32(c0, _MM_SHUFFLE(0, 1, 2, 3));
+        c1 = _mm_shuffle_epi32(c1, _MM_SHUFFLE(0, 1, 2, 3));
+        c2 = _mm_shuffle_epi32(c2, _MM_SHUFFLE(0, 1, 2, 3));
+        c3 = _mm_shuffle_epi32(c3, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+
+    t0 = _mm_unpacklo_epi32(c0, c1);
+    t1 = _mm_unpacklo_epi32(c2, c3);
+    t2 = _mm_unpackhi_epi32(c0, c1);
+    t3 = _mm_unpackhi_epi32(c2, c3);
+
+    _mm_storeu_si128((__m128i *)(dst), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dst + dstStride), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(dst + 2 * dstStride), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(dst + 3 * dstStride), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+/* Source lines map to destination columns: 90 and 270 degrees and their
+ * reflections. */
+static void
+NestedRotateBlitTransposed(const char *src, long stepX, long stepY,
+                           char *dst, int dstStride,
+                           int width, int height, int bytesPerPixel) {
+    int tileX, tileY, x, y, tileWidth, tileHeight;
+
+    for (tileY = 0; tileY < height; tileY += NESTED_ROTATE_TILE) {
+        tileHeight = min(NESTED_ROTATE_TILE, height - tileY);
+
+        for (tileX = 0; tileX < width; tileX += NESTED_ROTATE_TILE) {
+            const char *s = src + tileY * stepY + tileX * stepX;
+            char *d = dst + (long)tileY * dstStride + tileX * bytesPerPixel;
+
+            tileWidth = min(NESTED_ROTATE_TILE, width - tileX);
+            y = 0;
+
+#ifdef __SSE2__
+            if (bytesPerPixel == 4) {
+                for (; y + 4 <= tileHeight; y += 4) {
+                    for (x = 0; x + 4 <= tileWidth; x += 4)
+                        NestedRotateTranspose4x4(s + y * stepY + x * stepX,
+                                                 stepX, stepY,
+                                                 d + (long)y * dstStride + x * 4,
+                                                 dstStride);
+
+                    /* Right edge of the tile */
+                    for (; x < tileWidth; x++) {
+                        int i;
+
+                        for (i = 0; i < 4; i++)
+                            NestedRotateCopyPixel(d + (long)(y + i) * dstStride + x * 4,
+                                                  s + (y + i) * stepY + x * stepX,
+                                                  4);
+                    }
+                }
+            }
+#endif
+
+            /* Bottom edge of the tile, or whole tiles without SIMD */
+            for (; y < tileHeight; y++)
+                for (x = 0; x < tileWidth; x++)
+                    NestedRotateCopyPixel(d + (long)y * dstStride + x * bytesPerPixel,
+                                          s + y * stepY + x * stepX,
+                                          bytesPerPixel);
+        }
+    }
+}
+
+void
+NestedRotateCopy(Rotation rotation, int width, int height,
+                 const char *src, int srcStride,
+                 char *dst, int dstStride,
+                 int bytesPerPixel, const BoxRec *box) {
+    NestedRotateMatrix m;
+    long stepX, stepY;
+    int fbX, fbY;
+
+    if (box->x2 <= box->x1 || box->y2 <= box->y1)
+        return;
+
+    NestedRotateGetMatrix(rotation, width, height, &m);
+
+    fbX = m.ax * box->x1 + m.bx * box->y1 + m.cx;
+    fbY = m.ay * box->x1 + m.by * box->y1 + m.cy;
+
+    /* How far the source moves for one destination pixel to the right and
+     * for one destination line down */
+    stepX = (long)m.ax * bytesPerPixel + (long)m.ay * srcStride;
+    stepY = (long)m.bx * bytesPerPixel + (long)m.by * srcStride;
+
+    src += (long)fbY * srcStride + (long)fbX * bytesPerPixel;
+    dst += (long)box->y1 * dstStride + (long)box->x1 * bytesPerPixel;
+
+    if (m.ax != 0)
+        NestedRotateBlitLines(src, stepX, stepY, dst, dstStride,
+                              box->x2 - box->x1, box->y2 - box->y1,
+                              bytesPerPixel);
+    else
+        NestedRotateBlitTransposed(src, stepX, stepY, dst, dstStride,
+                                   box->x2 - box->x1, box->y2 - box->y1,
+                                   bytesPerPixel);
+}
@@ -0,0 +1,43 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <xf86.h>
+#include <randrstr.h>
+
+/* All functions below take the size of the CRTC mode (the host window) and
+ * work with frame buffer coordinates relative to the CRTC origin. */
+
+// Maps a host window pixel to the frame buffer pixel shown there.
+void
+NestedRotatePoint(Rotation rotation, int width, int height,
+                  int x, int y, int *retX, int *retY);
+
+// Maps a frame buffer box to the host window box it is shown in.
+void
+NestedRotateBox(Rotation rotation, int width, int height, BoxPtr box);
+
+// Fills a host window box of dst with the frame buffer pixels shown there.
+// src points to the frame buffer pixel at the CRTC origin.
+void
+NestedRotateCopy(Rotation rotation, int width, int height,
+                 const char *src, int srcStride,
+                 char *dst, int dstStride,
+                 int bytesPerPixel, const BoxRec *box);
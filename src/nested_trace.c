@@ -0,0 +1,261 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <scrnintstr.h>
+#include <pixmapstr.h>
+#include <regionstr.h>
+
+#include "nested_trace.h"
+
+/* Frames are written from the shadow update, so a large buffer keeps most
+ * of them from reaching the file system one by one */
+#define NESTED_TRACE_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int                scrnIndex; /* stored only for xf86DrvMsg usage */
+    FILE              *file;
+    char              *path;
+    Bool               withPixels;
+    uint64_t           startUsec;
+    unsigned int       width;     /* of the last frame, 0 before the first */
+    unsigned int       height;
+    uint64_t           frames;
+    uint64_t           bytes;
+} NestedTraceScreenRec, *NestedTraceScreenPtr;
+
+/* A trace covers the whole server lifetime: it is kept open across server
+ * generations, so a reset doesn't truncate what was recorded before */
+static NestedTraceScreenPtr nestedTraceScreens[MAXSCREENS];
+
+#define NESTED_TRACE_PRIV(pScreen) nestedTraceScreens[(pScreen)->myNum]
+
+static uint64_t
+NestedTraceNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static Bool
+NestedTraceWrite(NestedTraceScreenPtr priv, const void *data, size_t size) {
+    if (fwrite(data, 1, size, priv->file) != size)
+        return FALSE;
+
+    priv->bytes += size;
+    return TRUE;
+}
+
+static void
+NestedTraceLogCounters(NestedTraceScreenPtr priv) {
+    xf86DrvMsg(priv->scrnIndex, X_INFO,
+               "Damage trace %s: %llu frames, %llu bytes\n", priv->path,
+               (unsigned long long)priv->frames,
+               (unsigned long long)priv->bytes);
+}
+
+static void
+NestedTraceClose(NestedTraceScreenPtr priv) {
+    if (fclose(priv->file))
+        xf86DrvMsg(priv->scrnIndex, X_ERROR, "Damage trace %s: %s\n",
+                   priv->path, strerror(errno));
+
+    NestedTraceLogCounters(priv);
+    priv->file = NULL;
+}
+
+static Bool
+NestedTraceWriteFrame(NestedTraceScreenPtr priv, PixmapPtr pPixmap,
+                      BoxPtr boxes, int numBoxes) {
+    const char *src = pPixmap->devPrivate.ptr;
+    int cpp = pPixmap->drawable.bitsPerPixel / 8;
+    NestedTraceFrame frame = { 0 };
+    int i, y;
+
+    frame.usec = NestedTraceNow() - priv->startUsec;
+    frame.width = pPixmap->drawable.width;
+    frame.height = pPixmap->drawable.height;
+    frame.numRects = numBoxes;
+
+    if (!NestedTraceWrite(priv, &frame, sizeof(frame)))
+        return FALSE;
+
+    for (i = 0; i < numBoxes; i++) {
+        NestedTraceRect rect = {
+            boxes[i].x1, boxes[i].y1, boxes[i].x2, boxes[i].y2
+        };
+
+        if (!NestedTraceWrite(priv, &rect, sizeof(rect)))
+            return FALSE;
+    }
+
+    if (!priv->withPixels)
+        return TRUE;
+
+    for (i = 0; i < numBoxes; i++) {
+        size_t offset = (size_t)boxes[i].y1 * pPixmap->devKind +
+                        boxes[i].x1 * cpp;
+        size_t len = (size_t)(boxes[i].x2 - boxes[i].x1) * cpp;
+
+        for (y = boxes[i].y1; y < boxes[i].y2; y++, offset += pPixmap->devKind)
+            if (!NestedTraceWrite(priv, src + offset, len))
+                return FALSE;
+    }
+
+    return TRUE;
+}
+
+Bool
+NestedTraceScreenInit(ScreenPtr pScreen, const char *path, Bool withPixels,
+                      Pixel redMask, Pixel greenMask, Pixel blueMask) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    NestedTraceScreenPtr priv;
+    NestedTraceHeader header = { 0 };
+
+    /* Carries on with the trace of the previous generation, if recording
+     * hasn't stopped on an error */
+    priv = NESTED_TRACE_PRIV(pScreen);
+    if (priv)
+        return priv->file != NULL;
+
+    priv = calloc(1, sizeof(NestedTraceScreenRec));
+    if (!priv)
+        return FALSE;
+
+    priv->scrnIndex = pScrn->scrnIndex;
+    priv->withPixels = withPixels;
+    priv->path = strdup(path);
+    priv->file = fopen(path, "wb");
+
+    if (!priv->path || !priv->file) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Can't write the damage trace %s: %s\n", path,
+                   strerror(errno));
+        if (priv->file)
+            fclose(priv->file);
+        free(priv->path);
+        free(priv);
+        return FALSE;
+    }
+
+    setvbuf(priv->file, NULL, _IOFBF, NESTED_TRACE_BUFFER_SIZE);
+
+    header.magic = NESTED_TRACE_MAGIC;
+    header.version = NESTED_TRACE_VERSION;
+    header.flags = withPixels ? NESTED_TRACE_PIXELS : 0;
+    header.bitsPerPixel = pScrn->bitsPerPixel;
+    header.depth = pScrn->depth;
+    header.redMask = redMask;
+    header.greenMask = greenMask;
+    header.blueMask = blueMask;
+
+    if (!NestedTraceWrite(priv, &header, sizeof(header)) ||
+        fflush(priv->file)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
+                   "Can't write the damage trace %s: %s\n", path,
+                   strerror(errno));
+        fclose(priv->file);
+        free(priv->path);
+        free(priv);
+        return FALSE;
+    }
+
+    priv->startUsec = NestedTraceNow();
+    NESTED_TRACE_PRIV(pScreen) = priv;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO, "Recording damage%s to %s\n",
+               withPixels ? " and pixels" : "", path);
+    return TRUE;
+}
+
+void
+NestedTraceUpdate(ScreenPtr pScreen, RegionPtr pRegion) {
+    NestedTraceScreenPtr priv = NESTED_TRACE_PRIV(pScreen);
+    PixmapPtr pPixmap = pScreen->GetScreenPixmap(pScreen);
+    BoxRec screen;
+    BoxPtr boxes;
+    int numBoxes;
+
+    if (!priv || !priv->file || !pPixmap || !pPixmap->devPrivate.ptr)
+        return;
+
+    /* A replay starts from the whole screen, and starts again from it when
+     * the screen was resized */
+    if (pPixmap->drawable.width != priv->width ||
+        pPixmap->drawable.height != priv->height) {
+        priv->width = pPixmap->drawable.width;
+        priv->height = pPixmap->drawable.height;
+
+        screen.x1 = 0;
+        screen.y1 = 0;
+        screen.x2 = priv->width;
+        screen.y2 = priv->height;
+        boxes = &screen;
+        numBoxes = 1;
+    } else {
+        boxes = RegionRects(pRegion);
+        numBoxes = RegionNumRects(pRegion);
+    }
+
+    if (!NestedTraceWriteFrame(priv, pPixmap, boxes, numBoxes)) {
+        xf86DrvMsg(priv->scrnIndex, X_ERROR,
+                   "Damage trace %s: %s, stopped recording\n", priv->path,
+                   strerror(errno));
+        NestedTraceClose(priv);
+        return;
+    }
+
+    priv->frames++;
+}
+
+void
+NestedTraceCloseScreen(ScreenPtr pScreen) {
+    NestedTraceScreenPtr priv = NESTED_TRACE_PRIV(pScreen);
+
+    if (!priv || !priv->file)
+        return;
+
+    /* The file is closed when the server exits; the next generation starts
+     * again from a whole screen frame */
+    if (fflush(priv->file)) {
+        xf86DrvMsg(priv->scrnIndex, X_ERROR,
+                   "Damage trace %s: %s, stopped recording\n", priv->path,
+                   strerror(errno));
+        NestedTraceClose(priv);
+        return;
+    }
+
+    NestedTraceLogCounters(priv);
+    priv->width = 0;
+    priv->height = 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <xf86.h>
+
+#include "nested_trace_format.h"
+
+// Starts writing the damage of each frame of the screen to the file at path,
+// with the damaged pixels if withPixels is set. Later server generations
+// carry on with the same file.
+Bool
+NestedTraceScreenInit(ScreenPtr pScreen, const char *path, Bool withPixels,
+                      Pixel redMask, Pixel greenMask, Pixel blueMask);
+
+// Adds a frame with the given damage to the trace, if there is one.
+void
+NestedTraceUpdate(ScreenPtr pScreen, RegionPtr pRegion);
+
+// Flushes the trace; it stays open for the next server generation.
+void
+NestedTraceCloseScreen(ScreenPtr pScreen);
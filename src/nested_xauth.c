@@ -0,0 +1,218 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <X11/X.h>
+
+#include <xorg-server.h>
+#include <misc.h>
+
+#include "nested_xauth.h"
+
+#define NESTED_XAUTH_COOKIE "MIT-MAGIC-COOKIE-1"
+
+/* The addresses a display is known by in authority files */
+typedef struct {
+    unsigned short family;
+    int            length;
+    char           data[256];
+} NestedXauthAddress;
+
+static Bool
+NestedXauthMatch(Xauth *entry, const NestedXauthAddress *addresses,
+                 int numAddresses, const char *number) {
+    int i;
+
+    if (entry->name_length != strlen(NESTED_XAUTH_COOKIE) ||
+        memcmp(entry->name, NESTED_XAUTH_COOKIE, entry->name_length))
+        return FALSE;
+
+    if (entry->number_length &&
+        (entry->number_length != strlen(number) ||
+         memcmp(entry->number, number, entry->number_length)))
+        return FALSE;
+
+    if (entry->family == FamilyWild)
+        return TRUE;
+
+    for (i = 0; i < numAddresses; i++)
+        if (entry->family == addresses[i].family &&
+            entry->address_length == addresses[i].length &&
+            !memcmp(entry->address, addresses[i].data, addresses[i].length))
+            return TRUE;
+
+    return FALSE;
+}
+
+/* Local connections, also over the loopback, go by the host name */
+static int
+NestedXauthLocal(NestedXauthAddress *address) {
+    if (gethostname(address->data, sizeof(address->data)) < 0)
+        return 0;
+
+    address->data[sizeof(address->data) - 1] = '\0';
+    address->family = FamilyLocal;
+    address->length = strlen(address->data);
+    return 1;
+}
+
+/* Fills in up to max addresses of host, as libxcb finds them by the peer
+ * address of its socket */
+static int
+NestedXauthResolve(const char *host, NestedXauthAddress *addresses, int max) {
+    struct addrinfo hints, *list, *ai;
+    Bool loopback = FALSE;
+    int n = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, NULL, &hints, &list))
+        return 0;
+
+    for (ai = list; ai && n < max - 1; ai = ai->ai_next) {
+        const void *data;
+        int length;
+
+        if (ai->ai_family == AF_INET) {
+            struct sockaddr_in *sin = (struct sockaddr_in *)ai->ai_addr;
+
+            if (ntohl(sin->sin_addr.s_addr) >> 24 == 127) {
+                loopback = TRUE;
+                continue;
+            }
+
+            addresses[n].family = FamilyInternet;
+            data = &sin->sin_addr;
+            length = sizeof(sin->sin_addr);
+        } else if (ai->ai_family == AF_INET6) {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ai->ai_addr;
+
+            if (IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr)) {
+                loopback = TRUE;
+                continue;
+            }
+
+            /* libxcb names mapped IPv4 peers by their IPv4 address */
+            if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+                addresses[n].family = FamilyInternet;
+                data = &sin6->sin6_addr.s6_addr[12];
+                length = 4;
+            } else {
+                addresses[n].family = FamilyInternet6;
+                data = &sin6->sin6_addr;
+                length = sizeof(sin6->sin6_addr);
+            }
+        } else
+            continue;
+
+        memcpy(addresses[n].data, data, length);
+        addresses[n].length = length;
+        n++;
+    }
+
+    freeaddrinfo(list);
+
+    /* Connections over the loopback are local ones */
+    if (loopback)
+        n += NestedXauthLocal(&addresses[n]);
+
+    return n;
+}
+
+Xauth *
+NestedXauthGet(const char *path, const char *displayName) {
+    NestedXauthAddress addresses[8];
+    char host[256], number[16];
+    const char *colon, *start;
+    Xauth *entry;
+    FILE *file;
+    size_t len;
+    int numAddresses;
+
+    if (!displayName)
+        displayName = getenv("DISPLAY");
+    if (!displayName)
+        return NULL;
+
+    /* [protocol/][host]:display[.screen] */
+    start = strchr(displayName, '/');
+    if (!start || displayName[0] == '/')
+        start = displayName;
+    else
+        start++;
+
+    colon = strrchr(start, ':');
+    if (!colon)
+        return NULL;
+
+    len = strspn(colon + 1, "0123456789");
+    if (len == 0 || len >= sizeof(number))
+        return NULL;
+
+    memcpy(number, colon + 1, len);
+    number[len] = '\0';
+
+    len = colon - start;
+    if (len > 0 && start[0] == '[' && start[len - 1] == ']') {
+        start++;
+        len -= 2;
+    }
+
+    if (len >= sizeof(host))
+        return NULL;
+
+    memcpy(host, start, len);
+    host[len] = '\0';
+
+    if (host[0] == '\0' || host[0] == '/' || !strcmp(host, "unix") ||
+        !strncmp(displayName, "unix/", 5))
+        numAddresses = NestedXauthLocal(&addresses[0]);
+    else
+        numAddresses = NestedXauthResolve(host, addresses,
+                                          sizeof(addresses) /
+                                          sizeof(addresses[0]));
+
+    file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    while ((entry = XauReadAuth(file))) {
+        if (NestedXauthMatch(entry, addresses, numAddresses, number))
+            break;
+
+        XauDisposeAuth(entry);
+    }
+
+    fclose(file);
+    return entry;
+}
@@ -0,0 +1,255 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <xf86xv.h>
+#include <X11/extensions/Xv.h>
+#include "xf86Crtc.h"
+
+#include "nested_xv.h"
+
+#define MAKE_ATOM(a) MakeAtom(a, sizeof(a) - 1, TRUE)
+
+/* The image formats, their layout and the maximum image size all come from
+ * the host port, so nested clients lay out their images exactly the way the
+ * host wants them and the planes can be passed on untouched. */
+typedef struct {
+    NestedClientPrivatePtr clientData;
+    CARD32                 colorKey;
+    Bool                   colorKeyed; /* FALSE if the host port has no key */
+    RegionRec              clip; /* where the color key was last painted */
+} NestedXvPortPrivRec, *NestedXvPortPrivPtr;
+
+static Atom xvColorKey;
+
+static XF86VideoAdaptorPtr nestedXvAdaptors[MAXSCREENS];
+
+static XF86AttributeRec NestedXvAttributes[] = {
+    { XvSettable | XvGettable, 0, (1 << 24) - 1, "XV_COLORKEY" },
+};
+
+static void
+NestedXvStopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown) {
+    NestedXvPortPrivPtr pPriv = data;
+
+    RegionEmpty(&pPriv->clip);
+    NestedClientXvStopVideo(pPriv->clientData);
+}
+
+static int
+NestedXvSetPortAttribute(ScrnInfoPtr pScrn, Atom attribute, INT32 value,
+                         pointer data) {
+    NestedXvPortPrivPtr pPriv = data;
+
+    if (attribute != xvColorKey)
+        return BadMatch;
+
+    pPriv->colorKey = value;
+    pPriv->colorKeyed = NestedClientXvSetColorKey(pPriv->clientData, value);
+
+    /* Paint the new key on the next frame */
+    RegionEmpty(&pPriv->clip);
+    return Success;
+}
+
+static int
+NestedXvGetPortAttribute(ScrnInfoPtr pScrn, Atom attribute, INT32 *value,
+                         pointer data) {
+    NestedXvPortPrivPtr pPriv = data;
+
+    if (attribute != xvColorKey)
+        return BadMatch;
+
+    *value = pPriv->colorKey;
+    return Success;
+}
+
+static void
+NestedXvQueryBestSize(ScrnInfoPtr pScrn, Bool motion,
+                      short vid_w, short vid_h, short drw_w, short drw_h,
+                      unsigned int *p_w, unsigned int *p_h, pointer data) {
+    /* The host scales to any size */
+    *p_w = drw_w;
+    *p_h = drw_h;
+}
+
+static int
+NestedXvPutImage(ScrnInfoPtr pScrn,
+                 short src_x, short src_y, short drw_x, short drw_y,
+                 short src_w, short src_h, short drw_w, short drw_h,
+                 int id, unsigned char *buf, short width, short height,
+                 Bool sync, RegionPtr clipBoxes, pointer data,
+                 DrawablePtr pDraw) {
+    NestedXvPortPrivPtr pPriv = data;
+    xf86CrtcPtr crtc = XF86_CRTC_CONFIG_PTR(pScrn)->crtc[0];
+
+    /* The host can't rotate the video for us */
+    if (crtc->rotation != RR_Rotate_0)
+        return BadAlloc;
+
+    /* The key is painted in the nested frame buffer and reaches the host
+     * with the next screen update, like any other drawing. A port without
+     * a key draws over the window as it is, painting one would only cost
+     * an upload of the whole video area. */
+    if (pPriv->colorKeyed && !RegionEqual(&pPriv->clip, clipBoxes)) {
+        RegionCopy(&pPriv->clip, clipBoxes);
+        xf86XVFillKeyHelperDrawable(pDraw, pPriv->colorKey, clipBoxes);
+    }
+
+    NestedClientXvPutImage(pPriv->clientData, id, buf, width, height,
+                           src_x, src_y, src_w, src_h,
+                           drw_x, drw_y, drw_w, drw_h,
+                           RegionRects(clipBoxes),
+                           RegionNumRects(clipBoxes));
+
+    return Success;
+}
+
+static int
+NestedXvQueryImageAttributes(ScrnInfoPtr pScrn, int id,
+                             unsigned short *w, unsigned short *h,
+                             int *pitches, int *offsets) {
+    NestedXvPortPrivPtr pPriv = nestedXvAdaptors[pScrn->scrnIndex]->
+                                pPortPrivates[0].ptr;
+
+    return NestedClientXvQueryImageAttributes(pPriv->clientData, id, w, h,
+                                              pitches, offsets);
+}
+
+Bool
+NestedXvScreenInit(ScreenPtr pScreen, NestedClientPrivatePtr clientData) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    XF86VideoAdaptorPtr adapt;
+    XF86VideoEncodingPtr encoding;
+    XF86VideoFormatPtr format;
+    NestedXvPortPrivPtr pPriv;
+    XF86ImagePtr images;
+    int numImages;
+    unsigned short maxWidth, maxHeight;
+    Bool ret;
+
+    if (!NestedClientXvInit(clientData, &images, &numImages,
+                            &maxWidth, &maxHeight)) {
+        xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+                   "No usable host Xv port, XVideo disabled\n");
+        return FALSE;
+    }
+
+    /* Everything that xf86XVScreenInit() doesn't copy lives with the
+     * adaptor until NestedXvCloseScreen() */
+    adapt = calloc(1, sizeof(XF86VideoAdaptorRec) +
+                      sizeof(XF86VideoEncodingRec) +
+                      sizeof(XF86VideoFormatRec) +
+                      sizeof(DevUnion) +
+                      sizeof(NestedXvPortPrivRec));
+    if (!adapt) {
+        free(images);
+        return FALSE;
+    }
+
+    encoding = (XF86VideoEncodingPtr)&adapt[1];
+    format = (XF86VideoFormatPtr)&encoding[1];
+    adapt->pPortPrivates = (DevUnion *)&format[1];
+    pPriv = (NestedXvPortPrivPtr)&adapt->pPortPrivates[1];
+
+    encoding->id = 0;
+    encoding->name = "XV_IMAGE";
+    encoding->width = maxWidth;
+    encoding->height = maxHeight;
+    encoding->rate.numerator = 1;
+    encoding->rate.denominator = 1;
+
+    format->depth = pScrn->depth;
+    format->class = TrueColor;
+
+    /* A color key that is unlikely to show up in normal drawing */
+    pPriv->clientData = clientData;
+    pPriv->colorKey = (1 << pScrn->offset.red) |
+                      (1 << pScrn->offset.green) |
+                      (((pScrn->mask.blue >> pScrn->offset.blue) - 1) <<
+                       pScrn->offset.blue);
+    RegionNull(&pPriv->clip);
+    pPriv->colorKeyed = NestedClientXvSetColorKey(clientData, pPriv->colorKey);
+
+    adapt->type = XvWindowMask | XvInputMask | XvImageMask;
+    adapt->flags = VIDEO_OVERLAID_IMAGES;
+    adapt->name = "Nested Xv Forwarder";
+    adapt->nEncodings = 1;
+    adapt->pEncodings = encoding;
+    adapt->nFormats = 1;
+    adapt->pFormats = format;
+    adapt->nPorts = 1;
+    adapt->pPortPrivates[0].ptr = pPriv;
+    adapt->nAttributes = sizeof(NestedXvAttributes) /
+                         sizeof(NestedXvAttributes[0]);
+    adapt->pAttributes = NestedXvAttributes;
+    adapt->nImages = numImages;
+    adapt->pImages = images;
+    adapt->StopVideo = NestedXvStopVideo;
+    adapt->SetPortAttribute = NestedXvSetPortAttribute;
+    adapt->GetPortAttribute = NestedXvGetPortAttribute;
+    adapt->QueryBestSize = NestedXvQueryBestSize;
+    adapt->PutImage = NestedXvPutImage;
+    adapt->QueryImageAttributes = NestedXvQueryImageAttributes;
+
+    xvColorKey = MAKE_ATOM("XV_COLORKEY");
+
+    ret = xf86XVScreenInit(pScreen, &adapt, 1);
+
+    /* The images were copied */
+    free(images);
+    adapt->pImages = NULL;
+
+    if (!ret) {
+        xf86DrvMsg(pScrn->scrnIndex, X_WARNING, "XVideo initialization failed\n");
+        RegionUninit(&pPriv->clip);
+        free(adapt);
+        return FALSE;
+    }
+
+    nestedXvAdaptors[pScrn->scrnIndex] = adapt;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+               "XVideo forwarding %d image formats to the host\n", numImages);
+    return TRUE;
+}
+
+void
+NestedXvCloseScreen(ScreenPtr pScreen) {
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    XF86VideoAdaptorPtr adapt = nestedXvAdaptors[pScrn->scrnIndex];
+    NestedXvPortPrivPtr pPriv;
+
+    if (!adapt)
+        return;
+
+    pPriv = adapt->pPortPrivates[0].ptr;
+    RegionUninit(&pPriv->clip);
+    free(adapt);
+    nestedXvAdaptors[pScrn->scrnIndex] = NULL;
+}
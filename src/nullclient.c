@@ -0,0 +1,688 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* The null backend has no host: the frame buffer is plain memory and uploads
+ * are only counted. It is meant for measuring the cost of the nested server
+ * itself, without a host X server.
+ *
+ * An upload can be given a simulated cost, paid when the driver syncs:
+ *   NESTED_NULL_BANDWIDTH  megabytes per second, 0 (the default) for free
+ *   NESTED_NULL_LATENCY    microseconds per sync, default 0
+ * The counters are logged when a screen is closed or the server resets. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "client.h"
+
+/* The size of the simulated host screen, for "Fullscreen" and "Output" */
+#define NULL_HOST_WIDTH  1920
+#define NULL_HOST_HEIGHT 1080
+
+typedef struct {
+    uint64_t updates;  /* NestedNullUpdateScreen() calls */
+    uint64_t rects;    /* ... that were not clipped away */
+    uint64_t bytes;    /* uploaded, counting whole pixels */
+    uint64_t syncs;    /* syncs with pending uploads */
+    uint64_t waitedNs; /* time spent paying the simulated cost */
+} NullCounters;
+
+struct NestedBackendScreen {
+    int scrnIndex; /* stored only for xf86DrvMsg usage */
+    char *fb;
+    size_t fbSize; /* bytes allocated for fb */
+    unsigned int fbWidth;
+    unsigned int fbHeight;
+    unsigned int bytesPerPixel;
+    unsigned int width;
+    unsigned int height;
+    int viewX; /* frame buffer position shown at the window origin */
+    int viewY;
+    Bool blanked;
+    Pixel redMask;
+    Pixel greenMask;
+    Pixel blueMask;
+    DeviceIntPtr dev;
+
+    /* Simulated upload cost */
+    uint64_t bandwidth; /* bytes per second, 0 for free */
+    uint64_t latencyNs;
+    uint64_t pendingBytes;
+    Bool syncing;
+    uint64_t deadline; /* CLOCK_MONOTONIC ns the pending sync ends at */
+
+    NullCounters counters;
+};
+
+static void
+NestedNullUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                       int16_t y1, int16_t x2, int16_t y2);
+
+static uint64_t
+NullClientNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+NullClientGetEnv(int scrnIndex, const char *name) {
+    const char *value = getenv(name);
+    char *end;
+    unsigned long long n;
+
+    if (!value || !*value)
+        return 0;
+
+    n = strtoull(value, &end, 10);
+    if (*end) {
+        NestedClientMsg(scrnIndex, X_WARNING, "Ignoring invalid %s \"%s\"\n",
+                        name, value);
+        return 0;
+    }
+
+    return n;
+}
+
+static void
+NullClientLogCounters(NestedBackendScreenPtr pPriv) {
+    NullCounters *c = &pPriv->counters;
+
+    NestedClientMsg(pPriv->scrnIndex, X_INFO,
+                    "Null backend: %llu updates, %llu rects, %llu bytes, "
+                    "%llu syncs, %llu us waited\n",
+                    (unsigned long long)c->updates,
+                    (unsigned long long)c->rects,
+                    (unsigned long long)c->bytes,
+                    (unsigned long long)c->syncs,
+                    (unsigned long long)(c->waitedNs / 1000));
+}
+
+/* The frame buffer lines are 32 bit aligned, like host images */
+static Bool
+NullClientCreateFrameBuffer(NestedBackendScreenPtr pPriv,
+                            unsigned int width, unsigned int height) {
+    size_t stride = ((size_t)width * pPriv->bytesPerPixel + 3) & ~(size_t)3;
+    size_t size = stride * height;
+    char *fb;
+
+    /* We are shrinking: keep the old buffer */
+    if (size > pPriv->fbSize) {
+        fb = calloc(1, size);
+        if (!fb)
+            return FALSE;
+
+        free(pPriv->fb);
+        pPriv->fb = fb;
+        pPriv->fbSize = size;
+    }
+
+    pPriv->fbWidth = width;
+    pPriv->fbHeight = height;
+    return TRUE;
+}
+
+/* There is no display to check, any name will do */
+static Bool
+NestedNullCheckDisplay(int scrnIndex,
+                       const char *displayName,
+                       const char *xauthority,
+                       const char *output,
+                       Bool enable,
+                       const char *parentOutput,
+                       char relation,
+                       unsigned int *width,
+                       unsigned int *height,
+                       int *x,
+                       int *y) {
+    if (output)
+        NestedClientMsg(scrnIndex, X_INFO,
+                        "Null backend: output %s is a %dx%d host screen\n",
+                        output, NULL_HOST_WIDTH, NULL_HOST_HEIGHT);
+
+    if (width != NULL)
+        *width = NULL_HOST_WIDTH;
+
+    if (height != NULL)
+        *height = NULL_HOST_HEIGHT;
+
+    if (x != NULL)
+        *x = 0;
+
+    if (y != NULL)
+        *y = 0;
+
+    return TRUE;
+}
+
+static Bool
+NestedNullValidDepth(int depth) {
+    return depth == 15 || depth == 16 || depth == 24;
+}
+
+static NestedBackendScreenPtr
+NestedNullCreateScreen(int scrnIndex,
+                       const char *displayName,
+                       const char *xauthority,
+                       Bool wantFullscreenHint,
+                       Bool rootless,
+                       Bool withInput,
+                       unsigned int fbWidth,
+                       unsigned int fbHeight,
+                       unsigned int width,
+                       unsigned int height,
+                       int originX,
+                       int originY,
+                       double scale,
+                       unsigned int depth,
+                       unsigned int bitsPerPixel,
+                       Pixel *retRedMask,
+                       Pixel *retGreenMask,
+                       Pixel *retBlueMask) {
+    NestedBackendScreenPtr pPriv;
+
+    pPriv = calloc(1, sizeof(struct NestedBackendScreen));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->bytesPerPixel = (bitsPerPixel + 7) / 8;
+    pPriv->width = width;
+    pPriv->height = height;
+
+    switch (depth) {
+    case 15:
+        pPriv->redMask = 0x7c00;
+        pPriv->greenMask = 0x03e0;
+        pPriv->blueMask = 0x001f;
+        break;
+    case 16:
+        pPriv->redMask = 0xf800;
+        pPriv->greenMask = 0x07e0;
+        pPriv->blueMask = 0x001f;
+        break;
+    default:
+        pPriv->redMask = 0xff0000;
+        pPriv->greenMask = 0x00ff00;
+        pPriv->blueMask = 0x0000ff;
+        break;
+    }
+
+    if (!NullClientCreateFrameBuffer(pPriv, fbWidth, fbHeight)) {
+        free(pPriv);
+        return NULL;
+    }
+
+    pPriv->bandwidth = NullClientGetEnv(scrnIndex,
+                                        "NESTED_NULL_BANDWIDTH") * 1000000;
+    pPriv->latencyNs = NullClientGetEnv(scrnIndex,
+                                        "NESTED_NULL_LATENCY") * 1000;
+
+    if (pPriv->bandwidth || pPriv->latencyNs)
+        NestedClientMsg(scrnIndex, X_INFO,
+                        "Null backend: uploads cost %llu us plus 1 s per %llu MB\n",
+                        (unsigned long long)(pPriv->latencyNs / 1000),
+                        (unsigned long long)(pPriv->bandwidth / 1000000));
+    else
+        NestedClientMsg(scrnIndex, X_INFO, "Null backend: uploads are free\n");
+
+    *retRedMask = pPriv->redMask;
+    *retGreenMask = pPriv->greenMask;
+    *retBlueMask = pPriv->blueMask;
+
+    return pPriv;
+}
+
+static char *
+NestedNullGetFrameBuffer(NestedBackendScreenPtr pPriv) {
+    return pPriv->fb;
+}
+
+static Bool
+NestedNullResizeFrameBuffer(NestedBackendScreenPtr pPriv,
+                            unsigned int width, unsigned int height) {
+    return NullClientCreateFrameBuffer(pPriv, width, height);
+}
+
+static Bool
+NestedNullResizeWindow(NestedBackendScreenPtr pPriv,
+                       unsigned int width, unsigned int height) {
+    pPriv->width = width;
+    pPriv->height = height;
+    return TRUE;
+}
+
+static void
+NestedNullSetViewport(NestedBackendScreenPtr pPriv, int x, int y) {
+    if (pPriv->viewX == x && pPriv->viewY == y)
+        return;
+
+    pPriv->viewX = x;
+    pPriv->viewY = y;
+
+    /* A real host needs the whole window again */
+    if (!pPriv->blanked)
+        NestedNullUpdateScreen(pPriv, x, y,
+                               x + pPriv->width, y + pPriv->height);
+}
+
+static void
+NestedNullUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                       int16_t y1, int16_t x2, int16_t y2) {
+    uint64_t bytes;
+
+    pPriv->counters.updates++;
+
+    /* Only the part of the frame buffer inside the viewport is uploaded */
+    if (x1 < pPriv->viewX)
+        x1 = pPriv->viewX;
+    if (y1 < pPriv->viewY)
+        y1 = pPriv->viewY;
+    if (x2 > pPriv->viewX + (int)pPriv->width)
+        x2 = pPriv->viewX + pPriv->width;
+    if (y2 > pPriv->viewY + (int)pPriv->height)
+        y2 = pPriv->viewY + pPriv->height;
+
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    bytes = (uint64_t)(x2 - x1) * (y2 - y1) * pPriv->bytesPerPixel;
+
+    pPriv->counters.rects++;
+    pPriv->counters.bytes += bytes;
+    pPriv->pendingBytes += bytes;
+}
+
+/* The simulated host starts working on the pending uploads when the driver
+ * asks for a sync, so the cost of all screens is paid concurrently */
+static void
+NestedNullBeginSync(NestedBackendScreenPtr pPriv) {
+    uint64_t cost = pPriv->latencyNs;
+
+    if (!pPriv->pendingBytes)
+        return;
+
+    if (pPriv->bandwidth)
+        cost += pPriv->pendingBytes * 1000000000ULL / pPriv->bandwidth;
+
+    pPriv->counters.syncs++;
+    pPriv->pendingBytes = 0;
+    pPriv->deadline = NullClientNow() + cost;
+    pPriv->syncing = TRUE;
+}
+
+static void
+NestedNullFinishSync(NestedBackendScreenPtr pPriv) {
+    struct timespec ts;
+    uint64_t now;
+
+    if (!pPriv->syncing)
+        return;
+
+    pPriv->syncing = FALSE;
+
+    now = NullClientNow();
+    if (now >= pPriv->deadline)
+        return;
+
+    pPriv->counters.waitedNs += pPriv->deadline - now;
+
+    ts.tv_sec = pPriv->deadline / 1000000000ULL;
+    ts.tv_nsec = pPriv->deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void
+NestedNullHideCursor(NestedBackendScreenPtr pPriv) {
+}
+
+static void
+NestedNullSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked) {
+    if (pPriv->blanked == blanked)
+        return;
+
+    pPriv->blanked = blanked;
+
+    if (!blanked)
+        NestedNullUpdateScreen(pPriv, pPriv->viewX, pPriv->viewY,
+                               pPriv->viewX + pPriv->width,
+                               pPriv->viewY + pPriv->height);
+}
+
+/* Nothing ever happens on the host side */
+static void
+NestedNullCheckEvents(NestedBackendScreenPtr pPriv) {
+}
+
+static void
+NestedNullCloseScreen(NestedBackendScreenPtr pPriv) {
+    NullClientLogCounters(pPriv);
+    free(pPriv->fb);
+    free(pPriv);
+}
+
+/* The host is never lost */
+static Bool
+NestedNullReattach(NestedBackendScreenPtr pPriv, const char *displayName,
+                   const char *xauthority) {
+    return TRUE;
+}
+
+/* Each server generation gets counters of its own */
+static void
+NestedNullResetScreen(NestedBackendScreenPtr pPriv) {
+    NullClientLogCounters(pPriv);
+    memset(&pPriv->counters, 0, sizeof(pPriv->counters));
+    pPriv->dev = NULL;
+}
+
+static Bool
+NestedNullReuseScreen(NestedBackendScreenPtr pPriv,
+                      unsigned int fbWidth, unsigned int fbHeight,
+                      unsigned int width, unsigned int height,
+                      Pixel *retRedMask, Pixel *retGreenMask,
+                      Pixel *retBlueMask) {
+    if (pPriv->fbWidth != fbWidth || pPriv->fbHeight != fbHeight ||
+        pPriv->width != width || pPriv->height != height)
+        return FALSE;
+
+    NestedNullSetBlanked(pPriv, FALSE);
+
+    *retRedMask = pPriv->redMask;
+    *retGreenMask = pPriv->greenMask;
+    *retBlueMask = pPriv->blueMask;
+    return TRUE;
+}
+
+static void
+NestedNullSetDevicePtr(NestedBackendScreenPtr pPriv, DeviceIntPtr dev) {
+    pPriv->dev = dev;
+}
+
+/* There are no host events to wait for */
+static int
+NestedNullGetFileDescriptor(NestedBackendScreenPtr pPriv) {
+    return -1;
+}
+
+/* The server's default keymap is kept */
+static Bool
+NestedNullGetKeyboardMappings(NestedBackendScreenPtr pPriv,
+                              KeySymsPtr keySyms, CARD8 *modmap,
+                              XkbControlsPtr ctrls) {
+    return FALSE;
+}
+
+/* There is nothing to forward to: NestedNullXvInit(),
+ * NestedNullRenderInit() and NestedNullCoreInit() failing keeps the
+ * driver from calling any of the others */
+static Bool
+NestedNullXvInit(NestedBackendScreenPtr pPriv, XF86ImagePtr *retImages,
+                 int *retNumImages, unsigned short *retMaxWidth,
+                 unsigned short *retMaxHeight) {
+    return FALSE;
+}
+
+static int
+NestedNullXvQueryImageAttributes(NestedBackendScreenPtr pPriv, int id,
+                                 unsigned short *width,
+                                 unsigned short *height,
+                                 int *pitches, int *offsets) {
+    return 0;
+}
+
+static Bool
+NestedNullXvSetColorKey(NestedBackendScreenPtr pPriv, CARD32 colorKey) {
+    return FALSE;
+}
+
+static void
+NestedNullXvPutImage(NestedBackendScreenPtr pPriv, int id,
+                     unsigned char *buf, short width, short height,
+                     short srcX, short srcY, short srcWidth, short srcHeight,
+                     short dstX, short dstY, short dstWidth, short dstHeight,
+                     BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedNullXvStopVideo(NestedBackendScreenPtr pPriv) {
+}
+
+static Bool
+NestedNullRenderInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedNullRenderReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedNullRenderCreateSolid(NestedBackendScreenPtr pPriv,
+                            xRenderColor *color) {
+    return None;
+}
+
+static CARD32
+NestedNullRenderCreateLinearGradient(NestedBackendScreenPtr pPriv,
+                                     xPointFixed *p1, xPointFixed *p2,
+                                     int numStops, xFixed *stops,
+                                     xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static CARD32
+NestedNullRenderCreateRadialGradient(NestedBackendScreenPtr pPriv,
+                                     xPointFixed *inner, xPointFixed *outer,
+                                     xFixed innerRadius, xFixed outerRadius,
+                                     int numStops, xFixed *stops,
+                                     xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static void
+NestedNullRenderFreePicture(NestedBackendScreenPtr pPriv, CARD32 picture) {
+}
+
+static void
+NestedNullRenderSetClip(NestedBackendScreenPtr pPriv, BoxPtr boxes,
+                        int numBoxes) {
+}
+
+static void
+NestedNullRenderComposite(NestedBackendScreenPtr pPriv, CARD8 op,
+                          CARD32 src, CARD32 mask,
+                          INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                          INT16 xDst, INT16 yDst,
+                          CARD16 width, CARD16 height) {
+}
+
+static Bool
+NestedNullRenderTrapezoids(NestedBackendScreenPtr pPriv, CARD8 op,
+                           CARD32 src, int maskFormat,
+                           INT16 xSrc, INT16 ySrc,
+                           int xOrigin, int yOrigin,
+                           int numTraps, xTrapezoid *traps) {
+    return FALSE;
+}
+
+static void
+NestedNullRenderResetGlyphs(NestedBackendScreenPtr pPriv, int format) {
+}
+
+static void
+NestedNullRenderAddGlyph(NestedBackendScreenPtr pPriv, int format,
+                         CARD32 id, xGlyphInfo *info,
+                         const char *data, int size) {
+}
+
+static Bool
+NestedNullRenderCompositeGlyphs(NestedBackendScreenPtr pPriv, CARD8 op,
+                                CARD32 src, int maskFormat, int format,
+                                INT16 xSrc, INT16 ySrc,
+                                int xOrigin, int yOrigin,
+                                int numLists, NestedGlyphListPtr lists,
+                                CARD32 *glyphs) {
+    return FALSE;
+}
+
+static Bool
+NestedNullCoreInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedNullCoreReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static void
+NestedNullCoreSetGC(NestedBackendScreenPtr pPriv, int alu,
+                    CARD32 planeMask, CARD32 foreground, int capStyle,
+                    BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedNullCorePolyFillRect(NestedBackendScreenPtr pPriv,
+                           int xOrigin, int yOrigin,
+                           int numRects, xRectangle *rects) {
+}
+
+static void
+NestedNullCorePolySegment(NestedBackendScreenPtr pPriv,
+                          int xOrigin, int yOrigin,
+                          int numSegments, xSegment *segments) {
+}
+
+static Bool
+NestedNullCoreCopyArea(NestedBackendScreenPtr pPriv, int srcX, int srcY,
+                       int width, int height, int dstX, int dstY) {
+    return FALSE;
+}
+
+static Bool
+NestedNullCorePutImage(NestedBackendScreenPtr pPriv, int depth,
+                       int x, int y, int width, int height,
+                       int stride, char *data) {
+    return FALSE;
+}
+
+/* Rootless mode needs a host window manager, the screen is handled as usual */
+static Bool
+NestedNullRootlessReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedNullRootlessCreateWindow(NestedBackendScreenPtr pPriv, int x, int y,
+                               unsigned int width, unsigned int height,
+                               Bool overrideRedirect,
+                               const char *name, int nameLength) {
+    return 0;
+}
+
+static void
+NestedNullRootlessConfigureWindow(NestedBackendScreenPtr pPriv,
+                                  CARD32 window, int x, int y,
+                                  unsigned int width, unsigned int height) {
+}
+
+static void
+NestedNullRootlessRaiseWindow(NestedBackendScreenPtr pPriv, CARD32 window) {
+}
+
+static void
+NestedNullRootlessDestroyWindow(NestedBackendScreenPtr pPriv,
+                                CARD32 window) {
+}
+
+static void
+NestedNullRootlessUpdateWindow(NestedBackendScreenPtr pPriv, CARD32 window,
+                               int x, int y, BoxPtr boxes, int numBoxes) {
+}
+
+const NestedClientBackendRec nestedNullBackend = {
+    .name = "null",
+    .Probe = NULL,
+    .CheckDisplay = NestedNullCheckDisplay,
+    .ValidDepth = NestedNullValidDepth,
+    .CreateScreen = NestedNullCreateScreen,
+    .GetFrameBuffer = NestedNullGetFrameBuffer,
+    .ResizeFrameBuffer = NestedNullResizeFrameBuffer,
+    .ResizeWindow = NestedNullResizeWindow,
+    .SetViewport = NestedNullSetViewport,
+    .UpdateScreen = NestedNullUpdateScreen,
+    .BeginSync = NestedNullBeginSync,
+    .FinishSync = NestedNullFinishSync,
+    .HideCursor = NestedNullHideCursor,
+    .SetBlanked = NestedNullSetBlanked,
+    .CheckEvents = NestedNullCheckEvents,
+    .CloseScreen = NestedNullCloseScreen,
+    .Reattach = NestedNullReattach,
+    .ResetScreen = NestedNullResetScreen,
+    .ReuseScreen = NestedNullReuseScreen,
+    .SetDevicePtr = NestedNullSetDevicePtr,
+    .GetFileDescriptor = NestedNullGetFileDescriptor,
+    .GetKeyboardMappings = NestedNullGetKeyboardMappings,
+    .XvInit = NestedNullXvInit,
+    .XvQueryImageAttributes = NestedNullXvQueryImageAttributes,
+    .XvSetColorKey = NestedNullXvSetColorKey,
+    .XvPutImage = NestedNullXvPutImage,
+    .XvStopVideo = NestedNullXvStopVideo,
+    .RenderInit = NestedNullRenderInit,
+    .RenderReady = NestedNullRenderReady,
+    .RenderCreateSolid = NestedNullRenderCreateSolid,
+    .RenderCreateLinearGradient = NestedNullRenderCreateLinearGradient,
+    .RenderCreateRadialGradient = NestedNullRenderCreateRadialGradient,
+    .RenderFreePicture = NestedNullRenderFreePicture,
+    .RenderSetClip = NestedNullRenderSetClip,
+    .RenderComposite = NestedNullRenderComposite,
+    .RenderTrapezoids = NestedNullRenderTrapezoids,
+    .RenderResetGlyphs = NestedNullRenderResetGlyphs,
+    .RenderAddGlyph = NestedNullRenderAddGlyph,
+    .RenderCompositeGlyphs = NestedNullRenderCompositeGlyphs,
+    .CoreInit = NestedNullCoreInit,
+    .CoreReady = NestedNullCoreReady,
+    .CoreSetGC = NestedNullCoreSetGC,
+    .CorePolyFillRect = NestedNullCorePolyFillRect,
+    .CorePolySegment = NestedNullCorePolySegment,
+    .CoreCopyArea = NestedNullCoreCopyArea,
+    .CorePutImage = NestedNullCorePutImage,
+    .RootlessReady = NestedNullRootlessReady,
+    .RootlessCreateWindow = NestedNullRootlessCreateWindow,
+    .RootlessConfigureWindow = NestedNullRootlessConfigureWindow,
+    .RootlessRaiseWindow = NestedNullRootlessRaiseWindow,
+    .RootlessDestroyWindow = NestedNullRootlessDestroyWindow,
+    .RootlessUpdateWindow = NestedNullRootlessUpdateWindow,
+};
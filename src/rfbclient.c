@@ -0,0 +1,2073 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* The RFB backend has no host X server: the nested screen is served to VNC
+ * viewers (RFB 3.3 to 3.8, no authentication, Raw and ZRLE encodings and
+ * DesktopSize). The "Display" option is the address to listen on:
+ *   /path or unix:/path   a Unix socket
+ *   tcp:[host:]port       TCP, on 127.0.0.1 unless a host is given
+ * Without it, screen N of display :D listens on the Unix socket D.N in
+ * $XDG_RUNTIME_DIR/nested-vnc, or /tmp/nested-vnc-UID without it. As
+ * viewers don't authenticate, that directory is only open to the user of
+ * the server and Unix sockets are mode 0600; anyone who can reach a TCP
+ * address gets the screen and its input, which is why it has to be asked
+ * for with "tcp:".
+ *
+ * Each viewer has a thread of its own that encodes its updates and sends
+ * them. Updates are encoded between NestedRfbBeginSync() and
+ * NestedRfbFinishSync(), while the frame buffer holds still; sending
+ * doesn't hold up the server. A viewer only gets an update after asking for
+ * one and after sending the previous one, and at most NESTED_RFB_MAX_FPS
+ * (default 60) times a second; damage accumulates in between. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <zlib.h>
+
+#include <X11/keysym.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <regionstr.h>
+
+#include "client.h"
+
+#include "nested_input.h"
+
+#define RFB_DEFAULT_MAX_FPS 60
+
+/* The size of the screen for "Fullscreen" and "Output", there is no host
+ * screen to take it from */
+#define RFB_HOST_WIDTH      1920
+#define RFB_HOST_HEIGHT     1080
+
+#define RFB_ZRLE_TILE       64
+#define RFB_MAX_RECTS       64 /* more are sent as their extents */
+
+#define RFB_ENCODING_RAW          0
+#define RFB_ENCODING_ZRLE         16
+#define RFB_ENCODING_DESKTOP_SIZE (-223)
+
+#define RFB_MIN_KEYCODE     8
+#define RFB_NUM_KEYCODES    (256 - RFB_MIN_KEYCODE)
+
+extern char *display;
+
+enum {
+    RFB_STATE_VERSION,
+    RFB_STATE_SECURITY,
+    RFB_STATE_INIT,
+    RFB_STATE_NORMAL
+};
+
+typedef struct {
+    int      bitsPerPixel;
+    int      depth;
+    Bool     bigEndian;
+    Bool     trueColour;
+    uint32_t redMax, greenMax, blueMax;
+    int      redShift, greenShift, blueShift;
+} RfbPixelFormat;
+
+typedef struct {
+    unsigned char *data;
+    size_t         len;
+    size_t         size;
+} RfbBuffer;
+
+/* Everything the viewer thread needs to encode an update, so the main
+ * thread can go on changing the viewer */
+typedef struct {
+    BoxPtr         boxes; /* window coordinates */
+    int            numBoxes;
+    int            viewX;
+    int            viewY;
+    const char    *fb;
+    int            stride;
+    Bool           black;
+    Bool           desktopSize;
+    unsigned int   width;
+    unsigned int   height;
+    Bool           zrle;
+    RfbPixelFormat format;
+} RfbJob;
+
+typedef struct RfbViewer {
+    struct RfbViewer      *next;
+    NestedBackendScreenPtr pPriv;
+    int                    fd;
+    char                   name[64]; /* for messages */
+
+    /* Main thread only */
+    int                    state;
+    int                    minor; /* protocol version 3.minor */
+    unsigned char          in[1024];
+    size_t                 inLen;
+    size_t                 skip; /* cut text still to be read */
+    RfbPixelFormat         format;
+    Bool                   zrle;
+    Bool                   desktopSize;
+    Bool                   updateRequested;
+    unsigned int           width; /* what the viewer thinks the size is */
+    unsigned int           height;
+    RegionRec              damage; /* window coordinates */
+    CARD32                 lastUpdate;
+    unsigned int           buttons;
+
+    /* Shared with the viewer thread */
+    pthread_t              thread;
+    pthread_mutex_t        lock;
+    pthread_cond_t         cond;
+    pthread_cond_t         encoded;
+    RfbJob                *job;
+    RfbBuffer              out;
+    Bool                   busy; /* a job or output not sent yet */
+    Bool                   quit;
+    Bool                   dead;
+
+    /* Viewer thread only */
+    z_stream               zs;
+    RfbBuffer              tiles;
+} RfbViewer;
+
+struct NestedBackendScreen {
+    int scrnIndex; /* stored only for xf86DrvMsg usage */
+    char *fb;
+    size_t fbSize; /* bytes allocated for fb */
+    unsigned int fbWidth;
+    unsigned int fbHeight;
+    int stride;
+    unsigned int width;
+    unsigned int height;
+    int viewX; /* frame buffer position shown at the window origin */
+    int viewY;
+    Bool blanked;
+    RfbPixelFormat format;
+    Pixel redMask;
+    Pixel greenMask;
+    Pixel blueMask;
+    DeviceIntPtr dev;
+
+    int listenFd;
+    char *socketPath; /* to unlink, for Unix sockets */
+    int epollFd;
+    int wakeFd; /* written by viewer threads when they are done */
+    RfbViewer *viewers;
+    int minInterval; /* ms between the updates of a viewer */
+    OsTimerPtr throttleTimer;
+    Bool encoding;
+};
+
+/* One keycode per keysym, letters with their upper case as the second
+ * level. The viewers send keysyms; the nested server gets this keymap. */
+static KeySym rfbKeymap[RFB_NUM_KEYCODES][2];
+static int rfbNumKeycodes;
+static pthread_once_t rfbKeymapOnce = PTHREAD_ONCE_INIT;
+
+static const KeySym rfbFunctionKeys[] = {
+    XK_BackSpace, XK_Tab, XK_Return, XK_Escape, XK_Delete, XK_Home, XK_Left,
+    XK_Up, XK_Right, XK_Down, XK_Prior, XK_Next, XK_End, XK_Insert, XK_Menu,
+    XK_Print, XK_Pause, XK_Scroll_Lock, XK_KP_Enter,
+    XK_F1, XK_F2, XK_F3, XK_F4, XK_F5, XK_F6, XK_F7, XK_F8, XK_F9, XK_F10,
+    XK_F11, XK_F12,
+};
+
+static const struct {
+    KeySym sym;
+    int    modifier;
+} rfbModifierKeys[] = {
+    { XK_Shift_L,           ShiftMapIndex },
+    { XK_Shift_R,           ShiftMapIndex },
+    { XK_Caps_Lock,         LockMapIndex },
+    { XK_Control_L,         ControlMapIndex },
+    { XK_Control_R,         ControlMapIndex },
+    { XK_Alt_L,             Mod1MapIndex },
+    { XK_Alt_R,             Mod1MapIndex },
+    { XK_Meta_L,            Mod1MapIndex },
+    { XK_Meta_R,            Mod1MapIndex },
+    { XK_Num_Lock,          Mod2MapIndex },
+    { XK_Super_L,           Mod4MapIndex },
+    { XK_Super_R,           Mod4MapIndex },
+    { XK_ISO_Level3_Shift,  Mod5MapIndex },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static void
+RfbAddKey(KeySym lower, KeySym upper) {
+    rfbKeymap[rfbNumKeycodes][0] = lower;
+    rfbKeymap[rfbNumKeycodes][1] = upper;
+    rfbNumKeycodes++;
+}
+
+static Bool
+RfbIsUpper(KeySym sym) {
+    return (sym >= XK_A && sym <= XK_Z) ||
+           (sym >= XK_Agrave && sym <= XK_Thorn && sym != XK_multiply);
+}
+
+static void
+RfbBuildKeymap(void) {
+    KeySym sym;
+    int i;
+
+    for (sym = XK_space; sym <= XK_asciitilde; sym++)
+        if (!RfbIsUpper(sym))
+            RfbAddKey(sym, sym >= XK_a && sym <= XK_z ? sym - 0x20 : sym);
+
+    for (sym = XK_nobreakspace; sym <= XK_ydiaeresis; sym++)
+        if (!RfbIsUpper(sym))
+            RfbAddKey(sym, RfbIsUpper(sym - 0x20) ? sym - 0x20 : sym);
+
+    for (i = 0; i < ARRAY_SIZE(rfbFunctionKeys); i++)
+        RfbAddKey(rfbFunctionKeys[i], rfbFunctionKeys[i]);
+
+    for (i = 0; i < ARRAY_SIZE(rfbModifierKeys); i++)
+        RfbAddKey(rfbModifierKeys[i].sym, rfbModifierKeys[i].sym);
+}
+
+static int
+RfbKeysymToKeycode(KeySym sym) {
+    int i;
+
+    if (RfbIsUpper(sym))
+        sym += 0x20;
+
+    for (i = 0; i < rfbNumKeycodes; i++)
+        if (rfbKeymap[i][0] == sym)
+            return i + RFB_MIN_KEYCODE;
+
+    return 0;
+}
+
+static CARD32
+RfbNow(void) {
+    return GetTimeInMillis();
+}
+
+static Bool
+RfbReserve(RfbBuffer *buf, size_t len) {
+    size_t size = buf->size ? buf->size : 4096;
+    unsigned char *data;
+
+    if (buf->len + len <= buf->size)
+        return TRUE;
+
+    while (size < buf->len + len)
+        size *= 2;
+
+    data = realloc(buf->data, size);
+    if (!data)
+        return FALSE;
+
+    buf->data = data;
+    buf->size = size;
+    return TRUE;
+}
+
+static void
+RfbAppend(RfbBuffer *buf, const void *data, size_t len) {
+    if (!RfbReserve(buf, len))
+        return;
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void
+RfbAppend8(RfbBuffer *buf, uint8_t value) {
+    RfbAppend(buf, &value, 1);
+}
+
+static void
+RfbAppend16(RfbBuffer *buf, uint16_t value) {
+    unsigned char b[2] = { value >> 8, value };
+
+    RfbAppend(buf, b, 2);
+}
+
+static void
+RfbAppend32(RfbBuffer *buf, uint32_t value) {
+    unsigned char b[4] = { value >> 24, value >> 16, value >> 8, value };
+
+    RfbAppend(buf, b, 4);
+}
+
+static uint16_t
+RfbGet16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+RfbGet32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int
+RfbMaskShift(Pixel mask) {
+    int shift = 0;
+
+    while (mask && !(mask & 1)) {
+        mask >>= 1;
+        shift++;
+    }
+
+    return shift;
+}
+
+static void
+RfbAppendPixelFormat(RfbBuffer *buf, const RfbPixelFormat *format) {
+    RfbAppend8(buf, format->bitsPerPixel);
+    RfbAppend8(buf, format->depth);
+    RfbAppend8(buf, format->bigEndian);
+    RfbAppend8(buf, format->trueColour);
+    RfbAppend16(buf, format->redMax);
+    RfbAppend16(buf, format->greenMax);
+    RfbAppend16(buf, format->blueMax);
+    RfbAppend8(buf, format->redShift);
+    RfbAppend8(buf, format->greenShift);
+    RfbAppend8(buf, format->blueShift);
+    RfbAppend8(buf, 0);
+    RfbAppend16(buf, 0);
+}
+
+/* Converts a frame buffer pixel to the format of the viewer */
+static inline uint32_t
+RfbConvertPixel(const RfbJob *job, const RfbPixelFormat *fb, uint32_t pixel) {
+    const RfbPixelFormat *to = &job->format;
+    uint32_t r, g, b;
+
+    if (job->black)
+        return 0;
+
+    if (fb->redShift == to->redShift && fb->redMax == to->redMax &&
+        fb->greenShift == to->greenShift && fb->greenMax == to->greenMax &&
+        fb->blueShift == to->blueShift && fb->blueMax == to->blueMax)
+        return pixel;
+
+    r = (pixel >> fb->redShift) & fb->redMax;
+    g = (pixel >> fb->greenShift) & fb->greenMax;
+    b = (pixel >> fb->blueShift) & fb->blueMax;
+
+    return ((r * to->redMax / fb->redMax) << to->redShift) |
+           ((g * to->greenMax / fb->greenMax) << to->greenShift) |
+           ((b * to->blueMax / fb->blueMax) << to->blueShift);
+}
+
+/* Reads a line of pixels in the format of the viewer */
+static void
+RfbReadLine(NestedBackendScreenPtr pPriv, const RfbJob *job,
+            int x, int y, int width, uint32_t *dst) {
+    const char *src = job->fb + (long)(y + job->viewY) * job->stride;
+    int i;
+
+    if (pPriv->format.bitsPerPixel == 32) {
+        const uint32_t *p = (const uint32_t *)src + x + job->viewX;
+
+        for (i = 0; i < width; i++)
+            dst[i] = RfbConvertPixel(job, &pPriv->format, p[i]);
+    } else {
+        const uint16_t *p = (const uint16_t *)src + x + job->viewX;
+
+        for (i = 0; i < width; i++)
+            dst[i] = RfbConvertPixel(job, &pPriv->format, p[i]);
+    }
+}
+
+static void
+RfbAppendPixel(RfbBuffer *buf, const RfbPixelFormat *format, uint32_t pixel,
+               int bytes) {
+    unsigned char b[4];
+    int i, n = format->bitsPerPixel / 8;
+
+    for (i = 0; i < n; i++)
+        b[format->bigEndian ? n - 1 - i : i] = pixel >> (8 * i);
+
+    /* ZRLE leaves out the unused byte of 32 bit pixels */
+    if (bytes == 3) {
+        Bool low = (format->redMax << format->redShift |
+                    format->greenMax << format->greenShift |
+                    format->blueMax << format->blueShift) < (1 << 24);
+
+        RfbAppend(buf, b + (low == format->bigEndian), 3);
+        return;
+    }
+
+    RfbAppend(buf, b, n);
+}
+
+static int
+RfbCPixelBytes(const RfbPixelFormat *format) {
+    uint32_t used = format->redMax << format->redShift |
+                    format->greenMax << format->greenShift |
+                    format->blueMax << format->blueShift;
+
+    if (format->bitsPerPixel == 32 && format->depth <= 24 &&
+        (used < (1 << 24) || !(used & 0xff)))
+        return 3;
+
+    return format->bitsPerPixel / 8;
+}
+
+static void
+RfbEncodeRaw(RfbViewer *viewer, const RfbJob *job, const BoxRec *box,
+             RfbBuffer *buf) {
+    int bytes = job->format.bitsPerPixel / 8;
+    uint32_t line[RFB_ZRLE_TILE * RFB_ZRLE_TILE];
+    int x, y, i, n;
+
+    for (y = box->y1; y < box->y2; y++) {
+        for (x = box->x1; x < box->x2; x += n) {
+            n = min(box->x2 - x, (int)ARRAY_SIZE(line));
+            RfbReadLine(viewer->pPriv, job, x, y, n, line);
+
+            if (!RfbReserve(buf, (size_t)n * bytes))
+                return;
+
+            for (i = 0; i < n; i++)
+                RfbAppendPixel(buf, &job->format, line[i], bytes);
+        }
+    }
+}
+
+/* Appends one ZRLE tile: solid, packed palette, plain RLE or raw, whatever
+ * is smallest */
+static void
+RfbEncodeTile(RfbBuffer *buf, const RfbPixelFormat *format, int cpixel,
+              const uint32_t *pixels, int width, int height) {
+    uint32_t palette[16];
+    int numColors = 0, numRuns = 0, i, j, n = width * height;
+
+    for (i = 0; i < n; i++) {
+        if (i == 0 || pixels[i] != pixels[i - 1])
+            numRuns++;
+
+        if (numColors > 16)
+            continue;
+
+        for (j = 0; j < numColors; j++)
+            if (palette[j] == pixels[i])
+                break;
+
+        if (j == numColors) {
+            if (numColors < 16)
+                palette[numColors] = pixels[i];
+            numColors++;
+        }
+    }
+
+    if (numColors == 1) {
+        RfbAppend8(buf, 1);
+        RfbAppendPixel(buf, format, pixels[0], cpixel);
+        return;
+    }
+
+    if (numColors <= 16) {
+        int bits = numColors == 2 ? 1 : numColors <= 4 ? 2 : 4;
+        int x, y;
+
+        RfbAppend8(buf, numColors);
+        for (j = 0; j < numColors; j++)
+            RfbAppendPixel(buf, format, palette[j], cpixel);
+
+        for (y = 0; y < height; y++) {
+            uint8_t byte = 0;
+            int used = 0;
+
+            for (x = 0; x < width; x++) {
+                uint32_t p = pixels[y * width + x];
+
+                for (j = 0; palette[j] != p; j++)
+                    ;
+
+                byte |= j << (8 - bits - used);
+                used += bits;
+
+                if (used == 8) {
+                    RfbAppend8(buf, byte);
+                    byte = 0;
+                    used = 0;
+                }
+            }
+
+            if (used)
+                RfbAppend8(buf, byte);
+        }
+        return;
+    }
+
+    /* A run costs a pixel and at least one length byte */
+    if (numRuns * (cpixel + 1) < n * cpixel) {
+        RfbAppend8(buf, 128);
+
+        for (i = 0; i < n; i = j) {
+            int len;
+
+            for (j = i + 1; j < n && pixels[j] == pixels[i]; j++)
+                ;
+
+            RfbAppendPixel(buf, format, pixels[i], cpixel);
+            for (len = j - i - 1; len >= 255; len -= 255)
+                RfbAppend8(buf, 255);
+            RfbAppend8(buf, len);
+        }
+        return;
+    }
+
+    RfbAppend8(buf, 0);
+    for (i = 0; i < n; i++)
+        RfbAppendPixel(buf, format, pixels[i], cpixel);
+}
+
+static void
+RfbEncodeZrle(RfbViewer *viewer, const RfbJob *job, const BoxRec *box,
+              RfbBuffer *buf) {
+    uint32_t tile[RFB_ZRLE_TILE * RFB_ZRLE_TILE];
+    int cpixel = RfbCPixelBytes(&job->format);
+    size_t lengthAt;
+    int x, y, ty, width, height;
+
+    viewer->tiles.len = 0;
+
+    for (y = box->y1; y < box->y2; y += RFB_ZRLE_TILE) {
+        height = min(RFB_ZRLE_TILE, box->y2 - y);
+
+        for (x = box->x1; x < box->x2; x += RFB_ZRLE_TILE) {
+            width = min(RFB_ZRLE_TILE, box->x2 - x);
+
+            for (ty = 0; ty < height; ty++)
+                RfbReadLine(viewer->pPriv, job, x, y + ty, width,
+                            tile + ty * width);
+
+            RfbEncodeTile(&viewer->tiles, &job->format, cpixel,
+                          tile, width, height);
+        }
+    }
+
+    /* All rectangles share one zlib stream; each is flushed on its own */
+    lengthAt = buf->len;
+    RfbAppend32(buf, 0);
+
+    viewer->zs.next_in = viewer->tiles.data;
+    viewer->zs.avail_in = viewer->tiles.len;
+
+    do {
+        if (!RfbReserve(buf, viewer->tiles.len / 2 + 1024))
+            return;
+
+        viewer->zs.next_out = buf->data + buf->len;
+        viewer->zs.avail_out = buf->size - buf->len;
+        deflate(&viewer->zs, Z_SYNC_FLUSH);
+        buf->len = buf->size - viewer->zs.avail_out;
+    } while (viewer->zs.avail_in || !viewer->zs.avail_out);
+
+    buf->data[lengthAt] = (buf->len - lengthAt - 4) >> 24;
+    buf->data[lengthAt + 1] = (buf->len - lengthAt - 4) >> 16;
+    buf->data[lengthAt + 2] = (buf->len - lengthAt - 4) >> 8;
+    buf->data[lengthAt + 3] = (buf->len - lengthAt - 4);
+}
+
+static void
+RfbEncode(RfbViewer *viewer, const RfbJob *job, RfbBuffer *buf) {
+    int i;
+
+    RfbAppend8(buf, 0); /* FramebufferUpdate */
+    RfbAppend8(buf, 0);
+    RfbAppend16(buf, job->numBoxes + (job->desktopSize ? 1 : 0));
+
+    if (job->desktopSize) {
+        RfbAppend16(buf, 0);
+        RfbAppend16(buf, 0);
+        RfbAppend16(buf, job->width);
+        RfbAppend16(buf, job->height);
+        RfbAppend32(buf, RFB_ENCODING_DESKTOP_SIZE);
+    }
+
+    for (i = 0; i < job->numBoxes; i++) {
+        const BoxRec *box = &job->boxes[i];
+
+        RfbAppend16(buf, box->x1);
+        RfbAppend16(buf, box->y1);
+        RfbAppend16(buf, box->x2 - box->x1);
+        RfbAppend16(buf, box->y2 - box->y1);
+
+        if (job->zrle) {
+            RfbAppend32(buf, RFB_ENCODING_ZRLE);
+            RfbEncodeZrle(viewer, job, box, buf);
+        } else {
+            RfbAppend32(buf, RFB_ENCODING_RAW);
+            RfbEncodeRaw(viewer, job, box, buf);
+        }
+    }
+}
+
+static Bool
+RfbSendAll(int fd, const unsigned char *data, size_t len) {
+    ssize_t n;
+
+    while (len) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+
+        data += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static void
+RfbWake(NestedBackendScreenPtr pPriv) {
+    uint64_t one = 1;
+
+    if (write(pPriv->wakeFd, &one, sizeof(one)) < 0)
+        return;
+}
+
+static void *
+RfbViewerThread(void *arg) {
+    RfbViewer *viewer = arg;
+    RfbBuffer buf = { NULL, 0, 0 };
+    RfbJob *job;
+
+    pthread_mutex_lock(&viewer->lock);
+
+    while (!viewer->quit) {
+        if (viewer->job) {
+            job = viewer->job;
+            pthread_mutex_unlock(&viewer->lock);
+
+            buf.len = 0;
+            RfbEncode(viewer, job, &buf);
+
+            pthread_mutex_lock(&viewer->lock);
+            RfbAppend(&viewer->out, buf.data, buf.len);
+            viewer->job = NULL;
+            pthread_cond_broadcast(&viewer->encoded);
+            free(job->boxes);
+            free(job);
+            continue;
+        }
+
+        if (viewer->out.len && !viewer->dead) {
+            RfbBuffer out = viewer->out;
+            Bool sent;
+
+            viewer->out = buf;
+            viewer->out.len = 0;
+            pthread_mutex_unlock(&viewer->lock);
+
+            sent = RfbSendAll(viewer->fd, out.data, out.len);
+
+            pthread_mutex_lock(&viewer->lock);
+            buf = out;
+            if (!sent)
+                viewer->dead = TRUE;
+            continue;
+        }
+
+        /* Done: let the server know the viewer can take the next update */
+        if (viewer->busy) {
+            viewer->busy = FALSE;
+            RfbWake(viewer->pPriv);
+        }
+
+        pthread_cond_wait(&viewer->cond, &viewer->lock);
+    }
+
+    pthread_mutex_unlock(&viewer->lock);
+    free(buf.data);
+    return NULL;
+}
+
+/* Queues data for the viewer thread to send */
+static void
+RfbQueue(RfbViewer *viewer, RfbBuffer *data) {
+    pthread_mutex_lock(&viewer->lock);
+    RfbAppend(&viewer->out, data->data, data->len);
+    viewer->busy = TRUE;
+    pthread_cond_signal(&viewer->cond);
+    pthread_mutex_unlock(&viewer->lock);
+}
+
+static void
+RfbDamageAll(NestedBackendScreenPtr pPriv) {
+    RfbViewer *viewer;
+    BoxRec box = { 0, 0, pPriv->width, pPriv->height };
+    RegionRec region;
+
+    RegionInit(&region, &box, 1);
+
+    for (viewer = pPriv->viewers; viewer; viewer = viewer->next)
+        RegionUnion(&viewer->damage, &viewer->damage, &region);
+
+    RegionUninit(&region);
+}
+
+static void
+RfbCloseViewer(NestedBackendScreenPtr pPriv, RfbViewer *viewer) {
+    RfbViewer **p;
+
+    for (p = &pPriv->viewers; *p; p = &(*p)->next)
+        if (*p == viewer) {
+            *p = viewer->next;
+            break;
+        }
+
+    pthread_mutex_lock(&viewer->lock);
+    viewer->quit = TRUE;
+    pthread_cond_signal(&viewer->cond);
+    pthread_mutex_unlock(&viewer->lock);
+
+    /* Unblocks a send to a viewer that stopped reading */
+    shutdown(viewer->fd, SHUT_RDWR);
+    pthread_join(viewer->thread, NULL);
+
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "RFB viewer %s disconnected\n",
+                    viewer->name);
+
+    close(viewer->fd);
+    deflateEnd(&viewer->zs);
+    RegionUninit(&viewer->damage);
+    if (viewer->job) {
+        free(viewer->job->boxes);
+        free(viewer->job);
+    }
+    free(viewer->out.data);
+    free(viewer->tiles.data);
+    pthread_cond_destroy(&viewer->encoded);
+    pthread_cond_destroy(&viewer->cond);
+    pthread_mutex_destroy(&viewer->lock);
+    free(viewer);
+}
+
+static void
+RfbAccept(NestedBackendScreenPtr pPriv) {
+    struct epoll_event event;
+    RfbViewer *viewer;
+    RfbBuffer buf = { NULL, 0, 0 };
+    sigset_t allSignals, oldSignals;
+    int fd, err, one = 1;
+
+    fd = accept(pPriv->listenFd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    viewer = calloc(1, sizeof(RfbViewer));
+    if (!viewer) {
+        close(fd);
+        return;
+    }
+
+    viewer->pPriv = pPriv;
+    viewer->fd = fd;
+    viewer->state = RFB_STATE_VERSION;
+    viewer->format = pPriv->format;
+    viewer->width = pPriv->width;
+    viewer->height = pPriv->height;
+    snprintf(viewer->name, sizeof(viewer->name), "%d", fd);
+    RegionNull(&viewer->damage);
+    pthread_mutex_init(&viewer->lock, NULL);
+    pthread_cond_init(&viewer->cond, NULL);
+    pthread_cond_init(&viewer->encoded, NULL);
+
+    if (deflateInit(&viewer->zs, Z_BEST_SPEED) != Z_OK) {
+        err = -1;
+    } else {
+        /* Signals (input, timers, ...) must keep going to the server
+         * thread */
+        sigfillset(&allSignals);
+        pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+        err = pthread_create(&viewer->thread, NULL, RfbViewerThread, viewer);
+        pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+        if (err)
+            deflateEnd(&viewer->zs);
+    }
+
+    if (err) {
+        close(fd);
+        RegionUninit(&viewer->damage);
+        pthread_cond_destroy(&viewer->encoded);
+        pthread_cond_destroy(&viewer->cond);
+        pthread_mutex_destroy(&viewer->lock);
+        free(viewer);
+        return;
+    }
+
+    viewer->next = pPriv->viewers;
+    pPriv->viewers = viewer;
+
+    event.events = EPOLLIN;
+    event.data.ptr = viewer;
+    epoll_ctl(pPriv->epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    RfbAppend(&buf, "RFB 003.008\n", 12);
+    RfbQueue(viewer, &buf);
+    free(buf.data);
+}
+
+static void
+RfbSetEncodings(RfbViewer *viewer, const unsigned char *p, int n) {
+    int i;
+
+    viewer->zrle = FALSE;
+    viewer->desktopSize = FALSE;
+
+    for (i = 0; i < n; i++) {
+        int32_t encoding = RfbGet32(p + 4 * i);
+
+        if (encoding == RFB_ENCODING_ZRLE)
+            viewer->zrle = TRUE;
+        else if (encoding == RFB_ENCODING_DESKTOP_SIZE)
+            viewer->desktopSize = TRUE;
+    }
+}
+
+static Bool
+RfbSetPixelFormat(RfbViewer *viewer, const unsigned char *p) {
+    RfbPixelFormat *format = &viewer->format;
+
+    format->bitsPerPixel = p[0];
+    format->depth = p[1];
+    format->bigEndian = p[2] != 0;
+    format->trueColour = p[3] != 0;
+    format->redMax = RfbGet16(p + 4);
+    format->greenMax = RfbGet16(p + 6);
+    format->blueMax = RfbGet16(p + 8);
+    format->redShift = p[10];
+    format->greenShift = p[11];
+    format->blueShift = p[12];
+
+    if (!format->trueColour ||
+        (format->bitsPerPixel != 8 && format->bitsPerPixel != 16 &&
+         format->bitsPerPixel != 32) ||
+        !format->redMax || !format->greenMax || !format->blueMax) {
+        NestedClientMsg(viewer->pPriv->scrnIndex, X_WARNING,
+                        "RFB viewer %s wants an unsupported pixel format\n",
+                        viewer->name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+RfbPointerEvent(NestedBackendScreenPtr pPriv, RfbViewer *viewer,
+                unsigned int buttons, int x, int y) {
+    int i;
+
+    if (!pPriv->dev)
+        return;
+
+    NestedHostToScreen(pPriv->scrnIndex, &x, &y);
+    NestedInputPostMouseMotionEvent(pPriv->dev, x, y);
+
+    for (i = 0; i < 8; i++)
+        if ((buttons ^ viewer->buttons) & (1 << i))
+            NestedInputPostButtonEvent(pPriv->dev, i + 1, buttons & (1 << i));
+
+    viewer->buttons = buttons;
+}
+
+static void
+RfbKeyEvent(NestedBackendScreenPtr pPriv, KeySym sym, Bool down) {
+    int keycode = RfbKeysymToKeycode(sym);
+
+    if (!pPriv->dev || !keycode)
+        return;
+
+    NestedInputPostKeyboardEvent(pPriv->dev, keycode, down);
+}
+
+/* Handles the messages in the input buffer. Returns how much was used, or
+ * -1 if the viewer has to be dropped. */
+static int
+RfbHandleInput(NestedBackendScreenPtr pPriv, RfbViewer *viewer,
+               const unsigned char *in, size_t len) {
+    RfbBuffer buf = { NULL, 0, 0 };
+    size_t used = 0, need;
+    char name[32];
+
+    switch (viewer->state) {
+    case RFB_STATE_VERSION:
+        if (len < 12)
+            return 0;
+
+        if (memcmp(in, "RFB 003.", 8))
+            return -1;
+
+        /* Anything before 3.7 speaks 3.3 */
+        viewer->minor = min(atoi((const char *)in + 8), 8);
+        if (viewer->minor < 7)
+            viewer->minor = 3;
+        used = 12;
+
+        if (viewer->minor >= 7) {
+            RfbAppend8(&buf, 1);
+            RfbAppend8(&buf, 1); /* None */
+            viewer->state = RFB_STATE_SECURITY;
+        } else {
+            RfbAppend32(&buf, 1);
+            viewer->state = RFB_STATE_INIT;
+        }
+        break;
+
+    case RFB_STATE_SECURITY:
+        if (len < 1)
+            return 0;
+
+        if (in[0] != 1)
+            return -1;
+
+        if (viewer->minor >= 8)
+            RfbAppend32(&buf, 0);
+
+        used = 1;
+        viewer->state = RFB_STATE_INIT;
+        break;
+
+    case RFB_STATE_INIT:
+        if (len < 1)
+            return 0;
+
+        /* Always shared */
+        snprintf(name, sizeof(name), "Nested screen %d", pPriv->scrnIndex);
+        RfbAppend16(&buf, pPriv->width);
+        RfbAppend16(&buf, pPriv->height);
+        RfbAppendPixelFormat(&buf, &pPriv->format);
+        RfbAppend32(&buf, strlen(name));
+        RfbAppend(&buf, name, strlen(name));
+
+        viewer->width = pPriv->width;
+        viewer->height = pPriv->height;
+        used = 1;
+        viewer->state = RFB_STATE_NORMAL;
+
+        NestedClientMsg(pPriv->scrnIndex, X_INFO,
+                        "RFB viewer %s connected, protocol 3.%d\n",
+                        viewer->name, viewer->minor);
+        break;
+
+    case RFB_STATE_NORMAL:
+        if (len < 1)
+            return 0;
+
+        switch (in[0]) {
+        case 0: /* SetPixelFormat */
+            if (len < 20)
+                return 0;
+            if (!RfbSetPixelFormat(viewer, in + 4))
+                return -1;
+            used = 20;
+            break;
+
+        case 2: /* SetEncodings */
+            if (len < 4)
+                return 0;
+            need = 4 + 4 * RfbGet16(in + 2);
+            if (need > sizeof(viewer->in))
+                return -1;
+            if (len < need)
+                return 0;
+            RfbSetEncodings(viewer, in + 4, RfbGet16(in + 2));
+            used = need;
+            break;
+
+        case 3: /* FramebufferUpdateRequest */
+            if (len < 10)
+                return 0;
+
+            if (!in[1]) {
+                unsigned x = RfbGet16(in + 2), y = RfbGet16(in + 4);
+                unsigned w = RfbGet16(in + 6), h = RfbGet16(in + 8);
+                BoxRec box;
+                RegionRec region;
+
+                /* Anything from the viewer goes, but a BoxRec is short */
+                x = min(x, viewer->width);
+                y = min(y, viewer->height);
+                box.x1 = x;
+                box.y1 = y;
+                box.x2 = x + min(w, viewer->width - x);
+                box.y2 = y + min(h, viewer->height - y);
+                RegionInit(&region, &box, 1);
+                RegionUnion(&viewer->damage, &viewer->damage, &region);
+                RegionUninit(&region);
+            }
+
+            viewer->updateRequested = TRUE;
+            used = 10;
+            break;
+
+        case 4: /* KeyEvent */
+            if (len < 8)
+                return 0;
+            RfbKeyEvent(pPriv, RfbGet32(in + 4), in[1]);
+            used = 8;
+            break;
+
+        case 5: /* PointerEvent */
+            if (len < 6)
+                return 0;
+            RfbPointerEvent(pPriv, viewer, in[1],
+                            RfbGet16(in + 2), RfbGet16(in + 4));
+            used = 6;
+            break;
+
+        case 6: /* ClientCutText, ignored */
+            if (len < 8)
+                return 0;
+            viewer->skip = RfbGet32(in + 4);
+            used = 8;
+            break;
+
+        default:
+            NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                            "RFB viewer %s sent unknown message %d\n",
+                            viewer->name, in[0]);
+            return -1;
+        }
+        break;
+    }
+
+    if (buf.len)
+        RfbQueue(viewer, &buf);
+    free(buf.data);
+
+    return used;
+}
+
+/* Returns FALSE if the viewer went away */
+static Bool
+RfbReadViewer(NestedBackendScreenPtr pPriv, RfbViewer *viewer) {
+    ssize_t n;
+    int used;
+
+    for (;;) {
+        n = recv(viewer->fd, viewer->in + viewer->inLen,
+                 sizeof(viewer->in) - viewer->inLen, MSG_DONTWAIT);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return TRUE;
+        if (n <= 0)
+            return FALSE;
+
+        viewer->inLen += n;
+
+        for (;;) {
+            if (viewer->skip) {
+                size_t skipped = min(viewer->skip, viewer->inLen);
+
+                memmove(viewer->in, viewer->in + skipped,
+                        viewer->inLen - skipped);
+                viewer->inLen -= skipped;
+                viewer->skip -= skipped;
+                if (viewer->skip)
+                    break;
+            }
+
+            used = RfbHandleInput(pPriv, viewer, viewer->in, viewer->inLen);
+            if (used < 0)
+                return FALSE;
+            if (used == 0)
+                break;
+
+            memmove(viewer->in, viewer->in + used, viewer->inLen - used);
+            viewer->inLen -= used;
+        }
+    }
+}
+
+static CARD32
+RfbThrottleTimer(OsTimerPtr timer, CARD32 time, pointer arg) {
+    /* Waking up is all it takes, updates are sent from the block handler */
+    return 0;
+}
+
+static int
+RfbListenUnix(int scrnIndex, const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask;
+    int fd, err;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Left over by a server that didn't exit cleanly; anything else at
+     * that path isn't ours to remove */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    /* Only the user of the server may connect, there is no password. The
+     * socket is created that way, there's no moment it is open to all. */
+    mask = umask(077);
+    err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (err < 0 || listen(fd, 4) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int
+RfbListenTcp(int scrnIndex, const char *host, const char *port) {
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, one = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo(host, port, &hints, &res))
+        return -1;
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC |
+                    SOCK_NONBLOCK, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 4) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* The directory of the default sockets, in dir */
+static void
+RfbDefaultDir(char *dir, size_t size) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime && runtime[0] == '/')
+        snprintf(dir, size, "%s/nested-vnc", runtime);
+    else
+        snprintf(dir, size, "/tmp/nested-vnc-%u", (unsigned int)geteuid());
+}
+
+/* Creates the directory of the default sockets, or checks that the one
+ * there belongs to the user of the server and nobody else can enter it */
+static Bool
+RfbMakeDefaultDir(int scrnIndex) {
+    char dir[PATH_MAX];
+    struct stat st;
+
+    RfbDefaultDir(dir, sizeof(dir));
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        NestedClientMsg(scrnIndex, X_ERROR, "Can't create %s: %s\n", dir,
+                        strerror(errno));
+        return FALSE;
+    }
+
+    if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & 077)) {
+        NestedClientMsg(scrnIndex, X_ERROR,
+                        "%s isn't a directory only the server's user can "
+                        "enter, not listening there\n", dir);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Splits the "Display" option into a Unix socket path, or a host and a
+ * port; without it, the default socket path is written to pathBuf. Returns
+ * FALSE if it makes no sense. */
+static Bool
+RfbParseAddress(int scrnIndex, const char *address, const char **path,
+                char *pathBuf, size_t pathSize,
+                char *host, size_t hostSize, char *port, size_t portSize) {
+    const char *colon;
+    char dir[PATH_MAX];
+
+    *path = NULL;
+
+    if (!address) {
+        RfbDefaultDir(dir, sizeof(dir));
+        if (snprintf(pathBuf, pathSize, "%s/%s.%d", dir,
+                     display ? display : "0", scrnIndex) >= pathSize)
+            return FALSE;
+        *path = pathBuf;
+        return TRUE;
+    }
+
+    if (!strncmp(address, "unix:", 5))
+        address += 5;
+
+    if (address[0] == '/') {
+        *path = address;
+        return TRUE;
+    }
+
+    if (strncmp(address, "tcp:", 4)) {
+        NestedClientMsg(scrnIndex, X_ERROR,
+                        "RFB viewers connect without a password, write "
+                        "\"tcp:%s\" to listen on TCP anyway\n", address);
+        return FALSE;
+    }
+
+    address += 4;
+
+    colon = strrchr(address, ':');
+    if (colon && colon != address) {
+        if (colon - address >= hostSize)
+            return FALSE;
+        memcpy(host, address, colon - address);
+        host[colon - address] = '\0';
+    } else {
+        snprintf(host, hostSize, "127.0.0.1");
+    }
+
+    snprintf(port, portSize, "%s", colon ? colon + 1 : address);
+    return strtol(port, NULL, 10) > 0;
+}
+
+/* There is no host to check, only the address to listen on */
+static Bool
+NestedRfbCheckDisplay(int scrnIndex,
+                      const char *displayName,
+                      const char *xauthority,
+                      const char *output,
+                      Bool enable,
+                      const char *parentOutput,
+                      char relation,
+                      unsigned int *width,
+                      unsigned int *height,
+                      int *x,
+                      int *y) {
+    char host[256], port[32], pathBuf[PATH_MAX];
+    const char *path;
+
+    if (!RfbParseAddress(scrnIndex, displayName, &path, pathBuf,
+                         sizeof(pathBuf), host, sizeof(host),
+                         port, sizeof(port))) {
+        NestedClientMsg(scrnIndex, X_ERROR, "Invalid RFB address \"%s\"\n",
+                        displayName);
+        return FALSE;
+    }
+
+    if (width != NULL)
+        *width = RFB_HOST_WIDTH;
+
+    if (height != NULL)
+        *height = RFB_HOST_HEIGHT;
+
+    if (x != NULL)
+        *x = 0;
+
+    if (y != NULL)
+        *y = 0;
+
+    return TRUE;
+}
+
+static Bool
+NestedRfbValidDepth(int depth) {
+    return depth == 16 || depth == 24;
+}
+
+static Bool
+RfbCreateFrameBuffer(NestedBackendScreenPtr pPriv,
+                     unsigned int width, unsigned int height) {
+    int stride = ((width * pPriv->format.bitsPerPixel / 8) + 3) & ~3;
+    size_t size = (size_t)stride * height;
+    char *fb;
+
+    /* We are shrinking: keep the old buffer */
+    if (size > pPriv->fbSize) {
+        fb = calloc(1, size);
+        if (!fb)
+            return FALSE;
+
+        free(pPriv->fb);
+        pPriv->fb = fb;
+        pPriv->fbSize = size;
+    }
+
+    pPriv->fbWidth = width;
+    pPriv->fbHeight = height;
+    pPriv->stride = stride;
+    return TRUE;
+}
+
+static NestedBackendScreenPtr
+NestedRfbCreateScreen(int scrnIndex,
+                      const char *displayName,
+                      const char *xauthority,
+                      Bool wantFullscreenHint,
+                      Bool rootless,
+                      Bool withInput,
+                      unsigned int fbWidth,
+                      unsigned int fbHeight,
+                      unsigned int width,
+                      unsigned int height,
+                      int originX,
+                      int originY,
+                      double scale,
+                      unsigned int depth,
+                      unsigned int bitsPerPixel,
+                      Pixel *retRedMask,
+                      Pixel *retGreenMask,
+                      Pixel *retBlueMask) {
+    NestedBackendScreenPtr pPriv;
+    struct epoll_event event;
+    char host[256], port[32], pathBuf[PATH_MAX];
+    const char *path;
+    const char *fps;
+
+    pthread_once(&rfbKeymapOnce, RfbBuildKeymap);
+
+    if (!RfbParseAddress(scrnIndex, displayName, &path, pathBuf,
+                         sizeof(pathBuf), host, sizeof(host),
+                         port, sizeof(port)))
+        return NULL;
+
+    pPriv = calloc(1, sizeof(struct NestedBackendScreen));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->width = width;
+    pPriv->height = height;
+    pPriv->listenFd = -1;
+    pPriv->epollFd = -1;
+    pPriv->wakeFd = -1;
+
+    if (depth == 16) {
+        pPriv->redMask = 0xf800;
+        pPriv->greenMask = 0x07e0;
+        pPriv->blueMask = 0x001f;
+    } else {
+        pPriv->redMask = 0xff0000;
+        pPriv->greenMask = 0x00ff00;
+        pPriv->blueMask = 0x0000ff;
+    }
+
+    pPriv->format.bitsPerPixel = bitsPerPixel;
+    pPriv->format.depth = depth;
+#if X_BYTE_ORDER == X_BIG_ENDIAN
+    pPriv->format.bigEndian = TRUE;
+#endif
+    pPriv->format.trueColour = TRUE;
+    pPriv->format.redShift = RfbMaskShift(pPriv->redMask);
+    pPriv->format.greenShift = RfbMaskShift(pPriv->greenMask);
+    pPriv->format.blueShift = RfbMaskShift(pPriv->blueMask);
+    pPriv->format.redMax = pPriv->redMask >> pPriv->format.redShift;
+    pPriv->format.greenMax = pPriv->greenMask >> pPriv->format.greenShift;
+    pPriv->format.blueMax = pPriv->blueMask >> pPriv->format.blueShift;
+
+    fps = getenv("NESTED_RFB_MAX_FPS");
+    pPriv->minInterval = 1000 / max(fps ? atoi(fps) : RFB_DEFAULT_MAX_FPS, 1);
+
+    if (!RfbCreateFrameBuffer(pPriv, fbWidth, fbHeight))
+        goto fail;
+
+    if (!displayName && !RfbMakeDefaultDir(scrnIndex))
+        goto fail;
+
+    if (path) {
+        pPriv->listenFd = RfbListenUnix(scrnIndex, path);
+        pPriv->socketPath = strdup(path);
+    } else {
+        pPriv->listenFd = RfbListenTcp(scrnIndex, host, port);
+        if (pPriv->listenFd >= 0)
+            NestedClientMsg(scrnIndex, X_WARNING,
+                            "Anyone who can reach %s:%s gets this screen and "
+                            "its input, RFB viewers connect without a "
+                            "password\n", host, port);
+    }
+
+    if (pPriv->listenFd < 0) {
+        NestedClientMsg(scrnIndex, X_ERROR, "Can't listen on %s%s%s: %s\n",
+                        path ? path : host, path ? "" : ":", path ? "" : port,
+                        strerror(errno));
+        goto fail;
+    }
+
+    pPriv->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    pPriv->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (pPriv->epollFd < 0 || pPriv->wakeFd < 0)
+        goto fail;
+
+    /* The epoll descriptor is what the input device waits on */
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(pPriv->epollFd, EPOLL_CTL_ADD, pPriv->listenFd, &event);
+    event.data.ptr = &pPriv->wakeFd;
+    epoll_ctl(pPriv->epollFd, EPOLL_CTL_ADD, pPriv->wakeFd, &event);
+
+    NestedClientMsg(scrnIndex, X_INFO, "Serving RFB on %s%s%s\n",
+                    path ? path : host, path ? "" : ":", path ? "" : port);
+
+    *retRedMask = pPriv->redMask;
+    *retGreenMask = pPriv->greenMask;
+    *retBlueMask = pPriv->blueMask;
+
+    return pPriv;
+
+fail:
+    if (pPriv->listenFd >= 0)
+        close(pPriv->listenFd);
+    if (pPriv->epollFd >= 0)
+        close(pPriv->epollFd);
+    if (pPriv->wakeFd >= 0)
+        close(pPriv->wakeFd);
+    free(pPriv->socketPath);
+    free(pPriv->fb);
+    free(pPriv);
+    return NULL;
+}
+
+static char *
+NestedRfbGetFrameBuffer(NestedBackendScreenPtr pPriv) {
+    return pPriv->fb;
+}
+
+static Bool
+NestedRfbResizeFrameBuffer(NestedBackendScreenPtr pPriv,
+                           unsigned int width, unsigned int height) {
+    return RfbCreateFrameBuffer(pPriv, width, height);
+}
+
+/* Viewers that know DesktopSize follow, the others keep their size */
+static Bool
+NestedRfbResizeWindow(NestedBackendScreenPtr pPriv,
+                      unsigned int width, unsigned int height) {
+    if (pPriv->width == width && pPriv->height == height)
+        return TRUE;
+
+    pPriv->width = width;
+    pPriv->height = height;
+    RfbDamageAll(pPriv);
+    return TRUE;
+}
+
+static void
+NestedRfbSetViewport(NestedBackendScreenPtr pPriv, int x, int y) {
+    if (pPriv->viewX == x && pPriv->viewY == y)
+        return;
+
+    pPriv->viewX = x;
+    pPriv->viewY = y;
+    RfbDamageAll(pPriv);
+}
+
+static void
+NestedRfbUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                      int16_t y1, int16_t x2, int16_t y2) {
+    RfbViewer *viewer;
+    RegionRec region;
+    BoxRec box;
+
+    /* Only the part of the frame buffer inside the viewport is sent */
+    box.x1 = max(x1, pPriv->viewX) - pPriv->viewX;
+    box.y1 = max(y1, pPriv->viewY) - pPriv->viewY;
+    box.x2 = min(x2, pPriv->viewX + (int)pPriv->width) - pPriv->viewX;
+    box.y2 = min(y2, pPriv->viewY + (int)pPriv->height) - pPriv->viewY;
+
+    if (box.x1 >= box.x2 || box.y1 >= box.y2 || !pPriv->viewers)
+        return;
+
+    RegionInit(&region, &box, 1);
+
+    for (viewer = pPriv->viewers; viewer; viewer = viewer->next)
+        RegionUnion(&viewer->damage, &viewer->damage, &region);
+
+    RegionUninit(&region);
+}
+
+/* Hands the damage of each viewer that is ready for an update to its
+ * thread */
+static void
+NestedRfbBeginSync(NestedBackendScreenPtr pPriv) {
+    CARD32 now = RfbNow();
+    int wait = 0, left;
+    RfbViewer *viewer;
+
+    for (viewer = pPriv->viewers; viewer; viewer = viewer->next) {
+        Bool sizeChanged = viewer->desktopSize &&
+                           (viewer->width != pPriv->width ||
+                            viewer->height != pPriv->height);
+        BoxRec box = { 0, 0, viewer->width, viewer->height };
+        RegionRec region;
+        RfbJob *job;
+        Bool busy;
+
+        if (viewer->state != RFB_STATE_NORMAL || !viewer->updateRequested)
+            continue;
+
+        if (!RegionNotEmpty(&viewer->damage) && !sizeChanged)
+            continue;
+
+        pthread_mutex_lock(&viewer->lock);
+        busy = viewer->busy;
+        pthread_mutex_unlock(&viewer->lock);
+
+        if (busy)
+            continue;
+
+        left = pPriv->minInterval - (int)(now - viewer->lastUpdate);
+        if (left > 0) {
+            wait = wait ? min(wait, left) : left;
+            continue;
+        }
+
+        job = calloc(1, sizeof(RfbJob));
+        if (!job)
+            continue;
+
+        if (sizeChanged) {
+            viewer->width = pPriv->width;
+            viewer->height = pPriv->height;
+            box.x2 = viewer->width;
+            box.y2 = viewer->height;
+            job->desktopSize = TRUE;
+            job->width = viewer->width;
+            job->height = viewer->height;
+        }
+
+        RegionInit(&region, &box, 1);
+        RegionIntersect(&region, &region, &viewer->damage);
+
+        /* The frame buffer may be narrower than what the viewer shows */
+        box.x2 = min(box.x2, (int)pPriv->fbWidth - pPriv->viewX);
+        box.y2 = min(box.y2, (int)pPriv->fbHeight - pPriv->viewY);
+        if (box.x2 > 0 && box.y2 > 0) {
+            RegionRec fb;
+
+            RegionInit(&fb, &box, 1);
+            RegionIntersect(&region, &region, &fb);
+            RegionUninit(&fb);
+        } else {
+            RegionEmpty(&region);
+        }
+
+        /* Many small rectangles cost more in headers than they save */
+        job->numBoxes = min(RegionNumRects(&region), RFB_MAX_RECTS + 1);
+        if (job->numBoxes > RFB_MAX_RECTS)
+            job->numBoxes = 1;
+        job->boxes = malloc(max(job->numBoxes, 1) * sizeof(BoxRec));
+        if (!job->boxes) {
+            RegionUninit(&region);
+            free(job);
+            continue;
+        }
+
+        memcpy(job->boxes, job->numBoxes == 1 ? RegionExtents(&region)
+                                               : RegionRects(&region),
+               job->numBoxes * sizeof(BoxRec));
+        RegionUninit(&region);
+
+        job->viewX = pPriv->viewX;
+        job->viewY = pPriv->viewY;
+        job->fb = pPriv->fb;
+        job->stride = pPriv->stride;
+        job->black = pPriv->blanked;
+        job->zrle = viewer->zrle;
+        job->format = viewer->format;
+
+        RegionEmpty(&viewer->damage);
+        viewer->updateRequested = FALSE;
+        viewer->lastUpdate = now;
+
+        pthread_mutex_lock(&viewer->lock);
+        viewer->job = job;
+        viewer->busy = TRUE;
+        pthread_cond_signal(&viewer->cond);
+        pthread_mutex_unlock(&viewer->lock);
+
+        pPriv->encoding = TRUE;
+    }
+
+    if (wait)
+        pPriv->throttleTimer = TimerSet(pPriv->throttleTimer, 0, wait,
+                                        RfbThrottleTimer, pPriv);
+}
+
+/* Waits until the viewer threads are done reading the frame buffer; they
+ * send on their own */
+static void
+NestedRfbFinishSync(NestedBackendScreenPtr pPriv) {
+    RfbViewer *viewer;
+
+    if (!pPriv->encoding)
+        return;
+
+    pPriv->encoding = FALSE;
+
+    for (viewer = pPriv->viewers; viewer; viewer = viewer->next) {
+        pthread_mutex_lock(&viewer->lock);
+        while (viewer->job)
+            pthread_cond_wait(&viewer->encoded, &viewer->lock);
+        pthread_mutex_unlock(&viewer->lock);
+    }
+}
+
+/* The software cursor is drawn into the frame buffer */
+static void
+NestedRfbHideCursor(NestedBackendScreenPtr pPriv) {
+}
+
+/* Viewers get a black screen while blanked */
+static void
+NestedRfbSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked) {
+    if (pPriv->blanked == blanked)
+        return;
+
+    pPriv->blanked = blanked;
+    RfbDamageAll(pPriv);
+}
+
+static void
+NestedRfbCheckEvents(NestedBackendScreenPtr pPriv) {
+    struct epoll_event events[16];
+    RfbViewer *viewer, *next;
+    uint64_t count;
+    int i, n;
+
+    n = epoll_wait(pPriv->epollFd, events, ARRAY_SIZE(events), 0);
+
+    for (i = 0; i < n; i++) {
+        if (events[i].data.ptr == NULL) {
+            RfbAccept(pPriv);
+            continue;
+        }
+
+        /* Only there to wake the server up */
+        if (events[i].data.ptr == &pPriv->wakeFd) {
+            if (read(pPriv->wakeFd, &count, sizeof(count)) < 0)
+                count = 0;
+            continue;
+        }
+
+        viewer = events[i].data.ptr;
+        if (!RfbReadViewer(pPriv, viewer)) {
+            pthread_mutex_lock(&viewer->lock);
+            viewer->dead = TRUE;
+            pthread_mutex_unlock(&viewer->lock);
+        }
+    }
+
+    for (viewer = pPriv->viewers; viewer; viewer = next) {
+        Bool dead;
+
+        next = viewer->next;
+
+        pthread_mutex_lock(&viewer->lock);
+        dead = viewer->dead;
+        pthread_mutex_unlock(&viewer->lock);
+
+        if (dead)
+            RfbCloseViewer(pPriv, viewer);
+    }
+}
+
+static void
+NestedRfbCloseScreen(NestedBackendScreenPtr pPriv) {
+    while (pPriv->viewers)
+        RfbCloseViewer(pPriv, pPriv->viewers);
+
+    TimerFree(pPriv->throttleTimer);
+    close(pPriv->listenFd);
+    close(pPriv->epollFd);
+    close(pPriv->wakeFd);
+
+    if (pPriv->socketPath) {
+        unlink(pPriv->socketPath);
+        free(pPriv->socketPath);
+    }
+
+    free(pPriv->fb);
+    free(pPriv);
+}
+
+/* The listening socket is never lost */
+static Bool
+NestedRfbReattach(NestedBackendScreenPtr pPriv, const char *displayName,
+                  const char *xauthority) {
+    return TRUE;
+}
+
+/* Viewers stay connected across server resets */
+static void
+NestedRfbResetScreen(NestedBackendScreenPtr pPriv) {
+    pPriv->dev = NULL;
+}
+
+static Bool
+NestedRfbReuseScreen(NestedBackendScreenPtr pPriv,
+                     unsigned int fbWidth, unsigned int fbHeight,
+                     unsigned int width, unsigned int height,
+                     Pixel *retRedMask, Pixel *retGreenMask,
+                     Pixel *retBlueMask) {
+    if (pPriv->fbWidth != fbWidth || pPriv->fbHeight != fbHeight ||
+        pPriv->width != width || pPriv->height != height)
+        return FALSE;
+
+    NestedRfbSetBlanked(pPriv, FALSE);
+    RfbDamageAll(pPriv);
+
+    *retRedMask = pPriv->redMask;
+    *retGreenMask = pPriv->greenMask;
+    *retBlueMask = pPriv->blueMask;
+    return TRUE;
+}
+
+static void
+NestedRfbSetDevicePtr(NestedBackendScreenPtr pPriv, DeviceIntPtr dev) {
+    pPriv->dev = dev;
+}
+
+static int
+NestedRfbGetFileDescriptor(NestedBackendScreenPtr pPriv) {
+    return pPriv->epollFd;
+}
+
+static Bool
+NestedRfbGetKeyboardMappings(NestedBackendScreenPtr pPriv,
+                             KeySymsPtr keySyms, CARD8 *modmap,
+                             XkbControlsPtr ctrls) {
+    int i, j;
+
+    /* NestedInputUpdateKeymap() takes the map in the Xlib KeySym size */
+#ifdef _XSERVER64
+    unsigned long *map;
+#else
+    KeySym *map;
+#endif
+
+    map = calloc(RFB_NUM_KEYCODES * 2, sizeof(*map));
+    if (!map)
+        return FALSE;
+
+    for (i = 0; i < rfbNumKeycodes; i++) {
+        map[2 * i] = rfbKeymap[i][0];
+        map[2 * i + 1] = rfbKeymap[i][1];
+    }
+
+    memset(modmap, 0, sizeof(CARD8) * MAP_LENGTH);
+    for (i = 0; i < ARRAY_SIZE(rfbModifierKeys); i++)
+        for (j = 0; j < rfbNumKeycodes; j++)
+            if (rfbKeymap[j][0] == rfbModifierKeys[i].sym)
+                modmap[j + RFB_MIN_KEYCODE] |= 1 << rfbModifierKeys[i].modifier;
+
+    keySyms->minKeyCode = RFB_MIN_KEYCODE;
+    keySyms->maxKeyCode = RFB_MIN_KEYCODE + RFB_NUM_KEYCODES - 1;
+    keySyms->mapWidth = 2;
+    keySyms->map = (KeySym *)map;
+
+    /* Viewers repeat keys themselves */
+    memset(ctrls, 0, sizeof(XkbControlsRec));
+
+    return TRUE;
+}
+
+/* There is nothing to forward to: NestedRfbXvInit(),
+ * NestedRfbRenderInit() and NestedRfbCoreInit() failing keeps the
+ * driver from calling any of the others */
+static Bool
+NestedRfbXvInit(NestedBackendScreenPtr pPriv, XF86ImagePtr *retImages,
+                int *retNumImages, unsigned short *retMaxWidth,
+                unsigned short *retMaxHeight) {
+    return FALSE;
+}
+
+static int
+NestedRfbXvQueryImageAttributes(NestedBackendScreenPtr pPriv, int id,
+                                unsigned short *width,
+                                unsigned short *height,
+                                int *pitches, int *offsets) {
+    return 0;
+}
+
+static Bool
+NestedRfbXvSetColorKey(NestedBackendScreenPtr pPriv, CARD32 colorKey) {
+    return FALSE;
+}
+
+static void
+NestedRfbXvPutImage(NestedBackendScreenPtr pPriv, int id,
+                    unsigned char *buf, short width, short height,
+                    short srcX, short srcY, short srcWidth, short srcHeight,
+                    short dstX, short dstY, short dstWidth, short dstHeight,
+                    BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedRfbXvStopVideo(NestedBackendScreenPtr pPriv) {
+}
+
+static Bool
+NestedRfbRenderInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedRfbRenderReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedRfbRenderCreateSolid(NestedBackendScreenPtr pPriv,
+                           xRenderColor *color) {
+    return None;
+}
+
+static CARD32
+NestedRfbRenderCreateLinearGradient(NestedBackendScreenPtr pPriv,
+                                    xPointFixed *p1, xPointFixed *p2,
+                                    int numStops, xFixed *stops,
+                                    xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static CARD32
+NestedRfbRenderCreateRadialGradient(NestedBackendScreenPtr pPriv,
+                                    xPointFixed *inner, xPointFixed *outer,
+                                    xFixed innerRadius, xFixed outerRadius,
+                                    int numStops, xFixed *stops,
+                                    xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static void
+NestedRfbRenderFreePicture(NestedBackendScreenPtr pPriv, CARD32 picture) {
+}
+
+static void
+NestedRfbRenderSetClip(NestedBackendScreenPtr pPriv, BoxPtr boxes,
+                       int numBoxes) {
+}
+
+static void
+NestedRfbRenderComposite(NestedBackendScreenPtr pPriv, CARD8 op,
+                         CARD32 src, CARD32 mask,
+                         INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                         INT16 xDst, INT16 yDst,
+                         CARD16 width, CARD16 height) {
+}
+
+static Bool
+NestedRfbRenderTrapezoids(NestedBackendScreenPtr pPriv, CARD8 op,
+                          CARD32 src, int maskFormat,
+                          INT16 xSrc, INT16 ySrc,
+                          int xOrigin, int yOrigin,
+                          int numTraps, xTrapezoid *traps) {
+    return FALSE;
+}
+
+static void
+NestedRfbRenderResetGlyphs(NestedBackendScreenPtr pPriv, int format) {
+}
+
+static void
+NestedRfbRenderAddGlyph(NestedBackendScreenPtr pPriv, int format,
+                        CARD32 id, xGlyphInfo *info,
+                        const char *data, int size) {
+}
+
+static Bool
+NestedRfbRenderCompositeGlyphs(NestedBackendScreenPtr pPriv, CARD8 op,
+                               CARD32 src, int maskFormat, int format,
+                               INT16 xSrc, INT16 ySrc,
+                               int xOrigin, int yOrigin,
+                               int numLists, NestedGlyphListPtr lists,
+                               CARD32 *glyphs) {
+    return FALSE;
+}
+
+static Bool
+NestedRfbCoreInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedRfbCoreReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static void
+NestedRfbCoreSetGC(NestedBackendScreenPtr pPriv, int alu,
+                   CARD32 planeMask, CARD32 foreground, int capStyle,
+                   BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedRfbCorePolyFillRect(NestedBackendScreenPtr pPriv,
+                          int xOrigin, int yOrigin,
+                          int numRects, xRectangle *rects) {
+}
+
+static void
+NestedRfbCorePolySegment(NestedBackendScreenPtr pPriv,
+                         int xOrigin, int yOrigin,
+                         int numSegments, xSegment *segments) {
+}
+
+static Bool
+NestedRfbCoreCopyArea(NestedBackendScreenPtr pPriv, int srcX, int srcY,
+                      int width, int height, int dstX, int dstY) {
+    return FALSE;
+}
+
+static Bool
+NestedRfbCorePutImage(NestedBackendScreenPtr pPriv, int depth,
+                      int x, int y, int width, int height,
+                      int stride, char *data) {
+    return FALSE;
+}
+
+/* There is no host window manager, the screen is handled as usual */
+static Bool
+NestedRfbRootlessReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedRfbRootlessCreateWindow(NestedBackendScreenPtr pPriv, int x, int y,
+                              unsigned int width, unsigned int height,
+                              Bool overrideRedirect,
+                              const char *name, int nameLength) {
+    return 0;
+}
+
+static void
+NestedRfbRootlessConfigureWindow(NestedBackendScreenPtr pPriv,
+                                 CARD32 window, int x, int y,
+                                 unsigned int width, unsigned int height) {
+}
+
+static void
+NestedRfbRootlessRaiseWindow(NestedBackendScreenPtr pPriv, CARD32 window) {
+}
+
+static void
+NestedRfbRootlessDestroyWindow(NestedBackendScreenPtr pPriv,
+                               CARD32 window) {
+}
+
+static void
+NestedRfbRootlessUpdateWindow(NestedBackendScreenPtr pPriv, CARD32 window,
+                              int x, int y, BoxPtr boxes, int numBoxes) {
+}
+
+const NestedClientBackendRec nestedRfbBackend = {
+    .name = "rfb",
+    .Probe = NULL,
+    .CheckDisplay = NestedRfbCheckDisplay,
+    .ValidDepth = NestedRfbValidDepth,
+    .CreateScreen = NestedRfbCreateScreen,
+    .GetFrameBuffer = NestedRfbGetFrameBuffer,
+    .ResizeFrameBuffer = NestedRfbResizeFrameBuffer,
+    .ResizeWindow = NestedRfbResizeWindow,
+    .SetViewport = NestedRfbSetViewport,
+    .UpdateScreen = NestedRfbUpdateScreen,
+    .BeginSync = NestedRfbBeginSync,
+    .FinishSync = NestedRfbFinishSync,
+    .HideCursor = NestedRfbHideCursor,
+    .SetBlanked = NestedRfbSetBlanked,
+    .CheckEvents = NestedRfbCheckEvents,
+    .CloseScreen = NestedRfbCloseScreen,
+    .Reattach = NestedRfbReattach,
+    .ResetScreen = NestedRfbResetScreen,
+    .ReuseScreen = NestedRfbReuseScreen,
+    .SetDevicePtr = NestedRfbSetDevicePtr,
+    .GetFileDescriptor = NestedRfbGetFileDescriptor,
+    .GetKeyboardMappings = NestedRfbGetKeyboardMappings,
+    .XvInit = NestedRfbXvInit,
+    .XvQueryImageAttributes = NestedRfbXvQueryImageAttributes,
+    .XvSetColorKey = NestedRfbXvSetColorKey,
+    .XvPutImage = NestedRfbXvPutImage,
+    .XvStopVideo = NestedRfbXvStopVideo,
+    .RenderInit = NestedRfbRenderInit,
+    .RenderReady = NestedRfbRenderReady,
+    .RenderCreateSolid = NestedRfbRenderCreateSolid,
+    .RenderCreateLinearGradient = NestedRfbRenderCreateLinearGradient,
+    .RenderCreateRadialGradient = NestedRfbRenderCreateRadialGradient,
+    .RenderFreePicture = NestedRfbRenderFreePicture,
+    .RenderSetClip = NestedRfbRenderSetClip,
+    .RenderComposite = NestedRfbRenderComposite,
+    .RenderTrapezoids = NestedRfbRenderTrapezoids,
+    .RenderResetGlyphs = NestedRfbRenderResetGlyphs,
+    .RenderAddGlyph = NestedRfbRenderAddGlyph,
+    .RenderCompositeGlyphs = NestedRfbRenderCompositeGlyphs,
+    .CoreInit = NestedRfbCoreInit,
+    .CoreReady = NestedRfbCoreReady,
+    .CoreSetGC = NestedRfbCoreSetGC,
+    .CorePolyFillRect = NestedRfbCorePolyFillRect,
+    .CorePolySegment = NestedRfbCorePolySegment,
+    .CoreCopyArea = NestedRfbCoreCopyArea,
+    .CorePutImage = NestedRfbCorePutImage,
+    .RootlessReady = NestedRfbRootlessReady,
+    .RootlessCreateWindow = NestedRfbRootlessCreateWindow,
+    .RootlessConfigureWindow = NestedRfbRootlessConfigureWindow,
+    .RootlessRaiseWindow = NestedRfbRootlessRaiseWindow,
+    .RootlessDestroyWindow = NestedRfbRootlessDestroyWindow,
+    .RootlessUpdateWindow = NestedRfbRootlessUpdateWindow,
+};
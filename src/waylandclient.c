@@ -0,0 +1,1562 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* The Wayland backend shows each screen in an xdg_toplevel of a Wayland
+ * compositor. The "Display" option is the compositor socket, as in
+ * WAYLAND_DISPLAY, which is used when it isn't given.
+ *
+ * The frame buffer is plain memory. Damaged rectangles are copied into one
+ * of a few wl_shm buffers the compositor isn't using, which is committed
+ * with exactly those rectangles as buffer damage. At most one commit waits
+ * for its frame callback: damage accumulates until the compositor wants the
+ * next frame. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <linux/input-event-codes.h>
+
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <X11/keysym.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+#include <regionstr.h>
+
+#include "client.h"
+
+#include "nested_input.h"
+
+#include "xdg-shell-client-protocol.h"
+
+#define BUF_LEN 256
+
+/* The compositor may hold on to one buffer for showing and one for a
+ * pending frame */
+#define WAYLAND_NUM_BUFFERS 3
+
+#define WAYLAND_MAX_DAMAGE  64 /* more are sent as their extents */
+
+/* wl_pointer.axis units per wheel click */
+#define WAYLAND_AXIS_STEP   10.0
+
+#define WAYLAND_MIN_KEYCODE 8
+#define WAYLAND_MAX_KEYCODE 255
+
+typedef struct {
+    struct wl_buffer *buffer;
+    char *data;
+    Bool busy; /* until the compositor releases it */
+    RegionRec stale; /* window coordinates not copied since it was used */
+} WaylandBuffer;
+
+struct NestedBackendScreen {
+    int scrnIndex; /* stored only for xf86DrvMsg usage */
+    const char *displayName;
+    Bool wantFullscreenHint;
+    char *fb;
+    size_t fbSize; /* bytes allocated for fb */
+    unsigned int fbWidth;
+    unsigned int fbHeight;
+    int stride;
+    unsigned int width;
+    unsigned int height;
+    int viewX; /* frame buffer position shown at the window origin */
+    int viewY;
+    Bool blanked;
+    Bool detached;
+    DeviceIntPtr dev;
+
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *wmBase;
+    struct wl_seat *seat;
+    struct wl_pointer *pointer;
+    struct wl_keyboard *keyboard;
+    struct wl_output *output;
+    int outputWidth;
+    int outputHeight;
+
+    struct wl_surface *surface;
+    struct xdg_surface *xdgSurface;
+    struct xdg_toplevel *toplevel;
+    Bool configured;
+    Bool closed; /* handled once the events are dispatched */
+    struct wl_callback *frame; /* the last commit wasn't shown yet */
+
+    struct wl_shm_pool *pool;
+    char *poolData;
+    size_t poolSize;
+    WaylandBuffer buffers[WAYLAND_NUM_BUFFERS];
+    RegionRec damage; /* window coordinates, since the last commit */
+
+    uint32_t pointerSerial; /* of the last pointer enter */
+    double axis[2]; /* scrolling not posted yet */
+    struct xkb_context *xkbContext;
+    struct xkb_keymap *keymap;
+    int32_t repeatRate;
+    int32_t repeatDelay;
+    unsigned char keysDown[(WAYLAND_MAX_KEYCODE + 1) / 8];
+};
+
+static void
+NestedWaylandCloseScreen(NestedBackendScreenPtr pPriv);
+
+static void WaylandHostGone(NestedBackendScreenPtr pPriv, Bool closed);
+
+static int
+WaylandCreateFile(size_t size) {
+    int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("nested-wayland", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/nested-wayland-XXXXXX";
+
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+WaylandDamageAll(NestedBackendScreenPtr pPriv) {
+    BoxRec box = { 0, 0, pPriv->width, pPriv->height };
+    RegionRec region;
+    int i;
+
+    RegionInit(&region, &box, 1);
+    RegionUnion(&pPriv->damage, &pPriv->damage, &region);
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionUnion(&pPriv->buffers[i].stale, &pPriv->buffers[i].stale,
+                    &region);
+
+    RegionUninit(&region);
+}
+
+static void
+WaylandBufferRelease(void *data, struct wl_buffer *buffer) {
+    WaylandBuffer *buf = data;
+
+    buf->busy = FALSE;
+}
+
+static const struct wl_buffer_listener waylandBufferListener = {
+    WaylandBufferRelease,
+};
+
+static void
+WaylandDestroyBuffers(NestedBackendScreenPtr pPriv) {
+    int i;
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++) {
+        if (pPriv->buffers[i].buffer)
+            wl_buffer_destroy(pPriv->buffers[i].buffer);
+        pPriv->buffers[i].buffer = NULL;
+        pPriv->buffers[i].data = NULL;
+        pPriv->buffers[i].busy = FALSE;
+    }
+
+    if (pPriv->pool)
+        wl_shm_pool_destroy(pPriv->pool);
+    pPriv->pool = NULL;
+
+    if (pPriv->poolData)
+        munmap(pPriv->poolData, pPriv->poolSize);
+    pPriv->poolData = NULL;
+    pPriv->poolSize = 0;
+}
+
+/* Window sized buffers, all in one pool */
+static Bool
+WaylandCreateBuffers(NestedBackendScreenPtr pPriv) {
+    int stride = pPriv->width * 4;
+    size_t size = (size_t)stride * pPriv->height;
+    int fd, i;
+
+    pPriv->poolSize = size * WAYLAND_NUM_BUFFERS;
+
+    fd = WaylandCreateFile(pPriv->poolSize);
+    if (fd < 0)
+        return FALSE;
+
+    pPriv->poolData = mmap(NULL, pPriv->poolSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+    if (pPriv->poolData == MAP_FAILED) {
+        pPriv->poolData = NULL;
+        close(fd);
+        return FALSE;
+    }
+
+    pPriv->pool = wl_shm_create_pool(pPriv->shm, fd, pPriv->poolSize);
+    close(fd);
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++) {
+        WaylandBuffer *buf = &pPriv->buffers[i];
+
+        buf->buffer = wl_shm_pool_create_buffer(pPriv->pool, i * size,
+                                                pPriv->width, pPriv->height,
+                                                stride,
+                                                WL_SHM_FORMAT_XRGB8888);
+        buf->data = pPriv->poolData + i * size;
+        wl_buffer_add_listener(buf->buffer, &waylandBufferListener, buf);
+    }
+
+    /* Everything has to be copied into new buffers */
+    WaylandDamageAll(pPriv);
+    return TRUE;
+}
+
+/* Brings a buffer up to date with the frame buffer */
+static void
+WaylandCopyStale(NestedBackendScreenPtr pPriv, WaylandBuffer *buf) {
+    int stride = pPriv->width * 4;
+    BoxPtr boxes;
+    int i, n, y, width;
+
+    boxes = RegionRects(&buf->stale);
+    n = RegionNumRects(&buf->stale);
+
+    for (i = 0; i < n; i++) {
+        BoxRec box = boxes[i];
+
+        box.x1 = max(box.x1, 0);
+        box.y1 = max(box.y1, 0);
+        box.x2 = min(box.x2, (int)pPriv->width);
+        box.y2 = min(box.y2, (int)pPriv->height);
+
+        for (y = box.y1; y < box.y2; y++) {
+            char *dst = buf->data + (long)y * stride + box.x1 * 4;
+            int fbY = y + pPriv->viewY;
+
+            width = 0;
+            if (!pPriv->blanked && fbY < (int)pPriv->fbHeight)
+                width = max(min(box.x2 + pPriv->viewX,
+                                (int)pPriv->fbWidth) -
+                            (box.x1 + pPriv->viewX), 0);
+
+            if (width)
+                memcpy(dst, pPriv->fb + (long)fbY * pPriv->stride +
+                            (box.x1 + pPriv->viewX) * 4,
+                       width * 4);
+
+            /* Past the edge of the frame buffer, or blanked */
+            memset(dst + width * 4, 0, (box.x2 - box.x1 - width) * 4);
+        }
+    }
+
+    RegionEmpty(&buf->stale);
+}
+
+static void
+WaylandFrameDone(void *data, struct wl_callback *callback, uint32_t time) {
+    NestedBackendScreenPtr pPriv = data;
+
+    wl_callback_destroy(callback);
+    pPriv->frame = NULL;
+}
+
+static const struct wl_callback_listener waylandFrameListener = {
+    WaylandFrameDone,
+};
+
+static void
+WaylandWmBasePing(void *data, struct xdg_wm_base *wmBase, uint32_t serial) {
+    xdg_wm_base_pong(wmBase, serial);
+}
+
+static const struct xdg_wm_base_listener waylandWmBaseListener = {
+    WaylandWmBasePing,
+};
+
+static void
+WaylandXdgSurfaceConfigure(void *data, struct xdg_surface *xdgSurface,
+                           uint32_t serial) {
+    NestedBackendScreenPtr pPriv = data;
+
+    xdg_surface_ack_configure(xdgSurface, serial);
+    pPriv->configured = TRUE;
+}
+
+static const struct xdg_surface_listener waylandXdgSurfaceListener = {
+    WaylandXdgSurfaceConfigure,
+};
+
+/* The window is always as big as the nested screen, suggested sizes are
+ * ignored */
+static void
+WaylandToplevelConfigure(void *data, struct xdg_toplevel *toplevel,
+                         int32_t width, int32_t height,
+                         struct wl_array *states) {
+}
+
+static void
+WaylandToplevelClose(void *data, struct xdg_toplevel *toplevel) {
+    NestedBackendScreenPtr pPriv = data;
+
+    pPriv->closed = TRUE;
+}
+
+static const struct xdg_toplevel_listener waylandToplevelListener = {
+    WaylandToplevelConfigure,
+    WaylandToplevelClose,
+};
+
+static void
+WaylandOutputGeometry(void *data, struct wl_output *output,
+                      int32_t x, int32_t y, int32_t physicalWidth,
+                      int32_t physicalHeight, int32_t subpixel,
+                      const char *make, const char *model,
+                      int32_t transform) {
+}
+
+static void
+WaylandOutputMode(void *data, struct wl_output *output, uint32_t flags,
+                  int32_t width, int32_t height, int32_t refresh) {
+    NestedBackendScreenPtr pPriv = data;
+
+    if (flags & WL_OUTPUT_MODE_CURRENT) {
+        pPriv->outputWidth = width;
+        pPriv->outputHeight = height;
+    }
+}
+
+static void
+WaylandOutputDone(void *data, struct wl_output *output) {
+}
+
+static void
+WaylandOutputScale(void *data, struct wl_output *output, int32_t factor) {
+}
+
+static const struct wl_output_listener waylandOutputListener = {
+    WaylandOutputGeometry,
+    WaylandOutputMode,
+    WaylandOutputDone,
+    WaylandOutputScale,
+};
+
+static void
+WaylandPointerEnter(void *data, struct wl_pointer *pointer, uint32_t serial,
+                    struct wl_surface *surface,
+                    wl_fixed_t x, wl_fixed_t y) {
+    NestedBackendScreenPtr pPriv = data;
+
+    /* The nested server draws its own cursor */
+    pPriv->pointerSerial = serial;
+    wl_pointer_set_cursor(pointer, serial, NULL, 0, 0);
+}
+
+static void
+WaylandPointerLeave(void *data, struct wl_pointer *pointer, uint32_t serial,
+                    struct wl_surface *surface) {
+}
+
+static void
+WaylandPointerMotion(void *data, struct wl_pointer *pointer, uint32_t time,
+                     wl_fixed_t surfaceX, wl_fixed_t surfaceY) {
+    NestedBackendScreenPtr pPriv = data;
+    int x = wl_fixed_to_int(surfaceX), y = wl_fixed_to_int(surfaceY);
+
+    if (!pPriv->dev)
+        return;
+
+    NestedHostToScreen(pPriv->scrnIndex, &x, &y);
+    NestedInputPostMouseMotionEvent(pPriv->dev, x, y);
+}
+
+static void
+WaylandPointerButton(void *data, struct wl_pointer *pointer,
+                     uint32_t serial, uint32_t time, uint32_t button,
+                     uint32_t state) {
+    NestedBackendScreenPtr pPriv = data;
+    int xButton;
+
+    if (!pPriv->dev)
+        return;
+
+    /* Buttons 4 to 7 are scrolling */
+    switch (button) {
+    case BTN_LEFT:   xButton = 1; break;
+    case BTN_MIDDLE: xButton = 2; break;
+    case BTN_RIGHT:  xButton = 3; break;
+    case BTN_SIDE:   xButton = 8; break;
+    case BTN_EXTRA:  xButton = 9; break;
+    default:
+        return;
+    }
+
+    NestedInputPostButtonEvent(pPriv->dev, xButton,
+                               state == WL_POINTER_BUTTON_STATE_PRESSED);
+}
+
+static void
+WaylandPointerAxis(void *data, struct wl_pointer *pointer, uint32_t time,
+                   uint32_t axis, wl_fixed_t value) {
+    NestedBackendScreenPtr pPriv = data;
+    double *acc;
+    int button;
+
+    if (!pPriv->dev || axis > WL_POINTER_AXIS_HORIZONTAL_SCROLL)
+        return;
+
+    acc = &pPriv->axis[axis];
+    *acc += wl_fixed_to_double(value);
+
+    /* One click per step, positive is down or right */
+    while (*acc >= WAYLAND_AXIS_STEP || *acc <= -WAYLAND_AXIS_STEP) {
+        if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+            button = *acc > 0 ? 5 : 4;
+        else
+            button = *acc > 0 ? 7 : 6;
+
+        NestedInputPostButtonEvent(pPriv->dev, button, TRUE);
+        NestedInputPostButtonEvent(pPriv->dev, button, FALSE);
+        *acc -= *acc > 0 ? WAYLAND_AXIS_STEP : -WAYLAND_AXIS_STEP;
+    }
+}
+
+static const struct wl_pointer_listener waylandPointerListener = {
+    WaylandPointerEnter,
+    WaylandPointerLeave,
+    WaylandPointerMotion,
+    WaylandPointerButton,
+    WaylandPointerAxis,
+};
+
+static void
+WaylandKeyboardKeymap(void *data, struct wl_keyboard *keyboard,
+                      uint32_t format, int32_t fd, uint32_t size) {
+    NestedBackendScreenPtr pPriv = data;
+    struct xkb_keymap *keymap;
+    char *map;
+
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    keymap = xkb_keymap_new_from_string(pPriv->xkbContext, map,
+                                        XKB_KEYMAP_FORMAT_TEXT_V1,
+                                        XKB_KEYMAP_COMPILE_NO_FLAGS);
+    munmap(map, size);
+
+    if (!keymap) {
+        NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                        "Can't compile the compositor keymap\n");
+        return;
+    }
+
+    xkb_keymap_unref(pPriv->keymap);
+    pPriv->keymap = keymap;
+}
+
+static void
+WaylandKeyboardEnter(void *data, struct wl_keyboard *keyboard,
+                     uint32_t serial, struct wl_surface *surface,
+                     struct wl_array *keys) {
+}
+
+static void
+WaylandPostKey(NestedBackendScreenPtr pPriv, uint32_t keycode, Bool down) {
+    unsigned char bit = 1 << (keycode % 8);
+
+    if (keycode > WAYLAND_MAX_KEYCODE || !pPriv->dev)
+        return;
+
+    if (down)
+        pPriv->keysDown[keycode / 8] |= bit;
+    else
+        pPriv->keysDown[keycode / 8] &= ~bit;
+
+    NestedInputPostKeyboardEvent(pPriv->dev, keycode, down);
+}
+
+/* Keys held while the window loses the focus would stay down forever */
+static void
+WaylandKeyboardLeave(void *data, struct wl_keyboard *keyboard,
+                     uint32_t serial, struct wl_surface *surface) {
+    NestedBackendScreenPtr pPriv = data;
+    int keycode;
+
+    for (keycode = 0; keycode <= WAYLAND_MAX_KEYCODE; keycode++)
+        if (pPriv->keysDown[keycode / 8] & (1 << (keycode % 8)))
+            WaylandPostKey(pPriv, keycode, FALSE);
+}
+
+static void
+WaylandKeyboardKey(void *data, struct wl_keyboard *keyboard,
+                   uint32_t serial, uint32_t time, uint32_t key,
+                   uint32_t state) {
+    /* Wayland sends evdev codes, X keycodes are 8 higher */
+    WaylandPostKey(data, key + 8, state == WL_KEYBOARD_KEY_STATE_PRESSED);
+}
+
+/* The nested server keeps track of the modifiers from the key events */
+static void
+WaylandKeyboardModifiers(void *data, struct wl_keyboard *keyboard,
+                         uint32_t serial, uint32_t depressed,
+                         uint32_t latched, uint32_t locked, uint32_t group) {
+}
+
+static void
+WaylandKeyboardRepeatInfo(void *data, struct wl_keyboard *keyboard,
+                          int32_t rate, int32_t delay) {
+    NestedBackendScreenPtr pPriv = data;
+
+    pPriv->repeatRate = rate;
+    pPriv->repeatDelay = delay;
+}
+
+static const struct wl_keyboard_listener waylandKeyboardListener = {
+    WaylandKeyboardKeymap,
+    WaylandKeyboardEnter,
+    WaylandKeyboardLeave,
+    WaylandKeyboardKey,
+    WaylandKeyboardModifiers,
+    WaylandKeyboardRepeatInfo,
+};
+
+static void
+WaylandSeatCapabilities(void *data, struct wl_seat *seat, uint32_t caps) {
+    NestedBackendScreenPtr pPriv = data;
+
+    if ((caps & WL_SEAT_CAPABILITY_POINTER) && !pPriv->pointer) {
+        pPriv->pointer = wl_seat_get_pointer(seat);
+        wl_pointer_add_listener(pPriv->pointer, &waylandPointerListener,
+                                pPriv);
+    } else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && pPriv->pointer) {
+        wl_pointer_release(pPriv->pointer);
+        pPriv->pointer = NULL;
+    }
+
+    if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !pPriv->keyboard) {
+        pPriv->keyboard = wl_seat_get_keyboard(seat);
+        wl_keyboard_add_listener(pPriv->keyboard, &waylandKeyboardListener,
+                                 pPriv);
+    } else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && pPriv->keyboard) {
+        wl_keyboard_release(pPriv->keyboard);
+        pPriv->keyboard = NULL;
+    }
+}
+
+static void
+WaylandSeatName(void *data, struct wl_seat *seat, const char *name) {
+}
+
+static const struct wl_seat_listener waylandSeatListener = {
+    WaylandSeatCapabilities,
+    WaylandSeatName,
+};
+
+static void
+WaylandRegistryGlobal(void *data, struct wl_registry *registry,
+                      uint32_t name, const char *interface,
+                      uint32_t version) {
+    NestedBackendScreenPtr pPriv = data;
+
+    /* damage_buffer is new in version 4 */
+    if (!strcmp(interface, wl_compositor_interface.name) && version >= 4) {
+        pPriv->compositor = wl_registry_bind(registry, name,
+                                             &wl_compositor_interface, 4);
+    } else if (!strcmp(interface, wl_shm_interface.name)) {
+        pPriv->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (!strcmp(interface, xdg_wm_base_interface.name)) {
+        pPriv->wmBase = wl_registry_bind(registry, name,
+                                         &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(pPriv->wmBase, &waylandWmBaseListener,
+                                 pPriv);
+    } else if (!strcmp(interface, wl_seat_interface.name) && !pPriv->seat &&
+               version >= 4) {
+        /* Release requests and repeat info, without pointer frames */
+        pPriv->seat = wl_registry_bind(registry, name, &wl_seat_interface, 4);
+        wl_seat_add_listener(pPriv->seat, &waylandSeatListener, pPriv);
+    } else if (!strcmp(interface, wl_output_interface.name) &&
+               !pPriv->output) {
+        pPriv->output = wl_registry_bind(registry, name, &wl_output_interface,
+                                         min(version, 2));
+        wl_output_add_listener(pPriv->output, &waylandOutputListener, pPriv);
+    }
+}
+
+static void
+WaylandRegistryGlobalRemove(void *data, struct wl_registry *registry,
+                            uint32_t name) {
+}
+
+static const struct wl_registry_listener waylandRegistryListener = {
+    WaylandRegistryGlobal,
+    WaylandRegistryGlobalRemove,
+};
+
+static void
+WaylandDisconnect(NestedBackendScreenPtr pPriv) {
+    int i;
+
+    WaylandDestroyBuffers(pPriv);
+
+    if (pPriv->frame)
+        wl_callback_destroy(pPriv->frame);
+    if (pPriv->toplevel)
+        xdg_toplevel_destroy(pPriv->toplevel);
+    if (pPriv->xdgSurface)
+        xdg_surface_destroy(pPriv->xdgSurface);
+    if (pPriv->surface)
+        wl_surface_destroy(pPriv->surface);
+    if (pPriv->pointer)
+        wl_pointer_release(pPriv->pointer);
+    if (pPriv->keyboard)
+        wl_keyboard_release(pPriv->keyboard);
+    if (pPriv->seat)
+        wl_seat_destroy(pPriv->seat);
+    if (pPriv->output)
+        wl_output_destroy(pPriv->output);
+    if (pPriv->wmBase)
+        xdg_wm_base_destroy(pPriv->wmBase);
+    if (pPriv->shm)
+        wl_shm_destroy(pPriv->shm);
+    if (pPriv->compositor)
+        wl_compositor_destroy(pPriv->compositor);
+    if (pPriv->registry)
+        wl_registry_destroy(pPriv->registry);
+    if (pPriv->display)
+        wl_display_disconnect(pPriv->display);
+
+    pPriv->frame = NULL;
+    pPriv->toplevel = NULL;
+    pPriv->xdgSurface = NULL;
+    pPriv->surface = NULL;
+    pPriv->pointer = NULL;
+    pPriv->keyboard = NULL;
+    pPriv->seat = NULL;
+    pPriv->output = NULL;
+    pPriv->wmBase = NULL;
+    pPriv->shm = NULL;
+    pPriv->compositor = NULL;
+    pPriv->registry = NULL;
+    pPriv->display = NULL;
+    pPriv->configured = FALSE;
+    pPriv->closed = FALSE;
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionEmpty(&pPriv->buffers[i].stale);
+}
+
+static Bool
+WaylandConnect(NestedBackendScreenPtr pPriv) {
+    const char *name = pPriv->displayName ? pPriv->displayName
+                                          : getenv("WAYLAND_DISPLAY");
+
+    pPriv->display = wl_display_connect(pPriv->displayName);
+    if (!pPriv->display) {
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR,
+                        "Unable to connect to Wayland display \"%s\": %s\n",
+                        name ? name : "wayland-0", strerror(errno));
+        return FALSE;
+    }
+
+    pPriv->registry = wl_display_get_registry(pPriv->display);
+    wl_registry_add_listener(pPriv->registry, &waylandRegistryListener,
+                             pPriv);
+
+    /* The globals, then what they send when bound, then what the seat
+     * devices send: the keymap */
+    if (wl_display_roundtrip(pPriv->display) < 0 ||
+        wl_display_roundtrip(pPriv->display) < 0 ||
+        wl_display_roundtrip(pPriv->display) < 0) {
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR,
+                        "Lost the connection to the Wayland display\n");
+        WaylandDisconnect(pPriv);
+        return FALSE;
+    }
+
+    if (!pPriv->compositor || !pPriv->shm || !pPriv->wmBase) {
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR,
+                        "The Wayland compositor lacks %s\n",
+                        !pPriv->compositor ? "wl_compositor version 4" :
+                        !pPriv->shm ? "wl_shm" : "xdg_wm_base");
+        WaylandDisconnect(pPriv);
+        return FALSE;
+    }
+
+    if (!pPriv->seat)
+        NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                        "The Wayland compositor has no seat, no input\n");
+
+    return TRUE;
+}
+
+static Bool
+WaylandCreateWindow(NestedBackendScreenPtr pPriv) {
+    char buf[BUF_LEN + 1];
+    const char *name = pPriv->displayName ? pPriv->displayName
+                                          : getenv("WAYLAND_DISPLAY");
+
+    pPriv->surface = wl_compositor_create_surface(pPriv->compositor);
+    pPriv->xdgSurface = xdg_wm_base_get_xdg_surface(pPriv->wmBase,
+                                                    pPriv->surface);
+    xdg_surface_add_listener(pPriv->xdgSurface, &waylandXdgSurfaceListener,
+                             pPriv);
+    pPriv->toplevel = xdg_surface_get_toplevel(pPriv->xdgSurface);
+    xdg_toplevel_add_listener(pPriv->toplevel, &waylandToplevelListener,
+                              pPriv);
+
+    memset(buf, 0, BUF_LEN + 1);
+    snprintf(buf, BUF_LEN, "Xorg at :%s.%d nested on %s",
+             display, pPriv->scrnIndex, name ? name : "wayland-0");
+    xdg_toplevel_set_title(pPriv->toplevel, buf);
+    xdg_toplevel_set_app_id(pPriv->toplevel, "Xorg");
+
+    if (pPriv->wantFullscreenHint)
+        xdg_toplevel_set_fullscreen(pPriv->toplevel, NULL);
+
+    /* Nothing may be attached before the first configure */
+    wl_surface_commit(pPriv->surface);
+
+    while (!pPriv->configured)
+        if (wl_display_dispatch(pPriv->display) < 0)
+            return FALSE;
+
+    return WaylandCreateBuffers(pPriv);
+}
+
+/* The driver decides whether to go on without the compositor */
+static void
+WaylandHostGone(NestedBackendScreenPtr pPriv, Bool closed) {
+    if (!NestedHostDetached(pPriv->scrnIndex)) {
+        if (!closed)
+            NestedWaylandCloseScreen(pPriv);
+        exit(closed ? 0 : 1);
+    }
+
+    if (pPriv->dev)
+        NestedInputSetFileDescriptor(pPriv->dev, -1);
+
+    WaylandDisconnect(pPriv);
+    pPriv->detached = TRUE;
+}
+
+/* Every compositor takes wl_shm buffers, reaching one is enough */
+static NestedUploadMethod
+NestedWaylandProbe(int scrnIndex,
+                   const char *displayName,
+                   const char *xauthority) {
+    struct wl_display *display;
+
+    /* An X display is meant, $WAYLAND_DISPLAY or $WAYLAND_SOCKET would be
+     * reached instead */
+    if (displayName && strchr(displayName, ':'))
+        return NESTED_UPLOAD_NONE;
+
+    display = wl_display_connect(displayName);
+    if (!display)
+        return NESTED_UPLOAD_NONE;
+
+    wl_display_disconnect(display);
+    return NESTED_UPLOAD_SHM_FD;
+}
+
+static Bool
+NestedWaylandCheckDisplay(int scrnIndex,
+                          const char *displayName,
+                          const char *xauthority,
+                          const char *output,
+                          Bool enable,
+                          const char *parentOutput,
+                          char relation,
+                          unsigned int *width,
+                          unsigned int *height,
+                          int *x,
+                          int *y) {
+    NestedBackendScreenPtr pPriv;
+
+    if (output || parentOutput)
+        NestedClientMsg(scrnIndex, X_WARNING,
+                        "Outputs can't be chosen on Wayland, ignoring\n");
+
+    pPriv = calloc(1, sizeof(struct NestedBackendScreen));
+    if (!pPriv)
+        return FALSE;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->displayName = displayName;
+
+    pPriv->xkbContext = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!pPriv->xkbContext || !WaylandConnect(pPriv)) {
+        xkb_context_unref(pPriv->xkbContext);
+        free(pPriv);
+        return FALSE;
+    }
+
+    /* Compositors without outputs are headless */
+    if (width != NULL)
+        *width = pPriv->outputWidth > 0 ? pPriv->outputWidth : 1920;
+
+    if (height != NULL)
+        *height = pPriv->outputHeight > 0 ? pPriv->outputHeight : 1080;
+
+    if (x != NULL)
+        *x = 0;
+
+    if (y != NULL)
+        *y = 0;
+
+    WaylandDisconnect(pPriv);
+    xkb_keymap_unref(pPriv->keymap);
+    xkb_context_unref(pPriv->xkbContext);
+    free(pPriv);
+    return TRUE;
+}
+
+/* wl_shm only has to support XRGB8888 */
+static Bool
+NestedWaylandValidDepth(int depth) {
+    return depth == 24;
+}
+
+static Bool
+WaylandCreateFrameBuffer(NestedBackendScreenPtr pPriv,
+                         unsigned int width, unsigned int height) {
+    int stride = width * 4;
+    size_t size = (size_t)stride * height;
+    char *fb;
+
+    /* We are shrinking: keep the old buffer */
+    if (size > pPriv->fbSize) {
+        fb = calloc(1, size);
+        if (!fb)
+            return FALSE;
+
+        free(pPriv->fb);
+        pPriv->fb = fb;
+        pPriv->fbSize = size;
+    }
+
+    pPriv->fbWidth = width;
+    pPriv->fbHeight = height;
+    pPriv->stride = stride;
+    return TRUE;
+}
+
+static NestedBackendScreenPtr
+NestedWaylandCreateScreen(int scrnIndex,
+                          const char *displayName,
+                          const char *xauthority,
+                          Bool wantFullscreenHint,
+                          Bool rootless,
+                          Bool withInput,
+                          unsigned int fbWidth,
+                          unsigned int fbHeight,
+                          unsigned int width,
+                          unsigned int height,
+                          int originX,
+                          int originY,
+                          double scale,
+                          unsigned int depth,
+                          unsigned int bitsPerPixel,
+                          Pixel *retRedMask,
+                          Pixel *retGreenMask,
+                          Pixel *retBlueMask) {
+    NestedBackendScreenPtr pPriv;
+    int i;
+
+    if (scale != 1.0)
+        NestedClientMsg(scrnIndex, X_WARNING,
+                        "Scaling isn't supported on Wayland, ignoring\n");
+
+    pPriv = calloc(1, sizeof(struct NestedBackendScreen));
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->displayName = displayName;
+    pPriv->wantFullscreenHint = wantFullscreenHint;
+    pPriv->width = width;
+    pPriv->height = height;
+    pPriv->repeatRate = 25;
+    pPriv->repeatDelay = 600;
+
+    RegionNull(&pPriv->damage);
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionNull(&pPriv->buffers[i].stale);
+
+    pPriv->xkbContext = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!pPriv->xkbContext)
+        goto fail;
+
+    if (!WaylandCreateFrameBuffer(pPriv, fbWidth, fbHeight))
+        goto fail;
+
+    if (!WaylandConnect(pPriv))
+        goto fail;
+
+    if (!WaylandCreateWindow(pPriv)) {
+        NestedClientMsg(scrnIndex, X_ERROR, "Can't create the Wayland window\n");
+        WaylandDisconnect(pPriv);
+        goto fail;
+    }
+
+    *retRedMask = 0xff0000;
+    *retGreenMask = 0x00ff00;
+    *retBlueMask = 0x0000ff;
+
+    return pPriv;
+
+fail:
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionUninit(&pPriv->buffers[i].stale);
+    RegionUninit(&pPriv->damage);
+    xkb_keymap_unref(pPriv->keymap);
+    xkb_context_unref(pPriv->xkbContext);
+    free(pPriv->fb);
+    free(pPriv);
+    return NULL;
+}
+
+static char *
+NestedWaylandGetFrameBuffer(NestedBackendScreenPtr pPriv) {
+    return pPriv->fb;
+}
+
+static Bool
+NestedWaylandResizeFrameBuffer(NestedBackendScreenPtr pPriv,
+                               unsigned int width, unsigned int height) {
+    return WaylandCreateFrameBuffer(pPriv, width, height);
+}
+
+/* The window takes the size of the buffers attached to it */
+static Bool
+NestedWaylandResizeWindow(NestedBackendScreenPtr pPriv,
+                          unsigned int width, unsigned int height) {
+    if (pPriv->width == width && pPriv->height == height)
+        return TRUE;
+
+    pPriv->width = width;
+    pPriv->height = height;
+
+    if (pPriv->detached)
+        return TRUE;
+
+    WaylandDestroyBuffers(pPriv);
+    return WaylandCreateBuffers(pPriv);
+}
+
+static void
+NestedWaylandSetViewport(NestedBackendScreenPtr pPriv, int x, int y) {
+    if (pPriv->viewX == x && pPriv->viewY == y)
+        return;
+
+    pPriv->viewX = x;
+    pPriv->viewY = y;
+    WaylandDamageAll(pPriv);
+}
+
+static void
+NestedWaylandUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                          int16_t y1, int16_t x2, int16_t y2) {
+    RegionRec region;
+    BoxRec box;
+    int i;
+
+    /* Only the part of the frame buffer inside the viewport is shown */
+    box.x1 = max(x1, pPriv->viewX) - pPriv->viewX;
+    box.y1 = max(y1, pPriv->viewY) - pPriv->viewY;
+    box.x2 = min(x2, pPriv->viewX + (int)pPriv->width) - pPriv->viewX;
+    box.y2 = min(y2, pPriv->viewY + (int)pPriv->height) - pPriv->viewY;
+
+    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+        return;
+
+    RegionInit(&region, &box, 1);
+    RegionUnion(&pPriv->damage, &pPriv->damage, &region);
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionUnion(&pPriv->buffers[i].stale, &pPriv->buffers[i].stale,
+                    &region);
+
+    RegionUninit(&region);
+}
+
+/* Commits the damage to a free buffer, unless the compositor hasn't shown
+ * the previous commit yet */
+static void
+NestedWaylandBeginSync(NestedBackendScreenPtr pPriv) {
+    WaylandBuffer *buf = NULL;
+    BoxPtr boxes;
+    int i, n;
+
+    if (pPriv->detached || pPriv->frame || !RegionNotEmpty(&pPriv->damage))
+        return;
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        if (!pPriv->buffers[i].busy) {
+            buf = &pPriv->buffers[i];
+            break;
+        }
+
+    /* Woken up again by the release */
+    if (!buf || !buf->buffer)
+        return;
+
+    WaylandCopyStale(pPriv, buf);
+
+    wl_surface_attach(pPriv->surface, buf->buffer, 0, 0);
+
+    n = RegionNumRects(&pPriv->damage);
+    boxes = RegionRects(&pPriv->damage);
+    if (n > WAYLAND_MAX_DAMAGE) {
+        n = 1;
+        boxes = RegionExtents(&pPriv->damage);
+    }
+
+    for (i = 0; i < n; i++)
+        wl_surface_damage_buffer(pPriv->surface, boxes[i].x1, boxes[i].y1,
+                                 boxes[i].x2 - boxes[i].x1,
+                                 boxes[i].y2 - boxes[i].y1);
+
+    pPriv->frame = wl_surface_frame(pPriv->surface);
+    wl_callback_add_listener(pPriv->frame, &waylandFrameListener, pPriv);
+    wl_surface_commit(pPriv->surface);
+
+    buf->busy = TRUE;
+    RegionEmpty(&pPriv->damage);
+
+    if (wl_display_flush(pPriv->display) < 0 && errno != EAGAIN)
+        WaylandHostGone(pPriv, FALSE);
+}
+
+/* The compositor reads the shm buffers, never the frame buffer: there is
+ * nothing to wait for */
+static void
+NestedWaylandFinishSync(NestedBackendScreenPtr pPriv) {
+}
+
+/* Done on every pointer enter */
+static void
+NestedWaylandHideCursor(NestedBackendScreenPtr pPriv) {
+    if (pPriv->detached || !pPriv->pointer || !pPriv->pointerSerial)
+        return;
+
+    wl_pointer_set_cursor(pPriv->pointer, pPriv->pointerSerial, NULL, 0, 0);
+}
+
+static void
+NestedWaylandSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked) {
+    if (pPriv->blanked == blanked)
+        return;
+
+    pPriv->blanked = blanked;
+    WaylandDamageAll(pPriv);
+}
+
+static void
+NestedWaylandCheckEvents(NestedBackendScreenPtr pPriv) {
+    struct pollfd pfd;
+
+    if (pPriv->detached)
+        return;
+
+    while (wl_display_prepare_read(pPriv->display) != 0)
+        if (wl_display_dispatch_pending(pPriv->display) < 0)
+            goto gone;
+
+    if (wl_display_flush(pPriv->display) < 0 && errno != EAGAIN) {
+        wl_display_cancel_read(pPriv->display);
+        goto gone;
+    }
+
+    pfd.fd = wl_display_get_fd(pPriv->display);
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, 0) > 0) {
+        if (wl_display_read_events(pPriv->display) < 0)
+            goto gone;
+    } else {
+        wl_display_cancel_read(pPriv->display);
+    }
+
+    if (wl_display_dispatch_pending(pPriv->display) < 0)
+        goto gone;
+
+    if (pPriv->closed)
+        WaylandHostGone(pPriv, TRUE);
+
+    return;
+
+gone:
+    WaylandHostGone(pPriv, FALSE);
+}
+
+static void
+NestedWaylandCloseScreen(NestedBackendScreenPtr pPriv) {
+    int i;
+
+    WaylandDisconnect(pPriv);
+
+    for (i = 0; i < WAYLAND_NUM_BUFFERS; i++)
+        RegionUninit(&pPriv->buffers[i].stale);
+    RegionUninit(&pPriv->damage);
+    xkb_keymap_unref(pPriv->keymap);
+    xkb_context_unref(pPriv->xkbContext);
+    free(pPriv->fb);
+    free(pPriv);
+}
+
+static Bool
+NestedWaylandReattach(NestedBackendScreenPtr pPriv, const char *displayName,
+                      const char *xauthority) {
+    if (!pPriv->detached)
+        return TRUE;
+
+    pPriv->displayName = displayName;
+
+    if (!WaylandConnect(pPriv))
+        return FALSE;
+
+    if (!WaylandCreateWindow(pPriv)) {
+        WaylandDisconnect(pPriv);
+        return FALSE;
+    }
+
+    pPriv->detached = FALSE;
+
+    if (pPriv->dev)
+        NestedInputSetFileDescriptor(pPriv->dev,
+                                     wl_display_get_fd(pPriv->display));
+
+    /* Everything drawn while detached is shown at once */
+    WaylandDamageAll(pPriv);
+    wl_display_flush(pPriv->display);
+
+    return TRUE;
+}
+
+/* The window stays up across server resets */
+static void
+NestedWaylandResetScreen(NestedBackendScreenPtr pPriv) {
+    pPriv->dev = NULL;
+}
+
+static Bool
+NestedWaylandReuseScreen(NestedBackendScreenPtr pPriv,
+                         unsigned int fbWidth, unsigned int fbHeight,
+                         unsigned int width, unsigned int height,
+                         Pixel *retRedMask, Pixel *retGreenMask,
+                         Pixel *retBlueMask) {
+    if (pPriv->fbWidth != fbWidth || pPriv->fbHeight != fbHeight ||
+        pPriv->width != width || pPriv->height != height)
+        return FALSE;
+
+    NestedWaylandSetBlanked(pPriv, FALSE);
+    WaylandDamageAll(pPriv);
+
+    *retRedMask = 0xff0000;
+    *retGreenMask = 0x00ff00;
+    *retBlueMask = 0x0000ff;
+    return TRUE;
+}
+
+static void
+NestedWaylandSetDevicePtr(NestedBackendScreenPtr pPriv, DeviceIntPtr dev) {
+    pPriv->dev = dev;
+}
+
+static int
+NestedWaylandGetFileDescriptor(NestedBackendScreenPtr pPriv) {
+    if (pPriv->detached)
+        return -1;
+
+    return wl_display_get_fd(pPriv->display);
+}
+
+static int
+WaylandModifierIndex(KeySym sym) {
+    switch (sym) {
+    case XK_Shift_L:
+    case XK_Shift_R:
+        return ShiftMapIndex;
+    case XK_Caps_Lock:
+        return LockMapIndex;
+    case XK_Control_L:
+    case XK_Control_R:
+        return ControlMapIndex;
+    case XK_Alt_L:
+    case XK_Alt_R:
+    case XK_Meta_L:
+    case XK_Meta_R:
+        return Mod1MapIndex;
+    case XK_Num_Lock:
+        return Mod2MapIndex;
+    case XK_Super_L:
+    case XK_Super_R:
+    case XK_Hyper_L:
+    case XK_Hyper_R:
+        return Mod4MapIndex;
+    case XK_ISO_Level3_Shift:
+    case XK_Mode_switch:
+        return Mod5MapIndex;
+    default:
+        return -1;
+    }
+}
+
+/* The core keymap is made from the first two levels of the first layout of
+ * the compositor keymap; the modifier map from the modifier keysyms */
+static Bool
+NestedWaylandGetKeyboardMappings(NestedBackendScreenPtr pPriv,
+                                 KeySymsPtr keySyms, CARD8 *modmap,
+                                 XkbControlsPtr ctrls) {
+    int keycode, level, n, i, modifier;
+    const xkb_keysym_t *syms;
+
+    /* NestedInputUpdateKeymap() takes the map in the Xlib KeySym size */
+#ifdef _XSERVER64
+    unsigned long *map;
+#else
+    KeySym *map;
+#endif
+
+    if (!pPriv->keymap)
+        return FALSE;
+
+    n = WAYLAND_MAX_KEYCODE - WAYLAND_MIN_KEYCODE + 1;
+    map = calloc(n * 2, sizeof(*map));
+    if (!map)
+        return FALSE;
+
+    memset(modmap, 0, sizeof(CARD8) * MAP_LENGTH);
+
+    for (keycode = WAYLAND_MIN_KEYCODE; keycode <= WAYLAND_MAX_KEYCODE;
+         keycode++) {
+        i = (keycode - WAYLAND_MIN_KEYCODE) * 2;
+
+        for (level = 0; level < 2; level++)
+            if (xkb_keymap_key_get_syms_by_level(pPriv->keymap, keycode, 0,
+                                                 level, &syms) > 0)
+                map[i + level] = syms[0];
+
+        /* A single level is the same on both */
+        if (!map[i + 1])
+            map[i + 1] = map[i];
+
+        modifier = WaylandModifierIndex(map[i]);
+        if (modifier >= 0)
+            modmap[keycode] |= 1 << modifier;
+    }
+
+    keySyms->minKeyCode = WAYLAND_MIN_KEYCODE;
+    keySyms->maxKeyCode = WAYLAND_MAX_KEYCODE;
+    keySyms->mapWidth = 2;
+    keySyms->map = (KeySym *)map;
+
+    /* Wayland clients repeat keys themselves, so the nested server does */
+    memset(ctrls, 0, sizeof(XkbControlsRec));
+    ctrls->enabled_ctrls = pPriv->repeatRate > 0 ? XkbRepeatKeysMask : 0;
+    if (pPriv->repeatRate > 0) {
+        ctrls->repeat_delay = pPriv->repeatDelay;
+        ctrls->repeat_interval = max(1000 / pPriv->repeatRate, 1);
+    }
+
+    for (i = 0; i < XkbPerKeyBitArraySize; i++)
+        ctrls->per_key_repeat[i] = 0xff;
+
+    return TRUE;
+}
+
+/* There is nothing to forward to: NestedWaylandXvInit(),
+ * NestedWaylandRenderInit() and NestedWaylandCoreInit() failing keeps the
+ * driver from calling any of the others */
+static Bool
+NestedWaylandXvInit(NestedBackendScreenPtr pPriv, XF86ImagePtr *retImages,
+                    int *retNumImages, unsigned short *retMaxWidth,
+                    unsigned short *retMaxHeight) {
+    return FALSE;
+}
+
+static int
+NestedWaylandXvQueryImageAttributes(NestedBackendScreenPtr pPriv, int id,
+                                    unsigned short *width,
+                                    unsigned short *height,
+                                    int *pitches, int *offsets) {
+    return 0;
+}
+
+static Bool
+NestedWaylandXvSetColorKey(NestedBackendScreenPtr pPriv, CARD32 colorKey) {
+    return FALSE;
+}
+
+static void
+NestedWaylandXvPutImage(NestedBackendScreenPtr pPriv, int id,
+                        unsigned char *buf, short width, short height,
+                        short srcX, short srcY, short srcWidth, short srcHeight,
+                        short dstX, short dstY, short dstWidth, short dstHeight,
+                        BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedWaylandXvStopVideo(NestedBackendScreenPtr pPriv) {
+}
+
+static Bool
+NestedWaylandRenderInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedWaylandRenderReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedWaylandRenderCreateSolid(NestedBackendScreenPtr pPriv,
+                               xRenderColor *color) {
+    return None;
+}
+
+static CARD32
+NestedWaylandRenderCreateLinearGradient(NestedBackendScreenPtr pPriv,
+                                        xPointFixed *p1, xPointFixed *p2,
+                                        int numStops, xFixed *stops,
+                                        xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static CARD32
+NestedWaylandRenderCreateRadialGradient(NestedBackendScreenPtr pPriv,
+                                        xPointFixed *inner, xPointFixed *outer,
+                                        xFixed innerRadius, xFixed outerRadius,
+                                        int numStops, xFixed *stops,
+                                        xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static void
+NestedWaylandRenderFreePicture(NestedBackendScreenPtr pPriv, CARD32 picture) {
+}
+
+static void
+NestedWaylandRenderSetClip(NestedBackendScreenPtr pPriv, BoxPtr boxes,
+                           int numBoxes) {
+}
+
+static void
+NestedWaylandRenderComposite(NestedBackendScreenPtr pPriv, CARD8 op,
+                             CARD32 src, CARD32 mask,
+                             INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                             INT16 xDst, INT16 yDst,
+                             CARD16 width, CARD16 height) {
+}
+
+static Bool
+NestedWaylandRenderTrapezoids(NestedBackendScreenPtr pPriv, CARD8 op,
+                              CARD32 src, int maskFormat,
+                              INT16 xSrc, INT16 ySrc,
+                              int xOrigin, int yOrigin,
+                              int numTraps, xTrapezoid *traps) {
+    return FALSE;
+}
+
+static void
+NestedWaylandRenderResetGlyphs(NestedBackendScreenPtr pPriv, int format) {
+}
+
+static void
+NestedWaylandRenderAddGlyph(NestedBackendScreenPtr pPriv, int format,
+                            CARD32 id, xGlyphInfo *info,
+                            const char *data, int size) {
+}
+
+static Bool
+NestedWaylandRenderCompositeGlyphs(NestedBackendScreenPtr pPriv, CARD8 op,
+                                   CARD32 src, int maskFormat, int format,
+                                   INT16 xSrc, INT16 ySrc,
+                                   int xOrigin, int yOrigin,
+                                   int numLists, NestedGlyphListPtr lists,
+                                   CARD32 *glyphs) {
+    return FALSE;
+}
+
+static Bool
+NestedWaylandCoreInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedWaylandCoreReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static void
+NestedWaylandCoreSetGC(NestedBackendScreenPtr pPriv, int alu,
+                       CARD32 planeMask, CARD32 foreground, int capStyle,
+                       BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedWaylandCorePolyFillRect(NestedBackendScreenPtr pPriv,
+                              int xOrigin, int yOrigin,
+                              int numRects, xRectangle *rects) {
+}
+
+static void
+NestedWaylandCorePolySegment(NestedBackendScreenPtr pPriv,
+                             int xOrigin, int yOrigin,
+                             int numSegments, xSegment *segments) {
+}
+
+static Bool
+NestedWaylandCoreCopyArea(NestedBackendScreenPtr pPriv, int srcX, int srcY,
+                          int width, int height, int dstX, int dstY) {
+    return FALSE;
+}
+
+static Bool
+NestedWaylandCorePutImage(NestedBackendScreenPtr pPriv, int depth,
+                          int x, int y, int width, int height,
+                          int stride, char *data) {
+    return FALSE;
+}
+
+/* Toplevels can't be placed on Wayland, the screen is handled as usual */
+static Bool
+NestedWaylandRootlessReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedWaylandRootlessCreateWindow(NestedBackendScreenPtr pPriv, int x, int y,
+                                  unsigned int width, unsigned int height,
+                                  Bool overrideRedirect,
+                                  const char *name, int nameLength) {
+    return 0;
+}
+
+static void
+NestedWaylandRootlessConfigureWindow(NestedBackendScreenPtr pPriv,
+                                     CARD32 window, int x, int y,
+                                     unsigned int width, unsigned int height) {
+}
+
+static void
+NestedWaylandRootlessRaiseWindow(NestedBackendScreenPtr pPriv, CARD32 window) {
+}
+
+static void
+NestedWaylandRootlessDestroyWindow(NestedBackendScreenPtr pPriv,
+                                   CARD32 window) {
+}
+
+static void
+NestedWaylandRootlessUpdateWindow(NestedBackendScreenPtr pPriv, CARD32 window,
+                                  int x, int y, BoxPtr boxes, int numBoxes) {
+}
+
+const NestedClientBackendRec nestedWaylandBackend = {
+    .name = "wayland",
+    .Probe = NestedWaylandProbe,
+    .CheckDisplay = NestedWaylandCheckDisplay,
+    .ValidDepth = NestedWaylandValidDepth,
+    .CreateScreen = NestedWaylandCreateScreen,
+    .GetFrameBuffer = NestedWaylandGetFrameBuffer,
+    .ResizeFrameBuffer = NestedWaylandResizeFrameBuffer,
+    .ResizeWindow = NestedWaylandResizeWindow,
+    .SetViewport = NestedWaylandSetViewport,
+    .UpdateScreen = NestedWaylandUpdateScreen,
+    .BeginSync = NestedWaylandBeginSync,
+    .FinishSync = NestedWaylandFinishSync,
+    .HideCursor = NestedWaylandHideCursor,
+    .SetBlanked = NestedWaylandSetBlanked,
+    .CheckEvents = NestedWaylandCheckEvents,
+    .CloseScreen = NestedWaylandCloseScreen,
+    .Reattach = NestedWaylandReattach,
+    .ResetScreen = NestedWaylandResetScreen,
+    .ReuseScreen = NestedWaylandReuseScreen,
+    .SetDevicePtr = NestedWaylandSetDevicePtr,
+    .GetFileDescriptor = NestedWaylandGetFileDescriptor,
+    .GetKeyboardMappings = NestedWaylandGetKeyboardMappings,
+    .XvInit = NestedWaylandXvInit,
+    .XvQueryImageAttributes = NestedWaylandXvQueryImageAttributes,
+    .XvSetColorKey = NestedWaylandXvSetColorKey,
+    .XvPutImage = NestedWaylandXvPutImage,
+    .XvStopVideo = NestedWaylandXvStopVideo,
+    .RenderInit = NestedWaylandRenderInit,
+    .RenderReady = NestedWaylandRenderReady,
+    .RenderCreateSolid = NestedWaylandRenderCreateSolid,
+    .RenderCreateLinearGradient = NestedWaylandRenderCreateLinearGradient,
+    .RenderCreateRadialGradient = NestedWaylandRenderCreateRadialGradient,
+    .RenderFreePicture = NestedWaylandRenderFreePicture,
+    .RenderSetClip = NestedWaylandRenderSetClip,
+    .RenderComposite = NestedWaylandRenderComposite,
+    .RenderTrapezoids = NestedWaylandRenderTrapezoids,
+    .RenderResetGlyphs = NestedWaylandRenderResetGlyphs,
+    .RenderAddGlyph = NestedWaylandRenderAddGlyph,
+    .RenderCompositeGlyphs = NestedWaylandRenderCompositeGlyphs,
+    .CoreInit = NestedWaylandCoreInit,
+    .CoreReady = NestedWaylandCoreReady,
+    .CoreSetGC = NestedWaylandCoreSetGC,
+    .CorePolyFillRect = NestedWaylandCorePolyFillRect,
+    .CorePolySegment = NestedWaylandCorePolySegment,
+    .CoreCopyArea = NestedWaylandCoreCopyArea,
+    .CorePutImage = NestedWaylandCorePutImage,
+    .RootlessReady = NestedWaylandRootlessReady,
+    .RootlessCreateWindow = NestedWaylandRootlessCreateWindow,
+    .RootlessConfigureWindow = NestedWaylandRootlessConfigureWindow,
+    .RootlessRaiseWindow = NestedWaylandRootlessRaiseWindow,
+    .RootlessDestroyWindow = NestedWaylandRootlessDestroyWindow,
+    .RootlessUpdateWindow = NestedWaylandRootlessUpdateWindow,
+};
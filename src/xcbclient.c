@@ -27,10 +27,21 @@
 #include "config.h"
 #endif
 
+/* memfd_create() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/socket.h>
 
 #include <X11/XKBlib.h>
 
@@ -40,6 +51,8 @@
 #include <xcb/xcb_image.h>
 #include <xcb/shm.h>
 #include <xcb/randr.h>
+#include <xcb/render.h>
+#include <xcb/xv.h>
 #include <xcb/xkb.h>
 
 #include <xorg-server.h>
@@ -48,16 +61,19 @@
 #include "client.h"
 
 #include "nested_input.h"
+#include "nested_xauth.h"
 
 #define BUF_LEN 256
 
 #define MAX(a, b) (((a) <= (b)) ? (b) : (a))
+#define MIN(a, b) (((a) <= (b)) ? (a) : (b))
+
+/* Filter used when the viewport is scaled to the window */
+#define SCALE_FILTER "good"
 
 extern Bool enableNestedInput;
 extern char *display;
 
-static xcb_atom_t atom_WM_DELETE_WINDOW;
-
 typedef struct _Output {
     const char *name;
     int x;
@@ -66,26 +82,112 @@ typedef struct _Output {
     unsigned int height;
 } Output;
 
-struct NestedClientPrivate {
+/* A segment for Xv images, busy from the image copied to it until the sync
+ * that tells the host has read it */
+typedef struct _XvShm {
+    xcb_shm_segment_info_t info;
+    size_t size;
+    Bool busy;
+} XvShm;
+
+/* A connection made by a thread of its own while detached, so a host that is
+ * slow to answer, or not there at all, doesn't hold up the server. The thread
+ * frees it when the screen was closed in the meantime. */
+typedef struct _PendingConnect {
+    pthread_mutex_t mutex;
+    Bool done;
+    Bool abandoned;
+    char *displayName; /* NULL for $DISPLAY */
+    char *xauthority;
+    xcb_connection_t *conn;
+    int screenNumber;
+} PendingConnect;
+
+struct NestedBackendScreen {
     /* Host X server data */
+    const char *displayName; /* NULL for $DISPLAY */
     int screenNumber;
     xcb_connection_t *conn;
     xcb_visualtype_t *visual;
     xcb_window_t rootWindow;
     xcb_gcontext_t gc;
     xcb_cursor_t emptyCursor;
+    uint32_t blackPixel;
     Bool usingShm;
+    Bool usingShmFd; /* the segment is a file mapped by both servers */
 
     /* Nested X server window data */
     xcb_window_t window;
+    xcb_atom_t netWmStateAtom; /* atoms differ between host servers */
+    xcb_atom_t netWmStateFullscreenAtom;
+    xcb_atom_t wmProtocolsAtom;
+    xcb_atom_t wmDeleteWindowAtom;
     int scrnIndex;
     int x;
     int y;
     unsigned int width;
     unsigned int height;
     Bool usingFullscreen;
+    Bool blanked;
+    Bool rootless; /* the window stays unmapped, see NestedXcbRootless*() */
+    Bool withInput; /* FALSE for mirrors, no input events are selected */
+    Bool detached; /* no host, conn is NULL; see NestedXcbReattach() */
+    PendingConnect *pendingConnect; /* while reattaching */
+    int viewX; /* frame buffer position shown at the window origin */
+    int viewY;
+    double scale; /* window size / viewport size; 0 follows the window */
+    unsigned int windowWidth; /* differ from width and height when scaled */
+    unsigned int windowHeight;
+    unsigned int depth;
+    uint32_t redMask; /* of the visual the nested screen was created with */
+    uint32_t greenMask;
+    uint32_t blueMask;
     xcb_image_t *img;
+    size_t bufferSize; /* bytes allocated for img->data */
     xcb_shm_segment_info_t shminfo;
+    int shmFd; /* kept to attach the segment again after a reattach */
+
+    /* Uploads are only queued, the driver waits for all connections at once
+     * with NestedXcbBeginSync() and NestedXcbFinishSync() */
+    Bool uploadPending;
+    Bool syncing;
+    xcb_get_input_focus_cookie_t syncCookie;
+
+    /* When scaling, the viewport is uploaded to a pixmap which is then
+     * composited to the window with a RENDER transform */
+    Bool usingRender;
+    xcb_render_pictformat_t format;
+    xcb_drawable_t drawable; /* where the frame buffer is uploaded to */
+    xcb_pixmap_t pixmap;
+    xcb_render_picture_t srcPicture;
+    xcb_render_picture_t dstPicture;
+
+    /* Host RENDER formats, looked up once by _NestedClientRenderInit() */
+    Bool hasRender;
+    int renderMinor;
+    xcb_render_pictformat_t formats[NESTED_NUM_FORMATS]; /* NESTED_FORMAT_* */
+
+    /* RENDER operations replayed on the window, see NestedXcbRenderInit() */
+    Bool usingRenderForward;
+    xcb_render_picture_t windowPicture;
+    xcb_render_glyphset_t glyphSets[NESTED_NUM_FORMATS];
+
+    /* Core drawing replayed on the window, see NestedXcbCoreInit() */
+    Bool usingCoreForward;
+    xcb_gcontext_t coreGc;
+    uint32_t coreGcValues[4]; /* function, plane mask, foreground, cap style */
+
+    /* Host Xv port showing forwarded video, see NestedXcbXvInit() */
+    Bool usingXv;
+    xcb_xv_port_t xvPort;
+    xcb_gcontext_t xvGc;
+    xcb_atom_t xvColorKeyAtom; /* XCB_ATOM_NONE if the port has no color key */
+    XvShm xvShm[2]; /* one for the next image while the host reads the other */
+    int xvShmLast; /* index of the segment of the last image */
+    int xvId; /* format and size of the last image, and its data size */
+    short xvWidth;
+    short xvHeight;
+    int xvDataSize;
     DeviceIntPtr dev; // The pointer to the input device.  Passed back to the
                       // input driver when posting input events.
 
@@ -94,49 +196,114 @@ struct NestedClientPrivate {
     uint32_t attr_mask;
 };
 
+static void
+NestedXcbHideCursor(NestedBackendScreenPtr pPriv);
+
+static void
+NestedXcbSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked);
+
+static void
+NestedXcbUpdateScreen(NestedBackendScreenPtr pPriv,
+                      int16_t x1, int16_t y1,
+                      int16_t x2, int16_t y2);
+
+static void
+NestedXcbCloseScreen(NestedBackendScreenPtr pPriv);
+
+static Bool _NestedClientUpload(NestedBackendScreenPtr pPriv,
+                                int x1, int y1, int x2, int y2);
+
 static Bool
 _NestedClientConnectionHasError(int scrnIndex,
+                                const char *displayName,
                                 xcb_connection_t *conn)
 {
-    const char *displayName = getenv("DISPLAY");
+    if (!displayName)
+        displayName = getenv("DISPLAY");
 
     switch (xcb_connection_has_error(conn))
     {
     case XCB_CONN_ERROR:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Failed to connect to host X server at display %s.\n", displayName);
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Failed to connect to host X server at display %s.\n", displayName);
         return TRUE;
     case XCB_CONN_CLOSED_EXT_NOTSUPPORTED:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Connection to host X server closed: unsupported extension.\n");
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Connection to host X server closed: unsupported extension.\n");
         return TRUE;
     case XCB_CONN_CLOSED_MEM_INSUFFICIENT:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Connection to host X server closed: out of memory.\n");
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Connection to host X server closed: out of memory.\n");
         return TRUE;
     case XCB_CONN_CLOSED_REQ_LEN_EXCEED:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Connection to host X server closed: exceeding request length that server accepts.\n");
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Connection to host X server closed: exceeding request length that server accepts.\n");
         return TRUE;
     case XCB_CONN_CLOSED_PARSE_ERR:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Invalid display for host X server: %s\n", displayName);
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Invalid display for host X server: %s\n", displayName);
         return TRUE;
     case XCB_CONN_CLOSED_INVALID_SCREEN:
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Host X server does not have a screen matching display %s.\n", displayName);
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Host X server does not have a screen matching display %s.\n", displayName);
         return TRUE;
     default:
         return FALSE;
     }
 }
 
+/* Each screen may connect to a host server of its own, with an authority
+ * file of its own. Its cookie is passed to libxcb, which would otherwise
+ * look in $XAUTHORITY. */
+static xcb_connection_t *
+_NestedClientConnect(const char *displayName,
+                     const char *xauthority,
+                     int *screenNumber)
+{
+    xcb_connection_t *conn;
+
+    if (xauthority)
+    {
+        Xauth *entry = NestedXauthGet(xauthority, displayName);
+        /* No cookie for the display in the file, no authorization sent */
+        xcb_auth_info_t auth = { 0, NULL, 0, NULL };
+
+        if (entry)
+        {
+            auth.namelen = entry->name_length;
+            auth.name = entry->name;
+            auth.datalen = entry->data_length;
+            auth.data = entry->data;
+        }
+
+        conn = xcb_connect_to_display_with_auth_info(displayName, &auth,
+                                                     screenNumber);
+
+        if (entry)
+            XauDisposeAuth(entry);
+    }
+    else
+        conn = xcb_connect(displayName, screenNumber);
+
+    /* The extensions are all queried in one go, instead of one round trip
+     * for each the first time it is looked for */
+    if (!xcb_connection_has_error(conn))
+    {
+        xcb_prefetch_extension_data(conn, &xcb_randr_id);
+        xcb_prefetch_extension_data(conn, &xcb_shm_id);
+        xcb_prefetch_extension_data(conn, &xcb_render_id);
+        xcb_prefetch_extension_data(conn, &xcb_xv_id);
+    }
+
+    return conn;
+}
+
 static inline Bool
 _NestedClientCheckExtension(xcb_connection_t *connection,
                             xcb_extension_t *extension)
@@ -146,156 +313,306 @@ _NestedClientCheckExtension(xcb_connection_t *connection,
     return rep && rep->present;
 }
 
+static void
+_NestedClientFreePendingConnect(PendingConnect *pending)
+{
+    if (pending->conn)
+        xcb_disconnect(pending->conn);
+    pthread_mutex_destroy(&pending->mutex);
+    free(pending->displayName);
+    free(pending->xauthority);
+    free(pending);
+}
+
+static void *
+_NestedClientConnectThread(void *arg)
+{
+    PendingConnect *pending = arg;
+    xcb_connection_t *conn;
+    int screenNumber;
+    Bool abandoned;
+
+    conn = _NestedClientConnect(pending->displayName, pending->xauthority,
+                                &screenNumber);
+
+    pthread_mutex_lock(&pending->mutex);
+    pending->conn = conn;
+    pending->screenNumber = screenNumber;
+    pending->done = TRUE;
+    abandoned = pending->abandoned;
+    pthread_mutex_unlock(&pending->mutex);
+
+    if (abandoned)
+        _NestedClientFreePendingConnect(pending);
+
+    return NULL;
+}
+
+static PendingConnect *
+_NestedClientStartConnect(const char *displayName, const char *xauthority)
+{
+    PendingConnect *pending = calloc(1, sizeof(PendingConnect));
+    sigset_t allSignals, oldSignals;
+    pthread_t thread;
+    int err;
+
+    if (!pending)
+        return NULL;
+
+    pthread_mutex_init(&pending->mutex, NULL);
+    pending->displayName = displayName ? strdup(displayName) : NULL;
+    pending->xauthority = xauthority ? strdup(xauthority) : NULL;
+
+    if ((displayName && !pending->displayName) ||
+        (xauthority && !pending->xauthority))
+    {
+        _NestedClientFreePendingConnect(pending);
+        return NULL;
+    }
+
+    /* Signals (input, timers, ...) must keep going to the server thread */
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+    err = pthread_create(&thread, NULL, _NestedClientConnectThread, pending);
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    if (err)
+    {
+        _NestedClientFreePendingConnect(pending);
+        return NULL;
+    }
+
+    pthread_detach(thread);
+    return pending;
+}
+
+static Bool
+_NestedClientConnectDone(PendingConnect *pending)
+{
+    Bool done;
+
+    pthread_mutex_lock(&pending->mutex);
+    done = pending->done;
+    pthread_mutex_unlock(&pending->mutex);
+
+    return done;
+}
+
+/* Leaves the connection to its thread if it is still going */
+static void
+_NestedClientAbandonConnect(PendingConnect *pending)
+{
+    Bool done;
+
+    pthread_mutex_lock(&pending->mutex);
+    pending->abandoned = TRUE;
+    done = pending->done;
+    pthread_mutex_unlock(&pending->mutex);
+
+    if (done)
+        _NestedClientFreePendingConnect(pending);
+}
+
 static inline void
-_NestedClientFree(NestedClientPrivatePtr pPriv)
+_NestedClientFree(NestedBackendScreenPtr pPriv)
 {
-    xcb_disconnect(pPriv->conn);
+    if (pPriv->pendingConnect)
+        _NestedClientAbandonConnect(pPriv->pendingConnect);
+    if (pPriv->conn)
+        xcb_disconnect(pPriv->conn);
     free(pPriv);
 }
 
+/* What RandR knows about the host outputs. The outputs and CRTCs are all
+ * asked for at once, instead of one round trip for each of them. */
+typedef struct _HostOutputs {
+    xcb_randr_get_screen_resources_reply_t *resources;
+    xcb_randr_output_t *outputIds;
+    xcb_randr_get_output_info_reply_t **outputs; /* NULL where it failed */
+    xcb_randr_crtc_t *crtcIds;
+    xcb_randr_get_crtc_info_reply_t **crtcs;
+} HostOutputs;
+
+static void
+_NestedClientFreeHostOutputs(HostOutputs *host)
+{
+    int i;
+
+    if (host->outputs)
+        for (i = 0; i < host->resources->num_outputs; i++)
+            free(host->outputs[i]);
+
+    if (host->crtcs)
+        for (i = 0; i < host->resources->num_crtcs; i++)
+            free(host->crtcs[i]);
+
+    free(host->outputs);
+    free(host->crtcs);
+    free(host->resources);
+}
+
 static Bool
-_NestedClientCheckRandRVersion(int scrnIndex,
-                               xcb_connection_t *conn,
-                               int major, int minor)
+_NestedClientGetHostOutputs(int scrnIndex,
+                            xcb_connection_t *conn,
+                            xcb_screen_t *screen,
+                            HostOutputs *host)
 {
-    xcb_randr_query_version_cookie_t cookie;
-    xcb_randr_query_version_reply_t *reply;
+    xcb_randr_query_version_cookie_t version_c;
+    xcb_randr_query_version_reply_t *version_r;
+    xcb_randr_get_screen_resources_cookie_t resources_c;
+    xcb_randr_get_output_info_cookie_t *output_c;
+    xcb_randr_get_crtc_info_cookie_t *crtc_c;
     xcb_generic_error_t *error;
+    int numOutputs, numCrtcs, i;
+
+    memset(host, 0, sizeof(*host));
 
     if (!_NestedClientCheckExtension(conn, &xcb_randr_id))
     {
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Host X server does not support RANDR extension (or it's disabled).\n");
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Host X server does not support RANDR extension (or it's disabled).\n");
         return FALSE;
     }
 
-    /* Check RandR version */
-    cookie = xcb_randr_query_version(conn, major, minor);
-    reply = xcb_randr_query_version_reply(conn, cookie, &error);
+    /* The resources are only looked at if the version is good enough */
+    version_c = xcb_randr_query_version(conn, 1, 2);
+    resources_c = xcb_randr_get_screen_resources(conn, screen->root);
 
-    if (!reply)
+    version_r = xcb_randr_query_version_reply(conn, version_c, &error);
+    if (!version_r)
     {
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Failed to get RandR version supported by host X server. Error code = %d.\n",
-                   error->error_code);
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Failed to get RandR version supported by host X server. Error code = %d.\n",
+                        error->error_code);
         free(error);
+        xcb_discard_reply(conn, resources_c.sequence);
         return FALSE;
     }
-    else if (reply->major_version < major || reply->minor_version < minor)
+    else if (version_r->major_version < 1 ||
+             (version_r->major_version == 1 && version_r->minor_version < 2))
     {
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Host X server doesn't support RandR %d.%d, needed for Option \"Output\" usage.\n",
-                   major, minor);
-        free(reply);
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Host X server doesn't support RandR %d.%d, needed for Option \"Output\" usage.\n",
+                        1, 2);
+        free(version_r);
+        xcb_discard_reply(conn, resources_c.sequence);
         return FALSE;
     }
 
-    free(reply);
+    free(version_r);
+
+    host->resources = xcb_randr_get_screen_resources_reply(conn, resources_c,
+                                                           &error);
+    if (!host->resources)
+    {
+        NestedClientMsg(scrnIndex,
+                        X_ERROR,
+                        "Failed to get host X server screen resources. Error code = %d.\n",
+                        error->error_code);
+        free(error);
+        return FALSE;
+    }
+
+    numOutputs = host->resources->num_outputs;
+    numCrtcs = host->resources->num_crtcs;
+    host->outputIds = xcb_randr_get_screen_resources_outputs(host->resources);
+    host->crtcIds = xcb_randr_get_screen_resources_crtcs(host->resources);
+    host->outputs = calloc(numOutputs + 1, sizeof(*host->outputs));
+    host->crtcs = calloc(numCrtcs + 1, sizeof(*host->crtcs));
+    output_c = calloc(numOutputs + 1, sizeof(*output_c));
+    crtc_c = calloc(numCrtcs + 1, sizeof(*crtc_c));
+
+    if (!host->outputs || !host->crtcs || !output_c || !crtc_c)
+    {
+        free(output_c);
+        free(crtc_c);
+        _NestedClientFreeHostOutputs(host);
+        return FALSE;
+    }
+
+    for (i = 0; i < numOutputs; i++)
+        output_c[i] = xcb_randr_get_output_info(conn, host->outputIds[i],
+                                                XCB_TIME_CURRENT_TIME);
+
+    for (i = 0; i < numCrtcs; i++)
+        crtc_c[i] = xcb_randr_get_crtc_info(conn, host->crtcIds[i],
+                                            XCB_TIME_CURRENT_TIME);
+
+    for (i = 0; i < numOutputs; i++)
+    {
+        host->outputs[i] = xcb_randr_get_output_info_reply(conn, output_c[i],
+                                                           &error);
+        if (!host->outputs[i])
+        {
+            NestedClientMsg(scrnIndex,
+                            X_ERROR,
+                            "Failed to get info for output %d. Error code = %d.\n",
+                            host->outputIds[i], error->error_code);
+            free(error);
+        }
+    }
+
+    /* Errors are reported for the CRTC of the output looked for only */
+    for (i = 0; i < numCrtcs; i++)
+    {
+        host->crtcs[i] = xcb_randr_get_crtc_info_reply(conn, crtc_c[i],
+                                                       &error);
+        free(error);
+    }
+
+    free(output_c);
+    free(crtc_c);
     return TRUE;
 }
 
 static Bool
 _NestedClientOutputInit(int scrnIndex,
                         xcb_connection_t *conn,
-                        int screenNumber,
+                        xcb_screen_t *screen,
+                        HostOutputs *host,
                         Output *output,
                         Bool enable,
                         Output *relativeTo,
                         char relation)
 {
     xcb_generic_error_t *error;
-    xcb_screen_t *screen;
-    xcb_randr_get_screen_resources_cookie_t screen_resources_c;
-    xcb_randr_get_screen_resources_reply_t *screen_resources_r;
-    xcb_randr_output_t *outputs;
     xcb_randr_mode_info_t *available_modes;
     int available_modes_len, i, j;
 
-    if (!_NestedClientCheckRandRVersion(scrnIndex, conn, 1, 2))
-        return FALSE;
-
-    screen = xcb_aux_get_screen(conn, screenNumber);
-
-    /* Get list of outputs from screen resources */
-    screen_resources_c = xcb_randr_get_screen_resources(conn,
-                                                        screen->root);
-    screen_resources_r = xcb_randr_get_screen_resources_reply(conn,
-                                                              screen_resources_c,
-                                                              &error);
+    available_modes = xcb_randr_get_screen_resources_modes(host->resources);
+    available_modes_len = xcb_randr_get_screen_resources_modes_length(host->resources);
 
-    if (!screen_resources_r)
+    for (i = 0; i < host->resources->num_outputs; i++)
     {
-        xf86DrvMsg(scrnIndex,
-                   X_ERROR,
-                   "Failed to get host X server screen resources. Error code = %d.\n",
-                   error->error_code);
-        free(error);
-        return FALSE;
-    }
-
-    outputs = xcb_randr_get_screen_resources_outputs(screen_resources_r);
-    available_modes = xcb_randr_get_screen_resources_modes(screen_resources_r);
-    available_modes_len = xcb_randr_get_screen_resources_modes_length(screen_resources_r);
-
-    for (i = 0; i < screen_resources_r->num_outputs; i++)
-    {
-        char *name;
-        int name_len;
-        xcb_randr_get_output_info_cookie_t output_info_c;
-        xcb_randr_get_output_info_reply_t *output_info_r;
-
-        /* Get info on the output */
-        output_info_c = xcb_randr_get_output_info(conn,
-                                                  outputs[i],
-                                                  XCB_TIME_CURRENT_TIME);
-        output_info_r = xcb_randr_get_output_info_reply(conn,
-                                                        output_info_c,
-                                                        &error);
+        xcb_randr_get_output_info_reply_t *output_info_r = host->outputs[i];
 
         if (!output_info_r)
-        {
-            xf86DrvMsg(scrnIndex,
-                       X_ERROR,
-                       "Failed to get info for output %d. Error code = %d.\n",
-                       outputs[i], error->error_code);
-            free(error);
             continue;
-        }
 
-        /* Get output name */
-        name_len = xcb_randr_get_output_info_name_length(output_info_r);
-        name = malloc(name_len + 1);
-        strncpy(name, (char *)xcb_randr_get_output_info_name(output_info_r), name_len);
-        name[name_len] = '\0';
-
-        if (!strcmp(name, output->name))
+        if ((size_t)xcb_randr_get_output_info_name_length(output_info_r) ==
+            strlen(output->name) &&
+            !strncmp((char *)xcb_randr_get_output_info_name(output_info_r),
+                     output->name, strlen(output->name)))
         {
             /* Output found! */
             if (output_info_r->crtc != XCB_NONE)
             {
                 /* Output is enabled! Get its CRTC geometry */
-                xcb_randr_get_crtc_info_cookie_t crtc_info_c;
-                xcb_randr_get_crtc_info_reply_t *crtc_info_r;
+                xcb_randr_get_crtc_info_reply_t *crtc_info_r = NULL;
 
-                crtc_info_c = xcb_randr_get_crtc_info(conn,
-                                                      output_info_r->crtc,
-                                                      XCB_TIME_CURRENT_TIME);
-                crtc_info_r = xcb_randr_get_crtc_info_reply(conn,
-                                                            crtc_info_c,
-                                                            &error);
+                for (j = 0; j < host->resources->num_crtcs; j++)
+                    if (host->crtcIds[j] == output_info_r->crtc)
+                        crtc_info_r = host->crtcs[j];
 
                 if (!crtc_info_r)
                 {
-                    xf86DrvMsg(scrnIndex,
-                               X_ERROR,
-                               "Failed to get CRTC info for output %s. Error code = %d.\n",
-                               name, error->error_code);
-                    free(error);
-                    free(output_info_r);
-                    free(screen_resources_r);
+                    NestedClientMsg(scrnIndex,
+                                    X_ERROR,
+                                    "Failed to get CRTC info for output %s.\n",
+                                    output->name);
                     return FALSE;
                 }
                 else
@@ -304,7 +621,6 @@ _NestedClientOutputInit(int scrnIndex,
                     output->height = crtc_info_r->height;
                     output->x = crtc_info_r->x;
                     output->y = crtc_info_r->y;
-                    free(crtc_info_r);
                 }
             }
             else if (enable)
@@ -342,10 +658,10 @@ _NestedClientOutputInit(int scrnIndex,
                         new_screen_height = MAX(relativeTo->height, output->height);
                         break;
 #else
-                        xf86DrvMsg(scrnIndex,
-                                   X_WARNING,
-                                   "Option \"LeftOf\" for output %s is not currently supported. Falling back to \"RightOf\".\n",
-                                   output->name);
+                        NestedClientMsg(scrnIndex,
+                                        X_WARNING,
+                                        "Option \"LeftOf\" for output %s is not currently supported. Falling back to \"RightOf\".\n",
+                                        output->name);
 #endif
                     case 'R':
                         output->x = relativeTo->x + relativeTo->width;
@@ -361,10 +677,10 @@ _NestedClientOutputInit(int scrnIndex,
                         new_screen_height = relativeTo->height + output->height;
                         break;
 #else
-                        xf86DrvMsg(scrnIndex,
-                                   X_WARNING,
-                                   "Option \"Above\" for output %s is not currently supported. Falling back to \"Below\".\n",
-                                   output->name);
+                        NestedClientMsg(scrnIndex,
+                                        X_WARNING,
+                                        "Option \"Above\" for output %s is not currently supported. Falling back to \"Below\".\n",
+                                        output->name);
 #endif
                     case 'B':
                         output->x = relativeTo->x;
@@ -378,14 +694,14 @@ _NestedClientOutputInit(int scrnIndex,
                     new_screen_height_mm = (new_screen_height / screen->height_in_pixels) * screen->height_in_millimeters;
                 }
 
-                xf86DrvMsg(scrnIndex,
-                           X_INFO,
-                           "New screen size to allocate output %s: %dx%d px, %dx%d mm.\n",
-                           output->name,
-                           new_screen_width,
-                           new_screen_height,
-                           new_screen_width_mm,
-                           new_screen_height_mm);
+                NestedClientMsg(scrnIndex,
+                                X_INFO,
+                                "New screen size to allocate output %s: %dx%d px, %dx%d mm.\n",
+                                output->name,
+                                new_screen_width,
+                                new_screen_height,
+                                new_screen_width_mm,
+                                new_screen_height_mm);
 
                 xcb_randr_set_screen_size(conn,
                                           screen->root,
@@ -403,19 +719,16 @@ _NestedClientOutputInit(int scrnIndex,
                                                           modes[0],
                                                           XCB_RANDR_ROTATION_ROTATE_0,
                                                           1,
-                                                          &outputs[i]);
+                                                          &host->outputIds[i]);
                 crtc_config_r = xcb_randr_set_crtc_config_reply(conn, crtc_config_c, &error);
 
                 if (!crtc_config_r)
                 {
-                    xf86DrvMsg(scrnIndex,
-                               X_ERROR,
-                               "Failed to enable output %s. Error code = %d.\n",
-                               output->name, error->error_code);
+                    NestedClientMsg(scrnIndex,
+                                    X_ERROR,
+                                    "Failed to enable output %s. Error code = %d.\n",
+                                    output->name, error->error_code);
                     free(error);
-                    free(name);
-                    free(output_info_r);
-                    free(screen_resources_r);
                     return FALSE;
                 }
 
@@ -423,58 +736,91 @@ _NestedClientOutputInit(int scrnIndex,
             }
             else
             {
-                xf86DrvMsg(scrnIndex,
-                           X_ERROR,
-                           "Output %s is currently disabled or disconnected.\n",
-                           output->name);
-                free(error);
-                free(name);
-                free(output_info_r);
-                free(screen_resources_r);
+                NestedClientMsg(scrnIndex,
+                                X_ERROR,
+                                "Output %s is currently disabled or disconnected.\n",
+                                output->name);
                 return FALSE;
             }
 
-            free(name);
-            free(output_info_r);
-            free(screen_resources_r);
             return TRUE;
         }
-
-        free(output_info_r);
     }
 
-    free(screen_resources_r);
     return FALSE;
 }
 
-Bool
-NestedClientCheckDisplay(int scrnIndex,
-                         const char *output,
-                         Bool enable,
-                         const char *parentOutput,
-                         char relation,
-                         unsigned int *width,
-                         unsigned int *height,
-                         int *x,
-                         int *y)
+/* The connection opened to probe or check a display is kept for
+ * NestedXcbCheckDisplay() and NestedXcbCreateScreen() of the same screen,
+ * rather than connecting again */
+static struct {
+    xcb_connection_t *conn;
+    int screenNumber;
+} checkedDisplays[MAXSCREENS];
+
+static void
+_NestedClientKeepChecked(int scrnIndex, xcb_connection_t *conn, int n)
+{
+    if (checkedDisplays[scrnIndex].conn)
+        xcb_disconnect(checkedDisplays[scrnIndex].conn);
+
+    checkedDisplays[scrnIndex].conn = conn;
+    checkedDisplays[scrnIndex].screenNumber = n;
+}
+
+static Bool
+NestedXcbCheckDisplay(int scrnIndex,
+                      const char *displayName,
+                      const char *xauthority,
+                      const char *output,
+                      Bool enable,
+                      const char *parentOutput,
+                      char relation,
+                      unsigned int *width,
+                      unsigned int *height,
+                      int *x,
+                      int *y)
 {
     int n;
     xcb_connection_t *conn;
+    xcb_screen_t *screen;
     Output thisOutput;
 
-    conn = xcb_connect(NULL, &n);
+    if (checkedDisplays[scrnIndex].conn)
+    {
+        /* Left by NestedXcbProbe() */
+        conn = checkedDisplays[scrnIndex].conn;
+        n = checkedDisplays[scrnIndex].screenNumber;
+        checkedDisplays[scrnIndex].conn = NULL;
+    }
+    else
+        conn = _NestedClientConnect(displayName, xauthority, &n);
 
-    if (_NestedClientConnectionHasError(scrnIndex, conn))
+    if (_NestedClientConnectionHasError(scrnIndex, displayName, conn))
+    {
+        xcb_disconnect(conn);
         return FALSE;
+    }
+
+    screen = xcb_aux_get_screen(conn, n);
 
     if (output != NULL)
     {
+        HostOutputs host;
+        Bool found;
+
         thisOutput.name = output;
         thisOutput.width = 0;
         thisOutput.height = 0;
         thisOutput.x = 0;
         thisOutput.y = 0;
 
+        if (!_NestedClientGetHostOutputs(scrnIndex, conn, screen, &host))
+        {
+            xcb_disconnect(conn);
+            return FALSE;
+        }
+
         if (parentOutput != NULL)
         {
             Output relativeTo;
@@ -485,26 +831,28 @@ NestedClientCheckDisplay(int scrnIndex,
             relativeTo.x = 0;
             relativeTo.y = 0;
 
-            if (!_NestedClientOutputInit(scrnIndex, conn, n, &relativeTo, FALSE, NULL, '\0'))
-                return FALSE;
-
-            if (!_NestedClientOutputInit(scrnIndex, conn, n, &thisOutput, enable, &relativeTo, relation))
-                return FALSE;
+            found = _NestedClientOutputInit(scrnIndex, conn, screen, &host, &relativeTo, FALSE, NULL, '\0') &&
+                    _NestedClientOutputInit(scrnIndex, conn, screen, &host, &thisOutput, enable, &relativeTo, relation);
         }
         else
+            found = _NestedClientOutputInit(scrnIndex, conn, screen, &host, &thisOutput, enable, NULL, '\0');
+
+        _NestedClientFreeHostOutputs(&host);
+
+        if (!found)
         {
-            if (!_NestedClientOutputInit(scrnIndex, conn, n, &thisOutput, enable, NULL, '\0'))
-                return FALSE;
+            xcb_disconnect(conn);
+            return FALSE;
         }
 
-        xf86DrvMsg(scrnIndex,
-                   X_INFO,
-                   "Got CRTC geometry from output %s: %dx%d+%d+%d\n",
-                   thisOutput.name,
-                   thisOutput.width,
-                   thisOutput.height,
-                   thisOutput.x,
-                   thisOutput.y);
+        NestedClientMsg(scrnIndex,
+                        X_INFO,
+                        "Got CRTC geometry from output %s: %dx%d+%d+%d\n",
+                        thisOutput.name,
+                        thisOutput.width,
+                        thisOutput.height,
+                        thisOutput.x,
+                        thisOutput.y);
 
         if (width != NULL)
             *width = thisOutput.width;
@@ -520,205 +868,411 @@ NestedClientCheckDisplay(int scrnIndex,
     }
     else
     {
-        xcb_screen_t *s = xcb_aux_get_screen(conn, n);
-
         if (width != NULL)
-            *width = s->width_in_pixels;
+            *width = screen->width_in_pixels;
 
         if (height != NULL)
-            *height = s->height_in_pixels;
+            *height = screen->height_in_pixels;
     }
 
-    xcb_disconnect(conn);
+    _NestedClientKeepChecked(scrnIndex, conn, n);
     return TRUE;
 }
 
-Bool
-NestedClientValidDepth(int depth)
+static Bool
+NestedXcbValidDepth(int depth)
 {
     /* XXX: implement! */
     return TRUE;
 }
 
-static void
-_NestedClientTryXShm(NestedClientPrivatePtr pPriv)
+/* File descriptors only pass over a local socket */
+static Bool
+_NestedClientIsLocal(xcb_connection_t *conn)
 {
-    int shmMajor = 0, shmMinor = 0;
-    Bool hasSharedPixmaps = FALSE;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
 
-    /* Try to get share memory ximages for a little bit more speed */
-    if (!_NestedClientCheckExtension(pPriv->conn, &xcb_shm_id))
-        pPriv->usingShm = FALSE;
-    else
+    return getsockname(xcb_get_file_descriptor(conn),
+                       (struct sockaddr *)&addr, &len) == 0 &&
+           addr.ss_family == AF_UNIX;
+}
+
+static int
+_NestedClientCreateShmFile(size_t size)
+{
+    int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create("nested-xcb", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/nested-xcb-XXXXXX";
+
+    fd = mkstemp(path);
+    if (fd >= 0)
     {
-        xcb_generic_error_t *e;
-        xcb_shm_query_version_cookie_t c;
-        xcb_shm_query_version_reply_t *r;
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
 
-        c = xcb_shm_query_version(pPriv->conn);
-        r = xcb_shm_query_version_reply(pPriv->conn, c, &e);
+    if (fd < 0)
+        return -1;
 
-        if (e)
-        {
-            pPriv->usingShm = FALSE;
-            free(e);
-        }
-        else
-        {
-            shmMajor = r->major_version;
-            shmMinor = r->minor_version;
-            hasSharedPixmaps = r->shared_pixmaps;
-            free(r);
+    if (ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        return -1;
+    }
 
-            /* Really really check we have shm - better way ?*/
-            xcb_shm_segment_info_t shminfo;
-            xcb_void_cookie_t cookie;
-            xcb_shm_seg_t shmseg;
+    return fd;
+}
 
-            pPriv->usingShm = TRUE;
+/* Benchmarks compare the upload methods on a single host by capping them
+ * with NESTED_XCB_MAX_UPLOAD set to "put-image", "shm" or "shm-fd" */
+static NestedUploadMethod
+_NestedClientMaxUpload(void)
+{
+    const char *max = getenv("NESTED_XCB_MAX_UPLOAD");
 
-            shminfo.shmid = shmget(IPC_PRIVATE, 1, IPC_CREAT | 0777);
-            shminfo.shmaddr = shmat(shminfo.shmid, 0, 0);
+    if (max && !strcmp(max, "put-image"))
+        return NESTED_UPLOAD_PUT_IMAGE;
+    else if (max && !strcmp(max, "shm"))
+        return NESTED_UPLOAD_SHM;
+    else
+        return NESTED_UPLOAD_SHM_FD;
+}
 
-            shmseg = xcb_generate_id(pPriv->conn);
-            cookie = xcb_shm_attach_checked(pPriv->conn,
-                                            shmseg,
-                                            shminfo.shmid,
-                                            TRUE);
-            e = xcb_request_check(pPriv->conn, cookie);
+/* The extension may be there for a host that can't see our memory, so a
+ * segment of each kind is attached on trial. Both come back with the
+ * version in a single round trip. */
+static NestedUploadMethod
+_NestedClientShmLevel(xcb_connection_t *conn,
+                      int *shmMajor,
+                      int *shmMinor,
+                      Bool *hasSharedPixmaps)
+{
+    NestedUploadMethod level = NESTED_UPLOAD_PUT_IMAGE;
+    xcb_generic_error_t *e;
+    xcb_shm_query_version_cookie_t c;
+    xcb_shm_query_version_reply_t *r;
+    xcb_shm_segment_info_t shminfo;
+    xcb_shm_seg_t fdSeg = 0;
+    xcb_void_cookie_t cookie, fdCookie = { 0 };
+    int fd = -1;
 
-            if (e)
-            {
-                pPriv->usingShm = FALSE;
-                free(e);
-            }
+    if (!_NestedClientCheckExtension(conn, &xcb_shm_id))
+        return level;
 
-            shmdt(shminfo.shmaddr);
-            shmctl(shminfo.shmid, IPC_RMID, 0);
-        }
-    }
+    shminfo.shmid = shmget(IPC_PRIVATE, 1, IPC_CREAT | 0777);
+    shminfo.shmaddr = shmat(shminfo.shmid, 0, 0);
+    shminfo.shmseg = xcb_generate_id(conn);
 
-    if (!pPriv->usingShm)
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_INFO,
-                   "XShm extension query failed. Dropping XShm support.\n");
+    c = xcb_shm_query_version(conn);
+    cookie = xcb_shm_attach_checked(conn,
+                                    shminfo.shmseg,
+                                    shminfo.shmid,
+                                    TRUE);
 
-    xf86DrvMsg(pPriv->scrnIndex,
-               X_INFO,
-               "XShm extension version %d.%d %s shared pixmaps\n",
-               shmMajor, shmMinor, hasSharedPixmaps ? "with" : "without");
-}
+    /* A host without MIT-SHM 1.2 fails the request, which is all we need
+     * to know. libxcb closes the descriptor once it is sent. */
+    if (_NestedClientIsLocal(conn))
+        fd = _NestedClientCreateShmFile(1);
 
-static void
-_NestedClientCreateXImage(NestedClientPrivatePtr pPriv, int depth)
-{
-    if (pPriv->img != NULL)
+    if (fd >= 0)
     {
-        /* Free up the image data if previously used
-         * i.e. called by server reset */
-        if (pPriv->usingShm)
-        {
-            xcb_shm_detach(pPriv->conn, pPriv->shminfo.shmseg);
-            xcb_image_destroy(pPriv->img);
-            shmdt(pPriv->shminfo.shmaddr);
-            shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
-        }
-        else
-        {
-            free(pPriv->img->data);
-            pPriv->img->data = NULL;
-            xcb_image_destroy(pPriv->img);
-        }
+        fdSeg = xcb_generate_id(conn);
+        fdCookie = xcb_shm_attach_fd_checked(conn, fdSeg, fd, TRUE);
     }
 
-    if (pPriv->usingShm)
+    r = xcb_shm_query_version_reply(conn, c, &e);
+    if (r)
     {
-        pPriv->img = xcb_image_create_native(pPriv->conn,
-                                             pPriv->width,
-                                             pPriv->height,
-                                             XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                             depth,
-                                             NULL,
-                                             ~0,
-                                             NULL);
+        *shmMajor = r->major_version;
+        *shmMinor = r->minor_version;
+        *hasSharedPixmaps = r->shared_pixmaps;
+    }
+    else
+        free(e);
 
-        /* XXX: change the 0777 mask? */
-        pPriv->shminfo.shmid = shmget(IPC_PRIVATE,
-                                      pPriv->img->stride * pPriv->height,
-                                      IPC_CREAT | 0777);
-        pPriv->img->data = shmat(pPriv->shminfo.shmid, 0, 0);
-        pPriv->shminfo.shmaddr = pPriv->img->data;
+    e = xcb_request_check(conn, cookie);
+    if (e)
+        free(e);
+    else
+    {
+        if (r)
+            level = NESTED_UPLOAD_SHM;
+        xcb_shm_detach(conn, shminfo.shmseg);
+    }
 
-        if (pPriv->img->data == (uint8_t *) -1)
-        {
-            xf86DrvMsg(pPriv->scrnIndex,
-                       X_INFO,
-                       "Can't attach SHM Segment, falling back to plain XImages.\n");
-            pPriv->usingShm = FALSE;
-            xcb_image_destroy(pPriv->img);
-            shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
-        }
+    if (fd >= 0)
+    {
+        e = xcb_request_check(conn, fdCookie);
+        if (e)
+            free(e);
         else
         {
-            xf86DrvMsg(pPriv->scrnIndex,
-                       X_INFO,
-                       "SHM segment attached %p\n",
-                       pPriv->shminfo.shmaddr);
-            pPriv->shminfo.shmseg = xcb_generate_id(pPriv->conn);
-            xcb_shm_attach(pPriv->conn,
-                           pPriv->shminfo.shmseg,
-                           pPriv->shminfo.shmid,
-                           FALSE);
+            if (r)
+                level = NESTED_UPLOAD_SHM_FD;
+            xcb_shm_detach(conn, fdSeg);
         }
     }
 
-    if (!pPriv->usingShm)
-    {
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_INFO,
-                   "Creating image %dx%d for screen pPriv=%p\n",
-                   pPriv->width, pPriv->height, pPriv);
-        pPriv->img = xcb_image_create_native(pPriv->conn,
-                                             pPriv->width,
-                                             pPriv->height,
-                                             XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                             depth,
-                                             NULL,
-                                             ~0,
-                                             NULL);
+    free(r);
+    shmdt(shminfo.shmaddr);
+    shmctl(shminfo.shmid, IPC_RMID, 0);
 
-        pPriv->img->data =
-            malloc(pPriv->img->stride * pPriv->height);
-    }
+    return min(level, _NestedClientMaxUpload());
 }
 
 static void
-_NestedClientSetWindowTitle(NestedClientPrivatePtr pPriv,
-                            const char *extra_text)
+_NestedClientTryXShm(NestedBackendScreenPtr pPriv)
 {
-    char buf[BUF_LEN + 1];
+    int shmMajor = 0, shmMinor = 0;
+    Bool hasSharedPixmaps = FALSE;
+    NestedUploadMethod level;
 
-    if (!pPriv)
-        return;
+    /* Try to get share memory ximages for a little bit more speed */
+    level = _NestedClientShmLevel(pPriv->conn,
+                                  &shmMajor,
+                                  &shmMinor,
+                                  &hasSharedPixmaps);
+    pPriv->usingShm = level >= NESTED_UPLOAD_SHM;
+    pPriv->usingShmFd = level == NESTED_UPLOAD_SHM_FD;
 
-    memset(buf, 0, BUF_LEN + 1);
-    snprintf(buf, BUF_LEN, "Xorg at :%s.%d nested on %s%s%s",
-             display,
-             pPriv->scrnIndex,
-             getenv("DISPLAY"),
-             extra_text ? " " : "",
-             extra_text ? extra_text : "");
-    xcb_icccm_set_wm_name(pPriv->conn,
-                          pPriv->window,
-                          XCB_ATOM_STRING,
-                          8,
-                          strlen(buf),
-                          buf);
+    if (!pPriv->usingShm)
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_INFO,
+                        "XShm extension query failed. Dropping XShm support.\n");
+
+    NestedClientMsg(pPriv->scrnIndex,
+                    X_INFO,
+                    "XShm extension version %d.%d %s shared pixmaps%s\n",
+                    shmMajor, shmMinor, hasSharedPixmaps ? "with" : "without",
+                    pPriv->usingShmFd ? ", segments passed as files" : "");
 }
 
-static void
-_NestedClientSetWMClass(NestedClientPrivatePtr pPriv,
-                        const char* wm_class)
+static NestedUploadMethod
+NestedXcbProbe(int scrnIndex,
+               const char *displayName,
+               const char *xauthority)
+{
+    NestedUploadMethod level = NESTED_UPLOAD_NONE;
+    int shmMajor, shmMinor, screenNumber;
+    Bool hasSharedPixmaps;
+    xcb_connection_t *conn;
+
+    conn = _NestedClientConnect(displayName, xauthority, &screenNumber);
+    if (xcb_connection_has_error(conn))
+    {
+        xcb_disconnect(conn);
+        return level;
+    }
+
+    level = _NestedClientShmLevel(conn,
+                                  &shmMajor,
+                                  &shmMinor,
+                                  &hasSharedPixmaps);
+
+    /* For NestedXcbCheckDisplay(), if this backend is picked */
+    _NestedClientKeepChecked(scrnIndex, conn, screenNumber);
+    return level;
+}
+
+static void
+NestedXcbDropProbe(int scrnIndex)
+{
+    _NestedClientKeepChecked(scrnIndex, NULL, 0);
+}
+
+/* Releases the memory of a segment, which the host may still have attached */
+static void
+_NestedClientFreeShm(NestedBackendScreenPtr pPriv)
+{
+    if (pPriv->usingShmFd)
+    {
+        munmap(pPriv->shminfo.shmaddr, pPriv->bufferSize);
+        close(pPriv->shmFd);
+    }
+    else
+    {
+        shmdt(pPriv->shminfo.shmaddr);
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
+    }
+}
+
+static void
+_NestedClientDestroyXImage(NestedBackendScreenPtr pPriv)
+{
+    if (pPriv->img == NULL)
+        return;
+
+    if (pPriv->usingShm)
+    {
+        if (!pPriv->detached)
+            xcb_shm_detach(pPriv->conn, pPriv->shminfo.shmseg);
+        xcb_image_destroy(pPriv->img);
+        _NestedClientFreeShm(pPriv);
+    }
+    else
+    {
+        free(pPriv->img->data);
+        pPriv->img->data = NULL;
+        xcb_image_destroy(pPriv->img);
+    }
+
+    pPriv->img = NULL;
+    pPriv->bufferSize = 0;
+}
+
+static Bool
+_NestedClientCreateXImage(NestedBackendScreenPtr pPriv,
+                          unsigned int width,
+                          unsigned int height)
+{
+    xcb_image_t *img;
+    size_t size;
+
+    img = xcb_image_create_native(pPriv->conn,
+                                  width,
+                                  height,
+                                  XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                  pPriv->depth,
+                                  NULL,
+                                  ~0,
+                                  NULL);
+
+    if (!img)
+        return FALSE;
+
+    size = img->stride * height;
+
+    if (pPriv->img != NULL && size <= pPriv->bufferSize)
+    {
+        /* The old buffer is big enough (i.e. we are shrinking), so just
+         * describe it with the new geometry. xcb_image_destroy() doesn't
+         * free data it didn't allocate. */
+        img->data = pPriv->img->data;
+        xcb_image_destroy(pPriv->img);
+        pPriv->img = img;
+        return TRUE;
+    }
+
+    /* Free up the image data if previously used
+     * i.e. called by server reset or by a resize */
+    _NestedClientDestroyXImage(pPriv);
+    pPriv->img = img;
+
+    if (pPriv->usingShmFd)
+    {
+        /* The host maps our file, there is no SysV segment to leak or to
+         * give others access to */
+        pPriv->shmFd = _NestedClientCreateShmFile(size);
+        pPriv->img->data = pPriv->shmFd < 0 ? MAP_FAILED :
+                           mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, pPriv->shmFd, 0);
+        pPriv->shminfo.shmaddr = pPriv->img->data;
+
+        if (pPriv->img->data == MAP_FAILED)
+        {
+            NestedClientMsg(pPriv->scrnIndex,
+                            X_INFO,
+                            "Can't map SHM file, falling back to plain XImages.\n");
+            if (pPriv->shmFd >= 0)
+                close(pPriv->shmFd);
+            pPriv->usingShm = FALSE;
+            pPriv->usingShmFd = FALSE;
+            pPriv->img->data = NULL;
+        }
+        else
+        {
+            pPriv->shminfo.shmseg = xcb_generate_id(pPriv->conn);
+            xcb_shm_attach_fd(pPriv->conn,
+                              pPriv->shminfo.shmseg,
+                              dup(pPriv->shmFd),
+                              FALSE);
+        }
+    }
+    else if (pPriv->usingShm)
+    {
+        /* XXX: change the 0777 mask? */
+        pPriv->shminfo.shmid = shmget(IPC_PRIVATE,
+                                      size,
+                                      IPC_CREAT | 0777);
+        pPriv->img->data = shmat(pPriv->shminfo.shmid, 0, 0);
+        pPriv->shminfo.shmaddr = pPriv->img->data;
+
+        if (pPriv->img->data == (uint8_t *) -1)
+        {
+            NestedClientMsg(pPriv->scrnIndex,
+                            X_INFO,
+                            "Can't attach SHM Segment, falling back to plain XImages.\n");
+            pPriv->usingShm = FALSE;
+            pPriv->img->data = NULL;
+            shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
+        }
+        else
+        {
+            NestedClientMsg(pPriv->scrnIndex,
+                            X_INFO,
+                            "SHM segment attached %p\n",
+                            pPriv->shminfo.shmaddr);
+            pPriv->shminfo.shmseg = xcb_generate_id(pPriv->conn);
+            xcb_shm_attach(pPriv->conn,
+                           pPriv->shminfo.shmseg,
+                           pPriv->shminfo.shmid,
+                           FALSE);
+        }
+    }
+
+    if (!pPriv->usingShm)
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_INFO,
+                        "Creating image %dx%d for screen pPriv=%p\n",
+                        width, height, pPriv);
+
+        pPriv->img->data = malloc(size);
+
+        if (!pPriv->img->data)
+        {
+            xcb_image_destroy(pPriv->img);
+            pPriv->img = NULL;
+            return FALSE;
+        }
+    }
+
+    pPriv->bufferSize = size;
+    return TRUE;
+}
+
+static void
+_NestedClientSetWindowTitle(NestedBackendScreenPtr pPriv,
+                            const char *extra_text)
+{
+    char buf[BUF_LEN + 1];
+
+    if (!pPriv)
+        return;
+
+    memset(buf, 0, BUF_LEN + 1);
+    snprintf(buf, BUF_LEN, "Xorg at :%s.%d nested on %s%s%s",
+             display,
+             pPriv->scrnIndex,
+             pPriv->displayName ? pPriv->displayName : getenv("DISPLAY"),
+             extra_text ? " " : "",
+             extra_text ? extra_text : "");
+    xcb_icccm_set_wm_name(pPriv->conn,
+                          pPriv->window,
+                          XCB_ATOM_STRING,
+                          8,
+                          strlen(buf),
+                          buf);
+}
+
+static void
+_NestedClientSetWMClass(NestedBackendScreenPtr pPriv,
+                        const char* wm_class)
 {
     size_t class_len = strlen(wm_class) + 1;
     char *class_hint = malloc(class_len);
@@ -739,7 +1293,7 @@ _NestedClientSetWMClass(NestedClientPrivatePtr pPriv,
 }
 
 static void
-_NestedClientEmptyCursorInit(NestedClientPrivatePtr pPriv)
+_NestedClientEmptyCursorInit(NestedBackendScreenPtr pPriv)
 {
     uint32_t pixel = 0;
     xcb_pixmap_t cursor_pxm;
@@ -766,16 +1320,38 @@ _NestedClientEmptyCursorInit(NestedClientPrivatePtr pPriv)
     xcb_free_pixmap(pPriv->conn, cursor_pxm);
 }
 
+static xcb_atom_t
+_NestedClientAtomReply(NestedBackendScreenPtr pPriv,
+                       xcb_intern_atom_cookie_t cookie)
+{
+    xcb_intern_atom_reply_t *reply;
+    xcb_atom_t atom = XCB_ATOM_NONE;
+
+    reply = xcb_intern_atom_reply(pPriv->conn, cookie, NULL);
+    if (reply)
+        atom = reply->atom;
+
+    free(reply);
+    return atom;
+}
+
+/* All requests needing a reply are sent before waiting for any of them */
 static Bool
-_NestedClientHostXInit(NestedClientPrivatePtr pPriv)
+_NestedClientHostXInit(NestedBackendScreenPtr pPriv, const char *xauthority)
 {
-    uint16_t red, green, blue;
-    uint32_t pixel;
+    xcb_intern_atom_cookie_t cookie_WINDOW_STATE,
+                             cookie_WINDOW_STATE_FULLSCREEN,
+                             cookie_WM_PROTOCOLS,
+                             cookie_WM_DELETE_WINDOW;
+    xcb_alloc_color_cookie_t color_c;
+    xcb_alloc_color_reply_t *color_r;
+    uint32_t pixel = 0;
     xcb_screen_t *screen;
 
-    pPriv->attrs[0] = XCB_EVENT_MASK_EXPOSURE;
+    pPriv->attrs[0] = XCB_EVENT_MASK_EXPOSURE |
+                      XCB_EVENT_MASK_STRUCTURE_NOTIFY;
     
-    if (enableNestedInput)
+    if (enableNestedInput && pPriv->withInput)
         pPriv->attrs[0] |= XCB_EVENT_MASK_BUTTON_PRESS   |
                            XCB_EVENT_MASK_BUTTON_RELEASE |
                            XCB_EVENT_MASK_POINTER_MOTION |
@@ -784,294 +1360,2278 @@ _NestedClientHostXInit(NestedClientPrivatePtr pPriv)
 
     pPriv->attr_mask = XCB_CW_EVENT_MASK;
 
-    pPriv->conn = xcb_connect(NULL, &pPriv->screenNumber);
+    if (pPriv->conn)
+        ; /* made by the thread of NestedXcbReattach() */
+    else if (checkedDisplays[pPriv->scrnIndex].conn)
+    {
+        pPriv->conn = checkedDisplays[pPriv->scrnIndex].conn;
+        pPriv->screenNumber = checkedDisplays[pPriv->scrnIndex].screenNumber;
+        checkedDisplays[pPriv->scrnIndex].conn = NULL;
+    }
+    else
+        pPriv->conn = _NestedClientConnect(pPriv->displayName, xauthority,
+                                           &pPriv->screenNumber);
+
+    if (_NestedClientConnectionHasError(pPriv->scrnIndex, pPriv->displayName,
+                                        pPriv->conn))
+        return FALSE;
+
+    screen = xcb_aux_get_screen(pPriv->conn, pPriv->screenNumber);
+    pPriv->rootWindow = screen->root;
+    pPriv->blackPixel = screen->black_pixel;
+    pPriv->gc = xcb_generate_id(pPriv->conn);
+    pPriv->visual = xcb_aux_find_visual_by_id(screen,
+                                              screen->root_visual);
+
+    xcb_create_gc(pPriv->conn, pPriv->gc, pPriv->rootWindow, 0, NULL);
+
+    cookie_WINDOW_STATE = xcb_intern_atom(pPriv->conn, FALSE,
+                                          strlen("_NET_WM_STATE"),
+                                          "_NET_WM_STATE");
+    cookie_WINDOW_STATE_FULLSCREEN =
+        xcb_intern_atom(pPriv->conn, FALSE,
+                        strlen("_NET_WM_STATE_FULLSCREEN"),
+                        "_NET_WM_STATE_FULLSCREEN");
+    cookie_WM_PROTOCOLS = xcb_intern_atom(pPriv->conn, FALSE,
+                                          strlen("WM_PROTOCOLS"),
+                                          "WM_PROTOCOLS");
+    cookie_WM_DELETE_WINDOW =
+        xcb_intern_atom(pPriv->conn, FALSE,
+                        strlen("WM_DELETE_WINDOW"),
+                        "WM_DELETE_WINDOW");
+
+    /* The exact values of the "red" color name, no need to look it up */
+    color_c = xcb_alloc_color(pPriv->conn, screen->default_colormap,
+                              0xffff, 0, 0);
+
+    pPriv->netWmStateAtom = _NestedClientAtomReply(pPriv, cookie_WINDOW_STATE);
+    pPriv->netWmStateFullscreenAtom =
+        _NestedClientAtomReply(pPriv, cookie_WINDOW_STATE_FULLSCREEN);
+    pPriv->wmProtocolsAtom = _NestedClientAtomReply(pPriv, cookie_WM_PROTOCOLS);
+    pPriv->wmDeleteWindowAtom =
+        _NestedClientAtomReply(pPriv, cookie_WM_DELETE_WINDOW);
+
+    color_r = xcb_alloc_color_reply(pPriv->conn, color_c, NULL);
+    if (color_r)
+        pixel = color_r->pixel;
+    free(color_r);
+
+    xcb_change_gc(pPriv->conn, pPriv->gc, XCB_GC_FOREGROUND, &pixel);
+
+    _NestedClientEmptyCursorInit(pPriv);
+
+    return TRUE;
+}
+
+static void
+_NestedClientSetFullscreenHint(NestedBackendScreenPtr pPriv)
+{
+    xcb_change_property(pPriv->conn,
+                        XCB_PROP_MODE_REPLACE,
+                        pPriv->window,
+                        pPriv->netWmStateAtom,
+                        XCB_ATOM_ATOM,
+                        32,
+                        1,
+                        &pPriv->netWmStateFullscreenAtom);
+}
+
+static void
+_NestedClientSetDeleteWindowHint(NestedBackendScreenPtr pPriv)
+{
+    xcb_change_property(pPriv->conn,
+                        XCB_PROP_MODE_REPLACE,
+                        pPriv->window,
+                        pPriv->wmProtocolsAtom,
+                        XCB_ATOM_ATOM,
+                        32,
+                        1,
+                        &pPriv->wmDeleteWindowAtom);
+}
+
+/* Size of the window for the current viewport size */
+static void
+_NestedClientScaleWindowSize(NestedBackendScreenPtr pPriv)
+{
+    if (!pPriv->usingRender)
+    {
+        pPriv->windowWidth = pPriv->width;
+        pPriv->windowHeight = pPriv->height;
+    }
+    else if (pPriv->scale > 0)
+    {
+        pPriv->windowWidth = MAX(1, (unsigned int)(pPriv->width *
+                                                   pPriv->scale + 0.5));
+        pPriv->windowHeight = MAX(1, (unsigned int)(pPriv->height *
+                                                    pPriv->scale + 0.5));
+    }
+}
+
+static Bool
+_NestedClientIsMaskFormat(xcb_render_pictforminfo_t *info,
+                          int depth, int alphaShift)
+{
+    return info->type == XCB_RENDER_PICT_TYPE_DIRECT &&
+           info->depth == depth &&
+           info->direct.alpha_mask == 0xff &&
+           info->direct.alpha_shift == alphaShift &&
+           (depth == 8 ||
+            (info->direct.red_mask == 0xff &&
+             info->direct.red_shift == 16 &&
+             info->direct.green_mask == 0xff &&
+             info->direct.green_shift == 8 &&
+             info->direct.blue_mask == 0xff &&
+             info->direct.blue_shift == 0));
+}
+
+/* Finds the picture format of the host visual and the a8 and argb32 mask
+ * formats. "what" tells what is disabled if RENDER isn't usable. */
+static Bool
+_NestedClientRenderInit(NestedBackendScreenPtr pPriv, const char *what)
+{
+    xcb_render_query_version_cookie_t vc;
+    xcb_render_query_version_reply_t *vr;
+    xcb_render_query_pict_formats_cookie_t fc;
+    xcb_render_query_pict_formats_reply_t *fr;
+    xcb_render_pictscreen_iterator_t si;
+    xcb_render_pictforminfo_iterator_t fi;
+    Bool found = FALSE;
+
+    if (pPriv->hasRender)
+        return TRUE;
+
+    vc = xcb_render_query_version(pPriv->conn, 0, 11);
+    fc = xcb_render_query_pict_formats(pPriv->conn);
+    vr = xcb_render_query_version_reply(pPriv->conn, vc, NULL);
+    fr = xcb_render_query_pict_formats_reply(pPriv->conn, fc, NULL);
+
+    /* Picture transforms and filters appeared in RENDER 0.6 */
+    if (!vr || !fr ||
+        (vr->major_version == 0 && vr->minor_version < 6))
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_WARNING,
+                        "Host X server lacks RENDER 0.6, %s.\n", what);
+        free(vr);
+        free(fr);
+        return FALSE;
+    }
+
+    pPriv->renderMinor = vr->major_version > 0 ? 11 : vr->minor_version;
+
+    for (si = xcb_render_query_pict_formats_screens_iterator(fr);
+         si.rem && !found;
+         xcb_render_pictscreen_next(&si))
+    {
+        xcb_render_pictdepth_iterator_t di;
+
+        for (di = xcb_render_pictscreen_depths_iterator(si.data);
+             di.rem && !found;
+             xcb_render_pictdepth_next(&di))
+        {
+            xcb_render_pictvisual_iterator_t vi;
+
+            for (vi = xcb_render_pictdepth_visuals_iterator(di.data);
+                 vi.rem;
+                 xcb_render_pictvisual_next(&vi))
+            {
+                if (vi.data->visual == pPriv->visual->visual_id)
+                {
+                    pPriv->format = vi.data->format;
+                    found = TRUE;
+                    break;
+                }
+            }
+        }
+    }
+
+    pPriv->formats[NESTED_FORMAT_NONE] = XCB_NONE;
+    pPriv->formats[NESTED_FORMAT_A8] = XCB_NONE;
+    pPriv->formats[NESTED_FORMAT_ARGB32] = XCB_NONE;
+
+    for (fi = xcb_render_query_pict_formats_formats_iterator(fr);
+         fi.rem;
+         xcb_render_pictforminfo_next(&fi))
+    {
+        if (_NestedClientIsMaskFormat(fi.data, 8, 0))
+            pPriv->formats[NESTED_FORMAT_A8] = fi.data->id;
+        else if (_NestedClientIsMaskFormat(fi.data, 32, 24))
+            pPriv->formats[NESTED_FORMAT_ARGB32] = fi.data->id;
+    }
+
+    free(vr);
+    free(fr);
+
+    if (!found)
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_WARNING,
+                        "No RENDER format for the host visual, %s.\n", what);
+        return FALSE;
+    }
+
+    pPriv->hasRender = TRUE;
+    return TRUE;
+}
+
+/* The source picture maps window coordinates to viewport coordinates, so
+ * both composite and input use the same ratio */
+static void
+_NestedClientSetTransform(NestedBackendScreenPtr pPriv)
+{
+    xcb_render_transform_t transform = {
+        (xcb_render_fixed_t)((double)pPriv->width / pPriv->windowWidth * 65536), 0, 0,
+        0, (xcb_render_fixed_t)((double)pPriv->height / pPriv->windowHeight * 65536), 0,
+        0, 0, 65536
+    };
+
+    xcb_render_set_picture_transform(pPriv->conn, pPriv->srcPicture,
+                                     transform);
+}
+
+/* (Re)creates the pixmap holding the viewport */
+static void
+_NestedClientCreateRenderPixmap(NestedBackendScreenPtr pPriv)
+{
+    if (pPriv->pixmap)
+    {
+        xcb_render_free_picture(pPriv->conn, pPriv->srcPicture);
+        xcb_free_pixmap(pPriv->conn, pPriv->pixmap);
+    }
+
+    pPriv->pixmap = xcb_generate_id(pPriv->conn);
+    xcb_create_pixmap(pPriv->conn, pPriv->depth, pPriv->pixmap,
+                      pPriv->rootWindow, pPriv->width, pPriv->height);
+
+    pPriv->srcPicture = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, pPriv->srcPicture, pPriv->pixmap,
+                              pPriv->format, 0, NULL);
+    xcb_render_set_picture_filter(pPriv->conn, pPriv->srcPicture,
+                                  strlen(SCALE_FILTER), SCALE_FILTER,
+                                  0, NULL);
+    _NestedClientSetTransform(pPriv);
+
+    pPriv->drawable = pPriv->pixmap;
+}
+
+/* Paints a window rectangle from the pixmap */
+static void
+_NestedClientComposite(NestedBackendScreenPtr pPriv,
+                       int x, int y,
+                       unsigned int width, unsigned int height)
+{
+    xcb_render_composite(pPriv->conn, XCB_RENDER_PICT_OP_SRC,
+                         pPriv->srcPicture, XCB_RENDER_PICTURE_NONE,
+                         pPriv->dstPicture,
+                         x, y, 0, 0, x, y, width, height);
+}
+
+/* Paints the window area showing a viewport rectangle. One extra pixel is
+ * painted around it for the filter. */
+static void
+_NestedClientCompositeViewport(NestedBackendScreenPtr pPriv,
+                               int x1, int y1, int x2, int y2)
+{
+    double sx = (double)pPriv->windowWidth / pPriv->width;
+    double sy = (double)pPriv->windowHeight / pPriv->height;
+    int wx1 = MAX(0, (int)(x1 * sx) - 1);
+    int wy1 = MAX(0, (int)(y1 * sy) - 1);
+    int wx2 = MIN((int)pPriv->windowWidth, (int)(x2 * sx + 0.999) + 1);
+    int wy2 = MIN((int)pPriv->windowHeight, (int)(y2 * sy + 0.999) + 1);
+
+    if (wx1 < wx2 && wy1 < wy2)
+        _NestedClientComposite(pPriv, wx1, wy1, wx2 - wx1, wy2 - wy1);
+}
+
+/* Called once the window exists */
+static void
+_NestedClientSetupScaling(NestedBackendScreenPtr pPriv)
+{
+    pPriv->pixmap = XCB_NONE;
+    pPriv->drawable = pPriv->window;
+
+    if (!pPriv->usingRender)
+        return;
+
+    pPriv->dstPicture = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, pPriv->dstPicture, pPriv->window,
+                              pPriv->format, 0, NULL);
+    _NestedClientCreateRenderPixmap(pPriv);
+
+    if (pPriv->scale > 0)
+        NestedClientMsg(pPriv->scrnIndex, X_INFO, "Scaling output by %g\n",
+                        pPriv->scale);
+    else
+        NestedClientMsg(pPriv->scrnIndex, X_INFO, "Scaling output to the window\n");
+}
+
+static void
+_NestedClientSetSizeHints(NestedBackendScreenPtr pPriv)
+{
+    xcb_size_hints_t sizeHints;
+
+    memset(&sizeHints, 0, sizeof(sizeHints));
+    sizeHints.flags = XCB_ICCCM_SIZE_HINT_P_POSITION
+                      | XCB_ICCCM_SIZE_HINT_P_SIZE;
+    sizeHints.width = pPriv->windowWidth;
+    sizeHints.height = pPriv->windowHeight;
+
+    /* A window bound to a host output can't be resized, any other window
+     * can and the nested screen follows it through RandR, or the picture is
+     * scaled to it */
+    if (pPriv->usingFullscreen)
+    {
+        sizeHints.flags |= XCB_ICCCM_SIZE_HINT_P_MIN_SIZE
+                           | XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
+        sizeHints.min_width = pPriv->windowWidth;
+        sizeHints.max_width = pPriv->windowWidth;
+        sizeHints.min_height = pPriv->windowHeight;
+        sizeHints.max_height = pPriv->windowHeight;
+    }
+
+    xcb_icccm_set_wm_normal_hints(pPriv->conn,
+                                  pPriv->window,
+                                  &sizeHints);
+}
+
+static void
+_NestedClientCreateWindow(NestedBackendScreenPtr pPriv)
+{
+    pPriv->window = xcb_generate_id(pPriv->conn);
+
+    xcb_create_window(pPriv->conn,
+                      XCB_COPY_FROM_PARENT,
+                      pPriv->window,
+                      pPriv->rootWindow,
+                      0, 0, 100, 100, /* will resize */
+                      0,
+                      XCB_WINDOW_CLASS_COPY_FROM_PARENT,
+                      pPriv->visual->visual_id,
+                      pPriv->attr_mask,
+                      pPriv->attrs);
+
+    _NestedClientSetSizeHints(pPriv);
+
+    if (pPriv->usingFullscreen)
+        _NestedClientSetFullscreenHint(pPriv);
+
+    _NestedClientSetDeleteWindowHint(pPriv);
+    _NestedClientSetWindowTitle(pPriv, "");
+    _NestedClientSetWMClass(pPriv, "Xorg");
+
+    {
+        uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+        uint32_t values[2] = { pPriv->windowWidth, pPriv->windowHeight };
+        xcb_configure_window(pPriv->conn, pPriv->window, mask, values);
+    }
+
+    /* Still needed for its events and as the parent of the RENDER and Xv
+     * resources, but rootless screens are only shown in their own windows */
+    if (!pPriv->rootless)
+        xcb_map_window(pPriv->conn, pPriv->window);
+
+    {
+        uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
+        uint32_t values[2] = { pPriv->x, pPriv->y };
+        xcb_configure_window(pPriv->conn, pPriv->window, mask, values);
+    }
+}
+
+static NestedBackendScreenPtr
+NestedXcbCreateScreen(int scrnIndex,
+                      const char *displayName,
+                      const char *xauthority,
+                      Bool wantFullscreenHint,
+                      Bool rootless,
+                      Bool withInput,
+                      unsigned int fbWidth,
+                      unsigned int fbHeight,
+                      unsigned int width,
+                      unsigned int height,
+                      int originX,
+                      int originY,
+                      double scale,
+                      unsigned int depth,
+                      unsigned int bitsPerPixel,
+                      Pixel *retRedMask,
+                      Pixel *retGreenMask,
+                      Pixel *retBlueMask)
+{
+    NestedBackendScreenPtr pPriv = malloc(sizeof(struct NestedBackendScreen));
+
+    if (!pPriv)
+        return NULL;
+
+    pPriv->scrnIndex = scrnIndex;
+    pPriv->displayName = displayName;
+    pPriv->usingFullscreen = wantFullscreenHint;
+    pPriv->rootless = rootless;
+    pPriv->withInput = withInput;
+    pPriv->detached = FALSE;
+    pPriv->pendingConnect = NULL;
+    pPriv->conn = NULL;
+    pPriv->img = NULL;
+    pPriv->width = width;
+    pPriv->height = height;
+    pPriv->x = originX;
+    pPriv->y = originY;
+    pPriv->blanked = FALSE;
+    pPriv->viewX = 0;
+    pPriv->viewY = 0;
+    pPriv->scale = scale;
+    pPriv->windowWidth = width;
+    pPriv->windowHeight = height;
+    pPriv->depth = depth;
+    pPriv->bufferSize = 0;
+    pPriv->uploadPending = FALSE;
+    pPriv->syncing = FALSE;
+    pPriv->usingXv = FALSE;
+    memset(pPriv->xvShm, 0, sizeof(pPriv->xvShm));
+    pPriv->xvShmLast = 0;
+    pPriv->xvId = -1;
+    pPriv->hasRender = FALSE;
+    pPriv->usingRenderForward = FALSE;
+    pPriv->usingCoreForward = FALSE;
+    pPriv->dev = NULL;
+
+    if (!_NestedClientHostXInit(pPriv, xauthority))
+    {
+        _NestedClientFree(pPriv);
+        return NULL;
+    }
+
+    /* Rootless windows are always shown at their nested size */
+    pPriv->usingRender = scale != 1.0 && !rootless &&
+                         _NestedClientRenderInit(pPriv, "not scaling");
+    _NestedClientScaleWindowSize(pPriv);
+
+    _NestedClientCreateWindow(pPriv);
+    _NestedClientSetupScaling(pPriv);
+    _NestedClientTryXShm(pPriv);
+
+    if (!_NestedClientCreateXImage(pPriv, fbWidth, fbHeight))
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_ERROR,
+                        "Failed to allocate a %dx%d frame buffer.\n",
+                        fbWidth, fbHeight);
+        _NestedClientFree(pPriv);
+        return NULL;
+    }
+
+    NestedXcbHideCursor(pPriv);
+
+#if 0
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
+    NestedClientMsg(pPriv->scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
+#endif
+
+    pPriv->redMask = pPriv->visual->red_mask;
+    pPriv->greenMask = pPriv->visual->green_mask;
+    pPriv->blueMask = pPriv->visual->blue_mask;
+
+    *retRedMask = pPriv->redMask;
+    *retGreenMask = pPriv->greenMask;
+    *retBlueMask = pPriv->blueMask;
+
+    return pPriv;
+}
+
+/* The frame buffer memory is kept if the new host lays it out the same way.
+ * A segment is attached by the new host too, or copied to plain memory if
+ * that host can't. */
+static Bool
+_NestedClientReattachXImage(NestedBackendScreenPtr pPriv)
+{
+    Bool shmImage = pPriv->usingShm;
+    Bool shmFdImage = pPriv->usingShmFd;
+    Bool attached = FALSE;
+    xcb_image_t *img;
+
+    img = xcb_image_create_native(pPriv->conn,
+                                  pPriv->img->width,
+                                  pPriv->img->height,
+                                  XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                  pPriv->depth,
+                                  NULL,
+                                  ~0,
+                                  NULL);
+
+    if (!img || img->stride != pPriv->img->stride ||
+        img->bpp != pPriv->img->bpp)
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_ERROR,
+                        "Host X server uses another image layout, can't reattach.\n");
+        if (img)
+            xcb_image_destroy(img);
+        return FALSE;
+    }
+
+    img->data = pPriv->img->data;
+    xcb_image_destroy(pPriv->img);
+    pPriv->img = img;
+
+    _NestedClientTryXShm(pPriv);
+
+    /* The segment is attached the way it was made, which the new host may
+     * not take even if it does shared memory */
+    if (shmImage && pPriv->usingShm)
+    {
+        xcb_void_cookie_t cookie;
+        xcb_generic_error_t *e;
+
+        pPriv->shminfo.shmseg = xcb_generate_id(pPriv->conn);
+        if (shmFdImage)
+            cookie = xcb_shm_attach_fd_checked(pPriv->conn,
+                                               pPriv->shminfo.shmseg,
+                                               dup(pPriv->shmFd),
+                                               FALSE);
+        else
+            cookie = xcb_shm_attach_checked(pPriv->conn,
+                                            pPriv->shminfo.shmseg,
+                                            pPriv->shminfo.shmid,
+                                            FALSE);
+
+        e = xcb_request_check(pPriv->conn, cookie);
+        attached = e == NULL;
+        free(e);
+    }
+
+    /* The flags describe the image we have, not what the host could do */
+    pPriv->usingShm = shmImage;
+    pPriv->usingShmFd = shmFdImage;
+
+    if (shmImage && !attached)
+    {
+        uint8_t *data = malloc(pPriv->bufferSize);
+
+        if (!data)
+            return FALSE; /* still the segment, freed as such */
+
+        memcpy(data, pPriv->img->data, pPriv->bufferSize);
+        _NestedClientFreeShm(pPriv);
+        pPriv->img->data = data;
+        pPriv->usingShm = FALSE;
+        pPriv->usingShmFd = FALSE;
+    }
+
+    return TRUE;
+}
+
+static Bool
+NestedXcbReattach(NestedBackendScreenPtr pPriv,
+                  const char *displayName,
+                  const char *xauthority)
+{
+    PendingConnect *pending = pPriv->pendingConnect;
+    Bool blanked = pPriv->blanked;
+
+    if (!pPriv->detached)
+        return TRUE;
+
+    if (pending && !_NestedClientConnectDone(pending))
+        return FALSE;
+
+    /* A connection to the display that was asked for before is no use */
+    if (pending &&
+        ((displayName == NULL) != (pending->displayName == NULL) ||
+         (displayName && strcmp(displayName, pending->displayName)) ||
+         (xauthority == NULL) != (pending->xauthority == NULL) ||
+         (xauthority && strcmp(xauthority, pending->xauthority))))
+    {
+        _NestedClientFreePendingConnect(pending);
+        pending = NULL;
+    }
+
+    /* Connecting, and the authentication that comes with it, is left to a
+     * thread; the rest is done here once the host has answered */
+    if (!pending)
+    {
+        pPriv->pendingConnect = _NestedClientStartConnect(displayName,
+                                                          xauthority);
+        return FALSE;
+    }
+
+    pPriv->pendingConnect = NULL;
+    pPriv->conn = pending->conn;
+    pPriv->screenNumber = pending->screenNumber;
+    pending->conn = NULL;
+    _NestedClientFreePendingConnect(pending);
+
+    pPriv->displayName = displayName;
+
+    if (!_NestedClientHostXInit(pPriv, xauthority))
+        goto fail;
+
+    /* The nested visuals were made from the masks of the first host */
+    if (!pPriv->visual ||
+        pPriv->visual->red_mask != pPriv->redMask ||
+        pPriv->visual->green_mask != pPriv->greenMask ||
+        pPriv->visual->blue_mask != pPriv->blueMask)
+    {
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_ERROR,
+                        "Host X server has another visual, can't reattach.\n");
+        goto fail;
+    }
+
+    pPriv->usingRender = pPriv->scale != 1.0 &&
+                         _NestedClientRenderInit(pPriv, "not scaling");
+    _NestedClientScaleWindowSize(pPriv);
+
+    _NestedClientCreateWindow(pPriv);
+    _NestedClientSetupScaling(pPriv);
+
+    if (!_NestedClientReattachXImage(pPriv))
+        goto fail;
+
+    pPriv->detached = FALSE;
+    NestedXcbHideCursor(pPriv);
+
+    if (pPriv->dev)
+        NestedInputSetFileDescriptor(pPriv->dev,
+                                     xcb_get_file_descriptor(pPriv->conn));
+
+    /* Everything drawn while detached is uploaded at once */
+    pPriv->blanked = !blanked;
+    NestedXcbSetBlanked(pPriv, blanked);
+    xcb_flush(pPriv->conn);
+
+    return TRUE;
+
+fail:
+    xcb_disconnect(pPriv->conn);
+    pPriv->conn = NULL;
+    pPriv->visual = NULL;
+    pPriv->hasRender = FALSE;
+    pPriv->usingRender = FALSE;
+    return FALSE;
+}
+
+/* The host handles requests in order, so a segment detached after an image
+ * put in it is only gone once the host has read the image */
+static void
+_NestedClientXvDestroyShm(NestedBackendScreenPtr pPriv, XvShm *shm)
+{
+    if (shm->size == 0)
+        return;
+
+    xcb_shm_detach(pPriv->conn, shm->info.shmseg);
+    shmdt(shm->info.shmaddr);
+    shmctl(shm->info.shmid, IPC_RMID, 0);
+    shm->size = 0;
+}
+
+static Bool
+_NestedClientXvCreateShm(NestedBackendScreenPtr pPriv, XvShm *shm,
+                         size_t size)
+{
+    if (shm->size >= size)
+        return TRUE;
+
+    _NestedClientXvDestroyShm(pPriv, shm);
+
+    shm->info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (shm->info.shmid == -1)
+        return FALSE;
+
+    shm->info.shmaddr = shmat(shm->info.shmid, 0, 0);
+    if (shm->info.shmaddr == (uint8_t *) -1)
+    {
+        shmctl(shm->info.shmid, IPC_RMID, 0);
+        return FALSE;
+    }
+
+    shm->info.shmseg = xcb_generate_id(pPriv->conn);
+    xcb_shm_attach(pPriv->conn,
+                   shm->info.shmseg,
+                   shm->info.shmid,
+                   TRUE);
+    shm->size = size;
+    return TRUE;
+}
+
+/* Images alternate between the two segments. The sync of the block handler
+ * frees both, so only a client putting a third image before it waits for
+ * the host here. */
+static XvShm *
+_NestedClientXvNextShm(NestedBackendScreenPtr pPriv, size_t size)
+{
+    XvShm *shm = &pPriv->xvShm[!pPriv->xvShmLast];
+
+    if (shm->busy)
+    {
+        xcb_aux_sync(pPriv->conn);
+        pPriv->xvShm[0].busy = FALSE;
+        pPriv->xvShm[1].busy = FALSE;
+    }
+
+    if (!_NestedClientXvCreateShm(pPriv, shm, size))
+        return NULL;
+
+    pPriv->xvShmLast = !pPriv->xvShmLast;
+    shm->busy = TRUE;
+    return shm;
+}
+
+static void
+_NestedClientXvRelease(NestedBackendScreenPtr pPriv)
+{
+    if (!pPriv->usingXv)
+        return;
+
+    _NestedClientXvDestroyShm(pPriv, &pPriv->xvShm[0]);
+    _NestedClientXvDestroyShm(pPriv, &pPriv->xvShm[1]);
+    xcb_free_gc(pPriv->conn, pPriv->xvGc);
+    xcb_xv_ungrab_port(pPriv->conn, pPriv->xvPort, XCB_CURRENT_TIME);
+    pPriv->usingXv = FALSE;
+}
+
+/* Grabs the first free port of a host adaptor that can show images */
+static Bool
+_NestedClientXvGrabPort(NestedBackendScreenPtr pPriv)
+{
+    const xcb_query_extension_reply_t *ext;
+    xcb_xv_query_adaptors_reply_t *ar;
+    xcb_xv_adaptor_info_iterator_t ai;
+    const uint8_t type = XCB_XV_TYPE_INPUT_MASK | XCB_XV_TYPE_IMAGE_MASK;
+    int i;
+
+    ext = xcb_get_extension_data(pPriv->conn, &xcb_xv_id);
+    if (!ext || !ext->present)
+        return FALSE;
+
+    ar = xcb_xv_query_adaptors_reply(pPriv->conn,
+                                     xcb_xv_query_adaptors(pPriv->conn,
+                                                           pPriv->window),
+                                     NULL);
+    if (!ar)
+        return FALSE;
+
+    for (ai = xcb_xv_query_adaptors_info_iterator(ar);
+         ai.rem && !pPriv->usingXv;
+         xcb_xv_adaptor_info_next(&ai))
+    {
+        if ((ai.data->type & type) != type)
+            continue;
+
+        for (i = 0; i < ai.data->num_ports; i++)
+        {
+            xcb_xv_grab_port_reply_t *gr;
+            xcb_xv_port_t port = ai.data->base_id + i;
+
+            gr = xcb_xv_grab_port_reply(pPriv->conn,
+                                        xcb_xv_grab_port(pPriv->conn, port,
+                                                         XCB_CURRENT_TIME),
+                                        NULL);
+
+            if (gr && gr->result == XCB_GRAB_STATUS_SUCCESS)
+            {
+                pPriv->xvPort = port;
+                pPriv->usingXv = TRUE;
+            }
+
+            free(gr);
+
+            if (pPriv->usingXv)
+                break;
+        }
+    }
+
+    free(ar);
+    return pPriv->usingXv;
+}
+
+static Bool
+NestedXcbXvInit(NestedBackendScreenPtr pPriv,
+                XF86ImagePtr *retImages,
+                int *retNumImages,
+                unsigned short *retMaxWidth,
+                unsigned short *retMaxHeight)
+{
+    xcb_xv_list_image_formats_reply_t *fr;
+    xcb_xv_query_encodings_reply_t *er;
+    xcb_xv_query_port_attributes_reply_t *pr;
+    xcb_xv_image_format_info_t *info;
+    xcb_xv_encoding_info_iterator_t ei;
+    xcb_xv_attribute_info_iterator_t ai;
+    xcb_intern_atom_reply_t *atom;
+    XF86ImagePtr images;
+    int i, n;
+
+    if (!_NestedClientXvGrabPort(pPriv))
+        return FALSE;
+
+    fr = xcb_xv_list_image_formats_reply(pPriv->conn,
+             xcb_xv_list_image_formats(pPriv->conn, pPriv->xvPort), NULL);
+    n = fr ? xcb_xv_list_image_formats_format_length(fr) : 0;
+    images = n ? calloc(n, sizeof(XF86ImageRec)) : NULL;
+
+    if (!images)
+    {
+        free(fr);
+        _NestedClientXvRelease(pPriv);
+        return FALSE;
+    }
+
+    info = xcb_xv_list_image_formats_format(fr);
+    for (i = 0; i < n; i++)
+    {
+        images[i].id = info[i].id;
+        images[i].type = info[i].type;
+        images[i].byte_order = info[i].byte_order;
+        memcpy(images[i].guid, info[i].guid, 16);
+        images[i].bits_per_pixel = info[i].bpp;
+        images[i].format = info[i].format;
+        images[i].num_planes = info[i].num_planes;
+        images[i].depth = info[i].depth;
+        images[i].red_mask = info[i].red_mask;
+        images[i].green_mask = info[i].green_mask;
+        images[i].blue_mask = info[i].blue_mask;
+        images[i].y_sample_bits = info[i].y_sample_bits;
+        images[i].u_sample_bits = info[i].u_sample_bits;
+        images[i].v_sample_bits = info[i].v_sample_bits;
+        images[i].horz_y_period = info[i].vhorz_y_period;
+        images[i].horz_u_period = info[i].vhorz_u_period;
+        images[i].horz_v_period = info[i].vhorz_v_period;
+        images[i].vert_y_period = info[i].vvert_y_period;
+        images[i].vert_u_period = info[i].vvert_u_period;
+        images[i].vert_v_period = info[i].vvert_v_period;
+        memcpy(images[i].component_order, info[i].vcomp_order, 32);
+        images[i].scanline_order = info[i].vscanline_order;
+    }
+
+    free(fr);
+
+    /* Maximum image size */
+    *retMaxWidth = 2048;
+    *retMaxHeight = 2048;
+
+    er = xcb_xv_query_encodings_reply(pPriv->conn,
+             xcb_xv_query_encodings(pPriv->conn, pPriv->xvPort), NULL);
+
+    if (er)
+    {
+        for (ei = xcb_xv_query_encodings_info_iterator(er);
+             ei.rem;
+             xcb_xv_encoding_info_next(&ei))
+        {
+            if (strnlen(xcb_xv_encoding_info_name(ei.data),
+                        ei.data->name_size) == strlen("XV_IMAGE") &&
+                !strncmp(xcb_xv_encoding_info_name(ei.data), "XV_IMAGE",
+                         strlen("XV_IMAGE")))
+            {
+                *retMaxWidth = ei.data->width;
+                *retMaxHeight = ei.data->height;
+            }
+        }
+
+        free(er);
+    }
+
+    /* Overlay ports need the same color key as our frame buffer */
+    pPriv->xvColorKeyAtom = XCB_ATOM_NONE;
+
+    pr = xcb_xv_query_port_attributes_reply(pPriv->conn,
+             xcb_xv_query_port_attributes(pPriv->conn, pPriv->xvPort), NULL);
+
+    if (pr)
+    {
+        for (ai = xcb_xv_query_port_attributes_attributes_iterator(pr);
+             ai.rem;
+             xcb_xv_attribute_info_next(&ai))
+        {
+            if (strnlen(xcb_xv_attribute_info_name(ai.data),
+                        ai.data->size) != strlen("XV_COLORKEY") ||
+                strncmp(xcb_xv_attribute_info_name(ai.data), "XV_COLORKEY",
+                        strlen("XV_COLORKEY")))
+                continue;
+
+            atom = xcb_intern_atom_reply(pPriv->conn,
+                       xcb_intern_atom(pPriv->conn, FALSE,
+                                       strlen("XV_COLORKEY"), "XV_COLORKEY"),
+                       NULL);
+            if (atom)
+                pPriv->xvColorKeyAtom = atom->atom;
+            free(atom);
+        }
+
+        free(pr);
+    }
+
+    pPriv->xvGc = xcb_generate_id(pPriv->conn);
+    xcb_create_gc(pPriv->conn, pPriv->xvGc, pPriv->window, 0, NULL);
+
+    NestedClientMsg(pPriv->scrnIndex,
+                    X_INFO,
+                    "Using host Xv port %d for video, %d image formats%s\n",
+                    pPriv->xvPort, n,
+                    pPriv->xvColorKeyAtom != XCB_ATOM_NONE ? ", color keyed" : "");
+
+    *retImages = images;
+    *retNumImages = n;
+    return TRUE;
+}
+
+static int
+NestedXcbXvQueryImageAttributes(NestedBackendScreenPtr pPriv,
+                                int id,
+                                unsigned short *width,
+                                unsigned short *height,
+                                int *pitches,
+                                int *offsets)
+{
+    xcb_xv_query_image_attributes_reply_t *r;
+    uint32_t *p;
+    int i, size;
+
+    if (!pPriv->usingXv)
+        return 0;
+
+    r = xcb_xv_query_image_attributes_reply(pPriv->conn,
+            xcb_xv_query_image_attributes(pPriv->conn, pPriv->xvPort,
+                                          id, *width, *height),
+            NULL);
+    if (!r)
+        return 0;
+
+    *width = r->width;
+    *height = r->height;
+
+    if (pitches)
+    {
+        p = xcb_xv_query_image_attributes_pitches(r);
+        for (i = 0; i < r->num_planes; i++)
+            pitches[i] = p[i];
+    }
+
+    if (offsets)
+    {
+        p = xcb_xv_query_image_attributes_offsets(r);
+        for (i = 0; i < r->num_planes; i++)
+            offsets[i] = p[i];
+    }
+
+    size = r->data_size;
+    free(r);
+    return size;
+}
+
+static Bool
+NestedXcbXvSetColorKey(NestedBackendScreenPtr pPriv, CARD32 colorKey)
+{
+    if (!pPriv->usingXv || pPriv->xvColorKeyAtom == XCB_ATOM_NONE)
+        return FALSE;
+
+    xcb_xv_set_port_attribute(pPriv->conn, pPriv->xvPort,
+                              pPriv->xvColorKeyAtom, colorKey);
+    xcb_flush(pPriv->conn);
+    return TRUE;
+}
+
+/* Maps a nested screen position inside the viewport to the window */
+static void
+_NestedClientViewportToWindow(NestedBackendScreenPtr pPriv, int *x, int *y)
+{
+    *x -= pPriv->viewX;
+    *y -= pPriv->viewY;
+
+    if (pPriv->usingRender)
+    {
+        *x = *x * (int)pPriv->windowWidth / (int)pPriv->width;
+        *y = *y * (int)pPriv->windowHeight / (int)pPriv->height;
+    }
+}
+
+static void
+NestedXcbXvPutImage(NestedBackendScreenPtr pPriv,
+                    int id,
+                    unsigned char *buf,
+                    short width,
+                    short height,
+                    short srcX,
+                    short srcY,
+                    short srcWidth,
+                    short srcHeight,
+                    short dstX,
+                    short dstY,
+                    short dstWidth,
+                    short dstHeight,
+                    BoxPtr clipBoxes,
+                    int numClipBoxes)
+{
+    xcb_rectangle_t *rects;
+    XvShm *shm = NULL;
+    int x1, y1, x2, y2, i;
+
+    if (!pPriv->usingXv || pPriv->blanked)
+        return;
+
+    if (id != pPriv->xvId || width != pPriv->xvWidth ||
+        height != pPriv->xvHeight)
+    {
+        unsigned short w = width, h = height;
+
+        pPriv->xvDataSize = NestedXcbXvQueryImageAttributes(pPriv, id,
+                                                            &w, &h,
+                                                            NULL, NULL);
+        pPriv->xvId = id;
+        pPriv->xvWidth = width;
+        pPriv->xvHeight = height;
+    }
+
+    if (pPriv->xvDataSize <= 0)
+        return;
+
+    /* The host draws straight into the window, so it must not cover the
+     * nested windows on top of the video */
+    rects = malloc(numClipBoxes * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    for (i = 0; i < numClipBoxes; i++)
+    {
+        x1 = clipBoxes[i].x1;
+        y1 = clipBoxes[i].y1;
+        x2 = clipBoxes[i].x2;
+        y2 = clipBoxes[i].y2;
+        _NestedClientViewportToWindow(pPriv, &x1, &y1);
+        _NestedClientViewportToWindow(pPriv, &x2, &y2);
+        rects[i].x = x1;
+        rects[i].y = y1;
+        rects[i].width = x2 - x1;
+        rects[i].height = y2 - y1;
+    }
+
+    xcb_set_clip_rectangles(pPriv->conn, XCB_CLIP_ORDERING_UNSORTED,
+                            pPriv->xvGc, 0, 0, numClipBoxes, rects);
+    free(rects);
+
+    x1 = dstX;
+    y1 = dstY;
+    x2 = dstX + dstWidth;
+    y2 = dstY + dstHeight;
+    _NestedClientViewportToWindow(pPriv, &x1, &y1);
+    _NestedClientViewportToWindow(pPriv, &x2, &y2);
+
+    /* The nested client's buffer may be reused as soon as we return, so it
+     * is copied to a segment of our own */
+    if (pPriv->usingShm)
+        shm = _NestedClientXvNextShm(pPriv, pPriv->xvDataSize);
+
+    if (shm)
+    {
+        memcpy(shm->info.shmaddr, buf, pPriv->xvDataSize);
+        xcb_xv_shm_put_image(pPriv->conn, pPriv->xvPort, pPriv->window,
+                             pPriv->xvGc, shm->info.shmseg, id, 0,
+                             srcX, srcY, srcWidth, srcHeight,
+                             x1, y1, x2 - x1, y2 - y1,
+                             width, height, FALSE);
+    }
+    else
+        xcb_xv_put_image(pPriv->conn, pPriv->xvPort, pPriv->window,
+                         pPriv->xvGc, id,
+                         srcX, srcY, srcWidth, srcHeight,
+                         x1, y1, x2 - x1, y2 - y1,
+                         width, height, pPriv->xvDataSize, buf);
+
+    /* Sent and waited for with the uploads, from the block handler */
+    pPriv->uploadPending = TRUE;
+}
+
+static void
+NestedXcbXvStopVideo(NestedBackendScreenPtr pPriv)
+{
+    if (!pPriv->usingXv)
+        return;
+
+    xcb_xv_stop_video(pPriv->conn, pPriv->xvPort, pPriv->window);
+    xcb_flush(pPriv->conn);
+}
+
+/* RENDER operations are replayed on a picture of the window. Solid fills and
+ * gradients need RENDER 0.10. */
+static Bool
+NestedXcbRenderInit(NestedBackendScreenPtr pPriv)
+{
+    int i;
+
+    if (pPriv->usingRender)
+    {
+        NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                        "RENDER operations are not forwarded while scaling.\n");
+        return FALSE;
+    }
+
+    if (!_NestedClientRenderInit(pPriv, "not forwarding RENDER operations"))
+        return FALSE;
+
+    if (pPriv->renderMinor < 10 ||
+        !pPriv->formats[NESTED_FORMAT_A8] ||
+        !pPriv->formats[NESTED_FORMAT_ARGB32])
+    {
+        NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                        "Host X server lacks RENDER 0.10 or its standard formats, "
+                        "not forwarding RENDER operations.\n");
+        return FALSE;
+    }
+
+    pPriv->windowPicture = xcb_generate_id(pPriv->conn);
+    xcb_render_create_picture(pPriv->conn, pPriv->windowPicture, pPriv->window,
+                              pPriv->format, 0, NULL);
+
+    pPriv->glyphSets[NESTED_FORMAT_NONE] = XCB_NONE;
+
+    for (i = NESTED_FORMAT_A8; i < NESTED_NUM_FORMATS; i++)
+    {
+        pPriv->glyphSets[i] = xcb_generate_id(pPriv->conn);
+        xcb_render_create_glyph_set(pPriv->conn, pPriv->glyphSets[i],
+                                    pPriv->formats[i]);
+    }
+
+    pPriv->usingRenderForward = TRUE;
+    return TRUE;
+}
+
+/* While blanked the window shows black and is repainted in full when
+ * unblanking, so there is nothing to draw to */
+static Bool
+NestedXcbRenderReady(NestedBackendScreenPtr pPriv)
+{
+    return pPriv->usingRenderForward && !pPriv->blanked;
+}
+
+static CARD32
+NestedXcbRenderCreateSolid(NestedBackendScreenPtr pPriv,
+                           xRenderColor          *color)
+{
+    xcb_render_picture_t picture = xcb_generate_id(pPriv->conn);
+    xcb_render_color_t c = { color->red, color->green,
+                             color->blue, color->alpha };
+
+    xcb_render_create_solid_fill(pPriv->conn, picture, c);
+    return picture;
+}
+
+static void
+_NestedClientRenderSetRepeat(NestedBackendScreenPtr pPriv,
+                             xcb_render_picture_t picture, int repeat)
+{
+    uint32_t value = repeat;
+
+    if (repeat != XCB_RENDER_REPEAT_NONE)
+        xcb_render_change_picture(pPriv->conn, picture,
+                                  XCB_RENDER_CP_REPEAT, &value);
+}
+
+static CARD32
+NestedXcbRenderCreateLinearGradient(NestedBackendScreenPtr pPriv,
+                                    xPointFixed           *p1,
+                                    xPointFixed           *p2,
+                                    int                    numStops,
+                                    xFixed                *stops,
+                                    xRenderColor          *colors,
+                                    int                    repeat)
+{
+    xcb_render_picture_t picture = xcb_generate_id(pPriv->conn);
+    xcb_render_pointfix_t start = { p1->x, p1->y };
+    xcb_render_pointfix_t end = { p2->x, p2->y };
+
+    /* xRenderColor and xcb_render_color_t share their layout */
+    xcb_render_create_linear_gradient(pPriv->conn, picture, start, end,
+                                      numStops, (xcb_render_fixed_t *)stops,
+                                      (xcb_render_color_t *)colors);
+    _NestedClientRenderSetRepeat(pPriv, picture, repeat);
+    return picture;
+}
+
+static CARD32
+NestedXcbRenderCreateRadialGradient(NestedBackendScreenPtr pPriv,
+                                    xPointFixed           *inner,
+                                    xPointFixed           *outer,
+                                    xFixed                 innerRadius,
+                                    xFixed                 outerRadius,
+                                    int                    numStops,
+                                    xFixed                *stops,
+                                    xRenderColor          *colors,
+                                    int                    repeat)
+{
+    xcb_render_picture_t picture = xcb_generate_id(pPriv->conn);
+    xcb_render_pointfix_t c1 = { inner->x, inner->y };
+    xcb_render_pointfix_t c2 = { outer->x, outer->y };
+
+    xcb_render_create_radial_gradient(pPriv->conn, picture, c1, c2,
+                                      innerRadius, outerRadius, numStops,
+                                      (xcb_render_fixed_t *)stops,
+                                      (xcb_render_color_t *)colors);
+    _NestedClientRenderSetRepeat(pPriv, picture, repeat);
+    return picture;
+}
+
+static void
+NestedXcbRenderFreePicture(NestedBackendScreenPtr pPriv, CARD32 picture)
+{
+    xcb_render_free_picture(pPriv->conn, picture);
+}
+
+static void
+NestedXcbRenderSetClip(NestedBackendScreenPtr pPriv,
+                       BoxPtr                 boxes,
+                       int                    numBoxes)
+{
+    xcb_rectangle_t *rects = malloc(numBoxes * sizeof(xcb_rectangle_t));
+    int i;
+
+    if (!rects)
+        return;
+
+    for (i = 0; i < numBoxes; i++)
+    {
+        rects[i].x = boxes[i].x1;
+        rects[i].y = boxes[i].y1;
+        rects[i].width = boxes[i].x2 - boxes[i].x1;
+        rects[i].height = boxes[i].y2 - boxes[i].y1;
+    }
+
+    /* The window origin is the viewport origin */
+    xcb_render_set_picture_clip_rectangles(pPriv->conn, pPriv->windowPicture,
+                                           -pPriv->viewX, -pPriv->viewY,
+                                           numBoxes, rects);
+    free(rects);
+}
+
+static void
+NestedXcbRenderComposite(NestedBackendScreenPtr pPriv,
+                         CARD8                  op,
+                         CARD32                 src,
+                         CARD32                 mask,
+                         INT16                  xSrc,
+                         INT16                  ySrc,
+                         INT16                  xMask,
+                         INT16                  yMask,
+                         INT16                  xDst,
+                         INT16                  yDst,
+                         CARD16                 width,
+                         CARD16                 height)
+{
+    xcb_render_composite(pPriv->conn, op, src, mask, pPriv->windowPicture,
+                         xSrc, ySrc, xMask, yMask,
+                         xDst - pPriv->viewX, yDst - pPriv->viewY,
+                         width, height);
+}
+
+/* Size of a request in bytes, compared against the host limit */
+static Bool
+_NestedClientRequestFits(NestedBackendScreenPtr pPriv, size_t bytes)
+{
+    return bytes <= (size_t)xcb_get_maximum_request_length(pPriv->conn) * 4;
+}
+
+static Bool
+NestedXcbRenderTrapezoids(NestedBackendScreenPtr pPriv,
+                          CARD8                  op,
+                          CARD32                 src,
+                          int                    maskFormat,
+                          INT16                  xSrc,
+                          INT16                  ySrc,
+                          int                    xOrigin,
+                          int                    yOrigin,
+                          int                    numTraps,
+                          xTrapezoid            *traps)
+{
+    xcb_render_trapezoid_t *t;
+    xFixed dx = (xFixed)(xOrigin - pPriv->viewX) << 16;
+    xFixed dy = (xFixed)(yOrigin - pPriv->viewY) << 16;
+    int i;
+
+    /* Splitting the request would composite overlapping trapezoids twice */
+    if (!_NestedClientRequestFits(pPriv, sizeof(xRenderTrapezoidsReq) +
+                                         numTraps * sizeof(xTrapezoid)))
+        return FALSE;
+
+    t = malloc(numTraps * sizeof(xcb_render_trapezoid_t));
+    if (!t)
+        return FALSE;
+
+    for (i = 0; i < numTraps; i++)
+    {
+        t[i].top = traps[i].top + dy;
+        t[i].bottom = traps[i].bottom + dy;
+        t[i].left.p1.x = traps[i].left.p1.x + dx;
+        t[i].left.p1.y = traps[i].left.p1.y + dy;
+        t[i].left.p2.x = traps[i].left.p2.x + dx;
+        t[i].left.p2.y = traps[i].left.p2.y + dy;
+        t[i].right.p1.x = traps[i].right.p1.x + dx;
+        t[i].right.p1.y = traps[i].right.p1.y + dy;
+        t[i].right.p2.x = traps[i].right.p2.x + dx;
+        t[i].right.p2.y = traps[i].right.p2.y + dy;
+    }
+
+    /* The source stays aligned with the first trapezoid, which moved along */
+    xcb_render_trapezoids(pPriv->conn, op, src, pPriv->windowPicture,
+                          pPriv->formats[maskFormat], xSrc, ySrc,
+                          numTraps, t);
+    free(t);
+    return TRUE;
+}
+
+static void
+NestedXcbRenderResetGlyphs(NestedBackendScreenPtr pPriv, int format)
+{
+    xcb_render_free_glyph_set(pPriv->conn, pPriv->glyphSets[format]);
+    pPriv->glyphSets[format] = xcb_generate_id(pPriv->conn);
+    xcb_render_create_glyph_set(pPriv->conn, pPriv->glyphSets[format],
+                                pPriv->formats[format]);
+}
+
+static void
+NestedXcbRenderAddGlyph(NestedBackendScreenPtr pPriv,
+                        int                    format,
+                        CARD32                 id,
+                        xGlyphInfo            *info,
+                        const char            *data,
+                        int                    size)
+{
+    xcb_render_glyphinfo_t glyphInfo = {
+        info->width, info->height, info->x, info->y, info->xOff, info->yOff
+    };
+
+    xcb_render_add_glyphs(pPriv->conn, pPriv->glyphSets[format], 1, &id,
+                          &glyphInfo, size, (const uint8_t *)data);
+}
+
+/* One element holds at most 254 glyphs, 255 announces a glyph set change */
+#define GLYPHS_PER_ELT 254
+
+static Bool
+NestedXcbRenderCompositeGlyphs(NestedBackendScreenPtr pPriv,
+                               CARD8                  op,
+                               CARD32                 src,
+                               int                    maskFormat,
+                               int                    format,
+                               INT16                  xSrc,
+                               INT16                  ySrc,
+                               int                    xOrigin,
+                               int                    yOrigin,
+                               int                    numLists,
+                               NestedGlyphListPtr     lists,
+                               CARD32                *glyphs)
+{
+    size_t size = 0;
+    uint8_t *cmds, *p;
+    int i;
+
+    for (i = 0; i < numLists; i++)
+        size += ((lists[i].len + GLYPHS_PER_ELT - 1) / GLYPHS_PER_ELT) *
+                sizeof(xGlyphElt) + lists[i].len * sizeof(CARD32);
+
+    if (!_NestedClientRequestFits(pPriv, sizeof(xRenderCompositeGlyphsReq) +
+                                         size))
+        return FALSE;
+
+    cmds = p = malloc(size);
+    if (!cmds)
+        return FALSE;
+
+    for (i = 0; i < numLists; i++)
+    {
+        int left = lists[i].len;
+        INT16 dx = lists[i].xOff, dy = lists[i].yOff;
+
+        /* The first list is relative to the destination origin */
+        if (i == 0)
+        {
+            dx += xOrigin - pPriv->viewX;
+            dy += yOrigin - pPriv->viewY;
+        }
+
+        do
+        {
+            xGlyphElt *elt = (xGlyphElt *)p;
+            int n = MIN(left, GLYPHS_PER_ELT);
+
+            memset(elt, 0, sizeof(xGlyphElt));
+            elt->len = n;
+            elt->deltax = dx;
+            elt->deltay = dy;
+            p += sizeof(xGlyphElt);
+
+            memcpy(p, glyphs, n * sizeof(CARD32));
+            p += n * sizeof(CARD32);
+            glyphs += n;
+            left -= n;
+
+            /* Further elements continue where the last glyph left off */
+            dx = dy = 0;
+        } while (left > 0);
+    }
+
+    xcb_render_composite_glyphs_32(pPriv->conn, op, src, pPriv->windowPicture,
+                                   pPriv->formats[maskFormat],
+                                   pPriv->glyphSets[format], xSrc, ySrc,
+                                   size, cmds);
+    free(cmds);
+    return TRUE;
+}
+
+/* Core requests are replayed with a GC of their own, so the state of the
+ * upload GC is never touched. Graphics exposures stay on: parts of a copy
+ * the host window doesn't have are uploaded when they are reported. */
+static Bool
+NestedXcbCoreInit(NestedBackendScreenPtr pPriv)
+{
+    if (pPriv->usingRender)
+    {
+        NestedClientMsg(pPriv->scrnIndex, X_WARNING,
+                        "Core drawing is not forwarded while scaling.\n");
+        return FALSE;
+    }
+
+    pPriv->coreGcValues[0] = XCB_GX_COPY;
+    pPriv->coreGcValues[1] = ~0;
+    pPriv->coreGcValues[2] = 0;
+    pPriv->coreGcValues[3] = XCB_CAP_STYLE_BUTT;
+
+    pPriv->coreGc = xcb_generate_id(pPriv->conn);
+    xcb_create_gc(pPriv->conn, pPriv->coreGc, pPriv->window,
+                  XCB_GC_FUNCTION | XCB_GC_PLANE_MASK |
+                  XCB_GC_FOREGROUND | XCB_GC_CAP_STYLE,
+                  pPriv->coreGcValues);
+
+    pPriv->usingCoreForward = TRUE;
+    return TRUE;
+}
+
+static Bool
+NestedXcbCoreReady(NestedBackendScreenPtr pPriv)
+{
+    return pPriv->usingCoreForward && !pPriv->blanked;
+}
+
+static void
+NestedXcbCoreSetGC(NestedBackendScreenPtr pPriv,
+                   int                    alu,
+                   CARD32                 planeMask,
+                   CARD32                 foreground,
+                   int                    capStyle,
+                   BoxPtr                 clipBoxes,
+                   int                    numClipBoxes)
+{
+    uint32_t values[4] = { alu, planeMask, foreground, capStyle };
+    xcb_rectangle_t *rects;
+    int i;
+
+    if (memcmp(values, pPriv->coreGcValues, sizeof(values)))
+    {
+        memcpy(pPriv->coreGcValues, values, sizeof(values));
+        xcb_change_gc(pPriv->conn, pPriv->coreGc,
+                      XCB_GC_FUNCTION | XCB_GC_PLANE_MASK |
+                      XCB_GC_FOREGROUND | XCB_GC_CAP_STYLE,
+                      values);
+    }
+
+    rects = malloc(numClipBoxes * sizeof(xcb_rectangle_t));
+    if (!rects)
+        return;
+
+    for (i = 0; i < numClipBoxes; i++)
+    {
+        rects[i].x = clipBoxes[i].x1;
+        rects[i].y = clipBoxes[i].y1;
+        rects[i].width = clipBoxes[i].x2 - clipBoxes[i].x1;
+        rects[i].height = clipBoxes[i].y2 - clipBoxes[i].y1;
+    }
+
+    xcb_set_clip_rectangles(pPriv->conn, XCB_CLIP_ORDERING_UNSORTED,
+                            pPriv->coreGc, -pPriv->viewX, -pPriv->viewY,
+                            numClipBoxes, rects);
+    free(rects);
+}
+
+/* How many items of a poly request fit in one request. Rectangles and
+ * segments are drawn independently, so the list can be split. */
+static int
+_NestedClientPolyChunk(NestedBackendScreenPtr pPriv, size_t itemSize)
+{
+    return (xcb_get_maximum_request_length(pPriv->conn) * 4 -
+            sizeof(xcb_poly_fill_rectangle_request_t)) / itemSize;
+}
+
+static void
+NestedXcbCorePolyFillRect(NestedBackendScreenPtr pPriv,
+                          int                    xOrigin,
+                          int                    yOrigin,
+                          int                    numRects,
+                          xRectangle            *rects)
+{
+    int chunk = _NestedClientPolyChunk(pPriv, sizeof(xcb_rectangle_t));
+    int dx = xOrigin - pPriv->viewX, dy = yOrigin - pPriv->viewY;
+    xcb_rectangle_t *r = malloc(MIN(numRects, chunk) * sizeof(xcb_rectangle_t));
+    int i, j, n;
+
+    if (!r)
+        return;
+
+    for (i = 0; i < numRects; i += n)
+    {
+        n = MIN(chunk, numRects - i);
+
+        for (j = 0; j < n; j++)
+        {
+            r[j].x = rects[i + j].x + dx;
+            r[j].y = rects[i + j].y + dy;
+            r[j].width = rects[i + j].width;
+            r[j].height = rects[i + j].height;
+        }
+
+        xcb_poly_fill_rectangle(pPriv->conn, pPriv->window, pPriv->coreGc,
+                                n, r);
+    }
+
+    free(r);
+}
+
+static void
+NestedXcbCorePolySegment(NestedBackendScreenPtr pPriv,
+                         int                    xOrigin,
+                         int                    yOrigin,
+                         int                    numSegments,
+                         xSegment              *segments)
+{
+    int chunk = _NestedClientPolyChunk(pPriv, sizeof(xcb_segment_t));
+    int dx = xOrigin - pPriv->viewX, dy = yOrigin - pPriv->viewY;
+    xcb_segment_t *seg = malloc(MIN(numSegments, chunk) * sizeof(xcb_segment_t));
+    int i, j, n;
+
+    if (!seg)
+        return;
+
+    for (i = 0; i < numSegments; i += n)
+    {
+        n = MIN(chunk, numSegments - i);
+
+        for (j = 0; j < n; j++)
+        {
+            seg[j].x1 = segments[i + j].x1 + dx;
+            seg[j].y1 = segments[i + j].y1 + dy;
+            seg[j].x2 = segments[i + j].x2 + dx;
+            seg[j].y2 = segments[i + j].y2 + dy;
+        }
+
+        xcb_poly_segment(pPriv->conn, pPriv->window, pPriv->coreGc, n, seg);
+    }
+
+    free(seg);
+}
+
+/* The source must be shown in the window, the host has nothing else */
+static Bool
+NestedXcbCoreCopyArea(NestedBackendScreenPtr pPriv,
+                      int                    srcX,
+                      int                    srcY,
+                      int                    width,
+                      int                    height,
+                      int                    dstX,
+                      int                    dstY)
+{
+    if (srcX < pPriv->viewX || srcY < pPriv->viewY ||
+        srcX + width > pPriv->viewX + (int)pPriv->width ||
+        srcY + height > pPriv->viewY + (int)pPriv->height)
+        return FALSE;
+
+    xcb_copy_area(pPriv->conn, pPriv->window, pPriv->window, pPriv->coreGc,
+                  srcX - pPriv->viewX, srcY - pPriv->viewY,
+                  dstX - pPriv->viewX, dstY - pPriv->viewY,
+                  width, height);
+    return TRUE;
+}
+
+/* Only images laid out the way the host wants them are passed on */
+static Bool
+NestedXcbCorePutImage(NestedBackendScreenPtr pPriv,
+                      int                    depth,
+                      int                    x,
+                      int                    y,
+                      int                    width,
+                      int                    height,
+                      int                    stride,
+                      char                  *data)
+{
+    xcb_image_t *img = pPriv->img;
+    uint32_t rowBytes = (width * img->bpp + img->scanline_pad - 1) /
+                        img->scanline_pad * (img->scanline_pad / 8);
+    uint32_t maxBytes = xcb_get_maximum_request_length(pPriv->conn) * 4 -
+                        sizeof(xcb_put_image_request_t);
+    int bandHeight, i;
+
+    if (depth != img->depth || stride != rowBytes || rowBytes > maxBytes)
+        return FALSE;
+
+    bandHeight = MIN(height, (int)(maxBytes / rowBytes));
+
+    for (i = 0; i < height; i += bandHeight)
+    {
+        int h = MIN(bandHeight, height - i);
+
+        xcb_put_image(pPriv->conn,
+                      XCB_IMAGE_FORMAT_Z_PIXMAP,
+                      pPriv->window,
+                      pPriv->coreGc,
+                      width, h,
+                      x - pPriv->viewX, y + i - pPriv->viewY,
+                      0,
+                      depth,
+                      rowBytes * h,
+                      (uint8_t *)data + i * rowBytes);
+    }
+
+    return TRUE;
+}
+
+/* Rootless mode. Host windows are placed at the nested screen coordinates
+ * of the nested windows, so host root coordinates are nested screen
+ * coordinates too. */
+
+static Bool
+NestedXcbRootlessReady(NestedBackendScreenPtr pPriv)
+{
+    return pPriv->rootless;
+}
+
+static CARD32
+NestedXcbRootlessCreateWindow(NestedBackendScreenPtr pPriv,
+                              int x, int y,
+                              unsigned int width, unsigned int height,
+                              Bool overrideRedirect,
+                              const char *name, int nameLength)
+{
+    xcb_window_t window = xcb_generate_id(pPriv->conn);
+    xcb_size_hints_t sizeHints;
+    uint32_t values[4] = {
+        XCB_BACK_PIXMAP_NONE,
+        overrideRedirect,
+        pPriv->attrs[0] | XCB_EVENT_MASK_FOCUS_CHANGE,
+        pPriv->emptyCursor
+    };
+
+    /* No background, so the host never paints over what we upload */
+    xcb_create_window(pPriv->conn,
+                      XCB_COPY_FROM_PARENT,
+                      window,
+                      pPriv->rootWindow,
+                      x, y, width, height,
+                      0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      pPriv->visual->visual_id,
+                      XCB_CW_BACK_PIXMAP | XCB_CW_OVERRIDE_REDIRECT |
+                      XCB_CW_EVENT_MASK | XCB_CW_CURSOR,
+                      values);
+
+    if (!overrideRedirect)
+    {
+        /* The nested client chose the position, the host WM shouldn't */
+        memset(&sizeHints, 0, sizeof(sizeHints));
+        sizeHints.flags = XCB_ICCCM_SIZE_HINT_US_POSITION |
+                          XCB_ICCCM_SIZE_HINT_US_SIZE;
+        sizeHints.x = x;
+        sizeHints.y = y;
+        sizeHints.width = width;
+        sizeHints.height = height;
+        xcb_icccm_set_wm_normal_hints(pPriv->conn, window, &sizeHints);
+
+        xcb_icccm_set_wm_protocols(pPriv->conn, window, pPriv->wmProtocolsAtom,
+                                   1, &pPriv->wmDeleteWindowAtom);
+
+        if (name)
+            xcb_icccm_set_wm_name(pPriv->conn, window, XCB_ATOM_STRING, 8,
+                                  nameLength, name);
+    }
+
+    xcb_map_window(pPriv->conn, window);
+    return window;
+}
+
+static void
+NestedXcbRootlessConfigureWindow(NestedBackendScreenPtr pPriv,
+                                 CARD32 window,
+                                 int x, int y,
+                                 unsigned int width, unsigned int height)
+{
+    uint32_t values[4] = { x, y, width, height };
+
+    xcb_configure_window(pPriv->conn, window,
+                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+                         values);
+}
+
+static void
+NestedXcbRootlessRaiseWindow(NestedBackendScreenPtr pPriv, CARD32 window)
+{
+    uint32_t value = XCB_STACK_MODE_ABOVE;
+
+    xcb_configure_window(pPriv->conn, window, XCB_CONFIG_WINDOW_STACK_MODE,
+                         &value);
+}
+
+static void
+NestedXcbRootlessDestroyWindow(NestedBackendScreenPtr pPriv, CARD32 window)
+{
+    xcb_destroy_window(pPriv->conn, window);
+}
+
+/* Straight from the frame buffer, which is already shared with the host
+ * when SHM is available */
+static void
+NestedXcbRootlessUpdateWindow(NestedBackendScreenPtr pPriv,
+                              CARD32 window,
+                              int x, int y,
+                              BoxPtr boxes, int numBoxes)
+{
+    int i;
+
+    for (i = 0; i < numBoxes; i++)
+    {
+        int x1 = MAX(boxes[i].x1, 0);
+        int y1 = MAX(boxes[i].y1, 0);
+        int x2 = MIN(boxes[i].x2, (int)pPriv->img->width);
+        int y2 = MIN(boxes[i].y2, (int)pPriv->img->height);
+
+        if (x1 >= x2 || y1 >= y2)
+            continue;
+
+        if (pPriv->usingShm)
+            xcb_image_shm_put(pPriv->conn, window,
+                              pPriv->gc, pPriv->img,
+                              pPriv->shminfo,
+                              x1, y1,
+                              x1 - x, y1 - y,
+                              x2 - x1, y2 - y1, FALSE);
+        else
+            _NestedClientPutImage(pPriv, window,
+                                  x1, y1,
+                                  x2 - x1, y2 - y1,
+                                  x1 - x, y1 - y);
+
+        pPriv->uploadPending = TRUE;
+    }
+}
+
+static void
+NestedXcbHideCursor(NestedBackendScreenPtr pPriv)
+{
+    if (pPriv->detached)
+        return;
+
+    xcb_change_window_attributes(pPriv->conn,
+                                 pPriv->window,
+                                 XCB_CW_CURSOR,
+                                 &pPriv->emptyCursor);
+}
+
+static void
+NestedXcbSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked)
+{
+    if (pPriv->blanked == blanked)
+        return;
+
+    pPriv->blanked = blanked;
+
+    if (pPriv->detached)
+        return;
+
+    if (blanked)
+    {
+        /* Let the host server paint the window black by itself, so exposures
+         * while blanked don't cost us any uploads. */
+        xcb_change_window_attributes(pPriv->conn,
+                                     pPriv->window,
+                                     XCB_CW_BACK_PIXEL,
+                                     &pPriv->blackPixel);
+        xcb_clear_area(pPriv->conn, FALSE, pPriv->window, 0, 0, 0, 0);
+        xcb_flush(pPriv->conn);
+    }
+    else
+    {
+        uint32_t none = XCB_BACK_PIXMAP_NONE;
+
+        xcb_change_window_attributes(pPriv->conn,
+                                     pPriv->window,
+                                     XCB_CW_BACK_PIXMAP,
+                                     &none);
+        NestedXcbUpdateScreen(pPriv,
+                              pPriv->viewX,
+                              pPriv->viewY,
+                              pPriv->viewX + pPriv->width,
+                              pPriv->viewY + pPriv->height);
+    }
+}
+
+static char *
+NestedXcbGetFrameBuffer(NestedBackendScreenPtr pPriv)
+{
+    return (char *)pPriv->img->data;
+}
+
+static Bool
+NestedXcbResizeFrameBuffer(NestedBackendScreenPtr pPriv,
+                           unsigned int width,
+                           unsigned int height)
+{
+    /* The image layout comes from the host */
+    if (pPriv->detached)
+        return FALSE;
+
+    return _NestedClientCreateXImage(pPriv, width, height);
+}
+
+static Bool
+NestedXcbResizeWindow(NestedBackendScreenPtr pPriv,
+                      unsigned int width,
+                      unsigned int height)
+{
+    uint32_t values[2];
+
+    if (pPriv->width == width && pPriv->height == height)
+        return TRUE;
+
+    pPriv->width = width;
+    pPriv->height = height;
+
+    /* The window gets the new size when it is created again */
+    if (pPriv->detached)
+        return TRUE;
+
+    /* Following the window, the picture is just scaled differently */
+    if (!pPriv->usingRender || pPriv->scale > 0)
+    {
+        _NestedClientScaleWindowSize(pPriv);
+        values[0] = pPriv->windowWidth;
+        values[1] = pPriv->windowHeight;
+
+        _NestedClientSetSizeHints(pPriv);
+        xcb_configure_window(pPriv->conn,
+                             pPriv->window,
+                             XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+                             values);
+    }
+
+    if (pPriv->usingRender)
+    {
+        /* Expose events only repaint from the pixmap, so fill it now */
+        _NestedClientCreateRenderPixmap(pPriv);
+
+        if (!pPriv->blanked)
+            _NestedClientUpload(pPriv,
+                                pPriv->viewX,
+                                pPriv->viewY,
+                                pPriv->viewX + width,
+                                pPriv->viewY + height);
+    }
 
-    if (_NestedClientConnectionHasError(pPriv->scrnIndex, pPriv->conn))
-        return FALSE;
+    xcb_flush(pPriv->conn);
 
-    screen = xcb_aux_get_screen(pPriv->conn, pPriv->screenNumber);
-    pPriv->rootWindow = screen->root;
-    pPriv->gc = xcb_generate_id(pPriv->conn);
-    pPriv->visual = xcb_aux_find_visual_by_id(screen,
-                                              screen->root_visual);
+    return TRUE;
+}
 
-    xcb_create_gc(pPriv->conn, pPriv->gc, pPriv->rootWindow, 0, NULL);
+/* Sends a rectangle of the frame buffer with plain PutImage requests, split
+ * in bands that fit in the maximum request length */
+static void
+_NestedClientPutImage(NestedBackendScreenPtr pPriv,
+                      xcb_drawable_t drawable,
+                      int x, int y,
+                      int width, int height,
+                      int dstX, int dstY)
+{
+    xcb_image_t *img = pPriv->img;
+    uint32_t rowBytes = (width * img->bpp + img->scanline_pad - 1) /
+                        img->scanline_pad * (img->scanline_pad / 8);
+    uint32_t maxBytes = xcb_get_maximum_request_length(pPriv->conn) * 4 -
+                        sizeof(xcb_put_image_request_t);
+    int bandHeight = MAX(1, MIN(height, (int)(maxBytes / rowBytes)));
+    uint8_t *band = NULL;
+    int i, j;
 
-    if (!xcb_aux_parse_color("red", &red, &green, &blue))
+    /* Rows can be sent straight from the frame buffer when they span its
+     * whole width, otherwise they are packed in a temporary band */
+    if (x != 0 || rowBytes != img->stride)
     {
-        xcb_lookup_color_cookie_t c =
-            xcb_lookup_color(pPriv->conn, screen->default_colormap, 3, "red");
-        xcb_lookup_color_reply_t *r =
-            xcb_lookup_color_reply(pPriv->conn, c, NULL);
-        red = r->exact_red;
-        green = r->exact_green;
-        blue = r->exact_blue;
-        free(r);
+        band = malloc(rowBytes * bandHeight);
+
+        if (!band)
+            return;
     }
 
+    for (i = 0; i < height; i += bandHeight)
     {
-        xcb_alloc_color_cookie_t c = xcb_alloc_color(pPriv->conn,
-                                                     screen->default_colormap,
-                                                     red, green, blue);
-        xcb_alloc_color_reply_t *r = xcb_alloc_color_reply(pPriv->conn, c, NULL);
-        pixel = r->pixel;
-        free(r);
-    }
+        int h = MIN(bandHeight, height - i);
+        uint8_t *src = img->data + (y + i) * img->stride +
+                       x * img->bpp / 8;
 
-    xcb_change_gc(pPriv->conn, pPriv->gc, XCB_GC_FOREGROUND, &pixel);
+        if (band)
+        {
+            for (j = 0; j < h; j++)
+                memcpy(band + j * rowBytes,
+                       src + j * img->stride,
+                       width * img->bpp / 8);
+            src = band;
+        }
 
-    _NestedClientEmptyCursorInit(pPriv);
+        xcb_put_image(pPriv->conn,
+                      XCB_IMAGE_FORMAT_Z_PIXMAP,
+                      drawable,
+                      pPriv->gc,
+                      width, h,
+                      dstX, dstY + i,
+                      0,
+                      img->depth,
+                      rowBytes * h,
+                      src);
+    }
 
-    return TRUE;
+    free(band);
 }
 
-static void
-_NestedClientSetFullscreenHint(NestedClientPrivatePtr pPriv)
+/* Uploads the part of a frame buffer rectangle inside the viewport, without
+ * waiting for the host. Returns FALSE if there was nothing to upload. */
+static Bool
+_NestedClientUpload(NestedBackendScreenPtr pPriv,
+                    int x1, int y1, int x2, int y2)
 {
-    xcb_intern_atom_cookie_t cookie_WINDOW_STATE,
-                             cookie_WINDOW_STATE_FULLSCREEN;
-    xcb_atom_t atom_WINDOW_STATE, atom_WINDOW_STATE_FULLSCREEN;
-    xcb_intern_atom_reply_t *reply;
+    if (pPriv->rootless || pPriv->detached)
+        return FALSE;
 
-    cookie_WINDOW_STATE = xcb_intern_atom(pPriv->conn, FALSE,
-                                          strlen("_NET_WM_STATE"),
-                                          "_NET_WM_STATE");
-    cookie_WINDOW_STATE_FULLSCREEN =
-        xcb_intern_atom(pPriv->conn, FALSE,
-                        strlen("_NET_WM_STATE_FULLSCREEN"),
-                        "_NET_WM_STATE_FULLSCREEN");
+    x1 = MAX(x1, pPriv->viewX);
+    y1 = MAX(y1, pPriv->viewY);
+    x2 = MIN(x2, pPriv->viewX + (int)pPriv->width);
+    y2 = MIN(y2, pPriv->viewY + (int)pPriv->height);
 
-    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WINDOW_STATE, NULL);
-    atom_WINDOW_STATE = reply->atom;
-    free(reply);
+    /* The frame buffer may not have been resized to the viewport yet */
+    x2 = MIN(x2, (int)pPriv->img->width);
+    y2 = MIN(y2, (int)pPriv->img->height);
 
-    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WINDOW_STATE_FULLSCREEN,
-                                  NULL);
-    atom_WINDOW_STATE_FULLSCREEN = reply->atom;
-    free(reply);
+    if (x1 >= x2 || y1 >= y2)
+        return FALSE;
 
-    xcb_change_property(pPriv->conn,
-                        XCB_PROP_MODE_REPLACE,
-                        pPriv->window,
-                        atom_WINDOW_STATE,
-                        XCB_ATOM_ATOM,
-                        32,
-                        1,
-                        &atom_WINDOW_STATE_FULLSCREEN);
+    if (pPriv->usingShm)
+        xcb_image_shm_put(pPriv->conn, pPriv->drawable,
+                          pPriv->gc, pPriv->img,
+                          pPriv->shminfo,
+                          x1, y1,
+                          x1 - pPriv->viewX, y1 - pPriv->viewY,
+                          x2 - x1, y2 - y1, FALSE);
+    else
+        _NestedClientPutImage(pPriv,
+                              pPriv->drawable,
+                              x1, y1,
+                              x2 - x1, y2 - y1,
+                              x1 - pPriv->viewX, y1 - pPriv->viewY);
+
+    if (pPriv->usingRender)
+        _NestedClientCompositeViewport(pPriv,
+                                       x1 - pPriv->viewX, y1 - pPriv->viewY,
+                                       x2 - pPriv->viewX, y2 - pPriv->viewY);
+
+    pPriv->uploadPending = TRUE;
+    return TRUE;
 }
 
 static void
-_NestedClientSetDeleteWindowHint(NestedClientPrivatePtr pPriv)
+NestedXcbUpdateScreen(NestedBackendScreenPtr pPriv,
+                      int16_t x1, int16_t y1,
+                      int16_t x2, int16_t y2)
 {
-    xcb_intern_atom_cookie_t cookie_WM_PROTOCOLS,
-                             cookie_WM_DELETE_WINDOW;
-    xcb_atom_t atom_WM_PROTOCOLS;
-    xcb_intern_atom_reply_t *reply;
+    _NestedClientUpload(pPriv, x1, y1, x2, y2);
+}
 
-    cookie_WM_PROTOCOLS = xcb_intern_atom(pPriv->conn, FALSE,
-                                          strlen("WM_PROTOCOLS"),
-                                          "WM_PROTOCOLS");
-    cookie_WM_DELETE_WINDOW =
-        xcb_intern_atom(pPriv->conn, FALSE,
-                        strlen("WM_DELETE_WINDOW"),
-                        "WM_DELETE_WINDOW");
+/* Any request with a reply will do: the host handles requests in order, so
+ * once it replies it is done reading the shared frame buffer */
+static void
+NestedXcbBeginSync(NestedBackendScreenPtr pPriv)
+{
+    if (!pPriv->uploadPending || pPriv->syncing)
+        return;
 
-    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WM_PROTOCOLS, NULL);
-    atom_WM_PROTOCOLS = reply->atom;
-    free(reply);
+    pPriv->syncCookie = xcb_get_input_focus(pPriv->conn);
+    pPriv->syncing = TRUE;
+    xcb_flush(pPriv->conn);
+}
 
-    reply = xcb_intern_atom_reply(pPriv->conn, cookie_WM_DELETE_WINDOW,
-                                  NULL);
-    atom_WM_DELETE_WINDOW = reply->atom;
-    free(reply);
+static void
+NestedXcbFinishSync(NestedBackendScreenPtr pPriv)
+{
+    if (!pPriv->syncing)
+        return;
 
-    xcb_change_property(pPriv->conn,
-                        XCB_PROP_MODE_REPLACE,
-                        pPriv->window,
-                        atom_WM_PROTOCOLS,
-                        XCB_ATOM_ATOM,
-                        32,
-                        1,
-                        &atom_WM_DELETE_WINDOW);
+    free(xcb_get_input_focus_reply(pPriv->conn, pPriv->syncCookie, NULL));
+    pPriv->syncing = FALSE;
+    pPriv->uploadPending = FALSE;
+    pPriv->xvShm[0].busy = FALSE;
+    pPriv->xvShm[1].busy = FALSE;
 }
 
 static void
-_NestedClientCreateWindow(NestedClientPrivatePtr pPriv)
+NestedXcbSetViewport(NestedBackendScreenPtr pPriv, int x, int y)
 {
-    xcb_size_hints_t sizeHints;
+    int dx = x - pPriv->viewX;
+    int dy = y - pPriv->viewY;
+    int w = pPriv->width;
+    int h = pPriv->height;
 
-    sizeHints.flags = XCB_ICCCM_SIZE_HINT_P_POSITION
-                      | XCB_ICCCM_SIZE_HINT_P_SIZE
-                      | XCB_ICCCM_SIZE_HINT_P_MIN_SIZE
-                      | XCB_ICCCM_SIZE_HINT_P_MAX_SIZE;
-    sizeHints.min_width = pPriv->width;
-    sizeHints.max_width = pPriv->width;
-    sizeHints.min_height = pPriv->height;
-    sizeHints.max_height = pPriv->height;
+    if (dx == 0 && dy == 0)
+        return;
 
-    pPriv->window = xcb_generate_id(pPriv->conn);
-    pPriv->img = NULL;
+    pPriv->viewX = x;
+    pPriv->viewY = y;
 
-    xcb_create_window(pPriv->conn,
-                      XCB_COPY_FROM_PARENT,
-                      pPriv->window,
-                      pPriv->rootWindow,
-                      0, 0, 100, 100, /* will resize */
-                      0,
-                      XCB_WINDOW_CLASS_COPY_FROM_PARENT,
-                      pPriv->visual->visual_id,
-                      pPriv->attr_mask,
-                      pPriv->attrs);
+    if (pPriv->blanked || pPriv->rootless || pPriv->detached)
+        return;
 
-    xcb_icccm_set_wm_normal_hints(pPriv->conn,
-                                  pPriv->window,
-                                  &sizeHints);
+    if (abs(dx) >= w || abs(dy) >= h)
+    {
+        NestedXcbUpdateScreen(pPriv, x, y, x + w, y + h);
+        return;
+    }
 
-    if (pPriv->usingFullscreen)
-        _NestedClientSetFullscreenHint(pPriv);
+    /* The host already has the part that is still visible, it just has to
+     * move it. Only the strips that scrolled in are uploaded. */
+    xcb_copy_area(pPriv->conn,
+                  pPriv->drawable, pPriv->drawable, pPriv->gc,
+                  MAX(dx, 0), MAX(dy, 0),
+                  MAX(-dx, 0), MAX(-dy, 0),
+                  w - abs(dx), h - abs(dy));
+
+    if (pPriv->usingRender)
+        _NestedClientComposite(pPriv, 0, 0,
+                               pPriv->windowWidth, pPriv->windowHeight);
+
+    if (dx > 0)
+        _NestedClientUpload(pPriv, x + w - dx, y, x + w, y + h);
+    else if (dx < 0)
+        _NestedClientUpload(pPriv, x, y, x - dx, y + h);
+
+    if (dy > 0)
+        _NestedClientUpload(pPriv, x, y + h - dy, x + w, y + h);
+    else if (dy < 0)
+        _NestedClientUpload(pPriv, x, y, x + w, y - dy);
+}
 
-    _NestedClientSetDeleteWindowHint(pPriv);
-    _NestedClientSetWindowTitle(pPriv, "");
-    _NestedClientSetWMClass(pPriv, "Xorg");
+/* Everything on the host went away with the connection, only local memory
+ * is left to free. The frame buffer is kept and drawn to as usual, its
+ * uploads are just skipped. */
+static void
+_NestedClientDetach(NestedBackendScreenPtr pPriv)
+{
+    int i;
 
+    for (i = 0; i < 2; i++)
     {
-        uint32_t mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
-        uint32_t values[2] = { pPriv->width, pPriv->height };
-        xcb_configure_window(pPriv->conn, pPriv->window, mask, values);
+        if (pPriv->xvShm[i].size == 0)
+            continue;
+
+        shmdt(pPriv->xvShm[i].info.shmaddr);
+        shmctl(pPriv->xvShm[i].info.shmid, IPC_RMID, 0);
+        pPriv->xvShm[i].size = 0;
+        pPriv->xvShm[i].busy = FALSE;
     }
 
-    xcb_map_window(pPriv->conn, pPriv->window);
+    /* Forwarding isn't set up again, drawing goes to the frame buffer */
+    pPriv->usingXv = FALSE;
+    pPriv->usingRenderForward = FALSE;
+    pPriv->usingCoreForward = FALSE;
+    pPriv->usingRender = FALSE;
+    pPriv->hasRender = FALSE;
+    pPriv->uploadPending = FALSE;
+    pPriv->syncing = FALSE;
 
+    if (pPriv->dev)
+        NestedInputSetFileDescriptor(pPriv->dev, -1);
+
+    xcb_disconnect(pPriv->conn);
+    pPriv->conn = NULL;
+    pPriv->visual = NULL;
+    pPriv->detached = TRUE;
+}
+
+/* The driver decides whether to go on without the host */
+static void
+_NestedClientHostGone(NestedBackendScreenPtr pPriv, Bool closed)
+{
+    if (!NestedHostDetached(pPriv->scrnIndex))
     {
-        uint32_t mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
-        uint32_t values[2] = { pPriv->x, pPriv->y };
-        xcb_configure_window(pPriv->conn, pPriv->window, mask, values);
+        /* XXX: Is there a better way to do this? */
+        if (!closed)
+            NestedXcbCloseScreen(pPriv);
+        exit(closed ? 0 : 1);
     }
+
+    _NestedClientDetach(pPriv);
 }
 
-NestedClientPrivatePtr
-NestedClientCreateScreen(int scrnIndex,
-                         Bool wantFullscreenHint,
-                         unsigned int width,
-                         unsigned int height,
-                         int originX,
-                         int originY,
-                         unsigned int depth,
-                         unsigned int bitsPerPixel,
-                         Pixel *retRedMask,
-                         Pixel *retGreenMask,
-                         Pixel *retBlueMask)
+static inline void
+_NestedClientProcessExpose(NestedBackendScreenPtr pPriv,
+                           xcb_generic_event_t *ev)
 {
-    NestedClientPrivatePtr pPriv = malloc(sizeof(struct NestedClientPrivate));
+    xcb_expose_event_t *xev = (xcb_expose_event_t *)ev;
 
-    if (!pPriv)
-        return NULL;
+    if (xev->window != pPriv->window)
+    {
+        NestedRootlessHostExpose(pPriv->scrnIndex, xev->window,
+                                 xev->x, xev->y, xev->width, xev->height);
+        return;
+    }
 
-    pPriv->scrnIndex = scrnIndex;
-    pPriv->usingFullscreen = wantFullscreenHint;
-    pPriv->width = width;
-    pPriv->height = height;
-    pPriv->x = originX;
-    pPriv->y = originY;
-    pPriv->dev = NULL;
+    if (pPriv->blanked)
+        return;
 
-    if (!_NestedClientHostXInit(pPriv))
+    /* The pixmap still has the picture, only the window lost it */
+    if (pPriv->usingRender)
     {
-        _NestedClientFree(pPriv);
-        return NULL;
+        _NestedClientComposite(pPriv, xev->x, xev->y, xev->width, xev->height);
+        return;
     }
 
-    _NestedClientCreateWindow(pPriv);
-    _NestedClientTryXShm(pPriv);
-    _NestedClientCreateXImage(pPriv, depth);
-    NestedClientHideCursor(pPriv);
+    NestedXcbUpdateScreen(pPriv,
+                          pPriv->viewX + xev->x,
+                          pPriv->viewY + xev->y,
+                          pPriv->viewX + xev->x + xev->width,
+                          pPriv->viewY + xev->y + xev->height);
+}
 
-#if 0
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bpp);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "red_mask: 0x%x\n", pPriv->visual->red_mask);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "gre_mask: 0x%x\n", pPriv->visual->green_mask);
-    xf86DrvMsg(pPriv->scrnIndex, X_INFO, "blu_mask: 0x%x\n", pPriv->visual->blue_mask);
-#endif
+/* Parts of the window that couldn't be copied when panning */
+static inline void
+_NestedClientProcessGraphicsExposure(NestedBackendScreenPtr pPriv,
+                                     xcb_generic_event_t *ev)
+{
+    xcb_graphics_exposure_event_t *gev = (xcb_graphics_exposure_event_t *)ev;
 
-    *retRedMask = pPriv->visual->red_mask;
-    *retGreenMask = pPriv->visual->green_mask;
-    *retBlueMask = pPriv->visual->blue_mask;
+    if (pPriv->blanked)
+        return;
 
-    return pPriv;
+    NestedXcbUpdateScreen(pPriv,
+                          pPriv->viewX + gev->x,
+                          pPriv->viewY + gev->y,
+                          pPriv->viewX + gev->x + gev->width,
+                          pPriv->viewY + gev->y + gev->height);
 }
 
-void
-NestedClientHideCursor(NestedClientPrivatePtr pPriv)
+/* A rootless window moved or resized by the host WM */
+static void
+_NestedClientProcessRootlessConfigure(NestedBackendScreenPtr pPriv,
+                                      xcb_configure_notify_event_t *cev)
 {
-    xcb_change_window_attributes(pPriv->conn,
-                                 pPriv->window,
-                                 XCB_CW_CURSOR,
-                                 &pPriv->emptyCursor);
-}
+    int x = cev->x;
+    int y = cev->y;
 
-char *
-NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv)
-{
-    return (char *)pPriv->img->data;
-}
+    /* Real events are relative to the frame a reparenting WM put the window
+     * in, the synthetic ones it sends are relative to the root */
+    if (!(cev->response_type & 0x80))
+    {
+        xcb_translate_coordinates_cookie_t c;
+        xcb_translate_coordinates_reply_t *r;
 
-void
-NestedClientUpdateScreen(NestedClientPrivatePtr pPriv,
-                         int16_t x1, int16_t y1,
-                         int16_t x2, int16_t y2)
-{
-    if (pPriv->usingShm)
-        xcb_image_shm_put(pPriv->conn, pPriv->window,
-                          pPriv->gc, pPriv->img,
-                          pPriv->shminfo,
-                          x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
-    else
-        xcb_image_put(pPriv->conn, pPriv->window, pPriv->gc,
-                      pPriv->img, x1, y1, 0);
+        c = xcb_translate_coordinates(pPriv->conn, cev->window,
+                                      pPriv->rootWindow, 0, 0);
+        r = xcb_translate_coordinates_reply(pPriv->conn, c, NULL);
+
+        if (!r)
+            return;
+
+        x = r->dst_x;
+        y = r->dst_y;
+        free(r);
+    }
 
-    xcb_aux_sync(pPriv->conn);
+    NestedRootlessHostConfigure(pPriv->scrnIndex, cev->window,
+                                x, y, cev->width, cev->height);
 }
 
 static inline void
-_NestedClientProcessExpose(NestedClientPrivatePtr pPriv,
-                           xcb_generic_event_t *ev)
+_NestedClientProcessConfigureNotify(NestedBackendScreenPtr pPriv,
+                                   xcb_generic_event_t *ev)
 {
-    xcb_expose_event_t *xev = (xcb_expose_event_t *)ev;
-    NestedClientUpdateScreen(pPriv,
-                             xev->x,
-                             xev->y,
-                             xev->x + xev->width,
-                             xev->y + xev->height);
+    xcb_configure_notify_event_t *cev = (xcb_configure_notify_event_t *)ev;
+
+    if (cev->window != pPriv->window)
+    {
+        _NestedClientProcessRootlessConfigure(pPriv, cev);
+        return;
+    }
+
+    /* Ignore our own resizes and plain moves */
+    if (cev->width == pPriv->windowWidth && cev->height == pPriv->windowHeight)
+        return;
+
+    pPriv->windowWidth = cev->width;
+    pPriv->windowHeight = cev->height;
+
+    if (!pPriv->usingRender)
+    {
+        pPriv->width = cev->width;
+        pPriv->height = cev->height;
+        NestedHostResized(pPriv->scrnIndex, cev->width, cev->height);
+        return;
+    }
+
+    _NestedClientSetTransform(pPriv);
+
+    if (!pPriv->blanked)
+        _NestedClientComposite(pPriv, 0, 0, cev->width, cev->height);
+
+    /* With a fixed scale the nested screen follows the window */
+    if (pPriv->scale > 0)
+        NestedHostResized(pPriv->scrnIndex,
+                          MAX(1, (unsigned int)(cev->width / pPriv->scale + 0.5)),
+                          MAX(1, (unsigned int)(cev->height / pPriv->scale + 0.5)));
 }
 
 static inline void
-_NestedClientProcessClientMessage(NestedClientPrivatePtr pPriv,
+_NestedClientProcessClientMessage(NestedBackendScreenPtr pPriv,
                                   xcb_generic_event_t *ev)
 {
     xcb_client_message_event_t *cmev = (xcb_client_message_event_t *)ev;
 
-    if (cmev->data.data32[0] == atom_WM_DELETE_WINDOW)
+    if (cmev->data.data32[0] != pPriv->wmDeleteWindowAtom)
+        return;
+
+    /* Closing a rootless window only closes that nested window */
+    if (cmev->window != pPriv->window)
     {
-        /* XXX: Is there a better way to do this? */
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_INFO,
-                   "Nested client window closed.\n");
-        free(ev);
-        exit(0);
+        NestedRootlessHostClose(pPriv->scrnIndex, cmev->window);
+        return;
     }
+
+    NestedClientMsg(pPriv->scrnIndex,
+                    X_INFO,
+                    "Nested client window closed.\n");
+    _NestedClientHostGone(pPriv, TRUE);
+}
+
+/* The host WM raises the windows it focuses, the nested stacking follows */
+static inline void
+_NestedClientProcessFocusIn(NestedBackendScreenPtr pPriv,
+                            xcb_generic_event_t *ev)
+{
+    xcb_focus_in_event_t *fev = (xcb_focus_in_event_t *)ev;
+
+    if (fev->event != pPriv->window && fev->mode == XCB_NOTIFY_MODE_NORMAL)
+        NestedRootlessHostRaise(pPriv->scrnIndex, fev->event);
 }
 
 static inline Bool
-_NestedClientEventCheckInputDevice(NestedClientPrivatePtr pPriv)
+_NestedClientEventCheckInputDevice(NestedBackendScreenPtr pPriv)
 {
     if (!pPriv->dev)
     {
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_INFO,
-                   "Input device is not yet initialized, ignoring input.\n");
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_INFO,
+                        "Input device is not yet initialized, ignoring input.\n");
 
         return FALSE;
     }
@@ -1080,20 +3640,35 @@ _NestedClientEventCheckInputDevice(NestedClientPrivatePtr pPriv)
 }
 
 static inline void
-_NestedClientProcessMotionNotify(NestedClientPrivatePtr pPriv,
+_NestedClientProcessMotionNotify(NestedBackendScreenPtr pPriv,
                                  xcb_generic_event_t *ev)
 {
     if (_NestedClientEventCheckInputDevice(pPriv))
     {
         xcb_motion_notify_event_t *mev = (xcb_motion_notify_event_t *)ev;
-        NestedInputPostMouseMotionEvent(pPriv->dev,
-                                        mev->event_x,
-                                        mev->event_y);
+        int x = mev->event_x;
+        int y = mev->event_y;
+
+        if (pPriv->rootless)
+        {
+            NestedInputPostMouseMotionEvent(pPriv->dev,
+                                            mev->root_x, mev->root_y);
+            return;
+        }
+
+        if (pPriv->usingRender)
+        {
+            x = x * (int)pPriv->width / (int)pPriv->windowWidth;
+            y = y * (int)pPriv->height / (int)pPriv->windowHeight;
+        }
+
+        NestedHostToScreen(pPriv->scrnIndex, &x, &y);
+        NestedInputPostMouseMotionEvent(pPriv->dev, x, y);
     }
 }
 
 static inline void
-_NestedClientProcessKeyPress(NestedClientPrivatePtr pPriv,
+_NestedClientProcessKeyPress(NestedBackendScreenPtr pPriv,
                              xcb_generic_event_t *ev)
 {
     if (_NestedClientEventCheckInputDevice(pPriv))
@@ -1104,7 +3679,7 @@ _NestedClientProcessKeyPress(NestedClientPrivatePtr pPriv,
 }
 
 static inline void
-_NestedClientProcessKeyRelease(NestedClientPrivatePtr pPriv,
+_NestedClientProcessKeyRelease(NestedBackendScreenPtr pPriv,
                                xcb_generic_event_t *ev)
 {
     if (_NestedClientEventCheckInputDevice(pPriv))
@@ -1115,7 +3690,7 @@ _NestedClientProcessKeyRelease(NestedClientPrivatePtr pPriv,
 }
 
 static inline void
-_NestedClientProcessButtonPress(NestedClientPrivatePtr pPriv,
+_NestedClientProcessButtonPress(NestedBackendScreenPtr pPriv,
                                 xcb_generic_event_t *ev)
 {
     if (_NestedClientEventCheckInputDevice(pPriv))
@@ -1126,7 +3701,7 @@ _NestedClientProcessButtonPress(NestedClientPrivatePtr pPriv,
 }
 
 static inline void
-_NestedClientProcessButtonRelease(NestedClientPrivatePtr pPriv,
+_NestedClientProcessButtonRelease(NestedBackendScreenPtr pPriv,
                                   xcb_generic_event_t *ev)
 {
     if (_NestedClientEventCheckInputDevice(pPriv))
@@ -1136,11 +3711,14 @@ _NestedClientProcessButtonRelease(NestedClientPrivatePtr pPriv,
     }
 }
 
-void
-NestedClientCheckEvents(NestedClientPrivatePtr pPriv)
+static void
+NestedXcbCheckEvents(NestedBackendScreenPtr pPriv)
 {
     xcb_generic_event_t *ev;
 
+    if (pPriv->detached)
+        return;
+
     while (TRUE)
     {
         ev = xcb_poll_for_event(pPriv->conn);
@@ -1148,15 +3726,14 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv)
         if (!ev)
         {
             if (_NestedClientConnectionHasError(pPriv->scrnIndex,
+                                                pPriv->displayName,
                                                 pPriv->conn))
             {
-                /* XXX: Is there a better way to do this? */
-                xf86DrvMsg(pPriv->scrnIndex,
-                           X_ERROR,
-                           "Connection with host X server lost.\n");
-                free(ev);
-                NestedClientCloseScreen(pPriv);
-                exit(1);
+                NestedClientMsg(pPriv->scrnIndex,
+                                X_ERROR,
+                                "Connection with host X server lost.\n");
+                _NestedClientHostGone(pPriv, FALSE);
+                return;
             }
 
             break;
@@ -1167,9 +3744,18 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv)
         case XCB_EXPOSE:
             _NestedClientProcessExpose(pPriv, ev);
             break;
+        case XCB_GRAPHICS_EXPOSURE:
+            _NestedClientProcessGraphicsExposure(pPriv, ev);
+            break;
+        case XCB_CONFIGURE_NOTIFY:
+            _NestedClientProcessConfigureNotify(pPriv, ev);
+            break;
         case XCB_CLIENT_MESSAGE:
             _NestedClientProcessClientMessage(pPriv, ev);
             break;
+        case XCB_FOCUS_IN:
+            _NestedClientProcessFocusIn(pPriv, ev);
+            break;
         case XCB_MOTION_NOTIFY:
             _NestedClientProcessMotionNotify(pPriv, ev);
             break;
@@ -1188,39 +3774,105 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv)
         }
 
         free(ev);
+
+        /* The window was closed */
+        if (pPriv->detached)
+            return;
+
         xcb_flush(pPriv->conn);
     }
+
+    /* Forwarded drawing is only queued */
+    xcb_flush(pPriv->conn);
 }
 
-void
-NestedClientCloseScreen(NestedClientPrivatePtr pPriv)
+static void
+NestedXcbCloseScreen(NestedBackendScreenPtr pPriv)
 {
-    if (pPriv->usingShm)
+    _NestedClientXvRelease(pPriv);
+    _NestedClientDestroyXImage(pPriv);
+    _NestedClientFree(pPriv);
+}
+
+/* Rootless windows were destroyed along with their nested windows */
+static void
+NestedXcbResetScreen(NestedBackendScreenPtr pPriv)
+{
+    int i;
+
+    /* The input device is created again with the next generation */
+    pPriv->dev = NULL;
+
+    if (pPriv->detached)
+        return;
+
+    _NestedClientXvRelease(pPriv);
+
+    if (pPriv->usingRenderForward)
     {
-        xcb_shm_detach(pPriv->conn, pPriv->shminfo.shmseg);
-        shmdt(pPriv->shminfo.shmaddr);
+        xcb_render_free_picture(pPriv->conn, pPriv->windowPicture);
+
+        for (i = NESTED_FORMAT_A8; i < NESTED_NUM_FORMATS; i++)
+            xcb_render_free_glyph_set(pPriv->conn, pPriv->glyphSets[i]);
+
+        pPriv->usingRenderForward = FALSE;
     }
 
-    xcb_image_destroy(pPriv->img);
-    _NestedClientFree(pPriv);
+    if (pPriv->usingCoreForward)
+    {
+        xcb_free_gc(pPriv->conn, pPriv->coreGc);
+        pPriv->usingCoreForward = FALSE;
+    }
+
+    xcb_flush(pPriv->conn);
+}
+
+/* The window keeps showing the last frame until the new generation paints
+ * its root window, which is then uploaded in one go */
+static Bool
+NestedXcbReuseScreen(NestedBackendScreenPtr pPriv,
+                     unsigned int fbWidth,
+                     unsigned int fbHeight,
+                     unsigned int width,
+                     unsigned int height,
+                     Pixel *retRedMask,
+                     Pixel *retGreenMask,
+                     Pixel *retBlueMask)
+{
+    if (pPriv->detached ||
+        pPriv->img->width != fbWidth || pPriv->img->height != fbHeight ||
+        pPriv->width != width || pPriv->height != height)
+        return FALSE;
+
+    NestedXcbSetBlanked(pPriv, FALSE);
+
+    *retRedMask = pPriv->visual->red_mask;
+    *retGreenMask = pPriv->visual->green_mask;
+    *retBlueMask = pPriv->visual->blue_mask;
+
+    return TRUE;
 }
 
-void
-NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev)
+static void
+NestedXcbSetDevicePtr(NestedBackendScreenPtr pPriv, DeviceIntPtr dev)
 {
     pPriv->dev = dev;
 }
 
-int
-NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv)
+static int
+NestedXcbGetFileDescriptor(NestedBackendScreenPtr pPriv)
 {
+    if (pPriv->detached)
+        return -1;
+
     return xcb_get_file_descriptor(pPriv->conn);
 }
 
-Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
-                                     KeySymsPtr keySyms,
-                                     CARD8 *modmap,
-                                     XkbControlsPtr ctrls)
+static Bool
+NestedXcbGetKeyboardMappings(NestedBackendScreenPtr pPriv,
+                             KeySymsPtr keySyms,
+                             CARD8 *modmap,
+                             XkbControlsPtr ctrls)
 {
     int mapWidth;
     int min_keycode, max_keycode;
@@ -1236,6 +3888,9 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
     xcb_xkb_use_extension_reply_t *use_r;
     xcb_xkb_get_controls_cookie_t controls_c;
     xcb_xkb_get_controls_reply_t *controls_r;
+
+    if (pPriv->detached)
+        return FALSE;
     
     use_c = xcb_xkb_use_extension(pPriv->conn,
                                   XCB_XKB_MAJOR_VERSION,
@@ -1243,14 +3898,14 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
     use_r = xcb_xkb_use_extension_reply(pPriv->conn, use_c, NULL);
     
     if (!use_r) {
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_ERROR,
-                   "Couldn't use XKB extension.\n");
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_ERROR,
+                        "Couldn't use XKB extension.\n");
         return FALSE;
     } else if (!use_r->supported) {
-        xf86DrvMsg(pPriv->scrnIndex,
-                   X_ERROR,
-                   "XKB extension is not supported in X server.\n");
+        NestedClientMsg(pPriv->scrnIndex,
+                        X_ERROR,
+                        "XKB extension is not supported in X server.\n");
         free(use_r);
         return FALSE;
     } else {
@@ -1263,9 +3918,9 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
                                                 NULL);
 
         if (!controls_r) {
-            xf86DrvMsg(pPriv->scrnIndex,
-                       X_ERROR,
-                       "Couldn't get XKB keyboard controls.");
+            NestedClientMsg(pPriv->scrnIndex,
+                            X_ERROR,
+                            "Couldn't get XKB keyboard controls.");
             return FALSE;
         }
 
@@ -1319,3 +3974,59 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv,
 
     return TRUE;
 }
+
+const NestedClientBackendRec nestedXcbBackend = {
+    .name = "xcb",
+    .Probe = NestedXcbProbe,
+    .DropProbe = NestedXcbDropProbe,
+    .CheckDisplay = NestedXcbCheckDisplay,
+    .ValidDepth = NestedXcbValidDepth,
+    .CreateScreen = NestedXcbCreateScreen,
+    .GetFrameBuffer = NestedXcbGetFrameBuffer,
+    .ResizeFrameBuffer = NestedXcbResizeFrameBuffer,
+    .ResizeWindow = NestedXcbResizeWindow,
+    .SetViewport = NestedXcbSetViewport,
+    .UpdateScreen = NestedXcbUpdateScreen,
+    .BeginSync = NestedXcbBeginSync,
+    .FinishSync = NestedXcbFinishSync,
+    .HideCursor = NestedXcbHideCursor,
+    .SetBlanked = NestedXcbSetBlanked,
+    .CheckEvents = NestedXcbCheckEvents,
+    .CloseScreen = NestedXcbCloseScreen,
+    .Reattach = NestedXcbReattach,
+    .ResetScreen = NestedXcbResetScreen,
+    .ReuseScreen = NestedXcbReuseScreen,
+    .SetDevicePtr = NestedXcbSetDevicePtr,
+    .GetFileDescriptor = NestedXcbGetFileDescriptor,
+    .GetKeyboardMappings = NestedXcbGetKeyboardMappings,
+    .XvInit = NestedXcbXvInit,
+    .XvQueryImageAttributes = NestedXcbXvQueryImageAttributes,
+    .XvSetColorKey = NestedXcbXvSetColorKey,
+    .XvPutImage = NestedXcbXvPutImage,
+    .XvStopVideo = NestedXcbXvStopVideo,
+    .RenderInit = NestedXcbRenderInit,
+    .RenderReady = NestedXcbRenderReady,
+    .RenderCreateSolid = NestedXcbRenderCreateSolid,
+    .RenderCreateLinearGradient = NestedXcbRenderCreateLinearGradient,
+    .RenderCreateRadialGradient = NestedXcbRenderCreateRadialGradient,
+    .RenderFreePicture = NestedXcbRenderFreePicture,
+    .RenderSetClip = NestedXcbRenderSetClip,
+    .RenderComposite = NestedXcbRenderComposite,
+    .RenderTrapezoids = NestedXcbRenderTrapezoids,
+    .RenderResetGlyphs = NestedXcbRenderResetGlyphs,
+    .RenderAddGlyph = NestedXcbRenderAddGlyph,
+    .RenderCompositeGlyphs = NestedXcbRenderCompositeGlyphs,
+    .CoreInit = NestedXcbCoreInit,
+    .CoreReady = NestedXcbCoreReady,
+    .CoreSetGC = NestedXcbCoreSetGC,
+    .CorePolyFillRect = NestedXcbCorePolyFillRect,
+    .CorePolySegment = NestedXcbCorePolySegment,
+    .CoreCopyArea = NestedXcbCoreCopyArea,
+    .CorePutImage = NestedXcbCorePutImage,
+    .RootlessReady = NestedXcbRootlessReady,
+    .RootlessCreateWindow = NestedXcbRootlessCreateWindow,
+    .RootlessConfigureWindow = NestedXcbRootlessConfigureWindow,
+    .RootlessRaiseWindow = NestedXcbRootlessRaiseWindow,
+    .RootlessDestroyWindow = NestedXcbRootlessDestroyWindow,
+    .RootlessUpdateWindow = NestedXcbRootlessUpdateWindow,
+};
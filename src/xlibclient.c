@@ -34,10 +34,12 @@
 #include "config.h"
 #endif
 
+#include <pthread.h>
 #include <stdlib.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/socket.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -50,20 +52,29 @@
 #include <xf86.h>
 
 #include "client.h"
+#include "nested_xauth.h"
 
 #ifdef NESTED_INPUT
 #include "nested_input.h"
 #endif
 
-struct NestedClientPrivate {
+struct NestedBackendScreen {
     Display *display;
     int screenNumber;
     Screen *screen;
     Window rootWindow;
     Window window;
+    unsigned int width;
+    unsigned int height;
+    int viewX; /* frame buffer position shown at the window origin */
+    int viewY;
+    unsigned int depth;
+    Bool usingFullscreen;
     XImage *img;
+    size_t bufferSize; /* bytes allocated for img->data */
     GC gc;
     Bool usingShm;
+    Bool blanked;
     XShmSegmentInfo shminfo;
     int scrnIndex; /* stored only for xf86DrvMsg usage */
     Cursor mycursor; /* Test cursor */
@@ -83,20 +94,63 @@ struct NestedClientPrivate {
 #endif
 };
 
+static void
+NestedXlibHideCursor(NestedBackendScreenPtr pPriv);
+
+static void
+NestedXlibUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                       int16_t y1, int16_t x2, int16_t y2);
+
+/* Opens the display of a screen. Xlib only reads $XAUTHORITY, but takes
+ * the cookie of the next display opened with XSetAuthorization(), which is
+ * global to the process; without a cookie for the display in the file,
+ * Xlib falls back to $XAUTHORITY. */
+static Display *
+NestedXlibOpenDisplay(const char *displayName, const char *xauthority) {
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    Xauth *entry;
+    Display *d;
+
+    if (!xauthority)
+        return XOpenDisplay(displayName);
+
+    entry = NestedXauthGet(xauthority, displayName);
+    if (!entry)
+        return XOpenDisplay(displayName);
+
+    pthread_mutex_lock(&mutex);
+
+    XSetAuthorization(entry->name, entry->name_length, entry->data,
+                      entry->data_length);
+    d = XOpenDisplay(displayName);
+    XSetAuthorization(NULL, 0, NULL, 0);
+
+    pthread_mutex_unlock(&mutex);
+
+    XauDisposeAuth(entry);
+    return d;
+}
+
 /* Checks if a display is open */
-Bool
-NestedClientCheckDisplay(int scrnIndex,
-                         const char *output,
-                         Bool enable,
-                         const char *parentOutput,
-                         char relation,
-                         unsigned int *width,
-                         unsigned int *height,
-                         int *x,
-                         int *y) {
+static Bool
+NestedXlibCheckDisplay(int scrnIndex,
+                       const char *displayName,
+                       const char *xauthority,
+                       const char *output,
+                       Bool enable,
+                       const char *parentOutput,
+                       char relation,
+                       unsigned int *width,
+                       unsigned int *height,
+                       int *x,
+                       int *y) {
     Display *d;
 
-    d = XOpenDisplay(NULL);
+    /* Screens are created from threads of their own, and this is the first
+     * Xlib call */
+    XInitThreads();
+
+    d = NestedXlibOpenDisplay(displayName, xauthority);
     if (!d) {
         return FALSE;
     } else {
@@ -105,99 +159,236 @@ NestedClientCheckDisplay(int scrnIndex,
     }
 }
 
-Bool
-NestedClientValidDepth(int depth) {
+static Bool
+NestedXlibValidDepth(int depth) {
     /* XXX: implement! */
     return TRUE;
 }
 
 static Bool
-NestedClientTryXShm(NestedClientPrivatePtr pPriv, int scrnIndex, int width, int height, int depth) {
+NestedXlibTryXShm(NestedBackendScreenPtr pPriv, int scrnIndex) {
     int shmMajor, shmMinor;
     Bool hasSharedPixmaps;
 
     if (!XShmQueryExtension(pPriv->display)) {
-        xf86DrvMsg(scrnIndex, X_INFO, "XShmQueryExtension failed.  Dropping XShm support.\n");
+        NestedClientMsg(scrnIndex, X_INFO, "XShmQueryExtension failed.  Dropping XShm support.\n");
 
         return FALSE;
     }
 
     if (XShmQueryVersion(pPriv->display, &shmMajor, &shmMinor,
                          &hasSharedPixmaps)) {
-        xf86DrvMsg(scrnIndex, X_INFO,
-                   "XShm extension version %d.%d %s shared pixmaps\n",
-                   shmMajor, shmMinor, (hasSharedPixmaps) ? "with" : "without");
+        NestedClientMsg(scrnIndex, X_INFO,
+                        "XShm extension version %d.%d %s shared pixmaps\n",
+                        shmMajor, shmMinor, (hasSharedPixmaps) ? "with" : "without");
     }
 
-    pPriv->img = XShmCreateImage(pPriv->display,
-                                 DefaultVisualOfScreen(pPriv->screen),
-                                 depth,
-                                 ZPixmap,
-                                 NULL, /* data */
-                                 &pPriv->shminfo,
-                                 width,
-                                 height);
-
-    if (!pPriv->img) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "XShmCreateImage failed.  Dropping XShm support.\n");
-        return FALSE;
-    }
+    return TRUE;
+}
+
+/* Only a host on a local socket can attach our segments */
+static NestedUploadMethod
+NestedXlibProbe(int scrnIndex,
+                const char *displayName,
+                const char *xauthority) {
+    NestedUploadMethod method = NESTED_UPLOAD_PUT_IMAGE;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    Display *d;
 
-    /* XXX: change the 0777 mask? */
-    pPriv->shminfo.shmid = shmget(IPC_PRIVATE,
-                                  pPriv->img->bytes_per_line *
-                                  pPriv->img->height,
-                                  IPC_CREAT | 0777);
+    /* This may be the first Xlib call, see NestedXlibCheckDisplay() */
+    XInitThreads();
 
-    if (pPriv->shminfo.shmid == -1) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "shmget failed.  Dropping XShm support.\n");
+    d = NestedXlibOpenDisplay(displayName, xauthority);
+    if (!d)
+        return NESTED_UPLOAD_NONE;
+
+    if (XShmQueryExtension(d) &&
+        getsockname(ConnectionNumber(d),
+                    (struct sockaddr *)&addr, &len) == 0 &&
+        addr.ss_family == AF_UNIX)
+        method = NESTED_UPLOAD_SHM;
+
+    XCloseDisplay(d);
+    return method;
+}
+
+static void
+NestedXlibDestroyImage(NestedBackendScreenPtr pPriv) {
+    if (!pPriv->img)
+        return;
+
+    if (pPriv->usingShm) {
+        XShmDetach(pPriv->display, &pPriv->shminfo);
+        pPriv->img->data = NULL;
+        XDestroyImage(pPriv->img);
+        shmdt(pPriv->shminfo.shmaddr);
+        shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
+    } else {
         XDestroyImage(pPriv->img);
-        return FALSE;
     }
 
-    pPriv->shminfo.shmaddr = (char *)shmat(pPriv->shminfo.shmid, NULL, 0);
+    pPriv->img = NULL;
+    pPriv->bufferSize = 0;
+}
+
+static XImage *
+NestedXlibNewImage(NestedBackendScreenPtr pPriv, char *data,
+                   unsigned int width, unsigned int height) {
+    if (pPriv->usingShm)
+        return XShmCreateImage(pPriv->display,
+                               DefaultVisualOfScreen(pPriv->screen),
+                               pPriv->depth,
+                               ZPixmap,
+                               data,
+                               &pPriv->shminfo,
+                               width,
+                               height);
+
+    return XCreateImage(pPriv->display,
+                        DefaultVisualOfScreen(pPriv->screen),
+                        pPriv->depth,
+                        ZPixmap,
+                        0, /* offset */
+                        data,
+                        width,
+                        height,
+                        32, /* XXX: bitmap_pad */
+                        0 /* XXX: bytes_per_line */);
+}
 
-    if (pPriv->shminfo.shmaddr == (char *) -1) {
-        xf86DrvMsg(scrnIndex, X_ERROR, "shmaddr failed.  Dropping XShm support.\n");
-        XDestroyImage(pPriv->img);
+static Bool
+NestedXlibCreateImage(NestedBackendScreenPtr pPriv,
+                      unsigned int width, unsigned int height) {
+    XImage *img;
+    size_t size;
+
+    img = NestedXlibNewImage(pPriv, NULL, width, height);
+    if (!img)
         return FALSE;
+
+    size = img->bytes_per_line * img->height;
+
+    if (pPriv->img && size <= pPriv->bufferSize) {
+        /* We are shrinking: keep the old buffer, just describe it with the
+         * new geometry */
+        img->data = pPriv->img->data;
+        pPriv->img->data = NULL;
+        XDestroyImage(pPriv->img);
+        pPriv->img = img;
+        return TRUE;
+    }
+
+    NestedXlibDestroyImage(pPriv);
+    pPriv->img = img;
+
+    if (pPriv->usingShm) {
+        /* XXX: change the 0777 mask? */
+        pPriv->shminfo.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0777);
+
+        if (pPriv->shminfo.shmid == -1) {
+            NestedClientMsg(pPriv->scrnIndex, X_ERROR, "shmget failed.  Dropping XShm support.\n");
+            XDestroyImage(pPriv->img);
+            pPriv->usingShm = FALSE;
+            pPriv->img = img = NestedXlibNewImage(pPriv, NULL, width, height);
+            if (!img)
+                return FALSE;
+        } else {
+            pPriv->shminfo.shmaddr = (char *)shmat(pPriv->shminfo.shmid, NULL, 0);
+
+            if (pPriv->shminfo.shmaddr == (char *) -1) {
+                NestedClientMsg(pPriv->scrnIndex, X_ERROR, "shmaddr failed.  Dropping XShm support.\n");
+                shmctl(pPriv->shminfo.shmid, IPC_RMID, 0);
+                XDestroyImage(pPriv->img);
+                pPriv->usingShm = FALSE;
+                pPriv->img = img = NestedXlibNewImage(pPriv, NULL, width, height);
+                if (!img)
+                    return FALSE;
+            } else {
+                pPriv->img->data = pPriv->shminfo.shmaddr;
+                pPriv->shminfo.readOnly = FALSE;
+                XShmAttach(pPriv->display, &pPriv->shminfo);
+            }
+        }
     }
 
-    pPriv->img->data = pPriv->shminfo.shmaddr;
-    pPriv->shminfo.readOnly = FALSE;
-    XShmAttach(pPriv->display, &pPriv->shminfo);
-    pPriv->usingShm = TRUE;
+    if (!pPriv->usingShm) {
+        pPriv->img->data = malloc(size);
+
+        if (!pPriv->img->data) {
+            XDestroyImage(pPriv->img);
+            pPriv->img = NULL;
+            return FALSE;
+        }
+    }
 
+    pPriv->bufferSize = size;
     return TRUE;
 }
 
-
-NestedClientPrivatePtr
-NestedClientCreateScreen(int scrnIndex,
-                         Bool wantFullscreenHint,
-                         unsigned int width,
-                         unsigned int height,
-                         int originX,
-                         int originY,
-                         unsigned int depth,
-                         unsigned int bitsPerPixel,
-                         Pixel *retRedMask,
-                         Pixel *retGreenMask,
-                         Pixel *retBlueMask) {
-    NestedClientPrivatePtr pPriv;
+static void
+NestedXlibSetSizeHints(NestedBackendScreenPtr pPriv) {
     XSizeHints sizeHints;
+
+    sizeHints.flags = PPosition | PSize;
+    sizeHints.width = pPriv->width;
+    sizeHints.height = pPriv->height;
+
+    /* A fullscreen window can't be resized, any other window can and the
+     * nested screen follows it through RandR */
+    if (pPriv->usingFullscreen) {
+        sizeHints.flags |= PMinSize | PMaxSize;
+        sizeHints.min_width = pPriv->width;
+        sizeHints.max_width = pPriv->width;
+        sizeHints.min_height = pPriv->height;
+        sizeHints.max_height = pPriv->height;
+    }
+
+    XSetWMNormalHints(pPriv->display, pPriv->window, &sizeHints);
+}
+
+static NestedBackendScreenPtr
+NestedXlibCreateScreen(int scrnIndex,
+                       const char *displayName,
+                       const char *xauthority,
+                       Bool wantFullscreenHint,
+                       Bool rootless,
+                       Bool withInput,
+                       unsigned int fbWidth,
+                       unsigned int fbHeight,
+                       unsigned int width,
+                       unsigned int height,
+                       int originX,
+                       int originY,
+                       double scale,
+                       unsigned int depth,
+                       unsigned int bitsPerPixel,
+                       Pixel *retRedMask,
+                       Pixel *retGreenMask,
+                       Pixel *retBlueMask) {
+    NestedBackendScreenPtr pPriv;
     Bool supported;
     char windowTitle[32];
+    long eventMask;
 
-    pPriv = malloc(sizeof(struct NestedClientPrivate));
+    pPriv = malloc(sizeof(struct NestedBackendScreen));
     pPriv->scrnIndex = scrnIndex;
 
-    /* Needed until we can pass authorization file
-     * directly to XOpenDisplay() */
-    if (xauthFile != NULL)
-        setenv("XAUTHORITY", xauthFile, 1);
-
-    pPriv->display = XOpenDisplay(NULL);
+    if (scale != 1.0)
+        NestedClientMsg(scrnIndex, X_WARNING,
+                        "Scaling needs the xcb backend, ignoring \"Scale\".\n");
+
+    pPriv->blanked = FALSE;
+    pPriv->width = width;
+    pPriv->height = height;
+    pPriv->viewX = 0;
+    pPriv->viewY = 0;
+    pPriv->depth = depth;
+    pPriv->usingFullscreen = wantFullscreenHint;
+    pPriv->img = NULL;
+    pPriv->bufferSize = 0;
+
+    pPriv->display = NestedXlibOpenDisplay(displayName, xauthority);
     if (!pPriv->display)
         return NULL;
 
@@ -205,7 +396,7 @@ NestedClientCreateScreen(int scrnIndex,
     supported = XkbQueryExtension(pPriv->display, &pPriv->xkb.op, &pPriv->xkb.event,
                                   &pPriv->xkb.error, &pPriv->xkb.major, &pPriv->xkb.minor);
     if (!supported) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "The remote server does not support the XKEYBOARD extension.\n");
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "The remote server does not support the XKEYBOARD extension.\n");
         XCloseDisplay(pPriv->display);
         return NULL;
     }
@@ -219,12 +410,7 @@ NestedClientCreateScreen(int scrnIndex,
     pPriv->window = XCreateSimpleWindow(pPriv->display, pPriv->rootWindow,
     originX, originY, width, height, 0, 0, 0);
 
-    sizeHints.flags = PPosition | PSize | PMinSize | PMaxSize;
-    sizeHints.min_width = width;
-    sizeHints.max_width = width;
-    sizeHints.min_height = height;
-    sizeHints.max_height = height;
-    XSetWMNormalHints(pPriv->display, pPriv->window, &sizeHints);
+    NestedXlibSetSizeHints(pPriv);
 
     snprintf(windowTitle, sizeof(windowTitle), "Screen %d", scrnIndex);
 
@@ -232,51 +418,35 @@ NestedClientCreateScreen(int scrnIndex,
     
     XMapWindow(pPriv->display, pPriv->window);
 
-    XSelectInput(pPriv->display, pPriv->window,
+    eventMask = StructureNotifyMask | ExposureMask;
 #ifdef NESTED_INPUT
-                 PointerMotionMask |
-                 EnterWindowMask   |
-                 LeaveWindowMask   |
-                 ButtonPressMask   |
-                 ButtonReleaseMask |
-                 KeyPressMask      |
-                 KeyReleaseMask    |
+    if (withInput)
+        eventMask |= PointerMotionMask |
+                     EnterWindowMask   |
+                     LeaveWindowMask   |
+                     ButtonPressMask   |
+                     ButtonReleaseMask |
+                     KeyPressMask      |
+                     KeyReleaseMask;
 #endif
-                 ExposureMask);
-
-    if (!NestedClientTryXShm(pPriv, scrnIndex, width, height, depth)) {
-        pPriv->img = XCreateImage(pPriv->display,
-        DefaultVisualOfScreen(pPriv->screen),
-                              depth,
-                              ZPixmap,
-                              0, /* offset */
-                              NULL, /* data */
-                              width,
-                              height,
-                              32, /* XXX: bitmap_pad */
-                              0 /* XXX: bytes_per_line */);
-
-        if (!pPriv->img)
-            return NULL;
-
-        pPriv->img->data = malloc(pPriv->img->bytes_per_line * pPriv->img->height);
-        pPriv->usingShm = FALSE;
-    }
+    XSelectInput(pPriv->display, pPriv->window, eventMask);
+
+    pPriv->usingShm = NestedXlibTryXShm(pPriv, scrnIndex);
 
-    if (!pPriv->img->data)
+    if (!NestedXlibCreateImage(pPriv, fbWidth, fbHeight))
         return NULL;
 
-    NestedClientHideCursor(pPriv); /* Hide cursor */
+    NestedXlibHideCursor(pPriv); /* Hide cursor */
 
 #if 0
-xf86DrvMsg(scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
-xf86DrvMsg(scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
-xf86DrvMsg(scrnIndex, X_INFO, "xoffset: %d\n", pPriv->img->xoffset);
-xf86DrvMsg(scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
-xf86DrvMsg(scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bits_per_pixel);
-xf86DrvMsg(scrnIndex, X_INFO, "red_mask: 0x%lx\n", pPriv->img->red_mask);
-xf86DrvMsg(scrnIndex, X_INFO, "gre_mask: 0x%lx\n", pPriv->img->green_mask);
-xf86DrvMsg(scrnIndex, X_INFO, "blu_mask: 0x%lx\n", pPriv->img->blue_mask);
+NestedClientMsg(scrnIndex, X_INFO, "width: %d\n", pPriv->img->width);
+NestedClientMsg(scrnIndex, X_INFO, "height: %d\n", pPriv->img->height);
+NestedClientMsg(scrnIndex, X_INFO, "xoffset: %d\n", pPriv->img->xoffset);
+NestedClientMsg(scrnIndex, X_INFO, "depth: %d\n", pPriv->img->depth);
+NestedClientMsg(scrnIndex, X_INFO, "bpp: %d\n", pPriv->img->bits_per_pixel);
+NestedClientMsg(scrnIndex, X_INFO, "red_mask: 0x%lx\n", pPriv->img->red_mask);
+NestedClientMsg(scrnIndex, X_INFO, "gre_mask: 0x%lx\n", pPriv->img->green_mask);
+NestedClientMsg(scrnIndex, X_INFO, "blu_mask: 0x%lx\n", pPriv->img->blue_mask);
 #endif
 
     *retRedMask = pPriv->img->red_mask;
@@ -296,7 +466,8 @@ xf86DrvMsg(scrnIndex, X_INFO, "blu_mask: 0x%lx\n", pPriv->img->blue_mask);
     return pPriv;
 }
 
-void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
+static void
+NestedXlibHideCursor(NestedBackendScreenPtr pPriv) {
     char noData[]= {0,0,0,0,0,0,0,0};
     pPriv->color1.red = pPriv->color1.green = pPriv->color1.blue = 0;
 
@@ -311,58 +482,210 @@ void NestedClientHideCursor(NestedClientPrivatePtr pPriv) {
     XFreeCursor(pPriv->display, pPriv->mycursor);
 }
 
-char *
-NestedClientGetFrameBuffer(NestedClientPrivatePtr pPriv) {
+static void
+NestedXlibSetBlanked(NestedBackendScreenPtr pPriv, Bool blanked) {
+    if (pPriv->blanked == blanked)
+        return;
+
+    pPriv->blanked = blanked;
+
+    if (blanked) {
+        XSetWindowBackground(pPriv->display, pPriv->window,
+                             BlackPixel(pPriv->display, pPriv->screenNumber));
+        XClearWindow(pPriv->display, pPriv->window);
+        XFlush(pPriv->display);
+    } else {
+        XSetWindowBackgroundPixmap(pPriv->display, pPriv->window, None);
+        NestedXlibUpdateScreen(pPriv, pPriv->viewX, pPriv->viewY,
+                               pPriv->viewX + pPriv->width,
+                               pPriv->viewY + pPriv->height);
+    }
+}
+
+static char *
+NestedXlibGetFrameBuffer(NestedBackendScreenPtr pPriv) {
     return pPriv->img->data;
 }
 
-void
-NestedClientUpdateScreen(NestedClientPrivatePtr pPriv, int16_t x1,
-                          int16_t y1, int16_t x2, int16_t y2) {
+static Bool
+NestedXlibResizeFrameBuffer(NestedBackendScreenPtr pPriv,
+                            unsigned int width, unsigned int height) {
+    return NestedXlibCreateImage(pPriv, width, height);
+}
+
+static Bool
+NestedXlibResizeWindow(NestedBackendScreenPtr pPriv,
+                       unsigned int width, unsigned int height) {
+    if (pPriv->width == width && pPriv->height == height)
+        return TRUE;
+
+    pPriv->width = width;
+    pPriv->height = height;
+
+    NestedXlibSetSizeHints(pPriv);
+    XResizeWindow(pPriv->display, pPriv->window, width, height);
+    XFlush(pPriv->display);
+
+    return TRUE;
+}
+
+static void
+NestedXlibUpdateScreen(NestedBackendScreenPtr pPriv, int16_t x1,
+                       int16_t y1, int16_t x2, int16_t y2) {
+    /* Only the part of the frame buffer inside the viewport is uploaded */
+    if (x1 < pPriv->viewX)
+        x1 = pPriv->viewX;
+    if (y1 < pPriv->viewY)
+        y1 = pPriv->viewY;
+    if (x2 > pPriv->viewX + (int)pPriv->width)
+        x2 = pPriv->viewX + pPriv->width;
+    if (y2 > pPriv->viewY + (int)pPriv->height)
+        y2 = pPriv->viewY + pPriv->height;
+
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
     if (pPriv->usingShm) {
         XShmPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
-                     x1, y1, x1, y1, x2 - x1, y2 - y1, FALSE);
+                     x1, y1, x1 - pPriv->viewX, y1 - pPriv->viewY,
+                     x2 - x1, y2 - y1, FALSE);
         /* Without this sync we get some freezes, probably due to some lock
          * in the shm usage */
         XSync(pPriv->display, FALSE);
     } else {
         XPutImage(pPriv->display, pPriv->window, pPriv->gc, pPriv->img,
-                  x1, y1, x1, y1, x2 - x1, y2 - y1);
+                  x1, y1, x1 - pPriv->viewX, y1 - pPriv->viewY,
+                  x2 - x1, y2 - y1);
+    }
+}
+
+/* Uploads are synchronous */
+static void
+NestedXlibBeginSync(NestedBackendScreenPtr pPriv) {
+}
+
+static void
+NestedXlibFinishSync(NestedBackendScreenPtr pPriv) {
+}
+
+static void
+NestedXlibSetViewport(NestedBackendScreenPtr pPriv, int x, int y) {
+    int dx = x - pPriv->viewX;
+    int dy = y - pPriv->viewY;
+    int w = pPriv->width;
+    int h = pPriv->height;
+
+    if (dx == 0 && dy == 0)
+        return;
+
+    pPriv->viewX = x;
+    pPriv->viewY = y;
+
+    if (pPriv->blanked)
+        return;
+
+    if (abs(dx) >= w || abs(dy) >= h) {
+        NestedXlibUpdateScreen(pPriv, x, y, x + w, y + h);
+        return;
     }
+
+    /* The host already has the part that is still visible, it just has to
+     * move it. Only the strips that scrolled in are uploaded; what the copy
+     * couldn't get comes back as GraphicsExpose. */
+    XCopyArea(pPriv->display, pPriv->window, pPriv->window, pPriv->gc,
+              max(dx, 0), max(dy, 0), w - abs(dx), h - abs(dy),
+              max(-dx, 0), max(-dy, 0));
+
+    if (dx > 0)
+        NestedXlibUpdateScreen(pPriv, x + w - dx, y, x + w, y + h);
+    else if (dx < 0)
+        NestedXlibUpdateScreen(pPriv, x, y, x - dx, y + h);
+
+    if (dy > 0)
+        NestedXlibUpdateScreen(pPriv, x, y + h - dy, x + w, y + h);
+    else if (dy < 0)
+        NestedXlibUpdateScreen(pPriv, x, y, x + w, y - dy);
+
+    XFlush(pPriv->display);
 }
 
-void
-NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
+static void
+NestedXlibCheckEvents(NestedBackendScreenPtr pPriv) {
     XEvent ev;
+#ifdef NESTED_INPUT
+    int x, y;
+#endif
+
+    /* The copies made when panning answer with GraphicsExpose for the parts
+     * that couldn't be copied, or NoExpose. Neither has an event mask, so
+     * XCheckMaskEvent() below never returns them. */
+    while (XCheckTypedWindowEvent(pPriv->display, pPriv->window,
+                                  GraphicsExpose, &ev)) {
+        if (pPriv->blanked)
+            continue;
+
+        NestedXlibUpdateScreen(pPriv,
+                               pPriv->viewX + ev.xgraphicsexpose.x,
+                               pPriv->viewY + ev.xgraphicsexpose.y,
+                               pPriv->viewX + ev.xgraphicsexpose.x +
+                               ev.xgraphicsexpose.width,
+                               pPriv->viewY + ev.xgraphicsexpose.y +
+                               ev.xgraphicsexpose.height);
+    }
+
+    while (XCheckTypedWindowEvent(pPriv->display, pPriv->window,
+                                  NoExpose, &ev))
+        ;
 
     while(XCheckMaskEvent(pPriv->display, ~0, &ev)) {
         switch (ev.type) {
         case Expose:
-            NestedClientUpdateScreen(pPriv,
-                                     ((XExposeEvent*)&ev)->x,
-                                     ((XExposeEvent*)&ev)->y,
-                                     ((XExposeEvent*)&ev)->x + 
-                                     ((XExposeEvent*)&ev)->width,
-                                     ((XExposeEvent*)&ev)->y + 
-                                     ((XExposeEvent*)&ev)->height);
+            if (pPriv->blanked)
+                break;
+
+            NestedXlibUpdateScreen(pPriv,
+                                   pPriv->viewX +
+                                   ((XExposeEvent*)&ev)->x,
+                                   pPriv->viewY +
+                                   ((XExposeEvent*)&ev)->y,
+                                   pPriv->viewX +
+                                   ((XExposeEvent*)&ev)->x + 
+                                   ((XExposeEvent*)&ev)->width,
+                                   pPriv->viewY +
+                                   ((XExposeEvent*)&ev)->y + 
+                                   ((XExposeEvent*)&ev)->height);
+            break;
+
+        case ConfigureNotify:
+            /* Ignore our own resizes and plain moves */
+            if (ev.xconfigure.window != pPriv->window ||
+                (ev.xconfigure.width == pPriv->width &&
+                 ev.xconfigure.height == pPriv->height))
+                break;
+
+            pPriv->width = ev.xconfigure.width;
+            pPriv->height = ev.xconfigure.height;
+            NestedHostResized(pPriv->scrnIndex,
+                              ev.xconfigure.width, ev.xconfigure.height);
             break;
 
 #ifdef NESTED_INPUT
         case MotionNotify:
             if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
                 break;
             }
 
-            NestedInputPostMouseMotionEvent(pPriv->dev,
-                                            ((XMotionEvent*)&ev)->x,
-                                            ((XMotionEvent*)&ev)->y);
+            x = ((XMotionEvent*)&ev)->x;
+            y = ((XMotionEvent*)&ev)->y;
+            NestedHostToScreen(pPriv->scrnIndex, &x, &y);
+            NestedInputPostMouseMotionEvent(pPriv->dev, x, y);
             break;
 
         case ButtonPress:
         case ButtonRelease:
             if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
                 break;
             }
 
@@ -372,7 +695,7 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
         case KeyPress:
         case KeyRelease:
             if (!pPriv->dev) {
-                xf86DrvMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
+                NestedClientMsg(pPriv->scrnIndex, X_INFO, "Input device is not yet initialized, ignoring input.\n");
                 break;
             }
 
@@ -383,29 +706,238 @@ NestedClientCheckEvents(NestedClientPrivatePtr pPriv) {
     }
 }
 
-void
-NestedClientCloseScreen(NestedClientPrivatePtr pPriv) {
-    if (pPriv->usingShm) {
-        XShmDetach(pPriv->display, &pPriv->shminfo);
-        shmdt(pPriv->shminfo.shmaddr);
-    }
+/* XVideo forwarding is only implemented by the xcb backend */
+static Bool
+NestedXlibXvInit(NestedBackendScreenPtr pPriv, XF86ImagePtr *retImages,
+                 int *retNumImages, unsigned short *retMaxWidth,
+                 unsigned short *retMaxHeight) {
+    return FALSE;
+}
+
+static int
+NestedXlibXvQueryImageAttributes(NestedBackendScreenPtr pPriv, int id,
+                                 unsigned short *width,
+                                 unsigned short *height,
+                                 int *pitches, int *offsets) {
+    return 0;
+}
+
+static Bool
+NestedXlibXvSetColorKey(NestedBackendScreenPtr pPriv, CARD32 colorKey) {
+    return FALSE;
+}
+
+static void
+NestedXlibXvPutImage(NestedBackendScreenPtr pPriv, int id,
+                     unsigned char *buf, short width, short height,
+                     short srcX, short srcY, short srcWidth, short srcHeight,
+                     short dstX, short dstY, short dstWidth, short dstHeight,
+                     BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedXlibXvStopVideo(NestedBackendScreenPtr pPriv) {
+}
+
+/* So is RENDER forwarding; NestedXlibRenderInit() failing keeps the driver
+ * from calling any of the others */
+static Bool
+NestedXlibRenderInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedXlibRenderReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedXlibRenderCreateSolid(NestedBackendScreenPtr pPriv,
+                            xRenderColor *color) {
+    return None;
+}
+
+static CARD32
+NestedXlibRenderCreateLinearGradient(NestedBackendScreenPtr pPriv,
+                                     xPointFixed *p1, xPointFixed *p2,
+                                     int numStops, xFixed *stops,
+                                     xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static CARD32
+NestedXlibRenderCreateRadialGradient(NestedBackendScreenPtr pPriv,
+                                     xPointFixed *inner, xPointFixed *outer,
+                                     xFixed innerRadius, xFixed outerRadius,
+                                     int numStops, xFixed *stops,
+                                     xRenderColor *colors, int repeat) {
+    return None;
+}
+
+static void
+NestedXlibRenderFreePicture(NestedBackendScreenPtr pPriv, CARD32 picture) {
+}
+
+static void
+NestedXlibRenderSetClip(NestedBackendScreenPtr pPriv, BoxPtr boxes,
+                        int numBoxes) {
+}
+
+static void
+NestedXlibRenderComposite(NestedBackendScreenPtr pPriv, CARD8 op,
+                          CARD32 src, CARD32 mask,
+                          INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+                          INT16 xDst, INT16 yDst,
+                          CARD16 width, CARD16 height) {
+}
+
+static Bool
+NestedXlibRenderTrapezoids(NestedBackendScreenPtr pPriv, CARD8 op,
+                           CARD32 src, int maskFormat,
+                           INT16 xSrc, INT16 ySrc,
+                           int xOrigin, int yOrigin,
+                           int numTraps, xTrapezoid *traps) {
+    return FALSE;
+}
+
+static void
+NestedXlibRenderResetGlyphs(NestedBackendScreenPtr pPriv, int format) {
+}
+
+static void
+NestedXlibRenderAddGlyph(NestedBackendScreenPtr pPriv, int format,
+                         CARD32 id, xGlyphInfo *info,
+                         const char *data, int size) {
+}
 
-    XDestroyImage(pPriv->img);
+static Bool
+NestedXlibRenderCompositeGlyphs(NestedBackendScreenPtr pPriv, CARD8 op,
+                                CARD32 src, int maskFormat, int format,
+                                INT16 xSrc, INT16 ySrc,
+                                int xOrigin, int yOrigin,
+                                int numLists, NestedGlyphListPtr lists,
+                                CARD32 *glyphs) {
+    return FALSE;
+}
+
+/* Core drawing forwarding as well */
+static Bool
+NestedXlibCoreInit(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static Bool
+NestedXlibCoreReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static void
+NestedXlibCoreSetGC(NestedBackendScreenPtr pPriv, int alu,
+                    CARD32 planeMask, CARD32 foreground, int capStyle,
+                    BoxPtr clipBoxes, int numClipBoxes) {
+}
+
+static void
+NestedXlibCorePolyFillRect(NestedBackendScreenPtr pPriv,
+                           int xOrigin, int yOrigin,
+                           int numRects, xRectangle *rects) {
+}
+
+static void
+NestedXlibCorePolySegment(NestedBackendScreenPtr pPriv,
+                          int xOrigin, int yOrigin,
+                          int numSegments, xSegment *segments) {
+}
+
+static Bool
+NestedXlibCoreCopyArea(NestedBackendScreenPtr pPriv, int srcX, int srcY,
+                       int width, int height, int dstX, int dstY) {
+    return FALSE;
+}
+
+static Bool
+NestedXlibCorePutImage(NestedBackendScreenPtr pPriv, int depth,
+                       int x, int y, int width, int height,
+                       int stride, char *data) {
+    return FALSE;
+}
+
+/* Rootless mode isn't supported, the screen is shown as usual */
+static Bool
+NestedXlibRootlessReady(NestedBackendScreenPtr pPriv) {
+    return FALSE;
+}
+
+static CARD32
+NestedXlibRootlessCreateWindow(NestedBackendScreenPtr pPriv, int x, int y,
+                               unsigned int width, unsigned int height,
+                               Bool overrideRedirect,
+                               const char *name, int nameLength) {
+    return 0;
+}
+
+static void
+NestedXlibRootlessConfigureWindow(NestedBackendScreenPtr pPriv,
+                                  CARD32 window, int x, int y,
+                                  unsigned int width, unsigned int height) {
+}
+
+static void
+NestedXlibRootlessRaiseWindow(NestedBackendScreenPtr pPriv, CARD32 window) {
+}
+
+static void
+NestedXlibRootlessDestroyWindow(NestedBackendScreenPtr pPriv,
+                                CARD32 window) {
+}
+
+static void
+NestedXlibRootlessUpdateWindow(NestedBackendScreenPtr pPriv, CARD32 window,
+                               int x, int y, BoxPtr boxes, int numBoxes) {
+}
+
+
+static void
+NestedXlibCloseScreen(NestedBackendScreenPtr pPriv) {
+    NestedXlibDestroyImage(pPriv);
     XCloseDisplay(pPriv->display);
 }
 
-void
-NestedClientSetDevicePtr(NestedClientPrivatePtr pPriv, DeviceIntPtr dev) {
+/* The Xlib backend exits when it loses the host */
+static Bool
+NestedXlibReattach(NestedBackendScreenPtr pPriv, const char *displayName,
+                   const char *xauthority) {
+    return FALSE;
+}
+
+/* Screens are always created again */
+static void
+NestedXlibResetScreen(NestedBackendScreenPtr pPriv) {
+}
+
+static Bool
+NestedXlibReuseScreen(NestedBackendScreenPtr pPriv,
+                      unsigned int fbWidth, unsigned int fbHeight,
+                      unsigned int width, unsigned int height,
+                      Pixel *retRedMask, Pixel *retGreenMask,
+                      Pixel *retBlueMask) {
+    return FALSE;
+}
+
+static void
+NestedXlibSetDevicePtr(NestedBackendScreenPtr pPriv, DeviceIntPtr dev) {
     pPriv->dev = dev;
 }
 
-int
-NestedClientGetFileDescriptor(NestedClientPrivatePtr pPriv) {
+static int
+NestedXlibGetFileDescriptor(NestedBackendScreenPtr pPriv) {
     return ConnectionNumber(pPriv->display);
 }
 
 #ifdef NESTED_INPUT
-Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr keySyms, CARD8 *modmap, XkbControlsPtr ctrls) {
+static Bool
+NestedXlibGetKeyboardMappings(NestedBackendScreenPtr pPriv, KeySymsPtr keySyms,
+                              CARD8 *modmap, XkbControlsPtr ctrls) {
     XModifierKeymap *modifier_keymap;
     KeySym *keymap;
     int mapWidth;
@@ -436,13 +968,13 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr ke
 
     xkb = XkbGetKeyboard(pPriv->display, XkbGBN_AllComponentsMask, XkbUseCoreKbd);
     if (xkb == NULL || xkb->geom == NULL) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard.\n");
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard.\n");
         free(keymap);
         return FALSE;
     }
 
     if(XkbGetControls(pPriv->display, XkbAllControlsMask, xkb) != Success) {
-        xf86DrvMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard controls.\n");
+        NestedClientMsg(pPriv->scrnIndex, X_ERROR, "Couldn't get XKB keyboard controls.\n");
         free(keymap);
         return FALSE;
     }
@@ -452,3 +984,60 @@ Bool NestedClientGetKeyboardMappings(NestedClientPrivatePtr pPriv, KeySymsPtr ke
     return TRUE;
 }
 #endif
+
+const NestedClientBackendRec nestedXlibBackend = {
+    .name = "xlib",
+    .Probe = NestedXlibProbe,
+    .CheckDisplay = NestedXlibCheckDisplay,
+    .ValidDepth = NestedXlibValidDepth,
+    .CreateScreen = NestedXlibCreateScreen,
+    .GetFrameBuffer = NestedXlibGetFrameBuffer,
+    .ResizeFrameBuffer = NestedXlibResizeFrameBuffer,
+    .ResizeWindow = NestedXlibResizeWindow,
+    .SetViewport = NestedXlibSetViewport,
+    .UpdateScreen = NestedXlibUpdateScreen,
+    .BeginSync = NestedXlibBeginSync,
+    .FinishSync = NestedXlibFinishSync,
+    .HideCursor = NestedXlibHideCursor,
+    .SetBlanked = NestedXlibSetBlanked,
+    .CheckEvents = NestedXlibCheckEvents,
+    .CloseScreen = NestedXlibCloseScreen,
+    .Reattach = NestedXlibReattach,
+    .ResetScreen = NestedXlibResetScreen,
+    .ReuseScreen = NestedXlibReuseScreen,
+    .SetDevicePtr = NestedXlibSetDevicePtr,
+    .GetFileDescriptor = NestedXlibGetFileDescriptor,
+#ifdef NESTED_INPUT
+    .GetKeyboardMappings = NestedXlibGetKeyboardMappings,
+#endif
+    .XvInit = NestedXlibXvInit,
+    .XvQueryImageAttributes = NestedXlibXvQueryImageAttributes,
+    .XvSetColorKey = NestedXlibXvSetColorKey,
+    .XvPutImage = NestedXlibXvPutImage,
+    .XvStopVideo = NestedXlibXvStopVideo,
+    .RenderInit = NestedXlibRenderInit,
+    .RenderReady = NestedXlibRenderReady,
+    .RenderCreateSolid = NestedXlibRenderCreateSolid,
+    .RenderCreateLinearGradient = NestedXlibRenderCreateLinearGradient,
+    .RenderCreateRadialGradient = NestedXlibRenderCreateRadialGradient,
+    .RenderFreePicture = NestedXlibRenderFreePicture,
+    .RenderSetClip = NestedXlibRenderSetClip,
+    .RenderComposite = NestedXlibRenderComposite,
+    .RenderTrapezoids = NestedXlibRenderTrapezoids,
+    .RenderResetGlyphs = NestedXlibRenderResetGlyphs,
+    .RenderAddGlyph = NestedXlibRenderAddGlyph,
+    .RenderCompositeGlyphs = NestedXlibRenderCompositeGlyphs,
+    .CoreInit = NestedXlibCoreInit,
+    .CoreReady = NestedXlibCoreReady,
+    .CoreSetGC = NestedXlibCoreSetGC,
+    .CorePolyFillRect = NestedXlibCorePolyFillRect,
+    .CorePolySegment = NestedXlibCorePolySegment,
+    .CoreCopyArea = NestedXlibCoreCopyArea,
+    .CorePutImage = NestedXlibCorePutImage,
+    .RootlessReady = NestedXlibRootlessReady,
+    .RootlessCreateWindow = NestedXlibRootlessCreateWindow,
+    .RootlessConfigureWindow = NestedXlibRootlessConfigureWindow,
+    .RootlessRaiseWindow = NestedXlibRootlessRaiseWindow,
+    .RootlessDestroyWindow = NestedXlibRootlessDestroyWindow,
+    .RootlessUpdateWindow = NestedXlibRootlessUpdateWindow,
+};